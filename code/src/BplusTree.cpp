@@ -3,9 +3,15 @@
 #include "include/page.h"
 #include "include/debug_log.h"
 #include "include/buffer_pool.h"
+#include "include/epoch.h"
+#include "include/cpu_features.h"
 #include <cstring>
 #include <string>
 #include <stack>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <immintrin.h>
 
 // UNDONE: read-write lock, does 1 operation holds just 2 locks at one time?
 //                                        or holds a sequence of locks from root to bottom?
@@ -16,51 +22,192 @@ namespace DB::tree
     using namespace ::DB::page;
 
 
-    BTit::BTit(buffer::BufferPoolManager* buffer_pool, BTreePage* leaf, uint32_t cur_index)
-        :buffer_pool_(buffer_pool), leaf_(leaf), cur_index_(cur_index) {}
-
-    BTit::BTit(const BTit& other) {
-        if (other.leaf_ == nullptr) {
-            leaf_ = nullptr;
-            cur_index_ = 0;
+    // the page holding the values, and the value offsets in it, of LEAF or ROOT_LEAF.
+    // the values are in the leaf itself if INLINE.
+    static std::pair<const char*, const uint32_t*> leaf_values(BTreePage* leaf) {
+        if (leaf->get_page_t() == page_t_t::ROOT_LEAF) {
+            RootPage* root = static_cast<RootPage*>(leaf);
+            if (root->leaf_format_ == leaf_format_t::INLINE)
+                return { root->get_data(), root->values_ };
+            return { root->value_page_->get_data(), root->values_ };
         }
         else {
-            leaf_ = other.leaf_;
-            cur_index_ = other.cur_index_;
-            leaf_->ref();
+            LeafPage* page = static_cast<LeafPage*>(leaf);
+            if (page->leaf_format_ == leaf_format_t::INLINE)
+                return { page->get_data(), page->values_ };
+            return { page->value_page_->get_data(), page->values_ };
         }
     }
 
+
+    BTit::BTit(buffer::BufferPoolManager* buffer_pool)
+        :leaf_(nullptr), cur_index_(0), buffer_pool_(buffer_pool) {}
+
+    BTit::BTit(buffer::BufferPoolManager* buffer_pool, const BTree* tree, const KeyEntry* kEntry, bool upper)
+        : leaf_(nullptr), cur_index_(0), buffer_pool_(buffer_pool), tree_(tree) {
+        seek(kEntry, upper);
+    }
+
+    BTit::BTit(const BTit& other)
+        :leaf_(other.leaf_), cur_index_(other.cur_index_), buffer_pool_(other.buffer_pool_),
+        use_once_(other.use_once_),
+        read_ahead_(other.read_ahead_), read_ahead_left_(other.read_ahead_left_), tree_(other.tree_), version_(other.version_),
+        nEntry_(other.nEntry_), next_page_id_(other.next_page_id_),
+        keys_(other.keys_), key_blocks_(other.key_blocks_), value_blocks_(other.value_blocks_) {
+        if (leaf_ != nullptr)
+            leaf_->ref();
+    }
+
     void BTit::operator=(const BTit& other) {
-        if (leaf_ == other.leaf_) {
-            cur_index_ = other.cur_index_;
+        if (this == &other)
+            return;
+        if (other.leaf_ != nullptr)
+            other.leaf_->ref();
+        release();
+        leaf_ = other.leaf_;
+        cur_index_ = other.cur_index_;
+        buffer_pool_ = other.buffer_pool_;
+        use_once_ = other.use_once_;
+        read_ahead_ = other.read_ahead_;
+        read_ahead_left_ = other.read_ahead_left_;
+        read_ahead_mark_.reset();
+        tree_ = other.tree_;
+        version_ = other.version_;
+        nEntry_ = other.nEntry_;
+        next_page_id_ = other.next_page_id_;
+        keys_ = other.keys_;
+        key_blocks_ = other.key_blocks_;
+        value_blocks_ = other.value_blocks_;
+    }
+
+    BTit::~BTit() {
+        release();
+    }
+
+    void BTit::release() {
+        if (leaf_ != nullptr)
+            leaf_->unref();
+        leaf_ = nullptr;
+        cur_index_ = 0;
+    }
+
+    void BTit::seek(const KeyEntry* kEntry, bool upper)
+    {
+        uint64_t version;
+        leaf_ = tree_->seek_leaf(kEntry, version);
+        while (!load_leaf(version)) {
+            leaf_->unref();
+            std::this_thread::yield();
+            leaf_ = tree_->seek_leaf(kEntry, version);
         }
-        else {
-            if (leaf_ == nullptr) {
-                leaf_ = other.leaf_;
-                cur_index_ = other.cur_index_;
-                leaf_->ref();
-            }
-            else if (other.leaf_ == nullptr) {
-                leaf_->unref();
-                leaf_ = nullptr;
-                cur_index_ = 0;
+
+        cur_index_ = 0;
+        if (kEntry != nullptr) {
+            if (kEntry->key_t == key_t_t::INTEGER) {
+                const int32_t* const keys = keys_.data();
+                cur_index_ = upper
+                    ? std::upper_bound(keys, keys + nEntry_, kEntry->key_int) - keys
+                    : std::lower_bound(keys, keys + nEntry_, kEntry->key_int) - keys;
             }
             else {
-                leaf_->unref();
-                leaf_ = other.leaf_;
-                cur_index_ = other.cur_index_;
-                leaf_->ref();
+                const std::string_view key(kEntry->key_str);
+                for (; cur_index_ < nEntry_; cur_index_++) {
+                    const int32_t cmp = key.compare(BTreePage::key_view(&key_blocks_[cur_index_ * KEY_STR_BLOCK]));
+                    if (upper ? cmp < 0 : cmp <= 0)
+                        break;
+                }
             }
         }
+        if (cur_index_ == nEntry_)
+            next_leaf();
     }
 
-    BTit::~BTit() {
-        if (leaf_ != nullptr) {
-            leaf_->unref();
-            // Hahaha, I donot know why not to use dtor but `destory()`.
-            //debug::ERROR_LOG("Are you FUCKing kidding me? Please correctly use `detroy()`");
+    void BTit::next_leaf()
+    {
+        if (next_page_id_ == NOT_A_PAGE) {
+            release();
+            return;
         }
+
+        if (read_ahead_ != 0) {
+            read_ahead();
+            read_ahead_left_--;
+        }
+        cur_index_ = nEntry_ - 1;
+        const KeyEntry last = getK();
+        // the link is valid only if the leaf is unchanged since the snapshot,
+        // otherwise `next_page_id_` might have been freed and reused as any page.
+        if (!leaf_->read_validate(version_)) {
+            release();
+            seek(&last, true);
+            return;
+        }
+        BTreePage* next = static_cast<BTreePage*>(buffer_pool_->FetchPage(next_page_id_, use_once_));
+        if (next == nullptr || next->get_page_t() != page_t_t::LEAF) {
+            if (next != nullptr)
+                next->unref();
+            release();
+            seek(&last, true);
+            return;
+        }
+        const uint64_t version = next->read_begin();
+        // still linked, the leaf has not been freed in between.
+        const bool linked = leaf_->read_validate(version_);
+        release();
+
+        leaf_ = next;
+        if (linked && load_leaf(version)) {
+            cur_index_ = 0;
+            return;
+        }
+        // the leaf has been split or merged, seek the last key again.
+        release();
+        seek(&last, true);
+    }
+
+    bool BTit::load_leaf(uint64_t version)
+    {
+        util::EpochManager::Guard guard;
+
+        const page_t_t page_t = leaf_->get_page_t();
+        if (page_t != page_t_t::LEAF && page_t != page_t_t::ROOT_LEAF)
+            return false;
+        const uint32_t nEntry = std::min(leaf_->nEntry_, MAX_LEAF_SIZE);
+        const page_id_t next_page_id = page_t == page_t_t::LEAF
+            ? static_cast<LeafPage*>(leaf_)->next_page_id_ : NOT_A_PAGE;
+        const auto[value_data, values] = leaf_values(leaf_);
+        // the pointers are valid only if the leaf is unchanged.
+        if (!leaf_->read_validate(version))
+            return false;
+
+        value_blocks_.resize(nEntry * TUPLE_BLOCK_SIZE);
+        for (uint32_t i = 0; i < nEntry; i++) {
+            const uint32_t offset = values[i];
+            if (offset > page::offset::PAGE_CHECKSUM - TUPLE_BLOCK_SIZE)
+                return false;
+            std::memcpy(&value_blocks_[i * TUPLE_BLOCK_SIZE], value_data + offset, TUPLE_BLOCK_SIZE);
+        }
+
+        if (leaf_->get_key_t() == key_t_t::INTEGER) {
+            keys_.resize(nEntry);
+            std::memcpy(keys_.data(), leaf_->keys_, nEntry * sizeof(int32_t));
+        }
+        else {
+            key_blocks_.resize(nEntry * KEY_STR_BLOCK);
+            for (uint32_t i = 0; i < nEntry; i++) {
+                const uint32_t offset = leaf_->keys_[i];
+                if (offset > page::offset::PAGE_CHECKSUM - KEY_STR_BLOCK)
+                    return false;
+                std::memcpy(&key_blocks_[i * KEY_STR_BLOCK], leaf_->get_data() + offset, KEY_STR_BLOCK);
+            }
+        }
+
+        if (!leaf_->read_validate(version))
+            return false;
+        version_ = version;
+        nEntry_ = nEntry;
+        next_page_id_ = next_page_id;
+        return true;
     }
 
     void BTit::operator++()
@@ -68,21 +215,38 @@ namespace DB::tree
         if (leaf_ == nullptr)
             debug::ERROR_LOG("BTit out of range, incorrect usage.\n");
 
-        if (++cur_index_ == leaf_->nEntry_) {
-            cur_index_ = 0;
-            if (leaf_->get_page_t() == page_t_t::ROOT_LEAF) {
-                leaf_->unref();
-                leaf_ = nullptr;
-            }
-            else {
-                BTreePage* temp = leaf_;
-                const page_id_t right_page_id = static_cast<LeafPage*>(leaf_)->next_page_id_;
-                if (right_page_id != NOT_A_PAGE)
-                    leaf_ = static_cast<LeafPage*>(buffer_pool_->FetchPage(right_page_id));
-                else
-                    leaf_ = nullptr;
-                temp->unref();
-            }
+        if (++cur_index_ == nEntry_)
+            next_leaf();
+    }
+
+    void BTit::set_use_once() noexcept {
+        use_once_ = true;
+    }
+
+    void BTit::set_read_ahead(uint32_t leaf_num) {
+        read_ahead_ = leaf_num;
+        read_ahead_left_ = 0;
+        read_ahead_mark_.reset();
+        if (leaf_ != nullptr && leaf_num != 0)
+            read_ahead();
+    }
+
+    void BTit::read_ahead()
+    {
+        // the first window, or the scan has caught up with the reads, start from the next leaf.
+        if (read_ahead_left_ == 0 || read_ahead_mark_ == nullptr) {
+            read_ahead_mark_ = std::make_shared<disk::ReadAheadMark>();
+            buffer_pool_->Prefetch(next_page_id_, read_ahead_, read_ahead_mark_);
+            read_ahead_left_ = read_ahead_;
+            return;
+        }
+        if (read_ahead_left_ > read_ahead_ / 2)
+            return;
+        // go on past the window, nothing to do while it is still being read.
+        const page_id_t page_id = read_ahead_mark_->next_.exchange(NOT_A_PAGE);
+        if (page_id != NOT_A_PAGE) {
+            buffer_pool_->Prefetch(page_id, read_ahead_ - read_ahead_left_, read_ahead_mark_);
+            read_ahead_left_ = read_ahead_;
         }
     }
 
@@ -98,26 +262,50 @@ namespace DB::tree
     }
     */
     KeyEntry BTit::getK() const {
-        return leaf_->read_key(cur_index_);
+        KeyEntry kEntry;
+        kEntry.key_t = leaf_->get_key_t();
+        if (kEntry.key_t == key_t_t::INTEGER)
+            kEntry.key_int = keys_[cur_index_];
+        else
+            kEntry.key_str = std::string(BTreePage::key_view(&key_blocks_[cur_index_ * KEY_STR_BLOCK]));
+        return kEntry;
     }
 
     ValueEntry BTit::getV() const {
         ValueEntry vEntry;
-        if (leaf_->get_page_t() == page_t_t::ROOT_LEAF)
-            static_cast<RootPage*>(leaf_)->read_value(cur_index_, vEntry);
-        else
-            static_cast<LeafPage*>(leaf_)->read_value(cur_index_, vEntry);
+        ValuePage::read_block(&value_blocks_[cur_index_ * TUPLE_BLOCK_SIZE], vEntry);
         return vEntry;
     }
 
-    void BTit::updateV(const ValueEntry& vEntry) {
-        if (leaf_->get_page_t() == page_t_t::ROOT_LEAF)
-            static_cast<RootPage*>(leaf_)->update_value(cur_index_, vEntry);
+    // the value slot of LEAF or ROOT_LEAF, the caller holds the write-lock.
+    static void leaf_update_value(BTreePage* leaf, uint32_t index, const ValueEntry& vEntry) {
+        if (leaf->get_page_t() == page_t_t::ROOT_LEAF)
+            static_cast<RootPage*>(leaf)->update_value(index, vEntry);
         else
-            static_cast<LeafPage*>(leaf_)->update_value(cur_index_, vEntry);
+            static_cast<LeafPage*>(leaf)->update_value(index, vEntry);
     }
 
-
+    bool BTit::updateV(const ValueEntry& vEntry) {
+#ifdef SIMPLE_TEST
+        std::lock_guard<std::mutex> lg{ tree_->write_mtx_ };
+#endif // SIMPLE_TEST
+        leaf_->page_write_lock();
+        // no other writer in between, the index is still valid.
+        const bool unchanged = leaf_->read_validate(version_ + 1);
+        if (unchanged)
+            leaf_update_value(leaf_, cur_index_, vEntry);
+        leaf_->page_write_unlock();
+        // the key might have been moved out of the leaf, or erased.
+        if (!unchanged && !tree_->update_value(getK(), vEntry))
+            return false;
+
+        char* const block = &value_blocks_[cur_index_ * TUPLE_BLOCK_SIZE];
+        block[0] = static_cast<char>(vEntry.value_state_);
+        std::memcpy(block + 1, vEntry.content_, MAX_TUPLE_SIZE);
+        if (unchanged)
+            version_ += 2;
+        return true;
+    }
 
 
 
@@ -127,7 +315,9 @@ namespace DB::tree
     BTree::BTree(OpenTableInfo openTableInfo, buffer::BufferPoolManager* buffer_pool,
         key_t_t key_t, uint32_t str_len)
         :buffer_pool_(buffer_pool),
-        key_t_(key_t), str_len_(str_len), root_(nullptr), size_(0)
+        key_t_(key_t), str_len_(str_len),
+        leaf_format_(key_t == key_t_t::INTEGER ? openTableInfo.leaf_format : leaf_format_t::VALUE_PAGE),
+        root_(nullptr), size_(0)
     {
         BT_create(openTableInfo);
     }
@@ -142,9 +332,13 @@ namespace DB::tree
 
     key_t_t BTree::key_t() const { return key_t_; }
     uint32_t BTree::str_len() const { return str_len_; }
+    leaf_format_t BTree::leaf_format() const { return leaf_format_; }
 
 
     void BTree::destruct() {
+#ifdef SIMPLE_TEST
+        std::lock_guard<std::mutex> lg{ write_mtx_ };
+#endif // SIMPLE_TEST
         std::stack<base_ptr> pages;
         pages.push(root_);
         root_->ref();
@@ -172,40 +366,13 @@ namespace DB::tree
 
 
 
-    void BTree::range_query_begin_lock() {
-        range_query_lock_.lock();
-    }
-
-
-    BTit BTree::range_query_from_begin()
-    {
-        if (root_->page_t_ == page_t_t::ROOT_LEAF) {
-            if (root_->nEntry_ > 0) {
-                root_->ref();
-                return BTit{ buffer_pool_, root_, 0 };
-            }
-            else
-                return BTit{ buffer_pool_, nullptr, 0 };
-        }
-        else {
-            base_ptr node = root_;
-            std::stack<base_ptr> stk;
-            while (node->page_t_ != page_t_t::LEAF) {
-                node = fetch_node(static_cast<link_ptr>(node)->branch_[0]);
-                stk.push(node);
-            }
-            node->ref(); // `ref` the leaf
-            while (!stk.empty()) {
-                stk.top()->unref();
-                stk.pop();
-            }
-            return BTit{ buffer_pool_, node, 0 };
-        }
+    BTit BTree::range_query_from_begin() {
+        return BTit{ buffer_pool_, this, nullptr, false };
     }
 
 
     BTit BTree::range_query_from_end() {
-        return BTit{ buffer_pool_, nullptr, 0 };
+        return BTit{ buffer_pool_ };
     }
 
 
@@ -230,97 +397,108 @@ namespace DB::tree
 
 
     // it > kEntry
-    BTit BTree::find_first_greater_than(const KeyEntry& kEntry)
-    {
-        base_ptr node = root_;
-        std::stack<base_ptr> stk;
-        while (node->page_t_ != page_t_t::LEAF || node->page_t_ != page_t_t::ROOT_LEAF) {
-            uint32_t index = 0;
-            for (; index < node->nEntry_; index++)
-                if (key_compare(kEntry, node, index) <= 0)
-                    break;
-            // internal.key[i] is the right-most key in internal.br[i]
-            if (index < node->nEntry_ && key_compare(kEntry, node, index) == 0)
-                node = fetch_node(node, index + 1);
-            else
-                node = fetch_node(node, index);
-            stk.push(node);
-        }
-        node->ref(); // `ref` the leaf(maybe root)
-        while (!stk.empty()) {
-            stk.top()->unref();
-            stk.pop();
-        }
-        uint32_t index = 0;
-        for (; index < node->nEntry_; index++)
-            if (key_compare(kEntry, node, index) < 0) // not equal
-                break;
-        if (index == node->nEntry_) {
-            node->unref();
-            return BTit{ buffer_pool_, nullptr, 0 };
-        }
-        else
-            return BTit{ buffer_pool_, node, index };
+    BTit BTree::find_first_greater_than(const KeyEntry& kEntry) {
+        return BTit{ buffer_pool_, this, &kEntry, true };
     }
 
 
     // it >= kEntry
-    BTit BTree::find_first_greater_than_or_equal_to(const KeyEntry& kEntry)
+    BTit BTree::find_first_greater_than_or_equal_to(const KeyEntry& kEntry) {
+        return BTit{ buffer_pool_, this, &kEntry, false };
+    }
+
+
+    BTree::base_ptr BTree::seek_leaf(const KeyEntry* kEntry, uint64_t& version) const
     {
-        base_ptr node = root_;
-        std::stack<base_ptr> stk;
-        while (node->page_t_ != page_t_t::LEAF || node->page_t_ != page_t_t::ROOT_LEAF) {
-            uint32_t index = 0;
-            for (; index < node->nEntry_; index++)
-                if (key_compare(kEntry, node, index) <= 0)
+        util::EpochManager::Guard guard;
+        while (true)
+        {
+            base_ptr node = root_;
+            node->ref();
+            version = node->read_begin();
+            bool restart = false;
+            while (true) {
+                const page_t_t page_t = node->get_page_t();
+                if (page_t == page_t_t::LEAF || page_t == page_t_t::ROOT_LEAF)
                     break;
-            // internal.key[i] is the right-most key in internal.br[i]
-            node = fetch_node(node, index);
-            stk.push(node);
-        }
-        node->ref(); // `ref` the leaf(maybe root)
-        while (!stk.empty()) {
-            stk.top()->unref();
-            stk.pop();
-        }
-        uint32_t index = 0;
-        for (; index < node->nEntry_; index++)
-            if (key_compare(kEntry, node, index) <= 0)
-                break;
-        if (index == node->nEntry_) {
+                if (page_t != page_t_t::INTERNAL && page_t != page_t_t::ROOT_INTERNAL) {
+                    restart = true; // obsolete
+                    break;
+                }
+                // internal.key[i] is the right-most key in internal.br[i]
+                const uint32_t index = kEntry == nullptr
+                    ? 0 : std::min(key_lower_bound(*kEntry, node), MAX_KEY_SIZE);
+                const page_id_t child_id = static_cast<link_ptr>(node)->branch_[index];
+                if (!node->read_validate(version)) {
+                    restart = true;
+                    break;
+                }
+                base_ptr child = fetch_node(child_id);
+                const uint64_t child_version = child->read_begin();
+                if (!node->read_validate(version)) {
+                    child->unref();
+                    restart = true;
+                    break;
+                }
+                node->unref();
+                node = child;
+                version = child_version;
+            }
+            if (!restart)
+                return node;
             node->unref();
-            return BTit{ buffer_pool_, nullptr, 0 };
+            std::this_thread::yield();
         }
-        else
-            return BTit{ buffer_pool_, node, index };
     }
 
 
-    void BTree::range_query_end_unlock() {
-        range_query_lock_.unlock();
+    ValueEntry BTree::find(const KeyEntry& kEntry) const
+    {
+        while (true)
+        {
+            ValueEntry vEntry;
+            uint64_t version;
+            base_ptr leaf = seek_leaf(&kEntry, version);
+            bool valid;
+            {
+                util::EpochManager::Guard guard;
+                const uint32_t index = key_find(kEntry, leaf);
+                if (index < std::min(leaf->nEntry_, MAX_LEAF_SIZE)) {
+                    const auto[value_data, values] = leaf_values(leaf);
+                    if (leaf->read_validate(version) && values[index] <= offset::PAGE_CHECKSUM - TUPLE_BLOCK_SIZE)
+                        ValuePage::read_block(value_data + values[index], vEntry);
+                }
+                valid = leaf->read_validate(version);
+            }
+            leaf->unref();
+            if (valid)
+                return vEntry;
+        }
     }
 
 
-    ValueEntry BTree::find(const KeyEntry& kEntry) const
+    bool BTree::update_value(const KeyEntry& kEntry, const ValueEntry& vEntry) const
     {
-        std::shared_lock<std::shared_mutex> lg(range_query_lock_);
-
-        ValueEntry vEntry;
-        BTree::SearchInfo info;
-        search(kEntry, info);
-        if (info.leaf_id == NOT_A_PAGE)
-            return vEntry;
-        if (info.leaf_id != root_->get_page_id()) {
-            leaf_ptr leaf = static_cast<leaf_ptr>(buffer_pool_->FetchPage(info.leaf_id));
-            leaf->page_read_lock();
-            leaf->read_value(info.key_index, vEntry);
-            leaf->page_read_unlock();
+        while (true)
+        {
+            uint64_t version;
+            base_ptr leaf = seek_leaf(&kEntry, version);
+            leaf->page_write_lock();
+            // no other writer since the descent, the leaf still covers the key.
+            if (!leaf->read_validate(version + 1)) {
+                leaf->page_write_unlock();
+                leaf->unref();
+                std::this_thread::yield();
+                continue;
+            }
+            const uint32_t index = key_find(kEntry, leaf);
+            const bool found = index != leaf->nEntry_;
+            if (found)
+                leaf_update_value(leaf, index, vEntry);
+            leaf->page_write_unlock();
             leaf->unref();
+            return found;
         }
-        else {
-            static_cast<root_ptr>(root_)->read_value(info.key_index, vEntry);
-        }
-        return vEntry;
     }
 
 
@@ -328,8 +506,9 @@ namespace DB::tree
     //         `INSERT_KV`,      no such key exists, and insert k-v.
     uint32_t BTree::insert(const KVEntry& kvEntry)
     {
-        std::shared_lock<std::shared_mutex> lg(range_query_lock_);
-
+#ifdef SIMPLE_TEST
+        std::lock_guard<std::mutex> lg{ write_mtx_ };
+#endif // SIMPLE_TEST
         root_->page_write_lock();
 
         // try to split full root
@@ -337,10 +516,7 @@ namespace DB::tree
             split_root();
 
         // find index such that kEntry <= node.k[index]
-        uint32_t index = 0;
-        for (; index < root_->nEntry_; index++)
-            if (key_compare(kvEntry.kEntry, root_, index) <= 0)
-                break;
+        uint32_t index = key_lower_bound(kvEntry.kEntry, root_);
 
         //
         // `ROOT_LEAF` insertion
@@ -386,10 +562,6 @@ namespace DB::tree
         if (node->nEntry_ == MAX_KEY_SIZE)
             split(static_cast<root_ptr>(root_), index, node);
 
-        // release write-lock of root, then hold the read-lock of root.
-        root_->page_write_unlock();
-        root_->page_read_lock();
-
         //  maybe update index and node=root_.br[index] after split.
         if (index != root_->nEntry_ // if equal, no split happens.
             && key_compare(kvEntry.kEntry, root_, index) > 0) {
@@ -400,9 +572,11 @@ namespace DB::tree
             node->page_write_lock();
         }
 
-        // recursively go down then release read-lock.
+        // release write-lock of root, node is non-full, so the writers on other branches go on.
+        root_->page_write_unlock();
+
+        // recursively go down.
         uint32_t insert_return = INSERT_NONFULL(node, kvEntry);
-        root_->page_read_unlock();
 
         node->unref();
         return insert_return;
@@ -410,6 +584,137 @@ namespace DB::tree
     } // end function `BTree::insert(kv)`
 
 
+    // the number of nodes to hold `n` entries in [min_size, max_size], about `target` per node.
+    // NB: n / k >= min_size, since either k = n / target, or k = ceil(n / max_size) >= 2.
+    static uint32_t bulk_load_node_num(uint32_t n, uint32_t target, uint32_t max_size) {
+        return std::max({ n / target, (n + max_size - 1) / max_size, 1u });
+    }
+
+    static uint32_t bulk_load_target(double fill_factor, uint32_t min_size, uint32_t max_size) {
+        const uint32_t target = static_cast<uint32_t>(fill_factor * max_size + 0.5);
+        return std::clamp(target, min_size, max_size);
+    }
+
+    static int32_t entry_compare(const KeyEntry& left, const KeyEntry& right) {
+        if (left.key_t == key_t_t::INTEGER)
+            return (left.key_int > right.key_int) - (left.key_int < right.key_int);
+        return std::string_view(left.key_str).compare(right.key_str);
+    }
+
+
+    bool BTree::bulk_load(const KVEntry* first, const KVEntry* last, double fill_factor)
+    {
+        const uint32_t n = static_cast<uint32_t>(last - first);
+        if (n == 0)
+            return true;
+        for (const KVEntry* kv = first + 1; kv != last; kv++)
+            if (entry_compare(kv[-1].kEntry, kv->kEntry) >= 0) {
+                debug::ERROR_LOG("`BTree::bulk_load()` k-v is not strictly ascending.\n");
+                return false;
+            }
+
+#ifdef SIMPLE_TEST
+        std::lock_guard<std::mutex> lg{ write_mtx_ };
+#endif // SIMPLE_TEST
+        root_->page_write_lock();
+        if (size_ != 0 || root_->get_page_t() != page_t_t::ROOT_LEAF) {
+            debug::ERROR_LOG("`BTree::bulk_load()` the tree is not empty.\n");
+            root_->page_write_unlock();
+            return false;
+        }
+        root_ptr root = static_cast<root_ptr>(root_);
+
+        // all fit in ROOT_LEAF
+        if (n <= MAX_LEAF_SIZE)
+        {
+            for (uint32_t index = 0; index < n; index++) {
+                root->insert_key(index, first[index].kEntry);
+                root->insert_value(index, first[index].vEntry);
+            }
+            root->nEntry_ = n;
+            root->set_dirty();
+            size_ = n;
+            root_->page_write_unlock();
+            return true;
+        }
+
+        std::vector<page_id_t> level;   // nodes of the current level, left to right
+        std::vector<KeyEntry> max_keys; // the right-most key in each node
+
+        // pack the leaves, and chain them.
+        PageInitInfo info;
+        info.page_t = page_t_t::LEAF;
+        info.parent_id = root_->get_page_id();
+        info.key_t = key_t_;
+        info.str_len = str_len_;
+        info.value_page_id = NOT_A_PAGE;
+        info.previous_page_id = NOT_A_PAGE;
+        info.next_page_id = NOT_A_PAGE;
+        const uint32_t leaf_num = bulk_load_node_num(n,
+            bulk_load_target(fill_factor, MIN_LEAF_SIZE, MAX_LEAF_SIZE), MAX_LEAF_SIZE);
+        level.reserve(leaf_num);
+        max_keys.reserve(leaf_num);
+        leaf_ptr prev = nullptr;
+        const KVEntry* kv = first;
+        for (uint32_t leaf_index = 0; leaf_index < leaf_num; leaf_index++)
+        {
+            const uint32_t leaf_size = n / leaf_num + (leaf_index < n % leaf_num);
+            info.near_page_id = prev == nullptr ? NOT_A_PAGE : prev->get_page_id();
+            leaf_ptr leaf = static_cast<leaf_ptr>(allocate_node(info));
+            for (uint32_t index = 0; index < leaf_size; index++, kv++) {
+                leaf->insert_key(index, kv->kEntry);
+                leaf->insert_value(index, kv->vEntry);
+            }
+            leaf->nEntry_ = leaf_size;
+            if (prev != nullptr) {
+                prev->set_right_leaf(leaf->get_page_id());
+                leaf->set_left_leaf(prev->get_page_id());
+                prev->set_dirty();
+                prev->unref();
+            }
+            leaf->set_dirty();
+            prev = leaf;
+            level.push_back(leaf->get_page_id());
+            max_keys.push_back(kv[-1].kEntry);
+        }
+        prev->unref();
+
+        // build the internal levels, until they fit in root.
+        info.page_t = page_t_t::INTERNAL;
+        const uint32_t branch_target = bulk_load_target(fill_factor, MIN_BRANCH_SIZE, MAX_BRANCH_SIZE);
+        while (level.size() > MAX_BRANCH_SIZE)
+        {
+            const uint32_t child_num = static_cast<uint32_t>(level.size());
+            const uint32_t node_num = bulk_load_node_num(child_num, branch_target, MAX_BRANCH_SIZE);
+            std::vector<page_id_t> upper_level;
+            std::vector<KeyEntry> upper_max_keys;
+            upper_level.reserve(node_num);
+            upper_max_keys.reserve(node_num);
+            uint32_t child_index = 0;
+            for (uint32_t node_index = 0; node_index < node_num; node_index++)
+            {
+                const uint32_t node_size = child_num / node_num + (node_index < child_num % node_num);
+                link_ptr node = static_cast<link_ptr>(allocate_node(info));
+                fill_internal(node, &level[child_index], &max_keys[child_index], node_size);
+                child_index += node_size;
+                upper_level.push_back(node->get_page_id());
+                upper_max_keys.push_back(std::move(max_keys[child_index - 1]));
+                node->unref();
+            }
+            level.swap(upper_level);
+            max_keys.swap(upper_max_keys);
+        }
+
+        // the top level is the children of root.
+        root->change_to_internal(buffer_pool_);
+        fill_internal(root, level.data(), max_keys.data(), static_cast<uint32_t>(level.size()));
+        size_ = n;
+        root_->page_write_unlock();
+        return true;
+
+    } // end function `BTree::bulk_load()`
+
+
     // return: `ERASE_NOTHING`, no such key exists.
     //         `ERASE_KV`,      the key-value has been erased.
     // operation:
@@ -440,8 +745,9 @@ namespace DB::tree
     //                     find K_index, recusively go down.
     uint32_t BTree::erase(const KeyEntry& kEntry)
     {
-        std::shared_lock<std::shared_mutex> lg(range_query_lock_);
-
+#ifdef SIMPLE_TEST
+        std::lock_guard<std::mutex> lg{ write_mtx_ };
+#endif // SIMPLE_TEST
         root_ptr root = static_cast<root_ptr>(root_);
         root->page_write_lock();
 
@@ -453,10 +759,7 @@ namespace DB::tree
                 "erase ROOT_LEAF [root_id = %d]\n", root->get_page_id());
 
             // 1. directly delete if exists.
-            uint32_t index = 0;
-            for (; index < root->nEntry_; index++)
-                if (key_compare(kEntry, root, index) == 0)
-                    break;
+            uint32_t index = key_find(kEntry, root);
             if (index == root->nEntry_) {
                 root_->page_write_unlock();
                 return ERASE_NOTHING;
@@ -516,10 +819,7 @@ namespace DB::tree
                     // 1. child.nEntry > MIN_KEY, directly delete. (return)
                     if (child_leaf->nEntry_ > MIN_KEY_SIZE)
                     {
-                        uint32_t K_index = 0;
-                        for (; K_index < child_leaf->nEntry_; K_index++)
-                            if (key_compare(kEntry, child_leaf, K_index) == 0)
-                                break;
+                        uint32_t K_index = key_find(kEntry, child_leaf);
                         if (K_index == child_leaf->nEntry_) {
                             child->page_write_unlock();
                             root_->page_write_unlock();
@@ -563,10 +863,7 @@ namespace DB::tree
                                 root->get_page_id(), child->get_page_id(), other_child->get_page_id());
 
                             // if delete child.key successfully, steal 1 k-v from other-child.
-                            uint32_t K_index = 0;
-                            for (; K_index < child_leaf->nEntry_; K_index++)
-                                if (key_compare(kEntry, child_leaf, K_index) == 0)
-                                    break;
+                            uint32_t K_index = key_find(kEntry, child_leaf);
                             if (K_index == child_leaf->nEntry_) {
                                 other_child->page_write_unlock();
                                 child->page_write_unlock();
@@ -698,7 +995,7 @@ namespace DB::tree
                             debug_page(debug::MERGE_LEAF, R->get_page_id());
 
 
-                            root->change_to_leaf(buffer_pool_);
+                            root->change_to_leaf(buffer_pool_, leaf_format_);
 
 
                             // delete root.k[0]
@@ -736,10 +1033,7 @@ namespace DB::tree
                             debug_page(debug::MERGE_LEAF, root->get_page_id());
 
                             // directly delete
-                            uint32_t K_index = 0;
-                            for (; K_index < root->nEntry_; K_index++)
-                                if (key_compare(kEntry, root, K_index) == 0)
-                                    break;
+                            uint32_t K_index = key_find(kEntry, root);
                             if (K_index == root->nEntry_) {
                                 root_->page_write_unlock();
                                 return ERASE_NOTHING;
@@ -791,20 +1085,14 @@ namespace DB::tree
 
                         // find K_index, recusively go down (from child).
                         root->page_write_unlock();
-                        root->page_read_lock();
 
-                        uint32_t K_index = 0;
-                        for (; K_index < child_link->nEntry_; K_index++)
-                            if (key_compare(kEntry, child_link, K_index) <= 0)
-                                break;
+                        uint32_t K_index = key_lower_bound(kEntry, child_link);
                         base_ptr child_child = fetch_node(child_link->branch_[K_index]);
                         uint32_t erase_return = ERASE_NONMIN(child_link, K_index, child_child, kEntry);
                         child_child->unref();
 
                         child_link->unref(); // here special, since no caller
 
-                        root->page_read_unlock();
-
                         return erase_return;
 
                     } // end child.nEntry > MIN_KEY
@@ -917,20 +1205,14 @@ namespace DB::tree
                             other_child->unref();
 
                             root->page_write_unlock();
-                            root->page_read_lock();
 
                             // find K_index, recusively go down.
-                            uint32_t K_index = 0;
-                            for (; K_index < child_link->nEntry_; K_index++)
-                                if (key_compare(kEntry, child_link, K_index) <= 0)
-                                    break;
+                            uint32_t K_index = key_lower_bound(kEntry, child_link);
                             // hold child write-lock
                             base_ptr child_child = fetch_node(child_link->branch_[K_index]);
                             uint32_t erase_return = ERASE_NONMIN(child_link, K_index, child_child, kEntry);
                             child_child->unref();
 
-                            root->page_read_unlock();
-
                             child->unref(); // here special, since no caller
 
                             return erase_return;
@@ -1001,10 +1283,7 @@ namespace DB::tree
                             other_child->unref();
 
                             // find K_index, recusively go down.
-                            uint32_t K_index = 0;
-                            for (; K_index < root->nEntry_; K_index++)
-                                if (key_compare(kEntry, root, K_index) <= 0)
-                                    break;
+                            uint32_t K_index = key_lower_bound(kEntry, root);
                             base_ptr root_child = fetch_node(root->branch_[K_index]);
                             // hold root write-lock
                             uint32_t erase_return = ERASE_NONMIN(root, K_index, root_child, kEntry);
@@ -1030,10 +1309,7 @@ namespace DB::tree
                     "erase ROOT_INTERNAL [root_id = %d], root.nEntry > 1\n", root->get_page_id());
 
                 // find K_index, recusively go down.
-                uint32_t K_index = 0;
-                for (; K_index < root->nEntry_; K_index++)
-                    if (key_compare(kEntry, root, K_index) <= 0)
-                        break;
+                uint32_t K_index = key_lower_bound(kEntry, root);
                 base_ptr root_child = fetch_node(root->branch_[K_index]);
                 // hold root write-lock
                 uint32_t erase_return = ERASE_NONMIN(root, K_index, root_child, kEntry);
@@ -1078,51 +1354,6 @@ namespace DB::tree
     }
 
 
-    // do nothing if BTree is empty.
-    void BTree::search(const KeyEntry& kEntry, SearchInfo& info) const
-    {
-        info.leaf_id = NOT_A_PAGE;
-        if (size_ == 0) return;
-        root_->page_read_lock();
-        doSearch(root_, kEntry, info);
-        root_->page_read_unlock();
-    }
-
-
-    // return the min leaf.key that *** KeyEntry <= leaf.key ***
-    void BTree::doSearch(base_ptr node, const KeyEntry& kEntry, SearchInfo& info) const
-    {
-        uint32_t index = 0;
-        for (; index < node->nEntry_; index++)
-            if (key_compare(kEntry, node, index) <= 0)
-                break;
-
-        // now (kEntry <= key[index]) or (index == n)
-        if (index == node->nEntry_ &&
-            (node->get_page_t() == page_t_t::LEAF || node->get_page_t() == page_t_t::ROOT_LEAF))
-            return; // all key < kEntry, so no result.
-
-        // if at Leaf
-        if (node->get_page_t() == page_t_t::LEAF
-            || node->get_page_t() == page_t_t::ROOT_LEAF)
-        {
-            if (key_compare(kEntry, node, index) == 0) {
-                info.leaf_id = node->get_page_id();
-                info.key_index = index;
-            }
-            return;
-        }
-
-        // root is Internal and (kEntry <= key[index])
-        // search recursively into branch[index]
-        base_ptr child = fetch_node(node, index);
-        child->page_read_lock();
-        doSearch(child, kEntry, info);
-        child->page_read_unlock();
-        child->unref();
-    }
-
-
     BTreePage* BTree::fetch_node(page_id_t page_id) const {
         return static_cast<base_ptr>(buffer_pool_->FetchPage(page_id));
     }
@@ -1135,6 +1366,7 @@ namespace DB::tree
 
 
     BTreePage* BTree::allocate_node(PageInitInfo info) const {
+        info.leaf_format = leaf_format_;
         BTreePage* page_ptr =
             static_cast<base_ptr>(buffer_pool_->NewPage(info));
         return page_ptr;
@@ -1348,6 +1580,7 @@ namespace DB::tree
         info.parent_id = node->get_page_id();
         info.key_t = key_t_;
         info.str_len = str_len_;
+        info.near_page_id = L->get_page_id();
         link_ptr R = static_cast<link_ptr>(allocate_node(info));
 
 
@@ -1420,6 +1653,7 @@ namespace DB::tree
         info.value_page_id = NOT_A_PAGE;
         info.previous_page_id = NOT_A_PAGE;
         info.next_page_id = NOT_A_PAGE;
+        info.near_page_id = L->get_page_id();
         leaf_ptr R = static_cast<leaf_ptr>(allocate_node(info));
 
         // step 2: move L.k-v[8..14] into R.k-v[0..6], adjust relation
@@ -1487,16 +1721,13 @@ namespace DB::tree
     //              1. find index such that kEntry <= node.k[index]
     //              2. hold write-lock of node.br[index]
     //                 if need to split node.br[index], then split.
-    //              3. release write-lock of node, then hold the read-lock of node.
-    //              4. maybe update index and child=node.br[index] after split.
-    //              5. recursively go down then release read-lock.
+    //              3. maybe update index and child=node.br[index] after split.
+    //              4. release write-lock of node, the child is non-full, node is never touched below.
+    //              5. recursively go down.
     uint32_t BTree::INSERT_NONFULL(base_ptr node, const KVEntry& kvEntry)
     {
         // step 1: find index such that kEntry <= node.k[index]
-        uint32_t index = 0;
-        for (; index < node->nEntry_; index++)
-            if (key_compare(kvEntry.kEntry, node, index) <= 0)
-                break;
+        uint32_t index = key_lower_bound(kvEntry.kEntry, node);
 
         uint32_t insert_return;
 
@@ -1539,11 +1770,7 @@ namespace DB::tree
             if (child->nEntry_ == MAX_KEY_SIZE)
                 split(static_cast<link_ptr>(node), index, child);
 
-            // step 3: release write-lock of node, then hold the read-lock of node.
-            node->page_write_unlock();
-            node->page_read_lock();
-
-            // step 4: maybe update index and child=node.br[index] after split.
+            // step 3: maybe update index and child=node.br[index] after split.
             if (index != node->nEntry_ && // if equal, no split happens.
                 key_compare(kvEntry.kEntry, node, index) > 0) {
                 child->page_write_unlock();
@@ -1553,9 +1780,11 @@ namespace DB::tree
                 child->page_write_lock();
             }
 
-            // step 5: recursively go down then release read-lock.
+            // step 4: release write-lock of node, the child is non-full, node is never touched below.
+            node->page_write_unlock();
+
+            // step 5: recursively go down.
             insert_return = INSERT_NONFULL(child, kvEntry);
-            node->page_read_unlock();
 
             child->unref();
 
@@ -1586,6 +1815,23 @@ namespace DB::tree
     }
 
 
+    void BTree::fill_internal(link_ptr node, const page_id_t* children, const KeyEntry* keys, uint32_t size) const
+    {
+        for (uint32_t index = 0; index < size; index++) {
+            // internal.key[i] is the right-most key in internal.br[i]
+            if (index + 1 < size)
+                node->insert_key(index, keys[index]);
+            node->branch_[index] = children[index];
+            base_ptr child = fetch_node(children[index]);
+            child->set_parent_id(node->get_page_id());
+            child->set_dirty();
+            child->unref();
+        }
+        node->nEntry_ = size - 1;
+        node->set_dirty();
+    }
+
+
     // all write-lock held, L.nEntry = R.nEtnry = KEY_MIN_SIZE
     // move R into L.
     //     move R.key[0..6] -> L.key[8..14], R.br[0..7] -> L.br[8..15], update parent_id
@@ -1616,7 +1862,7 @@ namespace DB::tree
         R->set_dirty();
         R->set_free();
 
-        for (uint32_t index = 8; index <= MAX_KEY_SIZE; index++) // [8..15]
+        for (uint32_t index = KEY_MIDEIUM + 1; index <= MAX_KEY_SIZE; index++) // [8..15]
         {
             base_ptr adopted = fetch_node(L->branch_[index]);
             adopted->page_write_lock();
@@ -1717,10 +1963,7 @@ namespace DB::tree
     uint32_t BTree::erase_from_leaf(leaf_ptr leaf, const KeyEntry& kEntry)
     {
         // directly deleted if key exists. (return)
-        uint32_t K_index = 0;
-        for (; K_index < leaf->nEntry_; K_index++)
-            if (key_compare(kEntry, leaf, K_index) == 0)
-                break;
+        uint32_t K_index = key_find(kEntry, leaf);
         if (K_index == leaf->nEntry_)
             return ERASE_NOTHING;
         else
@@ -1815,13 +2058,11 @@ namespace DB::tree
                     node->get_page_id(), child->get_page_id());
 
                 node->page_write_unlock();
-                node->page_read_lock();
 
                 // directly deleted if key exists. (return)
                 uint32_t erase_return = erase_from_leaf(child_leaf, kEntry);
 
                 child->page_write_unlock();
-                node->page_read_unlock();
                 return erase_return;
 
             } // end a. child.nEntry > MIN_KEY
@@ -1988,6 +2229,9 @@ namespace DB::tree
                 }
 
                 debug::ERROR_LOG("`BTree::ERASE_NONMIN()` no steal/merge from left/right");
+                child->page_write_unlock();
+                node->page_write_unlock();
+                return ERASE_NOTHING;
 
             } // end b. child.nEntry = MIN_KEY
 
@@ -2014,19 +2258,13 @@ namespace DB::tree
                 // find K_index, such that child.key[K_index] <= kEntry
                 // recusively go down.
                 node->page_write_unlock();
-                node->page_read_lock();
 
-                uint32_t K_index = 0;
-                for (; K_index < child_link->nEntry_; K_index++)
-                    if (key_compare(kEntry, child_link, K_index) <= 0)
-                        break;
+                uint32_t K_index = key_lower_bound(kEntry, child_link);
                 base_ptr child_child = fetch_node(child_link->branch_[K_index]);
                 // hold child write-lock
                 uint32_t erase_return = ERASE_NONMIN(child_link, K_index, child_child, kEntry);
                 child_child->unref();
 
-                node->page_read_unlock();
-
                 return erase_return;
 
             } // end a. child.nEntry > MIN_KEY
@@ -2095,19 +2333,13 @@ namespace DB::tree
                     // find K_index, recusively go down.
 
                     node->page_write_unlock();
-                    node->page_read_lock();
 
-                    uint32_t K_index = 0;
-                    for (; K_index < child_link->nEntry_; K_index++)
-                        if (key_compare(kEntry, child_link, K_index) <= 0)
-                            break;
+                    uint32_t K_index = key_lower_bound(kEntry, child_link);
                     base_ptr child_child = fetch_node(child_link->branch_[K_index]);
                     // hold child write-lock
                     uint32_t erase_return = ERASE_NONMIN(child_link, K_index, child_child, kEntry);
                     child_child->unref();
 
-                    node->page_read_unlock();
-
                     return erase_return;
 
                 } // end 1) R.nEntry > MIN_KEY
@@ -2132,19 +2364,13 @@ namespace DB::tree
                     R->unref();
 
                     node->page_write_unlock();
-                    node->page_read_lock();
 
-                    uint32_t K_index = 0;
-                    for (; K_index < child_link->nEntry_; K_index++)
-                        if (key_compare(kEntry, child_link, K_index) <= 0)
-                            break;
+                    uint32_t K_index = key_lower_bound(kEntry, child_link);
                     base_ptr child_child = fetch_node(child_link->branch_[K_index]);
                     // hold child write-lock
                     uint32_t erase_return = ERASE_NONMIN(child_link, K_index, child_child, kEntry);
                     child_child->unref();
 
-                    node->page_read_unlock();
-
                     return erase_return;
 
                 } // end 2) R.nEntry = MIN_KEY
@@ -2215,19 +2441,13 @@ namespace DB::tree
                     // find K_index, recusively go down.
 
                     node->page_write_unlock();
-                    node->page_read_lock();
 
-                    uint32_t K_index = 0;
-                    for (; K_index < child_link->nEntry_; K_index++)
-                        if (key_compare(kEntry, child_link, K_index) <= 0)
-                            break;
+                    uint32_t K_index = key_lower_bound(kEntry, child_link);
                     base_ptr child_child = fetch_node(child_link->branch_[K_index]);
                     // hold child write-lock
                     uint32_t erase_return = ERASE_NONMIN(child_link, K_index, child_child, kEntry);
                     child_child->unref();
 
-                    node->page_read_unlock();
-
                     return erase_return;
 
                 } // end L.nEntry > MIN_KEY
@@ -2252,18 +2472,13 @@ namespace DB::tree
                     // find K_index, recusively go down.
 
                     node->page_write_unlock();
-                    node->page_read_lock();
 
-                    uint32_t K_index = 0;
-                    for (; K_index < L->nEntry_; K_index++)
-                        if (key_compare(kEntry, L, K_index) <= 0)
-                            break;
+                    uint32_t K_index = key_lower_bound(kEntry, L);
                     base_ptr child_child = fetch_node(L->branch_[K_index]);
                     // hold L write-lock
                     uint32_t erase_return = ERASE_NONMIN(L, K_index, child_child, kEntry);
                     child_child->unref();
 
-                    node->page_read_unlock();
                     L->unref(); // here special, since no caller
 
                     return erase_return;
@@ -2295,14 +2510,120 @@ namespace DB::tree
     // > 0, if KeyEntry > keys[index]
     int32_t key_compare(const KeyEntry& kEntry, const BTreePage* node, uint32_t key_index) {
         if (node->get_key_t() == key_t_t::INTEGER) {
-            return kEntry.key_int - node->keys_[key_index];
+            // not `a - b`, which overflows.
+            const int32_t key = node->keys_[key_index];
+            return (kEntry.key_int > key) - (kEntry.key_int < key);
         }
         // TODO: compound key
         //          design a protocol that forms a bijection between compound keys and key_str.
         else {
-            const KeyEntry key = node->read_key(key_index);
-            return kEntry.key_str.compare(key.key_str);
+            return std::string_view(kEntry.key_str).compare(node->read_key_view(key_index));
+        }
+    }
+
+
+    // binary search until the range fits in a few SIMD compares.
+    static constexpr uint32_t linear_search_width = 32;
+
+    // count keys[i] in [begin, end), such that `key < value` (or `key <= value` if `inclusive`).
+    static uint32_t count_less_scalar(const int32_t* keys, uint32_t begin, uint32_t end, int32_t value, bool inclusive)
+    {
+        uint32_t count = 0;
+        for (uint32_t i = begin; i < end; i++)
+            count += inclusive ? keys[i] <= value : keys[i] < value;
+        return count;
+    }
+
+    __attribute__((target("avx2")))
+    static uint32_t count_less_avx2(const int32_t* keys, uint32_t begin, uint32_t end, int32_t value, bool inclusive)
+    {
+        uint32_t count = 0;
+        uint32_t i = begin;
+        const __m256i value_vec = _mm256_set1_epi32(value);
+        for (; i + 8 <= end; i += 8) {
+            const __m256i key_vec = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+            // key < value  <=> value > key
+            // key <= value <=> !(key > value)
+            const __m256i cmp = inclusive ? _mm256_cmpgt_epi32(key_vec, value_vec)
+                                          : _mm256_cmpgt_epi32(value_vec, key_vec);
+            const uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(cmp));
+            count += inclusive ? 8 - __builtin_popcount(mask) : __builtin_popcount(mask);
+        }
+        return count + count_less_scalar(keys, i, end, value, inclusive);
+    }
+
+    __attribute__((target("avx512f")))
+    static uint32_t count_less_avx512(const int32_t* keys, uint32_t begin, uint32_t end, int32_t value, bool inclusive)
+    {
+        uint32_t count = 0;
+        uint32_t i = begin;
+        const __m512i value_vec = _mm512_set1_epi32(value);
+        for (; i + 16 <= end; i += 16) {
+            const __m512i key_vec = _mm512_loadu_si512(keys + i);
+            const __mmask16 mask = inclusive ? _mm512_cmple_epi32_mask(key_vec, value_vec)
+                                             : _mm512_cmplt_epi32_mask(key_vec, value_vec);
+            count += __builtin_popcount(mask);
+        }
+        return count + count_less_scalar(keys, i, end, value, inclusive);
+    }
+
+    static uint32_t count_less(const int32_t* keys, uint32_t begin, uint32_t end, int32_t value, bool inclusive)
+    {
+        switch (cpu::simd_level())
+        {
+        case cpu::simd_level_t::AVX512: return count_less_avx512(keys, begin, end, value, inclusive);
+        case cpu::simd_level_t::AVX2:   return count_less_avx2(keys, begin, end, value, inclusive);
+        default:                        return count_less_scalar(keys, begin, end, value, inclusive);
+        }
+    }
+
+    static uint32_t int_bound(const int32_t* keys, uint32_t n, int32_t value, bool upper)
+    {
+        uint32_t begin = 0, end = n;
+        while (end - begin > linear_search_width) {
+            const uint32_t mid = begin + ((end - begin) >> 1);
+            if (upper ? keys[mid] <= value : keys[mid] < value)
+                begin = mid + 1;
+            else
+                end = mid;
+        }
+        // keys are sorted, so the count is the offset of the bound.
+        return begin + count_less(keys, begin, end, value, upper);
+    }
+
+    static uint32_t str_bound(const BTreePage* node, std::string_view value, bool upper)
+    {
+        uint32_t begin = 0, end = node->nEntry_;
+        while (begin < end) {
+            const uint32_t mid = begin + ((end - begin) >> 1);
+            const int cmp = node->read_key_view(mid).compare(value);
+            if (upper ? cmp <= 0 : cmp < 0)
+                begin = mid + 1;
+            else
+                end = mid;
         }
+        return begin;
+    }
+
+    uint32_t key_lower_bound(const KeyEntry& kEntry, const BTreePage* node) {
+        if (node->get_key_t() == key_t_t::INTEGER)
+            return int_bound(node->keys_, node->nEntry_, kEntry.key_int, false);
+        else
+            return str_bound(node, kEntry.key_str, false);
+    }
+
+    uint32_t key_upper_bound(const KeyEntry& kEntry, const BTreePage* node) {
+        if (node->get_key_t() == key_t_t::INTEGER)
+            return int_bound(node->keys_, node->nEntry_, kEntry.key_int, true);
+        else
+            return str_bound(node, kEntry.key_str, true);
+    }
+
+    uint32_t key_find(const KeyEntry& kEntry, const BTreePage* node) {
+        const uint32_t index = key_lower_bound(kEntry, node);
+        if (index < node->nEntry_ && key_compare(kEntry, node, index) == 0)
+            return index;
+        return node->nEntry_;
     }
 
 
@@ -1,10 +1,13 @@
 #include "ap_exec.h"
 #include <cstring>
+#include <algorithm>
+#include <limits>
+#include <string>
 
 namespace DB::debug {
     void debug_VECTOR_INT(bool config, ap::VECTOR_INT vec, const char* name) {
         debug::DEBUG_LOG(debug::AP_EXEC && config, "[VECTOR_INT \"%s\"]:", name);
-        for(int32_t i = 0; i < ap::VECTOR_SIZE; i++) {
+        for(uint32_t i = 0; i < ap::VECTOR_SIZE; i++) {
             debug::DEBUG_LOG(debug::AP_EXEC && config, " %d", vec[i]);
         }
         debug::DEBUG_LOG(debug::AP_EXEC && config, "\n");
@@ -13,106 +16,73 @@ namespace DB::debug {
 
 
 namespace DB::ap {
+inline namespace AP_SIMD_NAMESPACE {
 
     block_tuple_iter_t::block_tuple_iter_t(const block_tuple_t* block_tuple)
         : block_tuple_(block_tuple), idx_(0) {}
-    bool block_tuple_iter_t::is_end() const { return idx_ == VECTOR_SIZE; }
-    bool block_tuple_iter_t::valid() const { return block_tuple_->select_[idx_]; }
-    const ap_row_t& block_tuple_iter_t::getTuple() const { return block_tuple_->rows_[idx_]; }
+    bool block_tuple_iter_t::is_end() const { return idx_ == block_tuple_->sel_size_; }
+    ap_row_t block_tuple_iter_t::getTuple() const { return block_tuple_->getTuple(block_tuple_->sel_[idx_]); }
+    std::string_view block_tuple_iter_t::getVARCHAR(page::range_t range) const {
+        return block_tuple_->getVARCHAR(block_tuple_->sel_[idx_], range);
+    }
     void block_tuple_iter_t::next() { idx_++; }
 
 
     VECTOR_INT operator==(VECTOR_STR_HANDLER vec, std::string_view sv) {
-        VECTOR_INT res;
-        block_tuple_iter_t it{ vec.block_ };
-        for(int32_t i = 0; i < VECTOR_SIZE; i++, it.next()) {
-            if(it.valid()) {
-                std::string_view content = it.getTuple().getVARCHAR(vec.str_range_);
-                res[i] = (content == sv);
-            }
-            else {
-                res[i] = 0;
-            }
+        VECTOR_INT res = ZERO_VEC;
+        for(uint32_t i = 0; i < vec.vector_->size(); i++) {
+            std::string_view content = vec.vector_->getVARCHAR(i, vec.str_range_);
+            res[i] = (content == sv);
         }
         return res;
     }
     VECTOR_INT operator==(std::string_view sv, VECTOR_STR_HANDLER vec) { return vec == sv; }
 
     VECTOR_INT operator!=(VECTOR_STR_HANDLER vec, std::string_view sv) {
-        VECTOR_INT res;
-        block_tuple_iter_t it{ vec.block_ };
-        for(int32_t i = 0; i < VECTOR_SIZE; i++, it.next()) {
-            if(it.valid()) {
-                std::string_view content = it.getTuple().getVARCHAR(vec.str_range_);
-                res[i] = (content != sv);
-            }
-            else {
-                res[i] = 0;
-            }
+        VECTOR_INT res = ZERO_VEC;
+        for(uint32_t i = 0; i < vec.vector_->size(); i++) {
+            std::string_view content = vec.vector_->getVARCHAR(i, vec.str_range_);
+            res[i] = (content != sv);
         }
         return res;
     }
-    VECTOR_INT operator!=(std::string_view sv, VECTOR_STR_HANDLER vec)  { return vec != sv; }
+    VECTOR_INT operator!=(std::string_view sv, VECTOR_STR_HANDLER vec) { return vec != sv; }
 
     VECTOR_INT operator<(VECTOR_STR_HANDLER vec, std::string_view sv) {
-        VECTOR_INT res;
-        block_tuple_iter_t it{ vec.block_ };
-        for(int32_t i = 0; i < VECTOR_SIZE; i++, it.next()) {
-            if(it.valid()) {
-                std::string_view content = it.getTuple().getVARCHAR(vec.str_range_);
-                res[i] = (content < sv);
-            }
-            else {
-                res[i] = 0;
-            }
+        VECTOR_INT res = ZERO_VEC;
+        for(uint32_t i = 0; i < vec.vector_->size(); i++) {
+            std::string_view content = vec.vector_->getVARCHAR(i, vec.str_range_);
+            res[i] = (content < sv);
         }
         return res;
     }
     VECTOR_INT operator<(std::string_view sv, VECTOR_STR_HANDLER vec)  { return !(vec <= sv); }
 
     VECTOR_INT operator<=(VECTOR_STR_HANDLER vec, std::string_view sv) {
-        VECTOR_INT res;
-        block_tuple_iter_t it{ vec.block_ };
-        for(int32_t i = 0; i < VECTOR_SIZE; i++, it.next()) {
-            if(it.valid()) {
-                std::string_view content = it.getTuple().getVARCHAR(vec.str_range_);
-                res[i] = (content <= sv);
-            }
-            else {
-                res[i] = 0;
-            }
+        VECTOR_INT res = ZERO_VEC;
+        for(uint32_t i = 0; i < vec.vector_->size(); i++) {
+            std::string_view content = vec.vector_->getVARCHAR(i, vec.str_range_);
+            res[i] = (content <= sv);
         }
         return res;
     }
     VECTOR_INT operator<=(std::string_view sv, VECTOR_STR_HANDLER vec)  { return !(vec < sv); }
 
     VECTOR_INT operator>(VECTOR_STR_HANDLER vec, std::string_view sv) {
-        VECTOR_INT res;
-        block_tuple_iter_t it{ vec.block_ };
-        for(int32_t i = 0; i < VECTOR_SIZE; i++, it.next()) {
-            if(it.valid()) {
-                std::string_view content = it.getTuple().getVARCHAR(vec.str_range_);
-                res[i] = (content > sv);
-            }
-            else {
-                res[i] = 0;
-            }
+        VECTOR_INT res = ZERO_VEC;
+        for(uint32_t i = 0; i < vec.vector_->size(); i++) {
+            std::string_view content = vec.vector_->getVARCHAR(i, vec.str_range_);
+            res[i] = (content > sv);
         }
         return res;
     }
     VECTOR_INT operator>(std::string_view sv, VECTOR_STR_HANDLER vec)  { return !(vec >= sv); }
 
     VECTOR_INT operator>=(VECTOR_STR_HANDLER vec, std::string_view sv) {
-        VECTOR_INT res;
-        block_tuple_iter_t it{ vec.block_ };
-        for(int32_t i = 0; i < VECTOR_SIZE; i++, it.next()) {
-            if(it.valid()) {
-                std::string_view content = it.getTuple().getVARCHAR(vec.str_range_);
-                res[i] = (content >= sv);
-            }
-            else {
-                res[i] = 0;
-            }
+        VECTOR_INT res = ZERO_VEC;
+        for(uint32_t i = 0; i < vec.vector_->size(); i++) {
+            std::string_view content = vec.vector_->getVARCHAR(i, vec.str_range_);
+            res[i] = (content >= sv);
         }
         return res;
     }
@@ -120,59 +90,239 @@ namespace DB::ap {
 
 
 
-    VECTOR_INT block_tuple_t::getINT(page::range_t range) const {
-        VECTOR_INT vec;
-        // OPTIMIZATION: maybe we could use SIMD-gather
-        // `_mm256_mmask_i32gather_epi32()` requires CPU flags "AVX512VL + AVX512F"
-        // "AVX512" is supported on kightslanding, cascadelake and so on.
-        for(int32_t i = 0; i < VECTOR_SIZE / 2; i++) {
-            xjbDB_prefetch_on_array((char*)(rows_),
-                                    i,
-                                    sizeof(ap_row_t));
-            xjbDB_prefetch_on_array((char*)(rows_),
-                                    i + VECTOR_SIZE/2,
-                                    sizeof(ap_row_t));
-            vec[i] = rows_[i].getINT(range);
-            vec[i + VECTOR_SIZE / 2] = rows_[i + VECTOR_SIZE / 2].getINT(range);
+    VECTOR_INT block_vector_t::getINT(page::range_t range) const {
+        if(likely(block_->table_ != nullptr)) {
+            const int32_t* col = block_->table_->getINT(range);
+            if(unlikely(col == nullptr)) {
+                return ZERO_VEC;
+            }
+            col += block_->row_begin_;
+            // all selected, the lanes are consecutive rows
+            if(likely(pos_[VECTOR_SIZE - 1] - pos_[0] == VECTOR_SIZE - 1)) {
+                return simd_loadu(col + pos_[0]);
+            }
+            return simd_gatheri32(col, pos_);
+        }
+        VECTOR_INT vec = ZERO_VEC;
+        for(uint32_t i = 0; i < size_; i++) {
+            vec[i] = block_->rows_[pos_[i]].getINT(range);
         }
         return vec;
     }
 
+    std::string_view block_vector_t::getVARCHAR(uint32_t lane, page::range_t range) const {
+        return block_->getVARCHAR(pos_[lane], range);
+    }
+
 
-    ap_block_iter_t::ap_block_iter_t(const ap_table_t* table)
-        :it_(table->rows_.cbegin()), end_(table->rows_.cend()) {}
+    block_vector_t block_tuple_t::get_vector(uint32_t sel_begin) const {
+        block_vector_t vector;
+        vector.block_ = this;
+        vector.size_ = std::min(VECTOR_SIZE, sel_size_ - sel_begin);
+        if(likely(vector.size_ == VECTOR_SIZE)) {
+            vector.pos_ = simd_loadu16(sel_ + sel_begin);
+            return vector;
+        }
+        for(uint32_t i = 0; i < VECTOR_SIZE; i++) {
+            vector.pos_[i] = sel_[sel_begin + (i < vector.size_ ? i : 0)];
+        }
+        return vector;
+    }
+
+    int32_t block_tuple_t::getINT(uint32_t pos, page::range_t range) const {
+        if(likely(table_ != nullptr)) {
+            const int32_t* col = table_->getINT(range);
+            return col != nullptr ? col[row_begin_ + pos] : 0;
+        }
+        return rows_[pos].getINT(range);
+    }
+
+    ap_row_t block_tuple_t::getTuple(uint32_t pos) const {
+        if(table_ != nullptr) {
+            return table_->getTuple(row_begin_ + pos);
+        }
+        return rows_[pos];
+    }
+
+    std::string_view block_tuple_t::getVARCHAR(uint32_t pos, page::range_t range) const {
+        if(table_ != nullptr) {
+            return table_->getVARCHAR(row_begin_ + pos, range);
+        }
+        return rows_[pos].getVARCHAR(range);
+    }
+
+
+    ap_block_iter_t::ap_block_iter_t(const ap_table_t* table, uint32_t part, uint32_t parts)
+        :table_(table) {
+        const uint32_t blocks = (table->size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        row_ = std::min(table->size(), blocks * part / parts * BLOCK_SIZE);
+        row_end_ = std::min(table->size(), blocks * (part + 1) / parts * BLOCK_SIZE);
+    }
     ap_block_iter_t::ap_block_iter_t(const join_result_buf_t* table)
         :it_(table->rows_.cbegin()), end_(table->rows_.cend()) {}
-    bool ap_block_iter_t::is_end() const { return it_ == end_; }
+    bool ap_block_iter_t::is_end() const {
+        if(table_ != nullptr) {
+            return row_ >= row_end_;
+        }
+        return it_ == end_;
+    }
     block_tuple_t ap_block_iter_t::consume_block() {
         block_tuple_t block;
-        for(uint32_t i = 0; i < VECTOR_SIZE; i++, ++it_) {
-            if(likely(it_ != end_)) {
-                block.rows_[i] = *it_;
-                block.select_[i] = true;
+        if(table_ != nullptr) {
+            const uint32_t size = std::min(BLOCK_SIZE, row_end_ - row_);
+            block.table_ = table_;
+            block.row_begin_ = row_;
+            // select the alive rows, `alive_` is padded to a multiple of VECTOR_SIZE.
+            const int32_t* alive = table_->alive_.data() + row_;
+            for(uint32_t i = 0; i < size; i += VECTOR_SIZE) {
+                block.sel_size_ += simd_compress_u16(block.sel_ + block.sel_size_, IOTA_VEC + i, simd_load(alive + i));
+            }
+            row_ += size;
+            return block;
+        }
+        const uint32_t size = std::min<std::ptrdiff_t>(BLOCK_SIZE, end_ - it_);
+        block.rows_ = it_;
+        for(uint32_t i = 0; i < size; i++) {
+            block.sel_[i] = i;
+        }
+        block.sel_size_ = size;
+        it_ += size;
+        return block;
+    }
+
+
+    ap_table_t::ap_table_t(const std::vector<page::col_range_t>& cols, page::col_range_t key)
+        :key_(key) {
+        std::memset(col_at_, -1, sizeof(col_at_));
+        for(page::col_range_t col : cols) {
+            col_at_[col.range_.begin] = columns_.size();
+            columns_.emplace_back(col);
+        }
+    }
+
+    const ap_column_t* ap_table_t::get_column(page::range_t range) const {
+        if(unlikely(range.begin >= page::MAX_TUPLE_SIZE || col_at_[range.begin] < 0)) {
+            return nullptr;
+        }
+        return &columns_[col_at_[range.begin]];
+    }
+
+    const int32_t* ap_table_t::getINT(page::range_t range) const {
+        const ap_column_t* col = get_column(range);
+        if(unlikely(col == nullptr || col->col_.col_t_ != page::col_t_t::INTEGER)) {
+            debug::ERROR_LOG("`ap_table_t::getINT()` not an INTEGER column [begin=%d]\n", range.begin);
+            return nullptr;
+        }
+        return col->ints_.data();
+    }
+
+    std::string_view ap_table_t::getVARCHAR(uint32_t row, page::range_t range) const {
+        const ap_column_t* col = get_column(range);
+        if(unlikely(col == nullptr || col->col_.col_t_ == page::col_t_t::INTEGER)) {
+            debug::ERROR_LOG("`ap_table_t::getVARCHAR()` not a VARCHAR column [begin=%d]\n", range.begin);
+            return {};
+        }
+        const uint32_t begin = col->str_offsets_[row];
+        return std::string_view(col->str_heap_.data() + begin, col->str_offsets_[row + 1] - begin);
+    }
+
+    ap_row_t ap_table_t::getTuple(uint32_t row) const {
+        ap_row_t tuple;
+        tuple.row.value_state_ = page::value_state::INUSED;
+        for(const ap_column_t& col : columns_) {
+            const page::range_t range = col.col_.range_;
+            if(col.col_.col_t_ == page::col_t_t::INTEGER) {
+                std::memcpy(tuple.row.content_ + range.begin, &col.ints_[row], sizeof(int32_t));
             }
             else {
-                break;
+                const uint32_t begin = col.str_offsets_[row];
+                std::memcpy(tuple.row.content_ + range.begin, col.str_heap_.data() + begin,
+                            col.str_offsets_[row + 1] - begin);
             }
         }
-        return block;
+        return tuple;
     }
 
+    std::string ap_table_t::get_key(const page::ValueEntry& vEntry) const {
+        const char* key = vEntry.content_ + key_.range_.begin;
+        if(key_.col_t_ == page::col_t_t::INTEGER) {
+            return std::string(key, sizeof(int32_t));
+        }
+        return std::string(key, strnlen(key, key_.range_.len));
+    }
 
-    void VMEmitOp::emit(const block_tuple_t& block) {
-        for(uint32_t i = 0; i < VECTOR_SIZE; i++) {
-            if(likely(block.select_[i])) {
-                rows_.push_back(block.rows_[i]);
+    void ap_table_t::append(const page::ValueEntry& vEntry) {
+        // grow by a whole vector, the padding is 0 and not alive.
+        if(size_ % VECTOR_SIZE == 0) {
+            alive_.resize(size_ + VECTOR_SIZE, 0);
+            for(ap_column_t& col : columns_) {
+                if(col.col_.col_t_ == page::col_t_t::INTEGER) {
+                    col.ints_.resize(size_ + VECTOR_SIZE, 0);
+                }
             }
         }
-        if(debug::AP_EXEC_EMIT) {
-            for(uint32_t i = 0; i < VECTOR_SIZE; i++) {
-                if(likely(block.select_[i])) {
-                    debug::DEBUG_LOG(debug::AP_EXEC_EMIT,
-                                     "emit tuple: %s\n",
-                                     block.rows_[i].to_string());
+        for(ap_column_t& col : columns_) {
+            const page::range_t range = col.col_.range_;
+            if(col.col_.col_t_ == page::col_t_t::INTEGER) {
+                col.ints_[size_] = page::get_range_INT(vEntry, range);
+            }
+            else {
+                const char* str = vEntry.content_ + range.begin;
+                col.str_heap_.append(str, strnlen(str, range.len));
+                col.str_offsets_.push_back(col.str_heap_.size());
+            }
+        }
+        alive_[size_] = 1;
+        if(indexed_) {
+            key2row_[get_key(vEntry)] = size_;
+        }
+        size_++;
+    }
+
+    void ap_table_t::erase(const page::ValueEntry& vEntry) {
+        if(!indexed_) {
+            for(uint32_t row = 0; row < size_; row++) {
+                if(alive_[row]) {
+                    key2row_[get_key(getTuple(row).row)] = row;
                 }
             }
+            indexed_ = true;
+        }
+        auto it = key2row_.find(get_key(vEntry));
+        if(it == key2row_.end()) {
+            debug::ERROR_LOG("`ap_table_t::erase()` no such key\n");
+            return;
+        }
+        alive_[it->second] = 0;
+        key2row_.erase(it);
+        erased_++;
+    }
+
+    void ap_table_t::compact() {
+        std::vector<page::col_range_t> cols;
+        for(const ap_column_t& col : columns_) {
+            cols.push_back(col.col_);
+        }
+        ap_table_t table(cols, key_);
+        for(uint32_t row = 0; row < size_; row++) {
+            if(alive_[row]) {
+                table.append(getTuple(row).row);
+            }
+        }
+        *this = std::move(table);
+    }
+
+
+    void VMEmitOp::emit(const block_tuple_t& block) {
+        for(uint32_t i = 0; i < block.sel_size_; i++) {
+            rows_.push_back(block.getTuple(block.sel_[i]));
+        }
+        if(debug::AP_EXEC_EMIT) {
+            for(uint32_t i = 0; i < block.sel_size_; i++) {
+                debug::DEBUG_LOG(debug::AP_EXEC_EMIT,
+                                 "emit tuple: %s\n",
+                                 block.getTuple(block.sel_[i]).to_string().c_str());
+            }
         }
     }
 
@@ -202,15 +352,13 @@ namespace DB::ap {
 
 
     void hash_table_t::insert(const block_tuple_t& block) {
-        // OPTIMIZATION: use SIMD gather to get key-col, SIMD hash, then SIMD scatter-add?
-        for(block_tuple_iter_t it = block.first(); !it.is_end(); it.next()) {
-            if(likely(it.valid())) {
-                const ap_row_t& tuple = it.getTuple();
-                const int32_t key = tuple.getINT(left_);
-                lucky_key_ = key;
-                bucket_size_[hash2bucket(key)]++;
-                row_buf_.push_back(tuple);
-            }
+        // OPTIMIZATION: SIMD hash, then SIMD scatter-add?
+        for(uint32_t i = 0; i < block.sel_size_; i++) {
+            const uint32_t pos = block.sel_[i];
+            const int32_t key = block.getINT(pos, left_);
+            lucky_key_ = key;
+            bucket_size_[hash2bucket(key)]++;
+            row_buf_.push_back(block.getTuple(pos));
         }
     }
 
@@ -239,9 +387,9 @@ namespace DB::ap {
         // debug bucket_size_[]
         debug::DEBUG_LOG(debug::AP_EXEC_BUCKET_SIZE,
                          "----------------- hash bucket size begin -----------------\n");
-        for(int32_t i = 0; i < BUCKET_AMOUNT; i++) {
+        for(uint32_t i = 0; i < BUCKET_AMOUNT; i++) {
             debug::DEBUG_LOG(debug::AP_EXEC_BUCKET_SIZE,
-                             "bucket_size_[%d] = %d\n",
+                             "bucket_size_[%u] = %d\n",
                              i, bucket_size_[i]);
         }
         debug::DEBUG_LOG(debug::AP_EXEC_BUCKET_SIZE,
@@ -282,9 +430,9 @@ namespace DB::ap {
         // debug bucket_head_[]
         debug::DEBUG_LOG(debug::AP_EXEC_HISTOGRAM,
                          "----------------- hash bucket histogram begin -----------------\n");
-        for(int32_t i = 0; i < BUCKET_AMOUNT; i++) {
+        for(uint32_t i = 0; i < BUCKET_AMOUNT; i++) {
             debug::DEBUG_LOG(debug::AP_EXEC_HISTOGRAM,
-                             "bucket_head_[%d] = %d\t\tbucket_end_exclusive_[%d] = %d\n",
+                             "bucket_head_[%u] = %d\t\tbucket_end_exclusive_[%u] = %d\n",
                              i, bucket_head_[i], i, bucket_size_[i]);
         }
         debug::DEBUG_LOG(debug::AP_EXEC_HISTOGRAM,
@@ -293,9 +441,9 @@ namespace DB::ap {
         debug::DEBUG_LOG(debug::AP_EXEC_HASH_BUCKET,
                          "----------------- hash bucket begin -----------------\n");
         debug::DEBUG_LOG(debug::AP_EXEC_HASH_BUCKET, "key\t\tnext\n");
-        for(int32_t i = 0; i < N + 1; i++) {
+        for(uint32_t i = 0; i < N + 1; i++) {
             debug::DEBUG_LOG(debug::AP_EXEC_HASH_BUCKET,
-                             "key_col_[%d] = %d\t\tnext_[%d] = %d\n",
+                             "key_col_[%u] = %d\t\tnext_[%u] = %d\n",
                              i, key_col_[i], i, next_[i]);
         }
         debug::DEBUG_LOG(debug::AP_EXEC_HASH_BUCKET,
@@ -319,14 +467,18 @@ namespace DB::ap {
 
     join_result_buf_t hash_table_t::probe(const block_tuple_t& block) const {
         // wait if build is not completed
-        if(unlikely(!build_completed_)) {
-            build_completion_.get_future().wait();
-            build_completed_ = true;
-        }
+        build_completed_.wait();
 
         join_result_buf_t result;
+        for(uint32_t i = 0; i < block.sel_size_; i += VECTOR_SIZE) {
+            probe(block.get_vector(i), result);
+        }
+        return result;
+    }
+
 
-        const VECTOR_INT probe_keys = block.getINT(right_);
+    void hash_table_t::probe(const block_vector_t& vector, join_result_buf_t& result) const {
+        const VECTOR_INT probe_keys = vector.getINT(right_);
         debug::debug_VECTOR_INT(debug::AP_EXEC_PROBE_KEYS, probe_keys, "probe keys");
 
         // pos: probe[i] might be equal to build[pos[i]]
@@ -339,8 +491,9 @@ namespace DB::ap {
 
         // maybe_match (0-1 mask vector):
         //      maybe_match[i] == 1(0) <=> probe[i] should(not) be checked
-        VECTOR_INT maybe_match = simd_int2bool(pos) & block.select_;
-        debug::debug_VECTOR_INT(debug::AP_EXEC_BLOCK_SELECTIVITY, block.select_, "block selectivity");
+        const VECTOR_INT select = vector.select();
+        VECTOR_INT maybe_match = simd_int2bool(pos) & select;
+        debug::debug_VECTOR_INT(debug::AP_EXEC_BLOCK_SELECTIVITY, select, "block selectivity");
         debug::debug_VECTOR_INT(debug::AP_EXEC_MAYBE_MATCH, maybe_match, "maybe_match");
 
         VECTOR_INT build_keys = get_vec(lucky_key_);
@@ -350,7 +503,7 @@ namespace DB::ap {
             // prepare build_keys from key_col,
             // lucky_key is stuffed into the position where key does not match.
             build_keys =
-                simd_mask_gatheri32(build_keys, key_col_, pos, zero_one_mask_2_vector_mask(maybe_match));
+                simd_mask_gatheri32(build_keys, key_col_, pos, maybe_match);
             debug::DEBUG_LOG(debug::AP_EXEC_BUILD_KEYS, "try to match ");
             debug::debug_VECTOR_INT(debug::AP_EXEC_BUILD_KEYS, build_keys, "build keys");
 
@@ -367,7 +520,7 @@ namespace DB::ap {
                 // build_keys[pos[i]] == probe_keys[i]
                 if(check[i]) {
                     const uint32_t rowid = keypos2rowid_[pos[i]];
-                    result.rows_.push_back(splice(row_buf_[rowid], block.rows_[i], left_len_, right_len_));
+                    result.rows_.push_back(splice(row_buf_[rowid], vector.block_->getTuple(vector.pos_[i]), left_len_, right_len_));
                     debug::DEBUG_LOG(debug::AP_EXEC_JOIN_RESULT,
                                      "join on key = %d\n",
                                      probe_keys[i]);
@@ -381,7 +534,7 @@ namespace DB::ap {
 
             // checkout whether pos can go next
             maybe_match = maybe_match & (pos != end_inclusive);
-                // simd_mask_gatheri32(maybe_match, next_, pos, zero_one_mask_2_vector_mask(maybe_match));
+                // simd_mask_gatheri32(maybe_match, next_, pos, maybe_match);
             debug::debug_VECTOR_INT(debug::AP_EXEC_MAYBE_MATCH, maybe_match, "maybe_match");
 
             // no need to process, return
@@ -393,9 +546,293 @@ namespace DB::ap {
             pos = pos + maybe_match;
             debug::debug_VECTOR_INT(debug::AP_EXEC_POS, pos, "pos");
         }
+    }
+
+
+
+    ///////////////////////////////////////////////////////////////////////////
+    ///////////////////  aggregation hash table implementation  ///////////////
+    ///////////////////////////////////////////////////////////////////////////
+
+
+    static constexpr uint32_t AGG_INIT_SLOTS = 1024;
+    static constexpr int32_t EMPTY_SLOT = -1;
+
+    // FNV-1a, then mixed as the INTEGER keys
+    static
+    uint32_t hash_key(const char* key, uint32_t len) {
+        uint32_t h = 2166136261u;
+        for(uint32_t i = 0; i < len; i++) {
+            h = (h ^ static_cast<uint8_t>(key[i])) * 16777619u;
+        }
+        return hash32(h);
+    }
+
+
+    agg_hash_table_t::agg_hash_table_t(const std::vector<page::col_range_t>& group, const std::vector<agg_spec_t>& specs)
+        :group_(group), specs_(specs),
+         int_key_(group.size() == 1 && group[0].col_t_ == page::col_t_t::INTEGER),
+         slot_mask_(AGG_INIT_SLOTS - 1),
+         slot_group_(AGG_INIT_SLOTS, EMPTY_SLOT), slot_tag_(AGG_INIT_SLOTS, 0)
+    {
+        for(page::col_range_t col : group_) {
+            key_len_ += col.range_.len;
+        }
+    }
+
+
+    void agg_hash_table_t::insert(const block_tuple_t& block) {
+        for(uint32_t i = 0; i < block.sel_size_; i += VECTOR_SIZE) {
+            // a vector makes VECTOR_SIZE groups at most, keep the load factor under 1/2.
+            if((groups_ + VECTOR_SIZE) * 2 > slot_mask_ + 1) {
+                grow();
+            }
+            insert(block.get_vector(i));
+        }
+    }
 
+
+    void agg_hash_table_t::insert(const block_vector_t& vector) {
+        const VECTOR_INT group = find_or_insert(vector);
+        const uint32_t width = specs_.size() + 1;
+        for(uint32_t i = 0; i < vector.size_; i++) {
+            acc_[group[i] * width]++;
+        }
+        for(uint32_t s = 0; s < specs_.size(); s++) {
+            const agg_spec_t& spec = specs_[s];
+            if(spec.agg_t_ == agg_t_t::KEY || spec.agg_t_ == agg_t_t::COUNT) {
+                continue;
+            }
+            const VECTOR_INT values = vector.getINT(spec.in_);
+            int64_t* acc = acc_.data() + 1 + s;
+            switch(spec.agg_t_) {
+            case agg_t_t::SUM:
+            case agg_t_t::AVG:
+                for(uint32_t i = 0; i < vector.size_; i++)
+                    acc[group[i] * width] += values[i];
+                break;
+            case agg_t_t::MIN:
+                for(uint32_t i = 0; i < vector.size_; i++)
+                    acc[group[i] * width] = std::min<int64_t>(acc[group[i] * width], values[i]);
+                break;
+            case agg_t_t::MAX:
+                for(uint32_t i = 0; i < vector.size_; i++)
+                    acc[group[i] * width] = std::max<int64_t>(acc[group[i] * width], values[i]);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+
+    VECTOR_INT agg_hash_table_t::find_or_insert(const block_vector_t& vector) {
+        // key of each lane
+        char keys[VECTOR_SIZE][page::MAX_TUPLE_SIZE];
+        VECTOR_INT tags = ZERO_VEC, hashes = ZERO_VEC;
+        if(int_key_) {
+            tags = vector.getINT(group_[0].range_);
+            hashes = simd_hash32(tags);
+        }
+        else {
+            uint32_t offset = 0;
+            for(page::col_range_t col : group_) {
+                if(col.col_t_ == page::col_t_t::INTEGER) {
+                    const VECTOR_INT values = vector.getINT(col.range_);
+                    for(uint32_t i = 0; i < vector.size_; i++)
+                        std::memcpy(keys[i] + offset, &values.lane_[i], sizeof(int32_t));
+                }
+                else {
+                    for(uint32_t i = 0; i < vector.size_; i++) {
+                        const std::string_view str = vector.getVARCHAR(i, col.range_);
+                        std::memcpy(keys[i] + offset, str.data(), str.size());
+                        std::memset(keys[i] + offset + str.size(), 0, col.range_.len - str.size());
+                    }
+                }
+                offset += col.range_.len;
+            }
+            for(uint32_t i = 0; i < vector.size_; i++) {
+                hashes[i] = hash_key(keys[i], key_len_);
+            }
+            tags = hashes;
+        }
+
+        const VECTOR_INT slot_mask = get_vec(slot_mask_);
+        const VECTOR_INT empty = get_vec(EMPTY_SLOT);
+        VECTOR_INT pos = hashes & slot_mask;
+        VECTOR_INT group = ZERO_VEC;
+        VECTOR_INT active = vector.select();
+        while(!simd_all_eq(active, ZERO_VEC)) {
+            const VECTOR_INT slot_group = simd_mask_gatheri32(empty, slot_group_.data(), pos, active);
+            const VECTOR_INT slot_tag = simd_mask_gatheri32(ZERO_VEC, slot_tag_.data(), pos, active);
+            const VECTOR_INT occupied = active & (slot_group != empty);
+            VECTOR_INT hit = occupied & (slot_tag == tags);
+            if(!int_key_) {
+                // the tag is only the hash
+                for(uint32_t bits = simd_movemask(hit); bits != 0; bits &= bits - 1) {
+                    const uint32_t i = __builtin_ctz(bits);
+                    hit[i] = std::memcmp(get_key(slot_group[i]), keys[i], key_len_) == 0;
+                }
+            }
+            group = simd_blend(hit, slot_group, group);
+
+            // claim the empty slots lane by lane,
+            // a lane whose slot is taken by an earlier lane checks it again in the next round.
+            VECTOR_INT claimed = ZERO_VEC;
+            for(uint32_t bits = simd_movemask(active - occupied); bits != 0; bits &= bits - 1) {
+                const uint32_t i = __builtin_ctz(bits);
+                if(slot_group_[pos[i]] == EMPTY_SLOT) {
+                    const char* key = int_key_ ? reinterpret_cast<const char*>(&tags.lane_[i]) : keys[i];
+                    group[i] = new_group(pos[i], key, hashes[i], tags[i]);
+                    claimed[i] = 1;
+                }
+            }
+
+            // the lanes on the slot of another key go on to the next one
+            pos = (pos + occupied - hit) & slot_mask;
+            active = active - hit - claimed;
+        }
+        return group;
+    }
+
+
+    uint32_t agg_hash_table_t::find_or_insert(const char* key, uint32_t hash, int32_t tag) {
+        uint32_t slot = hash & slot_mask_;
+        for(; slot_group_[slot] != EMPTY_SLOT; slot = (slot + 1) & slot_mask_) {
+            const uint32_t group = slot_group_[slot];
+            if(slot_tag_[slot] == tag && std::memcmp(get_key(group), key, key_len_) == 0) {
+                return group;
+            }
+        }
+        return new_group(slot, key, hash, tag);
+    }
+
+
+    uint32_t agg_hash_table_t::new_group(uint32_t slot, const char* key, uint32_t hash, int32_t tag) {
+        slot_group_[slot] = groups_;
+        slot_tag_[slot] = tag;
+        keys_.append(key, key_len_);
+        hashes_.push_back(hash);
+        tags_.push_back(tag);
+        acc_.push_back(0); // row count
+        for(const agg_spec_t& spec : specs_) {
+            if(spec.agg_t_ == agg_t_t::MIN)
+                acc_.push_back(std::numeric_limits<int32_t>::max());
+            else if(spec.agg_t_ == agg_t_t::MAX)
+                acc_.push_back(std::numeric_limits<int32_t>::min());
+            else
+                acc_.push_back(0);
+        }
+        return groups_++;
+    }
+
+
+    void agg_hash_table_t::grow() {
+        const uint32_t slots = (slot_mask_ + 1) * 2;
+        slot_mask_ = slots - 1;
+        slot_group_.assign(slots, EMPTY_SLOT);
+        slot_tag_.assign(slots, 0);
+        for(uint32_t group = 0; group < groups_; group++) {
+            uint32_t slot = hashes_[group] & slot_mask_;
+            while(slot_group_[slot] != EMPTY_SLOT) {
+                slot = (slot + 1) & slot_mask_;
+            }
+            slot_group_[slot] = group;
+            slot_tag_[slot] = tags_[group];
+        }
+        debug::DEBUG_LOG(debug::AP_EXEC, "[AP_EXEC] agg_hash_table_t::grow() [slots=%d] [groups=%d]\n",
+                         slots, groups_);
+    }
+
+
+    void agg_hash_table_t::merge(const agg_hash_table_t& other) {
+        const uint32_t width = specs_.size() + 1;
+        for(uint32_t from = 0; from < other.groups_; from++) {
+            if((groups_ + 1) * 2 > slot_mask_ + 1) {
+                grow();
+            }
+            const uint32_t group = find_or_insert(other.get_key(from), other.hashes_[from], other.tags_[from]);
+            int64_t* acc = acc_.data() + group * width;
+            const int64_t* other_acc = other.acc_.data() + from * width;
+            acc[0] += other_acc[0];
+            for(uint32_t s = 0; s < specs_.size(); s++) {
+                if(specs_[s].agg_t_ == agg_t_t::MIN)
+                    acc[1 + s] = std::min(acc[1 + s], other_acc[1 + s]);
+                else if(specs_[s].agg_t_ == agg_t_t::MAX)
+                    acc[1 + s] = std::max(acc[1 + s], other_acc[1 + s]);
+                else
+                    acc[1 + s] += other_acc[1 + s];
+            }
+        }
+    }
+
+
+    hash_agg_t::hash_agg_t(std::vector<page::col_range_t> group, std::vector<agg_spec_t> specs, uint32_t parts)
+        :specs_(std::move(specs))
+    {
+        for(const agg_spec_t& spec : specs_) {
+            uint32_t offset = 0;
+            for(page::col_range_t col : group) {
+                if(col.range_.begin == spec.in_.begin)
+                    break;
+                offset += col.range_.len;
+            }
+            key_at_.push_back(offset);
+        }
+        partials_.reserve(parts);
+        for(uint32_t part = 0; part < parts; part++) {
+            partials_.emplace_back(group, specs_);
+        }
+    }
+
+
+    join_result_buf_t hash_agg_t::result() {
+        agg_hash_table_t& merged = partials_[0];
+        for(uint32_t part = 1; part < partials_.size(); part++) {
+            merged.merge(partials_[part]);
+        }
+        // without GROUP BY, there is a group even if no tuple
+        if(merged.group_.empty() && merged.groups_ == 0) {
+            const uint32_t hash = hash_key("", 0);
+            merged.find_or_insert("", hash, hash);
+        }
+        debug::DEBUG_LOG(debug::AP_EXEC, "[AP_EXEC] hash_agg_t::result() [groups=%d]\n", merged.groups_);
+
+        join_result_buf_t result;
+        const uint32_t width = specs_.size() + 1;
+        for(uint32_t group = 0; group < merged.groups_; group++) {
+            const int64_t* acc = merged.acc_.data() + group * width;
+            ap_row_t tuple;
+            tuple.row.value_state_ = page::value_state::INUSED;
+            for(uint32_t s = 0; s < specs_.size(); s++) {
+                const agg_spec_t& spec = specs_[s];
+                char* out = tuple.row.content_ + spec.out_.begin;
+                if(spec.agg_t_ == agg_t_t::KEY) {
+                    std::memcpy(out, merged.get_key(group) + key_at_[s], spec.out_.len);
+                    continue;
+                }
+                int64_t value = 0;
+                if(spec.agg_t_ == agg_t_t::COUNT)
+                    value = acc[0];
+                else if(acc[0] == 0) // MIN/MAX of nothing
+                    value = 0;
+                else if(spec.agg_t_ == agg_t_t::AVG)
+                    value = acc[1 + s] / acc[0];
+                else
+                    value = acc[1 + s];
+                // never wrap into the INTEGER column
+                if(value < std::numeric_limits<int32_t>::min() || value > std::numeric_limits<int32_t>::max()) {
+                    throw std::string(agg_t_str[static_cast<uint32_t>(spec.agg_t_)]) + " exceeds INT: " +
+                          std::to_string(value);
+                }
+                const int32_t out_value = static_cast<int32_t>(value);
+                std::memcpy(out, &out_value, sizeof(int32_t));
+            }
+            result.rows_.push_back(tuple);
+        }
         return result;
     }
 
 
-} // end namespace DB::ap
\ No newline at end of file
+} // end namespace AP_SIMD_NAMESPACE
+} // end namespace DB::ap
@@ -8,6 +8,7 @@
 #include "vm.h"
 #include <string>
 #include <map>
+#include <algorithm>
 #include <unordered_map>
 #include <utility>
 
@@ -22,6 +23,7 @@ namespace DB::ast{
 
     int g_iTableCount, g_iHashCount, g_iIndent, g_iPipeline;
     vector<string> g_vCode = {};
+    vector<string> g_vFuture = {}; // pipelines waited before return
 
     static inline
     std::string range2str(page::range_t range) {
@@ -33,13 +35,19 @@ namespace DB::ast{
         return str;
     }
 
+    static inline
+    std::string col_t2str(page::col_t_t col_t) {
+        static const std::string str[] = { "INTEGER", "CHAR", "VARCHAR" };
+        return "DB::page::col_t_t::" + str[int(col_t)];
+    }
+
     // init from source table
     APMap::APMap(const table::TableInfo& table)
         :attr_map(), tuple_len(table.columnInfos_.back().get_range().end())
     {
         const std::string tableName = table.tableName_;
         const uint32_t attr_size = table.colNames_.size();
-        for(int i = 0; i < attr_size; i++) {
+        for(uint32_t i = 0; i < attr_size; i++) {
             attr_map[{ tableName, table.colNames_[i] }] =
                 page::col_range_t{
                     table.columnInfos_[i].get_range(),
@@ -104,6 +112,23 @@ namespace DB::ast{
         return attr_map[attr].range_;
     }
 
+    APMap::APMap(const vector<pair<col_name_t, page::col_range_t>>& cols)
+        :attr_map(), tuple_len(0)
+    {
+        for(const auto& [col_name, col_range] : cols) {
+            attr_map[col_name] = page::col_range_t{ { tuple_len, col_range.range_.len }, col_range.col_t_ };
+            tuple_len += col_range.range_.len;
+        }
+    }
+
+
+    string APAggregate::get_name() const {
+        const string column = column_.first.empty() ? "$" : column_.first + "." + column_.second;
+        if(agg_t_ == ap::agg_t_t::KEY)
+            return column;
+        return string(ap::agg_t_str[int(agg_t_)]) + "(" + column + ")";
+    }
+
 
     // op node
     APBaseOp::~APBaseOp() {}
@@ -116,6 +141,7 @@ namespace DB::ast{
         g_iHashCount = _hashTableCount;
         g_iIndent = 0;
         g_iPipeline = 0;
+        g_vFuture.clear();
 
         // fixed code + reserved lines
         /*
@@ -124,8 +150,9 @@ namespace DB::ast{
          * const ap_table_t&    _tableCount
          * range_t              _hashTableCount * 2
          * hash_table_t         _hashTableCount
+         * hash_agg_t           1
          */
-        g_vCode.resize(START_BASE_LINE + _tableCount + 3 * _hashTableCount);
+        g_vCode.resize(START_BASE_LINE + _tableCount + 3 * _hashTableCount + 1);
         g_vCode[0] = "// this file is generated ";
         g_vCode[1] = "#include \"../include/ap_exec.h\"";
         g_vCode[2] = "#include \"../include/vm.h\"";
@@ -151,8 +178,12 @@ namespace DB::ast{
 
         g_vCode.push_back("};");
         g_vCode.push_back("std::future<void> future" + to_string(g_iPipeline) +
-                          " = vm->register_task(pipeline" + to_string(g_iPipeline) + ");");
-        g_vCode.push_back("future" + to_string(g_iPipeline) + ".wait();");
+                          " = vm->register_task(pipeline" + to_string(g_iPipeline) + ", 0, 1);");
+        g_vFuture.push_back("future" + to_string(g_iPipeline));
+        // build pipelines may still be running after the probe side is done,
+        // and the hash tables and this code go away once the query returns.
+        for(const string& future : g_vFuture)
+            g_vCode.push_back(future + ".wait();");
         g_vCode.push_back("return emit;");
         g_vCode.push_back("} // end codegen function");
     }
@@ -192,9 +223,9 @@ namespace DB::ast{
                 page::col_t_t id_t = table::getColumnInfo(idPtr->_tableName, idPtr->_columnName).col_t_;
                 string id_name;
                 if (id_t == page::col_t_t::INTEGER)
-                    id_name = " block.getINT(" + range2str(range) + ") ";
+                    id_name = " vec.getINT(" + range2str(range) + ") ";
                 else if (id_t == page::col_t_t::CHAR || id_t == page::col_t_t::VARCHAR)
-                    id_name = " block.getVARCHAR(" + range2str(range) + ") ";
+                    id_name = " vec.getVARCHAR(" + range2str(range) + ") ";
                 return id_name;
             }
             case base_t_t::NUMERIC:
@@ -207,6 +238,8 @@ namespace DB::ast{
                 std::shared_ptr<const StrExpr> strPtr = std::static_pointer_cast<const StrExpr>(condition);
                 return "\"" + strPtr->_value + "\"";
             }
+            default:
+                break;
         }
 
         // unexpect to reach here
@@ -215,7 +248,9 @@ namespace DB::ast{
 
     void APFilterOp::consume(APBaseOp *source, APMap &map)
     {
-        g_vCode.push_back("block.selectivity_and(" + generateCondStr(_condition, map) + ");");
+        // evaluated VECTOR_SIZE tuples at a time, only the selected ones are kept
+        g_vCode.push_back("block.filter([&](const DB::ap::block_vector_t& vec) { return " +
+                          generateCondStr(_condition, map) + "; });");
 
         // map doesn't need change
         _parentOp->consume(this, map);
@@ -266,7 +301,8 @@ namespace DB::ast{
 
             g_vCode.push_back("};");
             g_vCode.push_back("std::future<void> future" + to_string(g_iPipeline) +
-                          " = vm->register_task(pipeline" + to_string(g_iPipeline) + ");");
+                          " = vm->register_task(pipeline" + to_string(g_iPipeline) + ", 0, 1);");
+            g_vFuture.push_back("future" + to_string(g_iPipeline));
             g_iPipeline++;
         }
         else if(source == _tableRight)
@@ -302,6 +338,84 @@ namespace DB::ast{
         }
     }
 
+    void APAggregateOp::produce()
+    {
+        _table->produce();
+    }
+
+    void APAggregateOp::consume(APBaseOp *source, APMap &map)
+    {
+        // group columns of the input
+        string strGroup = "{ ";
+        for(const col_name_t& col : _groupBy)
+        {
+            page::col_t_t col_t = table::getColumnInfo(col.first, col.second).col_t_;
+            strGroup += "{ " + range2str(map.get(col)) + ", " + col_t2str(col_t) + " }, ";
+        }
+        strGroup += "}";
+
+        // output columns in select order, GROUP BY columns keep their names
+        string strSpec = "{ ";
+        vector<pair<col_name_t, page::col_range_t>> outCols;
+        uint32_t outLen = 0;
+        for(const APAggregate& agg : _aggregates)
+        {
+            page::col_range_t in{ {}, page::col_t_t::INTEGER };
+            if(!agg.column_.first.empty())
+                in = { map.get(agg.column_), table::getColumnInfo(agg.column_.first, agg.column_.second).col_t_ };
+
+            page::col_range_t out{ { outLen, sizeof(int32_t) }, page::col_t_t::INTEGER };
+            col_name_t outName{ "", agg.get_name() };
+            if(agg.agg_t_ == ap::agg_t_t::KEY)
+            {
+                out = { { outLen, in.range_.len }, in.col_t_ };
+                outName = agg.column_;
+            }
+            outCols.push_back({ outName, out });
+            strSpec += "{ DB::ap::agg_t_t::" + string(ap::agg_t_str[int(agg.agg_t_)]) + ", " +
+                       range2str(in.range_) + ", " + range2str(out.range_) + " }, ";
+            outLen += out.range_.len;
+        }
+        strSpec += "}";
+
+        if(outLen > page::MAX_TUPLE_SIZE) {
+            throw std::string("tuple len exceed on aggregation");
+        }
+
+        // reserved line for aggregation hash table declaration
+        g_vCode[START_BASE_LINE + g_iTableCount + 3 * g_iHashCount] =
+                "DB::ap::hash_agg_t agg(" + strGroup + ", " + strSpec + ", DB::ap::AGG_PARTS);";
+
+        // each task pre-aggregates into its own partial
+        g_vCode.push_back("agg.partial(part).insert(block);");
+
+        while(g_iIndent > 0)
+        {
+            g_vCode.push_back("}");
+            g_iIndent--;
+        }
+
+        g_vCode.push_back("};");
+        string strPipeline = to_string(g_iPipeline);
+        g_vCode.push_back("std::future<void> future" + strPipeline + "[DB::ap::AGG_PARTS];");
+        g_vCode.push_back("for(uint32_t part = 0; part < DB::ap::AGG_PARTS; part++)");
+        g_vCode.push_back("future" + strPipeline + "[part] = vm->register_task(pipeline" + strPipeline +
+                          ", part, DB::ap::AGG_PARTS);");
+        g_vCode.push_back("for(std::future<void>& future : future" + strPipeline + ")");
+        g_vCode.push_back("future.wait();");
+        g_vCode.push_back("DB::ap::join_result_buf_t agg_result = agg.result();");
+        g_iPipeline++;
+
+        // the groups are the source of the next pipeline
+        g_iIndent++;
+        g_vCode.push_back("auto pipeline" + to_string(g_iPipeline) + " =[&](uint32_t part, uint32_t parts) {");
+        g_vCode.push_back("for(DB::ap::ap_block_iter_t it = agg_result.get_block_iter(); !it.is_end();) {");
+        g_vCode.push_back("DB::ap::block_tuple_t block = it.consume_block();");
+
+        APMap aggMap(outCols);
+        _parentOp->consume(this, aggMap);
+    }
+
     APTableOp::APTableOp(const table::TableInfo& table, string tableName, int tableIndex)
         :APBaseOp(ap_op_t_t::TABLE, tableName), _tableIndex(tableIndex), _map(table) {}
 
@@ -316,9 +430,10 @@ namespace DB::ast{
                 "const DB::ap::ap_table_t& T" + strIndex +
                 " = tables.at(" + std::to_string(table::vm_->get_ap_table_index(_tableName)) + ");";
 
-        g_vCode.push_back("auto pipeline" + to_string(g_iPipeline) + " =[&]() {");
+        // a pipeline task scans the part `part` of `parts` of the table
+        g_vCode.push_back("auto pipeline" + to_string(g_iPipeline) + " =[&](uint32_t part, uint32_t parts) {");
 
-        g_vCode.push_back("for(DB::ap::ap_block_iter_t it = T" + strIndex + ".get_block_iter();" +
+        g_vCode.push_back("for(DB::ap::ap_block_iter_t it = T" + strIndex + ".get_block_iter(part, parts);" +
                 " !it.is_end();) {");
 
         g_vCode.push_back("DB::ap::block_tuple_t block = it.consume_block();");
@@ -431,10 +546,52 @@ namespace DB::ast{
         }
     }
 
+    void apCheckAggregate(const vector<string> &tables, const vector<col_name_t> &groupBy,
+                          const vector<APAggregate> &aggregates)
+    {
+        auto checkColumn = [&tables](const col_name_t &column)
+        {
+            if(std::find(tables.begin(), tables.end(), column.first) == tables.end())
+                throw string("table \"" + column.first + "\" is not in FROM");
+            // throw if not exist
+            return table::getColumnInfo(column.first, column.second).col_t_;
+        };
+
+        const bool hasFunc = std::any_of(aggregates.begin(), aggregates.end(), [](const APAggregate &aggregate) {
+            return aggregate.agg_t_ != ap::agg_t_t::KEY;
+        });
+        if(!groupBy.empty() && aggregates.empty())
+            throw string("GROUP BY needs a select list instead of \"$\"");
+        if(!aggregates.empty() && groupBy.empty() && !hasFunc)
+            throw string("projection is not supported, select \"$\" or aggregate");
+
+        for(const auto &column : groupBy)
+        {
+            checkColumn(column);
+        }
+
+        for(const auto &agg : aggregates)
+        {
+            if(agg.agg_t_ == ap::agg_t_t::COUNT && agg.column_.first.empty())
+                continue;
+            page::col_t_t col_t = checkColumn(agg.column_);
+            if(agg.agg_t_ == ap::agg_t_t::KEY)
+            {
+                if(std::find(groupBy.begin(), groupBy.end(), agg.column_) == groupBy.end())
+                    throw string("column \"" + agg.get_name() + "\" is not in GROUP BY");
+            }
+            else if(agg.agg_t_ != ap::agg_t_t::COUNT && col_t != page::col_t_t::INTEGER)
+            {
+                throw string(ap::agg_t_str[int(agg.agg_t_)]) + " on non-INT column \"" + agg.column_.first + "." + agg.column_.second + "\"";
+            }
+        }
+    }
+
 
 
 
-    shared_ptr<APEmitOp> generateAst(const vector<string> &tables, const vector<shared_ptr<BaseExpr>> &conditions, vector<Column> columns)
+    shared_ptr<APEmitOp> generateAst(const vector<string> &tables, const vector<shared_ptr<BaseExpr>> &conditions, vector<Column> columns,
+                                     const vector<col_name_t> &groupBy, const vector<APAggregate> &aggregates)
     {
         vector<int> singleConditions;   // only one table included
         vector<int> joinConditions;   // currently consider only T1.v == T2.v
@@ -452,7 +609,7 @@ namespace DB::ast{
             tableDict[tableName] = new APTableOp(tableinfo, tableName, tableIndex++);
         }
 
-        for(int i = 0; i < conditions.size(); ++i)
+        for(int i = 0; i < static_cast<int>(conditions.size()); ++i)
         {
             auto tableSet = conditions[i]->getTables();
             condDict[i] = tableSet;
@@ -510,7 +667,7 @@ namespace DB::ast{
             }
         }
 
-        for(auto condition : complexConditions)
+        for([[maybe_unused]] const auto& condition : complexConditions)
         {
             // currently don't complex condition
 
@@ -528,6 +685,14 @@ namespace DB::ast{
                 throw string("generate ast error, exist unjoined tables");
         }
 
+        //package into AggregateOp
+        if(!aggregates.empty())
+        {
+            APBaseOp *aggregateOp = new APAggregateOp(merge, groupBy, aggregates);
+            merge->setParentOp(aggregateOp);
+            merge = aggregateOp;
+        }
+
         //package into EmitOP
         shared_ptr<APEmitOp> emit{new APEmitOp(merge, hashTableIndex,tableIndex)};
         merge->setParentOp(emit.get());
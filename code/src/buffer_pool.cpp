@@ -1,15 +1,28 @@
 #include "include/buffer_pool.h"
 #include "include/debug_log.h"
+#include "include/frame_arena.h"
+#include <cstdlib>
 
 namespace DB::buffer
 {
     using page::Page;
 
-    BufferPoolManager::BufferPoolManager(disk::DiskManager* disk_manager)
-        :disk_manager_(disk_manager) {}
+    BufferPoolManager::BufferPoolManager(disk::DiskManager* disk_manager,
+        uint32_t frame_budget, replace_policy_t policy)
+        :disk_manager_(disk_manager), hash_lru_(frame_budget, policy)
+    {
+        buffer::FrameArena::init(frame_budget);
+        disk_manager_->set_cached_leaf([this](page_id_t page_id, page_id_t& next_page_id) {
+            return cached_leaf(page_id, next_page_id);
+        });
+    }
+
+    BufferPoolManager::~BufferPoolManager() {
+        disk_manager_->set_cached_leaf(nullptr);
+    }
 
 
-    page::Page* BufferPoolManager::FetchPage(page_id_t page_id)
+    page::Page* BufferPoolManager::FetchPage(page_id_t page_id, bool use_once)
     {
         // if the page is not in BufferPool but resides in memory, the page musy be dirty.
         // wait until the page is removed from dirty_page_set.
@@ -17,26 +30,58 @@ namespace DB::buffer
                          "[BUFFER_FETCH] BufferPoolManager::FetchPage() fetch [page_id=%d]\n",
                          page_id);
         if (page_id == NOT_A_PAGE) return nullptr;
-        Page* page_ptr = hash_lru_.find(page_id);
+        Page* page_ptr = hash_lru_.find(page_id, !use_once);
         if (page_ptr != nullptr) return page_ptr;
         debug::DEBUG_LOG(debug::BUFFER_FETCH,
                          "[BUFFER_FETCH] BufferPoolManager::FetchPage() does not fetch, maybe wait for reading [page_id=%d]\n",
                          page_id);
+        // the scan parses the page from the mapping, no copy into the buffer.
+        const char* page_data = use_once ? disk_manager_->MapPage(page_id) : nullptr;
         char buffer[page::PAGE_SIZE];
-        while (!disk_manager_->ReadPage(page_id, buffer)) {
-            page_ptr = hash_lru_.find(page_id);
-            if (page_ptr != nullptr) return page_ptr;
-            debug::DEBUG_LOG(debug::BUFFER_FETCH,
-                             "[BUFFER_FETCH] BufferPoolManager::FetchPage() does not fetch, maybe wait for reading [page_id=%d]\n",
-                             page_id);
+        if (page_data == nullptr) {
+            // no caller could go on with a corrupted page, stop before it is parsed.
+            // the uncommitted changes never reach the disk (no-steal), the recovery restores the last commit.
+            if (!disk_manager_->ReadPage(page_id, buffer)) {
+                debug::ERROR_LOG("BufferPoolManager::FetchPage() page is corrupted [page_id=%d]\n", page_id);
+                exit(1);
+            }
+            page_data = buffer;
+        }
+        page_ptr = buffer_to_page(this, *reinterpret_cast<const char(*)[page::PAGE_SIZE]>(page_data));
+        if (page_ptr == nullptr)    // unknown page_t, e.g. the page has been freed.
+            return nullptr;
+        page_ptr->ref(); // pin before insertion, in case of being evicted at once.
+        // another writer has read the page in between, drop this copy, or one of the updates is lost.
+        if (!hash_lru_.insert(page_ptr->get_page_id(), page_ptr, use_once)) {
+            page_ptr->unref();
+            return FetchPage(page_id, use_once);
         }
-        page_ptr = buffer_to_page(this, buffer);
-        hash_lru_.insert(page_ptr->get_page_id(), page_ptr);
-        page_ptr->ref();
         return page_ptr;
     }
 
 
+    void BufferPoolManager::Prefetch(page_id_t page_id, uint32_t leaf_num, std::shared_ptr<disk::ReadAheadMark> mark) {
+        disk_manager_->Prefetch(page_id, leaf_num, std::move(mark));
+    }
+
+
+    bool BufferPoolManager::cached_leaf(page_id_t page_id, page_id_t& next_page_id)
+    {
+        Page* page_ptr = hash_lru_.find(page_id, false);
+        if (page_ptr == nullptr)
+            return false;
+        // the link is read without latch, as the scan does.
+        const uint64_t version = page_ptr->read_begin();
+        bool cached = false;
+        if (page_ptr->get_page_t() == page_t_t::LEAF) {
+            next_page_id = static_cast<const page::LeafPage*>(page_ptr)->get_right_leaf();
+            cached = page_ptr->read_validate(version);
+        }
+        page_ptr->unref();
+        return cached;
+    }
+
+
     bool BufferPoolManager::FlushPage(page::Page* page_ptr) {
         if (page_ptr == nullptr) return false;
         debug::DEBUG_LOG(debug::BUFFER_FLUSH,
@@ -56,7 +101,7 @@ namespace DB::buffer
 
     Page* BufferPoolManager::NewPage(PageInitInfo info)
     {
-        const page_id_t page_id = disk_manager_->AllocatePage();
+        const page_id_t page_id = disk_manager_->AllocatePage(info.near_page_id);
 
         debug::DEBUG_LOG(debug::BUFFER_NEW,
             "[BUFFER_NEW] BufferPoolManager::NewPage() [page_id=%d], [page_t=%s]\n",
@@ -68,7 +113,7 @@ namespace DB::buffer
         case page_t_t::ROOT_INTERNAL:
         case page_t_t::ROOT_LEAF:
             page_ptr = new RootPage(this, info.page_t, page_id, info.parent_id, 0,
-                info.key_t, info.str_len, info.value_page_id, true);
+                info.key_t, info.str_len, info.value_page_id, info.leaf_format, true);
             if (info.page_t == page_t_t::ROOT_LEAF) {
                 static_cast<RootPage*>(page_ptr)->set_left_leaf(NOT_A_PAGE);
                 static_cast<RootPage*>(page_ptr)->set_right_leaf(NOT_A_PAGE);
@@ -80,7 +125,7 @@ namespace DB::buffer
             break;
         case page_t_t::LEAF:
             page_ptr = new LeafPage(this, page_id, info.parent_id, 0,
-                info.key_t, info.str_len, info.value_page_id, true);
+                info.key_t, info.str_len, info.value_page_id, info.leaf_format, true);
             static_cast<LeafPage*>(page_ptr)->set_left_leaf(NOT_A_PAGE);
             static_cast<LeafPage*>(page_ptr)->set_right_leaf(NOT_A_PAGE);
             break;
@@ -92,8 +137,8 @@ namespace DB::buffer
             page_ptr = nullptr;
             debug::ERROR_LOG("`BufferPoolManager::NewPage()` error");
         }
+        page_ptr->ref(); // pin before insertion, in case of being evicted at once.
         hash_lru_.insert(page_id, page_ptr);
-        page_ptr->ref();
         return page_ptr;
     }
 
@@ -22,33 +22,33 @@ DB::ap::VMEmitOp example_query(const DB::ap::ap_table_array_t& tables, DB::vm::V
     DB::ap::hash_table_t ht2(rng2, rng3, 8, 16, false);
     DB::ap::VMEmitOp emit;
 
-    auto pipeline0 = [&]() {
-        for(DB::ap::ap_block_iter_t it = T1.get_block_iter(); !it.is_end();) {
+    auto pipeline0 = [&](uint32_t part, uint32_t parts) {
+        for(DB::ap::ap_block_iter_t it = T1.get_block_iter(part, parts); !it.is_end();) {
             DB::ap::block_tuple_t block = it.consume_block();
 
-            block.selectivity_and(block.getINT({ 4, 4 }) > 42);
+            block.filter([&](const DB::ap::block_vector_t& vec) { return vec.getINT({ 4, 4 }) > 42; });
 
             ht1.insert(block);
         }
         ht1.build();
     };
-    std::future<void> future0 = vm->register_task(pipeline0);
+    std::future<void> future0 = vm->register_task(pipeline0, 0, 1);
 
-    auto pipeline1 = [&]() {
-        for(DB::ap::ap_block_iter_t it = T2.get_block_iter(); !it.is_end();) {
+    auto pipeline1 = [&](uint32_t part, uint32_t parts) {
+        for(DB::ap::ap_block_iter_t it = T2.get_block_iter(part, parts); !it.is_end();) {
             DB::ap::block_tuple_t block = it.consume_block();
 
-            block.selectivity_and(block.getINT({ 4, 4 }) < 233);
+            block.filter([&](const DB::ap::block_vector_t& vec) { return vec.getINT({ 4, 4 }) < 233; });
 
             ht2.insert(block);
         }
         ht2.build();
     };
-    std::future<void> future1 = vm->register_task(pipeline1);
+    std::future<void> future1 = vm->register_task(pipeline1, 0, 1);
 
 
-    auto pipeline2 = [&]() {
-        for(DB::ap::ap_block_iter_t it = T3.get_block_iter(); !it.is_end();) {
+    auto pipeline2 = [&](uint32_t part, uint32_t parts) {
+        for(DB::ap::ap_block_iter_t it = T3.get_block_iter(part, parts); !it.is_end();) {
             DB::ap::block_tuple_t block = it.consume_block();
 
             DB::ap::join_result_buf_t join_result2 = ht2.probe(block);
@@ -66,7 +66,7 @@ DB::ap::VMEmitOp example_query(const DB::ap::ap_table_array_t& tables, DB::vm::V
             }
         }
     };
-    std::future<void> future2 = vm->register_task(pipeline2);
+    std::future<void> future2 = vm->register_task(pipeline2, 0, 1);
 
     future2.wait();
     return emit;
@@ -0,0 +1,28 @@
+#include "include/cpu_features.h"
+
+namespace DB::cpu {
+
+    struct cpu_features_t {
+        simd_level_t simd_level_;
+        bool sse42_;
+        cpu_features_t() {
+            __builtin_cpu_init(); // may run before the constructors of libgcc
+            sse42_ = __builtin_cpu_supports("sse4.2");
+            if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl"))
+                simd_level_ = simd_level_t::AVX512;
+            else if (__builtin_cpu_supports("avx2"))
+                simd_level_ = simd_level_t::AVX2;
+            else
+                simd_level_ = simd_level_t::SCALAR;
+        }
+    };
+
+    static const cpu_features_t& features() {
+        static const cpu_features_t features;
+        return features;
+    }
+
+    simd_level_t simd_level() { return features().simd_level_; }
+    bool has_sse42() { return features().sse42_; }
+
+} // end namespace DB::cpu
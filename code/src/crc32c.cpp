@@ -0,0 +1,69 @@
+#include "include/crc32c.h"
+#include "include/cpu_features.h"
+#include <array>
+#include <cstring>
+#include <nmmintrin.h>
+
+namespace DB {
+
+    __attribute__((target("sse4.2")))
+    static uint32_t crc32c_sse42(uint32_t crc, const char* buffer, std::size_t len)
+    {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(buffer);
+        uint64_t crc64 = ~crc;
+        for (; len >= 8; p += 8, len -= 8) {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            crc64 = _mm_crc32_u64(crc64, word);
+        }
+        uint32_t crc32 = static_cast<uint32_t>(crc64);
+        for (; len > 0; p++, len--)
+            crc32 = _mm_crc32_u8(crc32, *p);
+        return ~crc32;
+    }
+
+    // table[k][b] is the CRC of byte `b` followed by `k` zero bytes.
+    using crc_table_t = std::array<std::array<uint32_t, 256>, 8>;
+    static constexpr crc_table_t make_crc_table()
+    {
+        crc_table_t table{};
+        for (uint32_t b = 0; b < 256; b++) {
+            uint32_t crc = b;
+            for (int i = 0; i < 8; i++)
+                crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+            table[0][b] = crc;
+        }
+        for (uint32_t b = 0; b < 256; b++)
+            for (uint32_t k = 1; k < 8; k++)
+                table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+        return table;
+    }
+    static constexpr crc_table_t crc_table = make_crc_table();
+
+    static uint32_t crc32c_table(uint32_t crc, const char* buffer, std::size_t len)
+    {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(buffer);
+        crc = ~crc;
+        for (; len >= 8; p += 8, len -= 8) {
+            // little endian
+            uint32_t low, high;
+            std::memcpy(&low, p, 4);
+            std::memcpy(&high, p + 4, 4);
+            low ^= crc;
+            crc = crc_table[7][low & 0xFF] ^ crc_table[6][(low >> 8) & 0xFF] ^
+                crc_table[5][(low >> 16) & 0xFF] ^ crc_table[4][low >> 24] ^
+                crc_table[3][high & 0xFF] ^ crc_table[2][(high >> 8) & 0xFF] ^
+                crc_table[1][(high >> 16) & 0xFF] ^ crc_table[0][high >> 24];
+        }
+        for (; len > 0; p++, len--)
+            crc = (crc >> 8) ^ crc_table[0][(crc ^ *p) & 0xFF];
+        return ~crc;
+    }
+
+    uint32_t crc32c(uint32_t crc, const char* buffer, std::size_t len)
+    {
+        static const auto impl = cpu::has_sse42() ? crc32c_sse42 : crc32c_table;
+        return impl(crc, buffer, len);
+    }
+
+} // end namespace DB
@@ -66,6 +66,12 @@ namespace DB::debug
         case page_t_t::ROOT_LEAF:
             debug_root(static_cast<const RootPage*>(node));
             break;
+        case page_t_t::DB_META:
+        case page_t_t::TABLE_META:
+        case page_t_t::FREE:
+        case page_t_t::BITMAP: // maintained by DiskManager, never cached in the buffer pool.
+            printf("[page_t = %s]\n", page_t_str[static_cast<uint32_t>(node->get_page_t())]);
+            break;
         }
         node->unref();
         printf("---------------------------------------------------\n");
@@ -82,7 +88,8 @@ namespace DB::debug
             std::ostream_iterator<int32_t>(std::cout, " "));
         printf("\n");
         printf("[left = %d], [right = %d]\n", leaf->get_left_leaf(), leaf->get_right_leaf());
-        debug_value(leaf->value_page_);
+        if (leaf->value_page_ != nullptr)
+            debug_value(leaf->value_page_);
     }
 
     void debug_internal(const page::InternalPage* link)
@@ -130,7 +137,8 @@ namespace DB::debug
             std::copy(root->keys_, root->keys_ + root->get_nEntry(),
                 std::ostream_iterator<int32_t>(std::cout, " "));
             printf("\n");
-            debug_value(root->value_page_);
+            if (root->value_page_ != nullptr)
+                debug_value(root->value_page_);
         }
     }
 
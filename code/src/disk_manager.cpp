@@ -2,88 +2,216 @@
 #include "include/debug_log.h"
 #include "include/vm.h"
 #include "include/page.h"
+#include "include/io_engine.h"
+#include "include/timing.h"
+#include "include/crc32c.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cerrno>
 #include <cstring>
 #include <mutex>
-#include <random>
+#include <vector>
 #include <string>
-#include <set>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace DB::disk
 {
 
+    // open for read & write, create if not exist.
+    static int open_file(const char* name, bool& created)
+    {
+        created = false;
+        int fd = ::open(name, O_RDWR);
+        // directory or file does not exist
+        if (fd < 0 && errno == ENOENT) {
+            created = true;
+            fd = ::open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        }
+        if (fd < 0)
+            debug::ERROR_LOG("open \"%s\" error: %s\n", name, std::strerror(errno));
+        return fd;
+    }
+
+    static bool sync_file(int fd)
+    {
+        while (::fdatasync(fd) < 0) {
+            if (errno != EINTR)
+                return false;
+        }
+        return true;
+    }
+
+    static inline off_t page_offset(page_id_t page_id) {
+        return static_cast<off_t>(page_id) * PAGE_SIZE;
+    }
+
+    // CRC32C of the page, seeded by the page_id, so that a misplaced page fails as well.
+    // the checkpoint LSN in DB meta is overwritten in place, leave it out.
+    static uint32_t page_checksum(page_id_t page_id, const char* page_data)
+    {
+        using page::offset;
+        const uint32_t seed = crc32c(0, reinterpret_cast<const char*>(&page_id), sizeof(page_id));
+        if (page_id != page::NOT_A_PAGE)
+            return crc32c(seed, page_data, offset::PAGE_CHECKSUM);
+        const uint32_t crc = crc32c(seed, page_data, offset::CHECKPOINT_LSN);
+        return crc32c(crc, page_data + offset::CHECKPOINT_LSN + 8,
+            offset::PAGE_CHECKSUM - offset::CHECKPOINT_LSN - 8);
+    }
+
+    // stamp the trailer right before the page goes to the db file.
+    static inline void stamp_page(page_id_t page_id, char* page_data) {
+        page::write_int(page_data + page::offset::PAGE_CHECKSUM, page_checksum(page_id, page_data));
+    }
+
+    // a page never written back is all zero, it has no checksum.
+    static bool verify_page(page_id_t page_id, const char* page_data)
+    {
+        if (static_cast<uint32_t>(page::read_int(page_data + page::offset::PAGE_CHECKSUM))
+            == page_checksum(page_id, page_data))
+            return true;
+        if (std::all_of(page_data, page_data + PAGE_SIZE, [](char c) { return c == 0; }))
+            return true;
+        debug::ERROR_LOG("[PAGE_READ] checksum mismatch, the page is corrupted [page_id=%d]\n", page_id);
+        return false;
+    }
+
+
+    //
+    // log protocol
+    //      record := header | body
+    //      header := LSN (8) | PAGE_ID | TYPE | LEN | CHECK
+    //      FULL_PAGE body is the page image,
+    //      DELTA body is a list of (offset, len, bytes) against the previous image of the page,
+    //      COMMIT has no body, the records before it are durable once it is synced.
+    //      CHECK is the CRC32C of the header before it, then the body.
+    //      the recovery stops at the first record whose LSN or check-sum fail to match.
+    //
+    struct log_offset {
+        static const uint32_t
+
+            LSN = 0,
+            PAGE_ID = 8,
+            TYPE = 12,
+            LEN = 16,
+            CHECK = 20,
+
+            HEADER_SIZE = 24,
+
+            // DELTA run
+            RUN_OFFSET = 0,
+            RUN_LEN = 4,
+            RUN_HEADER_SIZE = 8,
+
+            ZERO = 0;
+    };
+    enum log_t :uint32_t { FULL_PAGE = 1, DELTA = 2, COMMIT = 3 };
+
+    // the equal bytes shorter than a run header are merged into the run.
+    static constexpr uint32_t delta_merge_gap = log_offset::RUN_HEADER_SIZE;
+
+
+    struct DiskManager::PendingWrite :IORequest
+    {
+        DiskManager* disk_manager_;
+        page_id_t page_id_;
+        char data_[PAGE_SIZE];
+    };
+
+
     DiskManager::DiskManager()
         :
         dn_init_(false),
         cur_page_no_(page::NOT_A_PAGE),
         file_name_(db_name),
-        log_name_(log_name),
-        next_free_page_id_(page::NOT_A_PAGE)
+        log_name_(log_name)
     {
-        db_io_.open(db_name,
-            std::ios::binary | std::ios::in | std::ios::out);
-        // directory or file does not exist
-        if (!db_io_.is_open()) {
+        db_fd_ = open_file(db_name, dn_init_);
+        bool log_created;
+        log_fd_ = open_file(log_name, log_created);
+        io_engine_ = IOEngine::make();
+        struct stat db_stat;
+        if (::fstat(db_fd_, &db_stat) == 0)
+            allocated_page_no_ = db_stat.st_size / PAGE_SIZE;
+        // leave the mismatched file to vm init, the log may be of other format as well.
+        compatible_ = dn_init_ ||
+            (read_db_format() == page::DB_FORMAT_VERSION && read_db_page_size() == PAGE_SIZE);
+        if (compatible_ && !recover()) {
+            debug::ERROR_LOG("recovery failed, \"%s\" cannot be opened\n", file_name_.c_str());
+            exit(1);
+        }
+        // nothing has been committed before crash.
+        if (::fstat(db_fd_, &db_stat) == 0 && db_stat.st_size == 0)
             dn_init_ = true;
-            db_io_.clear();
-            // create a new file
-            db_io_.open(db_name,
-                std::ios::binary | std::ios::trunc | std::ios::out);
-            db_io_.close();
-            // reopen with original mode
-            db_io_.open(db_name,
-                std::ios::binary | std::ios::in | std::ios::out);
-        }
-
-        log_io_.open(log_name,
-            std::ios::binary | std::ios::in | std::ios::out);
-        // directory or file does not exist
-        if (!log_io_.is_open()) {
-            log_io_.clear();
-            // create a new file
-            log_io_.open(log_name,
-                std::ios::binary | std::ios::trunc | std::ios::out);
-            log_io_.close();
-            // reopen with original mode
-            log_io_.open(log_name,
-                std::ios::binary | std::ios::in | std::ios::out);
+        if (compatible_ && !load_bitmap()) {
+            debug::ERROR_LOG("free-space bitmap is corrupted, \"%s\" cannot be opened\n", file_name_.c_str());
+            exit(1);
         }
-
+        // map far beyond the file once, the file only grows,
+        // and a page is accessed only below `allocated_page_no_`.
+        void* db_map = ::mmap(nullptr, map_size, PROT_READ, MAP_SHARED | MAP_NORESERVE, db_fd_, 0);
+        if (db_map == MAP_FAILED)
+            debug::ERROR_LOG("mmap \"%s\" error: %s\n", file_name_.c_str(), std::strerror(errno));
+        else {
+            db_map_ = static_cast<const char*>(db_map);
+            // only the scans read through the mapping.
+            ::madvise(db_map, map_size, MADV_SEQUENTIAL);
+        }
+        checkpointer_ = std::thread(&DiskManager::checkpointer, this);
+        prefetcher_ = std::thread(&DiskManager::prefetcher, this);
     }
 
 
     DiskManager::~DiskManager()
     {
-        db_io_.close();
-        log_io_.close();
+        {
+            std::lock_guard<std::mutex> lg{ prefetch_mtx_ };
+            prefetch_stop_ = true;
+        }
+        prefetch_cv_.notify_all();
+        prefetcher_.join();
+        {
+            std::lock_guard<std::mutex> lg{ write_mtx_ };
+            checkpoint_stop_ = true;
+        }
+        checkpoint_cv_.notify_all();
+        checkpointer_.join(); // finish the running checkpoint
+
+        // the records after the last commit are dropped, so are their pages.
+        if (compatible_ && log_buffer_.empty()) {
+            {
+                std::lock_guard<std::mutex> lg{ write_mtx_ };
+                begin_checkpoint();
+            }
+            do_checkpoint();
+        }
+        else {
+            for (auto&[page_id, pending] : pending_writes_)
+                delete pending;
+            pending_writes_.clear();
+        }
+        io_engine_.reset();
+        if (db_map_ != nullptr) ::munmap(const_cast<char*>(db_map_), map_size);
+        if (db_fd_ >= 0) ::close(db_fd_);
+        if (log_fd_ >= 0) ::close(log_fd_);
     }
 
     void DiskManager::set_vm(vm::VM* vm) { vm_ = vm; }
 
     page_id_t DiskManager::get_cut_page_id() const { return cur_page_no_.load(); }
 
-    void DiskManager::set_cur_page_id(page_id_t page_id) { cur_page_no_ = page_id; }
-
-    void DiskManager::init_set_next_free_page_id(page_id_t next_free_page_id) {
-        next_free_page_id_ = next_free_page_id;
-    }
+    page_id_t DiskManager::get_allocated_page_no() const { return allocated_page_no_.load(); }
 
-    page_id_t DiskManager::set_next_free_page_id(page_id_t next_free_page_id)
+    void DiskManager::FreePage(page_id_t page_id)
     {
-#ifdef PAGE_GC
-        page_id_t previous_free_head;
-        while (next_free_page_id_lock_.test_and_set(std::memory_order_acquire))
-            ;
-        previous_free_head = next_free_page_id_;
-        next_free_page_id_ = next_free_page_id;
-        vm_->set_next_free_page_id(next_free_page_id);
-        next_free_page_id_lock_.clear(std::memory_order_release);
-        debug::DEBUG_LOG(debug::PAGE_GC,
-                         "[PAGE_GC] add [next_free_page_id=%d] -> [previous_free_head=%d]\n",
-                         next_free_page_id, previous_free_head);
-        return previous_free_head;
-#else
-        return page::NOT_A_PAGE;
-#endif
+        if (page_id == page::NOT_A_PAGE || page_id % bitmap_page_num == 1)
+            return;
+        std::lock_guard<std::mutex> lg{ alloc_mtx_ };
+        set_used(page_id, false);
+        first_free_ = std::min(first_free_, page_id);
+        debug::DEBUG_LOG(debug::PAGE_GC, "[PAGE_GC] free [page_id=%d]\n", page_id);
     }
 
     void DiskManager::WritePage(page_id_t page_id, const char(&page_data)[page::PAGE_SIZE])
@@ -91,21 +219,87 @@ namespace DB::disk
         debug::DEBUG_LOG(debug::PAGE_WRITE,
                          "[PAGE_WRITE] DiskManager::WritePage() [page_t=%s] [page_id=%d]\n",
                          page::page_t_str[static_cast<uint32_t>(page::get_page_t(page_data))], page_id);
-        db_io_.seekp(page_id * PAGE_SIZE, std::ios_base::beg);
-        db_io_.write(page_data, PAGE_SIZE);
-        if (db_io_.bad())
-        {
-            debug::ERROR_LOG("[PAGE_WRITE] DiskManager::WritePage() write error in \"%s\", page_id: %d\n",
-                file_name_.c_str(), page_id);
+        std::lock_guard<std::mutex> lg{ write_mtx_ };
+        uncommitted_.insert(page_id);
+        auto it = pending_writes_.find(page_id);
+        // log the changed bytes, then coalesce into the pending copy.
+        if (it != pending_writes_.end()) {
+            append_delta(page_id, it->second->data_, page_data);
+            std::memcpy(it->second->data_, page_data, PAGE_SIZE);
             return;
         }
-        db_io_.flush();
-        if (db_io_.bad())
-        {
-            debug::ERROR_LOG("[PAGE_WRITE] DiskManager::WritePage() flush error in \"%s\", page_id: %d\n",
-                file_name_.c_str(), page_id);
+        // the first write since the checkpoint began, log the full page even if it is being written back,
+        // so that the replay never starts from the image on disk, which may be torn by a later write-back.
+        append_log(log_t::FULL_PAGE, page_id, page_data, PAGE_SIZE);
+
+        PendingWrite* pending = new PendingWrite;
+        pending->op_ = IORequest::WRITE;
+        pending->fd_ = db_fd_;
+        pending->buffer_ = pending->data_;
+        pending->len_ = PAGE_SIZE;
+        pending->offset_ = page_offset(page_id);
+        pending->on_complete_ = &DiskManager::on_write_complete;
+        pending->disk_manager_ = this;
+        pending->page_id_ = page_id;
+        std::memcpy(pending->data_, page_data, PAGE_SIZE);
+        pending_writes_.emplace(page_id, pending);
+
+        // the committed images need not wait for the next commit, see `begin_write_back()`.
+        if (!checkpoint_running_ && pending_writes_.size() - uncommitted_.size() >= checkpoint_pending_num) {
+            begin_write_back();
+            checkpoint_cv_.notify_one();
+        }
+    }
+
+
+    void DiskManager::submit_writes(std::unique_lock<std::mutex>& ulk)
+    {
+        if (staged_writes_.empty())
             return;
+        std::vector<IORequest*> requests;
+        requests.reserve(write_batch_size);
+        while (!staged_writes_.empty() && requests.size() < write_batch_size) {
+            PendingWrite* pending = staged_writes_.back();
+            staged_writes_.pop_back();
+            // never let a stale checkpoint LSN reach the disk.
+            if (pending->page_id_ == page::NOT_A_PAGE) {
+                page::write_int(pending->data_ + page::offset::CHECKPOINT_LSN, static_cast<uint32_t>(checkpoint_lsn_));
+                page::write_int(pending->data_ + page::offset::CHECKPOINT_LSN + 4, static_cast<uint32_t>(static_cast<uint64_t>(checkpoint_lsn_) >> 32));
+            }
+            stamp_page(pending->page_id_, pending->data_);
+            requests.push_back(pending);
+        }
+        ulk.unlock();
+        io_engine_->submit(requests.data(), requests.size());
+        ulk.lock();
+    }
+
+
+    void DiskManager::on_write_complete(IORequest* request)
+    {
+        PendingWrite* pending = static_cast<PendingWrite*>(request);
+        DiskManager* disk_manager = pending->disk_manager_;
+        if (pending->result_ != static_cast<int32_t>(PAGE_SIZE))
+            debug::ERROR_LOG("[PAGE_WRITE] DiskManager::WritePage() write error in \"%s\", page_id: %d [result=%d]\n",
+                disk_manager->file_name_.c_str(), pending->page_id_, pending->result_);
+        {
+            std::lock_guard<std::mutex> lg{ disk_manager->write_mtx_ };
+            disk_manager->checkpoint_writes_.erase(pending->page_id_);
         }
+        disk_manager->write_cv_.notify_all();
+        delete pending;
+    }
+
+
+    DiskManager::PendingWrite* DiskManager::find_pending(page_id_t page_id) const
+    {
+        auto it = pending_writes_.find(page_id);
+        if (it != pending_writes_.end())
+            return it->second;
+        it = checkpoint_writes_.find(page_id);
+        if (it != checkpoint_writes_.end())
+            return it->second;
+        return nullptr;
     }
 
 
@@ -114,23 +308,31 @@ namespace DB::disk
     {
         auto doReadPage = [this](page_id_t page_id, char(&page_data)[page::PAGE_SIZE])
         {
-            db_io_.seekg(page_id * PAGE_SIZE, std::ios_base::beg);
-            db_io_.read(page_data, PAGE_SIZE);
-            const uint32_t read_count = db_io_.gcount();
+            const uint32_t read_count = read_at(db_fd_, page_data, PAGE_SIZE, page_offset(page_id));
             if (read_count < PAGE_SIZE)
             {
                 debug::ERROR_LOG("DiskManager::ReadPage() read error in \"%s\" [page_id=%d] [read_count=%d]\n",
                     file_name_.c_str(), page_id, read_count);
                 std::memset(page_data + read_count, 0, PAGE_SIZE - read_count);
+                return true;
             }
+            return verify_page(page_id, page_data);
         };
 
         debug::DEBUG_LOG(debug::PAGE_READ,
                          "[PAGE_READ] [page_id=%d]\n",
                          page_id);
 
-        doReadPage(page_id, page_data);
-        return true;
+        // the newest image might not reach the disk yet.
+        {
+            std::lock_guard<std::mutex> lg{ write_mtx_ };
+            if (const PendingWrite* pending = find_pending(page_id)) {
+                std::memcpy(page_data, pending->data_, PAGE_SIZE);
+                return true;
+            }
+        }
+
+        return doReadPage(page_id, page_data);
 
 
         /*
@@ -165,483 +367,735 @@ namespace DB::disk
     }
 
 
-    page_id_t DiskManager::AllocatePage()
+    bool DiskManager::ReadPages(const page_id_t* page_ids, char* const* page_datas, uint32_t n)
     {
-#ifdef PAGE_GC
-        bool allocate_free = false;
-        page_id_t free_page_id;
-        while (next_free_page_id_lock_.test_and_set(std::memory_order_acquire))
-            ;
-        if (next_free_page_id_ != page::NOT_A_PAGE) {
-            allocate_free = true;
-            free_page_id = next_free_page_id_;
-            // read next free page
-            // NB: free page must be not in buffer pool,
-            //     since the becoming free page is still not flush,
-            //     after flush, the free page is not is buffer pool.
-            char buffer[4];
-            db_io_.seekg(next_free_page_id_ * PAGE_SIZE + page::offset::FREE_PAGE_ID,
-                std::ios_base::beg);
-            db_io_.read(buffer, sizeof(uint32_t));
+        struct BatchRead :IORequest {
+            std::mutex* mtx_;
+            std::condition_variable* cv_;
+            uint32_t* left_;
+            bool* ok_;
+        };
+        std::mutex mtx;
+        std::condition_variable cv;
+        uint32_t left = 0;
+        bool ok = true;
+        std::vector<BatchRead> reads;
+        reads.reserve(n);
 
-            next_free_page_id_ = page::read_int(buffer);
-            debug::DEBUG_LOG(debug::PAGE_GC,
-                             "[PAGE_GC] reuse [free_page_id=%d] -> [next_free_page_id=%d]\n",
-                             free_page_id, next_free_page_id_);
-            vm_->set_next_free_page_id(next_free_page_id_);
+        {
+            std::lock_guard<std::mutex> lg{ write_mtx_ };
+            for (uint32_t i = 0; i < n; i++) {
+                if (const PendingWrite* pending = find_pending(page_ids[i])) {
+                    std::memcpy(page_datas[i], pending->data_, PAGE_SIZE);
+                    continue;
+                }
+                BatchRead read;
+                read.op_ = IORequest::READ;
+                read.fd_ = db_fd_;
+                read.buffer_ = page_datas[i];
+                read.len_ = PAGE_SIZE;
+                read.offset_ = page_offset(page_ids[i]);
+                read.on_complete_ = [](IORequest* request) {
+                    BatchRead* read = static_cast<BatchRead*>(request);
+                    if (read->result_ < static_cast<int32_t>(PAGE_SIZE))
+                        std::memset(read->buffer_ + std::max(read->result_, 0), 0,
+                            PAGE_SIZE - std::max(read->result_, 0));
+                    const bool verified = read->result_ < static_cast<int32_t>(PAGE_SIZE) ||
+                        verify_page(static_cast<page_id_t>(read->offset_ / PAGE_SIZE), read->buffer_);
+                    std::lock_guard<std::mutex> lg{ *read->mtx_ };
+                    if (!verified)
+                        *read->ok_ = false;
+                    if (--*read->left_ == 0)
+                        read->cv_->notify_all();
+                };
+                read.mtx_ = &mtx;
+                read.cv_ = &cv;
+                read.left_ = &left;
+                read.ok_ = &ok;
+                reads.push_back(read);
+            }
         }
-        next_free_page_id_lock_.clear(std::memory_order_release);
-
-        if (allocate_free)
-            return free_page_id;
-        else
-#endif // #ifdef PAGE_GC
-            return ++cur_page_no_;
-    }
-
-
+        if (reads.empty())
+            return true;
 
-    uint32_t DiskManager::hash(page_id_t page_id) const noexcept {
-        return page_id & (dirty_hash_bucket - 1);
+        debug::DEBUG_LOG(debug::PAGE_READ,
+                         "[PAGE_READ] ReadPages() [first_page_id=%d] [n=%d]\n",
+                         page_ids[0], static_cast<uint32_t>(reads.size()));
+        std::vector<IORequest*> requests;
+        requests.reserve(reads.size());
+        for (BatchRead& read : reads)
+            requests.push_back(&read);
+        left = reads.size();
+        io_engine_->submit(requests.data(), requests.size());
+
+        std::unique_lock<std::mutex> ulk{ mtx };
+        cv.wait(ulk, [&left]() { return left == 0; });
+        return ok;
     }
 
-    bool DiskManager::is_dirty(page_id_t page_id) const {
-        const uint32_t bucket_no = hash(page_id);
-        std::shared_lock<std::shared_mutex> slk{ dirty_page_sets_mtx_[bucket_no] };
-        return dirty_page_sets_[bucket_no].count(page_id);
-    }
 
-    void DiskManager::set_dirty(page_id_t page_id) {
-        const uint32_t bucket_no = hash(page_id);
+    const char* DiskManager::MapPage(page_id_t page_id)
+    {
+        if (db_map_ == nullptr || page_id >= allocated_page_no_ ||
+            page_offset(page_id) + PAGE_SIZE > static_cast<off_t>(map_size))
+            return nullptr;
         {
-            std::shared_lock<std::shared_mutex> slk{ dirty_page_sets_mtx_[bucket_no] };
-            if (dirty_page_sets_[bucket_no].count(page_id))
-                return;
+            std::lock_guard<std::mutex> lg{ write_mtx_ };
+            if (find_pending(page_id) != nullptr)
+                return nullptr;
         }
-        std::lock_guard<std::shared_mutex> lg{ dirty_page_sets_mtx_[bucket_no] };
-        dirty_page_sets_[bucket_no].insert(page_id);
+        debug::DEBUG_LOG(debug::PAGE_READ,
+                         "[PAGE_READ] MapPage() [page_id=%d]\n",
+                         page_id);
+        const char* page_data = db_map_ + page_offset(page_id);
+        return verify_page(page_id, page_data) ? page_data : nullptr;
     }
 
 
-    //
-    // log protocol
-    //      if nuance & check-sum fail to match, the state is regarded as OK.
-    //      if match, we should undo / redo.
-    //
-    uint32_t checksum(const char(&buffer)[page::PAGE_SIZE]);
-    uint32_t checksum(const char* buffer, const uint32_t len);
-    static constexpr uint32_t sql_max_len = 200;
-    struct log_offset {
-        static const uint32_t
-
-            SQL = 0,
-
-            NUANCE = PAGE_SIZE - 24,
-
-            NUANCE_PLUS_ONE = PAGE_SIZE - 20,
-
-            UNDO_LOG_NUM = PAGE_SIZE - 16,
-            UNDO_CHECK = PAGE_SIZE - 12,
-
-            REDO_SQL_LEN = PAGE_SIZE - 8,
-            REDO_CHECK = PAGE_SIZE - 4,
-
-            ZERO = 0;
+    struct DiskManager::PrefetchRead :IORequest
+    {
+        DiskManager* disk_manager_;
+        PrefetchTask task_;
+        char data_[PAGE_SIZE];
     };
 
+    // the value page of a leaf, and the next leaf if any left.
+    // the window ends at the last leaf, the scan goes on from its next leaf.
+    void DiskManager::follow_leaf(const char* page_data, const PrefetchTask& task, std::vector<PrefetchTask>& tasks)
+    {
+        const page::page_t_t page_t = static_cast<page::page_t_t>(page::read_int(page_data + page::offset::PAGE_T));
+        if (page_t != page::page_t_t::LEAF && page_t != page::page_t_t::ROOT_LEAF)
+            return;
+        tasks.push_back({ static_cast<page_id_t>(page::read_int(page_data + page::offset::VALUE_PAGE_ID)), 0, nullptr });
+        if (page_t != page::page_t_t::LEAF)
+            return;
+        const page_id_t next_page_id = page::read_int(page_data + page::offset::NEXT_PAGE_ID);
+        if (task.leaf_num_ > 0)
+            tasks.push_back({ next_page_id, task.leaf_num_ - 1, task.mark_ });
+        else if (task.mark_ != nullptr)
+            task.mark_->next_ = next_page_id;
+    }
 
 
-
-    log_state_t DiskManager::check_log_state()
+    void DiskManager::Prefetch(page_id_t page_id, uint32_t leaf_num, std::shared_ptr<ReadAheadMark> mark)
     {
-        char int_buffer[4] = { 0 };
-        log_io_.seekg(log_offset::NUANCE, std::ios_base::beg);
-        log_io_.read(int_buffer, 4);
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("check log state error on NUANCE\n");
-            return log_state_t::CORRUPTION;
-        }
-        const uint32_t nuance = page::read_int(int_buffer);
-
-        log_io_.seekg(log_offset::NUANCE_PLUS_ONE, std::ios_base::beg);
-        log_io_.read(int_buffer, 4);
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("check log state error on NUANCE_PLUS_ONE\n");
-            return log_state_t::CORRUPTION;
+        if (page_id == page::NOT_A_PAGE || leaf_num == 0)
+            return;
+        {
+            std::lock_guard<std::mutex> lg{ prefetch_mtx_ };
+            prefetch_tasks_.push_back({ page_id, leaf_num - 1, std::move(mark) });
         }
+        prefetch_cv_.notify_one();
+    }
 
-        if (nuance == 0 || nuance + 1 != page::read_int(int_buffer)) // fail to match
-            return log_state_t::OK;
 
-        // do check, if fail to match, return OK
-        bool undo = false;
-        bool redo = false;
+    void DiskManager::set_cached_leaf(cached_leaf_t cached_leaf)
+    {
+        std::lock_guard<std::mutex> lg{ cached_leaf_mtx_ };
+        cached_leaf_ = std::move(cached_leaf);
+    }
 
 
-        log_io_.seekg(log_offset::UNDO_LOG_NUM, std::ios_base::beg);
-        log_io_.read(int_buffer, 4);
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("check log state error on UNDO_LOG_NUM\n");
-            return log_state_t::CORRUPTION;
+    void DiskManager::prefetcher()
+    {
+        std::vector<PrefetchTask> tasks;
+        std::vector<IORequest*> requests;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> ulk{ prefetch_mtx_ };
+                prefetch_cv_.wait(ulk, [this]() { return prefetch_stop_ || !prefetch_tasks_.empty(); });
+                if (prefetch_stop_)
+                    return;
+                tasks.swap(prefetch_tasks_);
+            }
+            // the cached leaf and the pending image are in memory already, follow them at once.
+            for (std::size_t i = 0; i < tasks.size(); i++) {
+                const PrefetchTask task = tasks[i];
+                if (task.page_id_ == page::NOT_A_PAGE || task.page_id_ > cur_page_no_)
+                    continue;
+                if (task.mark_ != nullptr) {
+                    std::lock_guard<std::mutex> lg{ cached_leaf_mtx_ };
+                    page_id_t next_page_id;
+                    if (cached_leaf_ && cached_leaf_(task.page_id_, next_page_id)) {
+                        if (task.leaf_num_ > 0)
+                            tasks.push_back({ next_page_id, task.leaf_num_ - 1, task.mark_ });
+                        else
+                            task.mark_->next_ = next_page_id;
+                        continue;
+                    }
+                }
+                {
+                    std::lock_guard<std::mutex> lg{ write_mtx_ };
+                    if (const PendingWrite* pending = find_pending(task.page_id_)) {
+                        follow_leaf(pending->data_, task, tasks);
+                        continue;
+                    }
+                }
+                std::lock_guard<std::mutex> lg{ prefetch_mtx_ };
+                if (prefetching_.size() >= prefetch_inflight_num || !prefetching_.insert(task.page_id_).second) {
+                    // the scan picks the chain up from here next time.
+                    if (task.mark_ != nullptr)
+                        task.mark_->next_ = task.page_id_;
+                    continue;
+                }
+                PrefetchRead* read = new PrefetchRead;
+                read->op_ = IORequest::READ;
+                read->fd_ = db_fd_;
+                read->buffer_ = read->data_;
+                read->len_ = PAGE_SIZE;
+                read->offset_ = page_offset(task.page_id_);
+                read->on_complete_ = &DiskManager::on_prefetch_complete;
+                read->disk_manager_ = this;
+                read->task_ = task;
+                requests.push_back(read);
+            }
+            tasks.clear();
+            if (!requests.empty()) {
+                debug::DEBUG_LOG(debug::PAGE_READ,
+                                 "[PAGE_READ] prefetch [first_page_id=%d] [n=%d]\n",
+                                 static_cast<PrefetchRead*>(requests[0])->task_.page_id_,
+                                 static_cast<uint32_t>(requests.size()));
+                io_engine_->submit(requests.data(), requests.size());
+                requests.clear();
+            }
         }
-        const uint32_t undo_log_num = page::read_int(int_buffer);
+    }
 
 
-        log_io_.seekg(log_offset::UNDO_CHECK, std::ios_base::beg);
-        log_io_.read(int_buffer, 4);
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("check log state error on UNDO_CHECK\n");
-            return log_state_t::CORRUPTION;
+    // the page is in the OS page cache now, hand the next pages over to the prefetcher.
+    void DiskManager::on_prefetch_complete(IORequest* request)
+    {
+        PrefetchRead* read = static_cast<PrefetchRead*>(request);
+        DiskManager* disk_manager = read->disk_manager_;
+        {
+            std::lock_guard<std::mutex> lg{ disk_manager->prefetch_mtx_ };
+            disk_manager->prefetching_.erase(read->task_.page_id_);
+            if (read->result_ == static_cast<int32_t>(PAGE_SIZE))
+                follow_leaf(read->data_, read->task_, disk_manager->prefetch_tasks_);
         }
-        const uint32_t undo_check = page::read_int(int_buffer);
+        disk_manager->prefetch_cv_.notify_one();
+        delete read;
+    }
 
 
-        log_io_.seekg(log_offset::REDO_SQL_LEN, std::ios_base::beg);
-        log_io_.read(int_buffer, 4);
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("check log state error on REDO_SQL_LEN\n");
-            return log_state_t::CORRUPTION;
+    page_id_t DiskManager::AllocatePage(page_id_t near)
+    {
+        std::lock_guard<std::mutex> lg{ alloc_mtx_ };
+        const page_id_t end = cur_page_no_ + 1;
+        page_id_t page_id = page::NOT_A_PAGE;
+        // right after `near`, e.g. the sibling leaf, or the leaf of a value page.
+        if (near != page::NOT_A_PAGE && near < end)
+            page_id = find_free(near + 1, std::min(end, (near / 64 + near_extent_num) * 64));
+        if (page_id == page::NOT_A_PAGE) {
+            page_id = find_free(first_free_, end);
+            first_free_ = page_id == page::NOT_A_PAGE ? end : page_id + 1;
+        }
+        if (page_id != page::NOT_A_PAGE) {
+            set_used(page_id, true);
+            debug::DEBUG_LOG(debug::PAGE_GC,
+                             "[PAGE_GC] reuse [page_id=%d] [near=%d]\n", page_id, near);
+            return page_id;
         }
-        const uint32_t redo_sql_len = page::read_int(int_buffer);
-
 
-        log_io_.seekg(log_offset::REDO_CHECK, std::ios_base::beg);
-        log_io_.read(int_buffer, 4);
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("check log state error on REDO_CHECK\n");
-            return log_state_t::CORRUPTION;
+        // grow the file, a new bitmap page comes with every `bitmap_page_num` pages.
+        page_id = ++cur_page_no_;
+        if (page_id / bitmap_page_num == bitmap_dirty_.size()) {
+            bitmap_.resize(bitmap_.size() + bitmap_word_num, 0);
+            bitmap_dirty_.push_back(true);
+            set_used(bitmap_page_id(page_id / bitmap_page_num), true);
         }
-        const uint32_t redo_check = page::read_int(int_buffer);
+        if (page_id % bitmap_page_num == 1)
+            page_id = ++cur_page_no_;
+        set_used(page_id, true);
+        return page_id;
+    }
 
-        // check redo
-        char sql_buffer[sql_max_len] = { 0 };
-        log_io_.seekg(log_offset::SQL, std::ios_base::beg);
-        log_io_.read(sql_buffer, 4);
-        if (redo_sql_len != 0)
-            if (redo_check == checksum(sql_buffer, redo_sql_len) + nuance)
-                redo = true;
 
-        // check undo
-        char page_data[page::PAGE_SIZE] = { 0 };
-        uint32_t check_sum = 0;
-        for (uint32_t i = 1; i <= undo_log_num; i++) {
-            log_io_.seekg(i*page::PAGE_SIZE, std::ios_base::beg);
-            log_io_.read(page_data, page::PAGE_SIZE);
-            check_sum += checksum(page_data);
+    page_id_t DiskManager::find_free(page_id_t from, page_id_t to) const
+    {
+        for (page_id_t word_begin = from & ~63u; word_begin < to; word_begin += 64) {
+            uint64_t free = ~bitmap_[word_begin / 64];
+            if (word_begin < from)
+                free &= ~0ull << (from - word_begin);
+            if (free == 0)
+                continue;
+            const page_id_t page_id = word_begin + __builtin_ctzll(free);
+            return page_id < to ? page_id : page::NOT_A_PAGE;
         }
-        if (undo_check == check_sum + nuance) // check
-            undo = true;
+        return page::NOT_A_PAGE;
+    }
 
-        if (undo) {
-            if (redo && redo_sql_len == 0)
-                return log_state_t::UNDO;
-            else {
-                if (redo) {
-                    vm_->send_reply_sql(std::string(sql_buffer, redo_sql_len));
-                    return log_state_t::REDO;
-                }
-                else
-                    return log_state_t::CORRUPTION;
-            }
-        }
-        else
-            return log_state_t::OK;
 
-    } // check_log_state();
+    void DiskManager::set_used(page_id_t page_id, bool used)
+    {
+        const uint64_t bit = 1ull << (page_id % 64);
+        if (used)
+            bitmap_[page_id / 64] |= bit;
+        else
+            bitmap_[page_id / 64] &= ~bit;
+        bitmap_dirty_[page_id / bitmap_page_num] = true;
+    }
 
 
-    void DiskManager::replay_log(disk::log_state_t)
+    bool DiskManager::load_bitmap()
     {
-        char int_buffer[4] = { 0 };
-        log_io_.seekg(log_offset::UNDO_LOG_NUM, std::ios_base::beg);
-        log_io_.read(int_buffer, 4);
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("check log state error on UNDO_LOG_NUM\n");
-            return;
+        std::lock_guard<std::mutex> lg{ alloc_mtx_ };
+        // empty DB, DB meta and the 1st bitmap page.
+        if (dn_init_) {
+            bitmap_.assign(bitmap_word_num, 0);
+            bitmap_dirty_.assign(1, true);
+            set_used(page::NOT_A_PAGE, true);
+            set_used(bitmap_page_id(0), true);
+            cur_page_no_ = bitmap_page_id(0);
+            return true;
         }
-        const uint32_t undo_log_num = page::read_int(int_buffer);
-
-        char page_data[page::PAGE_SIZE] = { 0 };
-        for (uint32_t i = 1; i <= undo_log_num; i++) {
-            log_io_.seekg(1 * page::PAGE_SIZE, std::ios_base::beg);
-            log_io_.read(page_data, page::PAGE_SIZE);
-            if (log_io_.bad()) {
-                debug::ERROR_LOG("read undo log error\n");
-                return;
-            }
-
-            const page_id_t page_id = page::read_int(page_data + page::offset::FREE_PAGE_ID);
-
-            db_io_.seekp(page_id * PAGE_SIZE, std::ios_base::beg);
-            db_io_.write(page_data, PAGE_SIZE);
-            if (db_io_.bad()) {
-                debug::ERROR_LOG("[RECOVERY] DiskManager::replay_log() write error in undo, page_id: %d\n", page_id);
-                return;
-            }
-            db_io_.flush();
-            if (db_io_.bad()) {
-                debug::ERROR_LOG("[RECOVERY] DiskManager::replay_log() flush error in undo, page_id: %d\n", page_id);
-                return;
-            }
+        // the bitmap pages are committed along with the pages they describe,
+        // so the last page in use is found there, rather than the DB meta flushed lazily.
+        struct stat db_stat;
+        if (::fstat(db_fd_, &db_stat) < 0)
+            db_stat.st_size = 0;
+        char buffer[PAGE_SIZE];
+        for (uint32_t group = 0; page_offset(bitmap_page_id(group)) < db_stat.st_size; group++) {
+            if (!ReadPage(bitmap_page_id(group), buffer))
+                return false;
+            if (page::get_page_t(buffer) != page::page_t_t::BITMAP)
+                break;
+            const char* word = buffer + page::offset::BITMAP_START;
+            for (uint32_t i = 0; i < bitmap_word_num; i++, word += 8)
+                bitmap_.push_back(page::read_int(word) |
+                    static_cast<uint64_t>(page::read_int(word + 4)) << 32);
+            bitmap_dirty_.push_back(false);
+        }
+        if (bitmap_.empty()) {
+            debug::ERROR_LOG("no free-space bitmap in \"%s\"\n", file_name_.c_str());
+            return true;
         }
+        auto last = std::find_if(bitmap_.rbegin(), bitmap_.rend(), [](uint64_t word) { return word != 0; });
+        cur_page_no_ = (bitmap_.rend() - last - 1) * 64 + 63 - __builtin_clzll(*last);
+        first_free_ = find_free(0, cur_page_no_ + 1);
+        if (first_free_ == page::NOT_A_PAGE)
+            first_free_ = cur_page_no_ + 1;
+        return true;
     }
 
 
-    void DiskManager::doWAL(const page_id_t prev_last_page_id, const std::string& sql)
+    void DiskManager::log_bitmap()
     {
-        debug::DEBUG_LOG(debug::WAL,
-                         "[WAL] [prev_last_page_id=%d] [sql=\"%s\"]\n",
-                         prev_last_page_id, sql.c_str());
-
-        page_id_t cur_page_id = 0;
-        char buffer[PAGE_SIZE] = { 0 };
-        uint32_t undo_check = 0;
-        std::set<page_id_t> ditry_pages;
-
-        // no need to record undo log when init DB
-        if (prev_last_page_id != page::NOT_A_PAGE) {
-            for (uint32_t i = 0; i < dirty_hash_bucket; i++) {
-                std::unordered_set<page_id_t>& dirty_page_set = dirty_page_sets_[i];
-                for (page_id_t ditry_page : dirty_page_set)
-                    if (ditry_page <= prev_last_page_id)
-                        ditry_pages.insert(ditry_page);
-                dirty_page_set.clear();
+        std::lock_guard<std::mutex> lg{ alloc_mtx_ };
+        for (uint32_t group = 0; group < bitmap_dirty_.size(); group++) {
+            if (!bitmap_dirty_[group])
+                continue;
+            bitmap_dirty_[group] = false;
+            char buffer[PAGE_SIZE] = { 0 };
+            page::write_int(buffer + page::offset::PAGE_T, static_cast<uint32_t>(page::page_t_t::BITMAP));
+            page::write_int(buffer + page::offset::PAGE_ID, bitmap_page_id(group));
+            char* word = buffer + page::offset::BITMAP_START;
+            for (uint32_t i = 0; i < bitmap_word_num; i++, word += 8) {
+                const uint64_t bits = bitmap_[group * bitmap_word_num + i];
+                page::write_int(word, static_cast<uint32_t>(bits));
+                page::write_int(word + 4, static_cast<uint32_t>(bits >> 32));
             }
+            WritePage(bitmap_page_id(group), buffer);
         }
+    }
 
-        for (const page_id_t db_page_id : ditry_pages)
-        {
-
-            cur_page_id++;
-
-            // HACK: does below disk seekg/seekp happen to the detriment of I/O performance
-            // read old db page for undo
-            db_io_.seekg(db_page_id * PAGE_SIZE, std::ios_base::beg);
-            db_io_.read(buffer, PAGE_SIZE);
-            const uint32_t read_count = db_io_.gcount();
-            if (read_count < PAGE_SIZE)
-            {
-                debug::ERROR_LOG("DiskManager::doWAL() read error in \"%s\" [page_id=%d] [read_count=%d]\n",
-                    file_name_.c_str(), db_page_id, read_count);
-                return;
-            }
-
-            undo_check += checksum(buffer);
 
-            // write log
-            log_io_.seekp(cur_page_id * PAGE_SIZE, std::ios_base::beg);
-            log_io_.write(buffer, PAGE_SIZE);
-            if (log_io_.bad()) {
-                debug::ERROR_LOG("[WAL] write error in \"%s\", page_id: %d\n",
-                    log_name_.c_str(), cur_page_id);
-                return;
-            }
-            log_io_.flush();
-            if (log_io_.bad()) {
-                debug::ERROR_LOG("[WAL] flush error in \"%s\", page_id: %d\n",
-                    log_name_.c_str(), cur_page_id);
-                return;
-            }
-        }
 
-        // nuance
-        // undo_log_num
-        // undo_check
-        // redo_sql_len
-        // redo_check
+    // DB meta is all zero until the first checkpoint writes it back, but the checkpoint LSN,
+    // while a DB of any format writes something in its first 1KB.
+    static uint32_t read_db_meta(int db_fd, uint32_t offset, uint32_t unwritten)
+    {
+        char buffer[1 << 10] = { 0 };
+        read_at(db_fd, buffer, sizeof(buffer), page_offset(page::NOT_A_PAGE));
+        const uint32_t value = page::read_int(buffer + offset);
+        std::memset(buffer + page::offset::CHECKPOINT_LSN, 0, 8);
+        if (std::all_of(buffer, buffer + sizeof(buffer), [](char c) { return c == 0; }))
+            return unwritten;
+        return value;
+    }
 
-        std::random_device dev;
-        std::mt19937 rng(dev());
-        std::uniform_int_distribution<std::mt19937::result_type> dist(0x23333333, 0xffffffff);
+    uint32_t DiskManager::read_db_page_size()
+    {
+        return read_db_meta(db_fd_, page::offset::DB_PAGE_SIZE, PAGE_SIZE);
+    }
 
-        // nuance
-        const uint32_t nuance = dist(rng);
+    uint32_t DiskManager::read_db_format()
+    {
+        return read_db_meta(db_fd_, page::offset::DB_FORMAT, page::DB_FORMAT_VERSION);
+    }
 
-        // undo_log_num
-        const uint32_t undo_log_num = cur_page_id;
 
-        // undo_check
-        undo_check += nuance;
 
-        // redo_sql_len
-        uint32_t redo_sql_len = sql.size();
-        if (redo_sql_len > sql_max_len)
-            redo_sql_len = 0;
+    uint32_t DiskManager::hash(page_id_t page_id) const noexcept {
+        return page_id & (dirty_hash_bucket - 1);
+    }
 
-        // redo_check
-        const uint32_t redo_check = checksum(sql.c_str(), redo_sql_len) + nuance;
+    bool DiskManager::is_dirty(page_id_t page_id) const {
+        const uint32_t bucket_no = hash(page_id);
+        std::shared_lock<std::shared_mutex> slk{ dirty_page_sets_mtx_[bucket_no] };
+        return dirty_page_sets_[bucket_no].count(page_id);
+    }
 
-        char int_buffer[4] = { 0 };
+    void DiskManager::set_dirty(page_id_t page_id) {
+        const uint32_t bucket_no = hash(page_id);
+        {
+            std::shared_lock<std::shared_mutex> slk{ dirty_page_sets_mtx_[bucket_no] };
+            if (dirty_page_sets_[bucket_no].count(page_id))
+                return;
+        }
+        std::lock_guard<std::shared_mutex> lg{ dirty_page_sets_mtx_[bucket_no] };
+        dirty_page_sets_[bucket_no].insert(page_id);
+    }
 
 
-        /* [depricated]
-        log_io_.seekp(log_offset::PREV_LAST_PAGE_ID, std::ios_base::beg);
-        page::write_int(int_buffer, prev_last_page_id);
-        log_io_.write(int_buffer, 4);
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("WAL write error on PREV_LAST_PAGE_ID\n");
-            return;
-        }
-        log_io_.flush();
-        */
+    void DiskManager::append_log(uint32_t type, page_id_t page_id, const char* body, uint32_t len)
+    {
+        char header[log_offset::HEADER_SIZE] = { 0 };
+        const uint64_t lsn = log_size_ + log_buffer_.size();
+        page::write_int(header + log_offset::LSN, static_cast<uint32_t>(lsn));
+        page::write_int(header + log_offset::LSN + 4, static_cast<uint32_t>(lsn >> 32));
+        page::write_int(header + log_offset::PAGE_ID, page_id);
+        page::write_int(header + log_offset::TYPE, type);
+        page::write_int(header + log_offset::LEN, len);
+        page::write_int(header + log_offset::CHECK,
+            crc32c(crc32c(0, header, log_offset::CHECK), body, len));
+        log_buffer_.append(header, log_offset::HEADER_SIZE);
+        log_buffer_.append(body, len);
+    }
 
-        // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-        // write nuance as 0
-        // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-        log_io_.seekp(log_offset::NUANCE, std::ios_base::beg);
-        page::write_int(int_buffer, 0); // here write NUANCE as 0 !!!
-        log_io_.write(int_buffer, 4);
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("[WAL] write error on FAKE NUANCE\n");
-            return;
+    void DiskManager::append_delta(page_id_t page_id, const char* before, const char* after)
+    {
+        std::string body;
+        uint32_t i = 0;
+        while (i < PAGE_SIZE)
+        {
+            if (before[i] == after[i]) {
+                i++;
+                continue;
+            }
+            // extend the run until `delta_merge_gap` equal bytes
+            const uint32_t first = i;
+            uint32_t last = i + 1; // exclusive
+            for (uint32_t j = last; j < PAGE_SIZE && j < last + delta_merge_gap; j++)
+                if (before[j] != after[j])
+                    last = j + 1;
+            char run_header[log_offset::RUN_HEADER_SIZE];
+            page::write_int(run_header + log_offset::RUN_OFFSET, first);
+            page::write_int(run_header + log_offset::RUN_LEN, last - first);
+            body.append(run_header, log_offset::RUN_HEADER_SIZE);
+            body.append(after + first, last - first);
+            i = last;
         }
-        log_io_.flush();
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("[WAL] flush error on FAKE NUANCE\n");
+        if (body.empty())
             return;
-        }
+        // not worth a delta
+        if (body.size() >= PAGE_SIZE)
+            append_log(log_t::FULL_PAGE, page_id, after, PAGE_SIZE);
+        else
+            append_log(log_t::DELTA, page_id, body.data(), body.size());
+    }
 
 
-        log_io_.seekp(log_offset::NUANCE_PLUS_ONE, std::ios_base::beg);
-        page::write_int(int_buffer, nuance + 1);
-        log_io_.write(int_buffer, 4);
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("[WAL] write error on NUANCE_PLUS_ONE\n");
-            return;
+    bool DiskManager::commit()
+    {
+        log_bitmap();
+        std::lock_guard<std::mutex> lg{ write_mtx_ };
+        append_log(log_t::COMMIT, page::NOT_A_PAGE, nullptr, 0);
+        debug::DEBUG_LOG(debug::WAL,
+                         "[WAL] commit [lsn=%lld] [bytes=%u]\n",
+                         static_cast<long long>(log_size_),
+                         static_cast<uint32_t>(log_buffer_.size()));
+        // on failure, cut the records written, so that the recovery never replays a commit not acknowledged.
+        auto fail = [this]() {
+            if (::ftruncate(log_fd_, log_size_) < 0)
+                debug::ERROR_LOG("[WAL] truncate error in \"%s\"\n", log_name_.c_str());
+            return false;
+        };
+        if (!write_at(log_fd_, log_buffer_.data(), log_buffer_.size(), log_size_)) {
+            debug::ERROR_LOG("[WAL] write error in \"%s\"\n", log_name_.c_str());
+            return fail();
         }
-        log_io_.flush();
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("[WAL] flush error on NUANCE_PLUS_ONE\n");
-            return;
+        if (!sync_file(log_fd_)) { // commit point
+            debug::ERROR_LOG("[WAL] fdatasync error in \"%s\": %s\n",
+                log_name_.c_str(), std::strerror(errno));
+            return fail();
         }
+        log_size_ += log_buffer_.size();
+        log_buffer_.clear();
+        uncommitted_.clear();
 
-
-        log_io_.seekp(log_offset::UNDO_LOG_NUM, std::ios_base::beg);
-        page::write_int(int_buffer, undo_log_num);
-        log_io_.write(int_buffer, 4);
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("[WAL] write error on UNDO_LOG_NUM\n");
-            return;
+        for (uint32_t i = 0; i < dirty_hash_bucket; i++) {
+            std::lock_guard<std::shared_mutex> lg{ dirty_page_sets_mtx_[i] };
+            dirty_page_sets_[i].clear();
         }
-        log_io_.flush();
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("[WAL] flush error on UNDO_LOG_NUM\n");
-            return;
+
+        if (!checkpoint_running_ &&
+            (log_size_ - checkpoint_lsn_ >= checkpoint_log_size ||
+                pending_writes_.size() >= checkpoint_pending_num)) {
+            begin_checkpoint();
+            checkpoint_cv_.notify_one();
         }
+        return true;
+    }
 
 
-        log_io_.seekp(log_offset::UNDO_CHECK, std::ios_base::beg);
-        page::write_int(int_buffer, undo_check);
-        log_io_.write(int_buffer, 4);
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("[WAL] write error on UNDO_CHECK\n");
-            return;
-        }
-        log_io_.flush();
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("[WAL] flush error on UNDO_CHECK\n");
-            return;
-        }
+    void DiskManager::begin_checkpoint()
+    {
+        checkpoint_running_ = true;
+        checkpoint_begin_lsn_ = log_size_;
+        checkpoint_writes_.swap(pending_writes_);
+        staged_writes_.reserve(checkpoint_writes_.size());
+        for (auto&[page_id, pending] : checkpoint_writes_)
+            staged_writes_.push_back(pending);
+    }
 
 
-        if (redo_sql_len > 0) {
-            log_io_.seekp(log_offset::SQL, std::ios_base::beg);
-            log_io_.write(sql.c_str(), redo_sql_len);
-            if (log_io_.bad()) {
-                debug::ERROR_LOG("[WAL] write error on SQL\n");
-                return;
-            }
-            log_io_.flush();
-            if (log_io_.bad()) {
-                debug::ERROR_LOG("[WAL] flush error on SQL\n");
-                return;
+    // in the middle of a statement, write back the committed images only, no-steal.
+    // the checkpoint LSN stays, so the records of the uncommitted pages since then are replayed,
+    // and replaying the written-back pages again is harmless, a record only overwrites the bytes it carries.
+    void DiskManager::begin_write_back()
+    {
+        checkpoint_running_ = true;
+        checkpoint_begin_lsn_ = checkpoint_lsn_;
+        for (auto it = pending_writes_.begin(); it != pending_writes_.end(); ) {
+            if (uncommitted_.count(it->first)) {
+                ++it;
+                continue;
             }
+            checkpoint_writes_.emplace(it->first, it->second);
+            staged_writes_.push_back(it->second);
+            it = pending_writes_.erase(it);
         }
+    }
 
 
-        log_io_.seekp(log_offset::REDO_SQL_LEN, std::ios_base::beg);
-        page::write_int(int_buffer, redo_sql_len);
-        log_io_.write(int_buffer, 4);
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("[WAL] write error on REDO_SQL_LEN\n");
+    void DiskManager::reserve_file(page_id_t last_page_id)
+    {
+        const off_t begin = page_offset(allocated_page_no_);
+        if (page_offset(last_page_id) < begin)
             return;
-        }
-        log_io_.flush();
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("[WAL] flush error on REDO_SQL_LEN\n");
+        const off_t end = (page_offset(last_page_id) / file_extent_size + 1) * file_extent_size;
+        // not supported by the file system, the writes grow the file then.
+        if (::fallocate(db_fd_, 0, begin, end - begin) < 0) {
+            debug::DEBUG_LOG(debug::WAL,
+                             "[WAL] preallocate error in \"%s\": %s\n", file_name_.c_str(), std::strerror(errno));
             return;
         }
+        allocated_page_no_ = end / PAGE_SIZE;
+    }
 
 
-        log_io_.seekp(log_offset::REDO_CHECK, std::ios_base::beg);
-        page::write_int(int_buffer, redo_check);
-        log_io_.write(int_buffer, 4);
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("[WAL] write error on REDO_CHECK\n");
-            return;
+    void DiskManager::do_checkpoint()
+    {
+        std::unique_lock<std::mutex> ulk{ write_mtx_ };
+        const off_t checkpoint_lsn = checkpoint_begin_lsn_;
+        if (!staged_writes_.empty()) {
+            page_id_t last_page_id = page::NOT_A_PAGE;
+            for (const PendingWrite* pending : staged_writes_)
+                last_page_id = std::max(last_page_id, pending->page_id_);
+            ulk.unlock();
+            reserve_file(last_page_id);
+            ulk.lock();
         }
-        log_io_.flush();
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("[WAL] flush error on REDO_CHECK\n");
-            return;
+        debug::DEBUG_LOG(debug::WAL,
+                         "[WAL] checkpoint [lsn=%lld] [pages=%u]\n",
+                         static_cast<long long>(checkpoint_lsn),
+                         static_cast<uint32_t>(checkpoint_writes_.size()));
+        // in batch, the foreground never waits for the whole checkpoint.
+        while (!staged_writes_.empty()) {
+            submit_writes(ulk);
+            write_cv_.wait(ulk, [this]() { return checkpoint_writes_.size() == staged_writes_.size(); });
         }
+        ulk.unlock();
+
+        const bool ok = sync_file(db_fd_) && write_checkpoint_lsn(checkpoint_lsn);
+        if (!ok)
+            debug::ERROR_LOG("[WAL] DiskManager::do_checkpoint() error in \"%s\": %s\n",
+                file_name_.c_str(), std::strerror(errno));
+        // the log before the checkpoint LSN is useless, the file offset (LSN) keeps growing.
+        else if (checkpoint_lsn > 0 &&
+            ::fallocate(log_fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, checkpoint_lsn) < 0)
+            debug::DEBUG_LOG(debug::WAL,
+                             "[WAL] punch log error: %s\n", std::strerror(errno));
+
+        ulk.lock();
+        if (ok)
+            checkpoint_lsn_ = checkpoint_lsn;
+        checkpoint_running_ = false;
+    }
 
 
-        // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-        // notice that maybe crash during this write
-        // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-        log_io_.seekp(log_offset::NUANCE, std::ios_base::beg);
-        page::write_int(int_buffer, nuance);
-        log_io_.write(int_buffer, 4);
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("[WAL] write error on NUANCE\n");
-            return;
-        }
-        log_io_.flush();
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("[WAL] flush error on NUANCE\n");
-            return;
+    void DiskManager::checkpointer()
+    {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> ulk{ write_mtx_ };
+                checkpoint_cv_.wait(ulk, [this]() { return checkpoint_running_ || checkpoint_stop_; });
+                if (!checkpoint_running_)
+                    return;
+            }
+            do_checkpoint();
         }
+    }
 
 
-    } // end doWAL();
-
-
-    void DiskManager::detroy_log() {
-        // write 0 into NUANCE
-        char int_buffer[4];
-        log_io_.seekp(log_offset::NUANCE, std::ios_base::beg);
-        page::write_int(int_buffer, 0);
-        log_io_.write(int_buffer, 4);
-        if (log_io_.bad()) {
-            debug::ERROR_LOG("[DESTROY_LOG] write error on NUANCE = 0\n");
-            return;
-        }
-        log_io_.flush();
+    bool DiskManager::write_checkpoint_lsn(off_t lsn)
+    {
+        char buffer[8];
+        page::write_int(buffer, static_cast<uint32_t>(lsn));
+        page::write_int(buffer + 4, static_cast<uint32_t>(static_cast<uint64_t>(lsn) >> 32));
+        return write_at(db_fd_, buffer, 8, page_offset(page::NOT_A_PAGE) + page::offset::CHECKPOINT_LSN) &&
+            sync_file(db_fd_);
     }
 
 
-    //
-    // util
-    //
-
-    uint32_t checksum(const char(&buffer)[page::PAGE_SIZE]) {
-        uint32_t check_sum = 0;
-        for (uint32_t i = 0; i < PAGE_SIZE / 4; i++) {
-            check_sum +=
-                static_cast<uint32_t>(buffer[4 * i]) +
-                (static_cast<uint32_t>(buffer[4 * i + 1])) << 8 +
-                (static_cast<uint32_t>(buffer[4 * i + 2])) << 16 +
-                (static_cast<uint32_t>(buffer[4 * i + 3])) << 24;
+    bool DiskManager::recover()
+    {
+        // the checkpoint LSN in DB meta, 0 if the DB is empty.
+        char lsn_buffer[8] = { 0 };
+        read_at(db_fd_, lsn_buffer, 8, page_offset(page::NOT_A_PAGE) + page::offset::CHECKPOINT_LSN);
+        const off_t checkpoint_lsn = page::read_int(lsn_buffer) |
+            static_cast<uint64_t>(page::read_int(lsn_buffer + 4)) << 32;
+        checkpoint_lsn_ = log_size_ = checkpoint_lsn;
+
+        struct stat log_stat;
+        if (::fstat(log_fd_, &log_stat) < 0 || log_stat.st_size <= checkpoint_lsn)
+            return true;
+        const time_point_t begin = std::chrono::system_clock::now();
+        std::string log(log_stat.st_size - checkpoint_lsn, '\0');
+        const std::size_t log_len = read_at(log_fd_, log.data(), log.size(), checkpoint_lsn);
+
+        // read the log once, the records refer to `log`.
+        struct RedoRecord {
+            page_id_t page_id_;
+            bool full_;
+            const char* body_;
+            uint32_t len_;
+        };
+        std::vector<RedoRecord> redo;
+        std::size_t committed_num = 0;
+        std::size_t offset = 0;
+        std::size_t commit_end = 0;
+        while (offset + log_offset::HEADER_SIZE <= log_len)
+        {
+            const char* header = log.data() + offset;
+            const uint64_t lsn = page::read_int(header + log_offset::LSN) |
+                static_cast<uint64_t>(page::read_int(header + log_offset::LSN + 4)) << 32;
+            const page_id_t page_id = page::read_int(header + log_offset::PAGE_ID);
+            const uint32_t type = page::read_int(header + log_offset::TYPE);
+            const uint32_t len = page::read_int(header + log_offset::LEN);
+            const uint32_t check = page::read_int(header + log_offset::CHECK);
+            if (lsn != checkpoint_lsn + offset ||
+                offset + log_offset::HEADER_SIZE + len > log_len)
+                break;
+            const char* body = header + log_offset::HEADER_SIZE;
+            if (check != crc32c(crc32c(0, header, log_offset::CHECK), body, len))
+                break;
+            offset += log_offset::HEADER_SIZE + len;
+
+            if (type == log_t::COMMIT) {
+                committed_num = redo.size();
+                commit_end = offset;
+            }
+            else
+                redo.push_back(RedoRecord{ page_id, type == log_t::FULL_PAGE, body, len });
+        }
+        const std::size_t discard_num = redo.size() - committed_num;
+        redo.resize(committed_num);
+
+        // partition by page, each worker applies its pages in LSN order.
+        const uint32_t worker_num = std::max(1u, std::min(std::thread::hardware_concurrency(), recovery_worker_num));
+        std::vector<std::vector<const RedoRecord*>> partitions(worker_num);
+        for (const RedoRecord& record : redo)
+            partitions[record.page_id_ % worker_num].push_back(&record);
+
+        if (!redo.empty()) {
+            page_id_t last_page_id = page::NOT_A_PAGE;
+            for (const RedoRecord& record : redo)
+                last_page_id = std::max(last_page_id, record.page_id_);
+            reserve_file(last_page_id);
         }
-        return check_sum;
-    }
 
-    uint32_t checksum(const char* buffer, const uint32_t len) {
-        uint32_t check_sum = 0;
-        for (uint32_t i = 0; i < len; i++)
-            check_sum += static_cast<uint32_t>(buffer[i]) << (i % 4);
-        return check_sum;
+        std::atomic<uint32_t> page_num{ 0 };
+        std::atomic<bool> ok{ true };
+        auto replay = [&](const std::vector<const RedoRecord*>& partition)
+        {
+            std::unordered_map<page_id_t, std::string> images;
+            for (const RedoRecord* record : partition)
+            {
+                if (record->full_) {
+                    images[record->page_id_].assign(record->body_, record->len_);
+                    continue;
+                }
+                // the first record of a page since the checkpoint LSN is always a full page, see `WritePage()`,
+                // a delta without its base means the log is broken.
+                auto it = images.find(record->page_id_);
+                if (it == images.end()) {
+                    std::string image(PAGE_SIZE, '\0');
+                    if (read_at(db_fd_, image.data(), PAGE_SIZE, page_offset(record->page_id_)) == PAGE_SIZE &&
+                        !verify_page(record->page_id_, image.data())) {
+                        ok = false;
+                        return;
+                    }
+                    it = images.emplace(record->page_id_, std::move(image)).first;
+                }
+                const char* delta = record->body_;
+                for (uint32_t run = 0; run + log_offset::RUN_HEADER_SIZE <= record->len_; ) {
+                    const uint32_t run_offset = page::read_int(delta + run + log_offset::RUN_OFFSET);
+                    const uint32_t run_len = page::read_int(delta + run + log_offset::RUN_LEN);
+                    run += log_offset::RUN_HEADER_SIZE;
+                    if (run_offset + run_len > PAGE_SIZE || run + run_len > record->len_)
+                        break;
+                    std::memcpy(it->second.data() + run_offset, delta + run, run_len);
+                    run += run_len;
+                }
+            }
+            for (auto&[page_id, image] : images) {
+                if (page_id == page::NOT_A_PAGE) // keep the checkpoint LSN until all pages are durable
+                    std::memcpy(image.data() + page::offset::CHECKPOINT_LSN, lsn_buffer, 8);
+                stamp_page(page_id, image.data());
+                if (!write_at(db_fd_, image.data(), PAGE_SIZE, page_offset(page_id))) {
+                    debug::ERROR_LOG("[RECOVERY] DiskManager::recover() write error in redo, page_id: %d\n", page_id);
+                    ok = false;
+                }
+            }
+            page_num += images.size();
+        };
+        std::vector<std::thread> workers;
+        for (uint32_t i = 1; i < worker_num; i++)
+            workers.emplace_back(replay, std::cref(partitions[i]));
+        replay(partitions[0]);
+        for (std::thread& worker : workers)
+            worker.join();
+
+        if (!ok) {
+            debug::ERROR_LOG("[RECOVERY] DiskManager::recover() redo error\n");
+            return false;
+        }
+        if (!sync_file(db_fd_) || !write_checkpoint_lsn(checkpoint_lsn + commit_end)) {
+            debug::ERROR_LOG("[RECOVERY] DiskManager::recover() fdatasync error in redo\n");
+            return false;
+        }
+        checkpoint_lsn_ = log_size_ = checkpoint_lsn + commit_end;
+
+        // drop the uncommitted tail, and the replayed records.
+        if (::ftruncate(log_fd_, log_size_) < 0 || ::fsync(log_fd_) < 0)
+            debug::ERROR_LOG("[RECOVERY] DiskManager::recover() truncate error in \"%s\"\n", log_name_.c_str());
+        if (log_size_ > 0)
+            ::fallocate(log_fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, log_size_);
+
+        const time_point_t end = std::chrono::system_clock::now();
+        debug::DEBUG_LOG(debug::RECOVERY,
+                         "[RECOVERY] redo from [lsn=%lld] [workers=%u] [discard=%u]\n",
+                         static_cast<long long>(checkpoint_lsn), worker_num,
+                         static_cast<uint32_t>(discard_num));
+        const double seconds = std::chrono::duration<double>(end - begin).count();
+        print_timing(begin, end, "recovery: %u records, %u pages, %.1f MB/s",
+            static_cast<uint32_t>(redo.size()), page_num.load(),
+            seconds > 0 ? commit_end / seconds / (1 << 20) : 0.0);
+        return true;
     }
 
 
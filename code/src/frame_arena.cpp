@@ -0,0 +1,119 @@
+#include "include/frame_arena.h"
+#include "include/hash_lru.h"
+#include "include/debug_log.h"
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <sys/mman.h>
+
+namespace DB::buffer
+{
+
+    static constexpr std::size_t cache_line = 64;
+    static constexpr std::size_t huge_page_size = 2 << 20;
+
+    static FrameArena* page_arena_ = nullptr;
+    static FrameArena* handle_arena_ = nullptr;
+    static std::once_flag arena_init_flag_;
+
+
+    FrameArena::FrameArena(std::size_t slot_size, uint32_t slot_num)
+        :
+        slot_size_((slot_size + cache_line - 1) & ~(cache_line - 1)),
+        slot_num_(slot_num),
+        region_(nullptr),
+        free_head_(NIL)
+    {
+        region_size_ = (slot_size_ * slot_num_ + huge_page_size - 1) & ~(huge_page_size - 1);
+
+        void* region = MAP_FAILED;
+#ifdef HUGE_PAGE
+        region = mmap(nullptr, region_size_, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif // HUGE_PAGE
+        if (region == MAP_FAILED) {
+            region = mmap(nullptr, region_size_, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef HUGE_PAGE
+            if (region != MAP_FAILED)
+                madvise(region, region_size_, MADV_HUGEPAGE);
+#endif // HUGE_PAGE
+        }
+        if (region == MAP_FAILED) {
+            debug::ERROR_LOG("FrameArena mmap %zu bytes error, fall back to heap\n", region_size_);
+            return;
+        }
+        region_ = static_cast<char*>(region);
+
+        // chain all the slots, slot 0 at the head.
+        next_.reset(new std::atomic<uint32_t>[slot_num_]);
+        for (uint32_t i = 0; i < slot_num_; i++)
+            next_[i].store((i + 1 == slot_num_) ? NIL : i + 1, std::memory_order_relaxed);
+        free_head_.store(slot_num_ == 0 ? NIL : 0);
+    }
+
+    FrameArena::~FrameArena() {
+        if (region_ != nullptr)
+            munmap(region_, region_size_);
+    }
+
+    void* FrameArena::allocate() noexcept
+    {
+        if (region_ == nullptr)
+            return nullptr;
+        uint64_t head = free_head_.load(std::memory_order_acquire);
+        while (true) {
+            const uint32_t index = static_cast<uint32_t>(head);
+            if (index == NIL)
+                return nullptr;
+            const uint64_t tag = (head >> 32) + 1;
+            // stale if the slot has been popped meanwhile, then the tag fails the CAS.
+            const uint64_t new_head = (tag << 32) | next_[index].load(std::memory_order_relaxed);
+            if (free_head_.compare_exchange_weak(head, new_head,
+                std::memory_order_acquire, std::memory_order_acquire))
+                return region_ + index * slot_size_;
+        }
+    }
+
+    bool FrameArena::deallocate(void* ptr) noexcept
+    {
+        char* p = static_cast<char*>(ptr);
+        if (region_ == nullptr || p < region_ || p >= region_ + slot_size_ * slot_num_)
+            return false;
+        const uint32_t index = static_cast<uint32_t>((p - region_) / slot_size_);
+        uint64_t head = free_head_.load(std::memory_order_relaxed);
+        while (true) {
+            next_[index].store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+            const uint64_t tag = (head >> 32) + 1;
+            if (free_head_.compare_exchange_weak(head, (tag << 32) | index,
+                std::memory_order_release, std::memory_order_relaxed))
+                return true;
+        }
+    }
+
+    std::size_t FrameArena::slot_size() const noexcept {
+        return slot_size_;
+    }
+
+
+    // each LeafPage holds a ValuePage out of buffer pool, so 2 page slots per frame.
+    void FrameArena::init(uint32_t frame_budget)
+    {
+        std::call_once(arena_init_flag_, [frame_budget]()
+        {
+            const std::size_t page_slot = std::max({ sizeof(page::RootPage), sizeof(page::InternalPage),
+                sizeof(page::LeafPage), sizeof(page::ValuePage) });
+            page_arena_ = new FrameArena(page_slot, frame_budget * 2);
+            handle_arena_ = new FrameArena(sizeof(PageListHandle), frame_budget + (frame_budget >> 2));
+        });
+    }
+
+    FrameArena* FrameArena::page_arena() noexcept {
+        return page_arena_;
+    }
+
+    FrameArena* FrameArena::handle_arena() noexcept {
+        return handle_arena_;
+    }
+
+} // end namespace DB::buffer
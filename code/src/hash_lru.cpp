@@ -1,9 +1,32 @@
 #include "include/hash_lru.h"
+#include "include/replace_policy.h"
+#include "include/frame_arena.h"
 #include "include/debug_log.h"
+#include <vector>
+#include <thread>
 
 namespace DB::buffer
 {
 
+    /****************  implementation for struct PageListHandle  ****************/
+
+    void* PageListHandle::operator new(std::size_t size) {
+        FrameArena* arena = FrameArena::handle_arena();
+        if (arena != nullptr && size <= arena->slot_size()) {
+            if (void* ptr = arena->allocate())
+                return ptr;
+        }
+        return ::operator new(size);
+    }
+
+    void PageListHandle::operator delete(void* ptr) noexcept {
+        FrameArena* arena = FrameArena::handle_arena();
+        if (arena != nullptr && arena->deallocate(ptr))
+            return;
+        ::operator delete(ptr);
+    }
+
+
     /****************  implementation for class PageList  ****************/
 
     PageList::PageList() :size_(0), head_(page::NOT_A_PAGE, nullptr)
@@ -12,29 +35,33 @@ namespace DB::buffer
         head_.next_hash_ = &head_;
     }
 
+    // publish the handle after it is completely linked.
     void PageList::append(PageListHandle* handle) {
         handle->ref();
         size_++;
         handle->in_page_list_ = true;
-        PageListHandle* old = head_.next_hash_;
-        head_.next_hash_ = handle; handle->prev_hash_ = &head_;
-        handle->next_hash_ = old; old->prev_hash_ = handle;
+        PageListHandle* old = head_.next_hash_.load(std::memory_order_relaxed);
+        handle->prev_hash_ = &head_;
+        handle->next_hash_.store(old, std::memory_order_relaxed);
+        old->prev_hash_ = handle;
+        head_.next_hash_.store(handle, std::memory_order_release);
     }
 
     void PageList::remove(PageListHandle* handle) {
         size_--;
         handle->in_page_list_ = false;
         PageListHandle* prev = handle->prev_hash_;
-        PageListHandle* next = handle->next_hash_;
-        prev->next_hash_ = next; next->prev_hash_ = prev;
+        PageListHandle* next = handle->next_hash_.load(std::memory_order_relaxed);
+        prev->next_hash_.store(next, std::memory_order_release);
+        next->prev_hash_ = prev;
         handle->unref();
     }
 
     PageListHandle* PageList::find_handle(page_id_t page_id) const {
-        PageListHandle* it = head_.next_hash_;
+        PageListHandle* it = head_.next_hash_.load(std::memory_order_relaxed);
         while (it != &head_) {
             if (it->page_id_ == page_id) return it;
-            it = it->next_hash_;
+            it = it->next_hash_.load(std::memory_order_relaxed);
         }
         return nullptr;
     }
@@ -51,174 +78,147 @@ namespace DB::buffer
 
     /****************  implementation for class Hash_LRU  ****************/
 
-    // HACK: potential optimization:
-    // make consensus with the caller on `page_id`,
-    // such that the data race will not happen on the same handle !!!
-
-    Hash_LRU::Hash_LRU() :
-        bucket_num_(Hash_LRU::init_bucket),
+    Hash_LRU::Hash_LRU(uint32_t frame_budget, replace_policy_t policy) :
+        bucket_num_(bucket_num_of(frame_budget)),
         buckets_(bucket_num_),
         size_(0),
-        lru_head_(page::NOT_A_PAGE, nullptr),
-        //lru_size_(0),
-        lru_max_size_(lru_init_size)
-    {
-        lru_head_.next_lru_ = &lru_head_;
-        lru_head_.prev_lru_ = &lru_head_;
-    }
+        policy_(make_replace_policy(policy, frame_budget)),
+        lru_max_size_(frame_budget)
+    {}
 
     Hash_LRU::~Hash_LRU() {
-        PageListHandle* it = lru_head_.next_lru_;
-        while (it != &lru_head_) {
-            PageListHandle* temp = it;
-            it = it->next_lru_;
-            if (temp->ref_ != 2)
+        PageListHandle* it;
+        while ((it = policy_->drain()) != nullptr) {
+            if (it->ref_ != 2)
                 debug::ERROR_LOG("Incorrect ref usage\n");
-            temp->unref();
+            it->in_lru_ = false;
+            it->unref();
         }
+        buckets_.clear();
+        // no reader now, free the retired pages before the DiskManager is gone.
+        util::EpochManager::instance().drain();
     }
 
 
     // `ref_count` in PageList is tracked automatically, we only manage `ref_count` in LRU.
     // We manually manipulate `ref_count`, though, in some multi-thread conditions.
 
-    bool Hash_LRU::insert(page_id_t page_id, Page* page)
+    bool Hash_LRU::insert(page_id_t page_id, Page* page, bool use_once)
     {
         if (size() > max_size())
             lru_evict();
 
-        bool _rehash;
-        {
-            std::shared_lock<std::shared_mutex> lock(shared_mutex_);
-
-            const uint32_t _hash = hash(page_id);
-            PageList& page_list = buckets_[_hash];
-            PageListHandle* _page_handle = nullptr;
-            PageListHandle* newHandle = nullptr;
+        PageList& page_list = buckets_[hash(page_id)];
+        PageListHandle* newHandle = nullptr;
 
-            {
-                std::lock_guard<std::mutex> page_lg(page_list.mutex_);
-                _rehash = page_list.size_ > (bucket_num_ << rehash_ratio);
+        {
+            std::lock_guard<std::mutex> page_lg(page_list.mutex_);
 
-                _page_handle = page_list.find_handle(page_id);
-                if (_page_handle != nullptr)
-                    return false;
+            if (page_list.find_handle(page_id) != nullptr)
+                return false;
 
-                newHandle = new PageListHandle(page_id, page);
-                page_list.append(newHandle);
-            }
+            newHandle = new PageListHandle(page_id, page);
+            page_list.append(newHandle);
+        }
 
-            size_++;
+        size_++;
 
-            {
-                std::lock_guard<std::mutex> lru_lg(lru_mutex_);
-                lru_append(newHandle);
-            }
+        {
+            std::lock_guard<std::mutex> lru_lg(lru_mutex_);
+            lru_append(newHandle, use_once);
         }
 
-        if (_rehash)
-            rehash();
-
         return true;
     }
 
 
+    // the handle is immutable for the lock-free reader,
+    // so replace the old handle rather than assign its page.
     bool Hash_LRU::insert_or_assign(page_id_t page_id, Page* page)
     {
         if (size() > max_size())
             lru_evict();
 
-        bool _rehash;
-        {
-            std::shared_lock<std::shared_mutex> lock(shared_mutex_);
-
-            const uint32_t _hash = hash(page_id);
-            PageList& page_list = buckets_[_hash];
-            PageListHandle* _page_handle = nullptr;
-            PageListHandle* newHandle = nullptr;
-
-            {
-                std::lock_guard<std::mutex> page_lg(page_list.mutex_);
-                _rehash = page_list.size_ > (bucket_num_ << rehash_ratio);
+        PageList& page_list = buckets_[hash(page_id)];
+        PageListHandle* oldHandle = nullptr;
+        PageListHandle* newHandle = nullptr;
 
-                _page_handle = page_list.find_handle(page_id);
-                if (_page_handle != nullptr)
-                {
-                    _page_handle->page_ = page;
-                    return false;
-                }
+        {
+            std::lock_guard<std::mutex> page_lg(page_list.mutex_);
 
-                newHandle = new PageListHandle(page_id, page);
-                page_list.append(newHandle);
+            oldHandle = page_list.find_handle(page_id);
+            if (oldHandle != nullptr) {
+                oldHandle->ref(); // extend its life until removed from LRU
+                page_list.remove(oldHandle);
             }
 
+            newHandle = new PageListHandle(page_id, page);
+            page_list.append(newHandle);
+        }
+
+        if (oldHandle == nullptr)
             size_++;
 
-            {
-                std::lock_guard<std::mutex> lru_lg(lru_mutex_);
-                lru_append(newHandle);
+        {
+            std::lock_guard<std::mutex> lru_lg(lru_mutex_);
+            if (oldHandle != nullptr) {
+                if (oldHandle->in_lru_)
+                    lru_remove(oldHandle);
+                oldHandle->unref(); // pairwise with the early `ref()`
             }
+            lru_append(newHandle, false);
         }
 
-        if (_rehash)
-            rehash();
-
-        return true;
+        return oldHandle == nullptr;
     }
 
 
+    // No lock here.
+    // `try_ref()` then check `in_page_list_`, pairwise with `lru_evict()`,
+    // which clears `in_page_list_` then checks the ref.
+    // So either the evictor sees our ref and gives up, or we see the flag and retry.
     Page* Hash_LRU::find(page_id_t page_id, const bool update)
     {
-        std::shared_lock<std::shared_mutex> lock(shared_mutex_);
-
-        uint32_t _hash = hash(page_id);
-        const PageList& page_list = buckets_[_hash];
+        util::EpochManager::Guard guard;
 
-        PageListHandle* _page_handle = nullptr;
-        Page* page_ptr = nullptr;
+        const PageList& page_list = buckets_[hash(page_id)];
 
-        // find the page and try to acquire the lock
+        while (true)
         {
-            std::lock_guard<std::mutex> page_lg(page_list.mutex_);
+            bool retry = false;
+            PageListHandle* it = page_list.head_.next_hash_.load(std::memory_order_acquire);
+            for (; it != &page_list.head_; it = it->next_hash_.load(std::memory_order_acquire))
+            {
+                if (it->page_id_ != page_id)
+                    continue;
 
-            _page_handle = page_list.find_handle(page_id);
+                Page* page_ptr = it->page_;
 
-            // return if no such page.
-            if (_page_handle == nullptr)
-                return nullptr;
-
-            page_ptr = _page_handle->page_;
+                // the page has been `unref()` to 0, so has the handle left.
+                if (!page_ptr->try_ref())
+                    continue;
 
-            // in case that handle should be evited and page was ref to 0.
-            page_ptr->ref();
-            _page_handle->ref();
-        }
-
-        {
-            std::lock_guard<std::mutex> lru_lg(lru_mutex_);
+                if (!it->in_page_list_) {
+                    page_ptr->unref();
+                    retry = true; // being evicted, or erased.
+                    break;
+                }
 
-            if (_page_handle->in_lru_ == false)
-            {
-                _page_handle->unref(); // pairwise with the early `ref()`
+                if (update)
+                    it->accessed_.store(true, std::memory_order_relaxed);
                 return page_ptr;
             }
 
-            _page_handle->unref(); // pairwise with the early `ref()`
-
-            if (update)
-                lru_update(_page_handle);
+            if (!retry)
+                return nullptr;
+            std::this_thread::yield();
         }
-
-        return page_ptr;
     }
 
 
     bool Hash_LRU::erase(page_id_t page_id)
     {
-        std::shared_lock<std::shared_mutex> lock(shared_mutex_);
-
-        uint32_t _hash = hash(page_id);
-        PageList& page_list = buckets_[_hash];
+        PageList& page_list = buckets_[hash(page_id)];
 
         PageListHandle* _page_handle = nullptr;
 
@@ -268,155 +268,144 @@ namespace DB::buffer
 
 
     inline uint32_t Hash_LRU::max_size() const {
-        return lru_max_size_.load(std::memory_order_relaxed);
+        return lru_max_size_;
     }
 
 
     void Hash_LRU::flush() {
-        std::lock_guard<std::shared_mutex> lg(shared_mutex_);
         for (PageList& bucket : buckets_) {
-            PageListHandle* it = bucket.head_.next_hash_;
-            while (it != &bucket.head_) {
-                PageListHandle* temp = it;
-                it->page_->flush();
-                it = it->next_hash_;
-                // remove the free page, to promise FREE page is not in buffer pool.
-                if (temp->page_->get_page_t() == page::page_t_t::FREE) {
-                    bucket.remove(temp);
-                    lru_remove(temp);
+            std::vector<PageListHandle*> free_pages;
+            {
+                std::lock_guard<std::mutex> page_lg(bucket.mutex_);
+                PageListHandle* it = bucket.head_.next_hash_;
+                while (it != &bucket.head_) {
+                    PageListHandle* temp = it;
+                    it->page_->flush();
+                    it = it->next_hash_;
+                    // remove the free page, to promise FREE page is not in buffer pool.
+                    if (temp->page_->get_page_t() == page::page_t_t::FREE) {
+                        temp->ref(); // extend its life until removed from LRU
+                        bucket.remove(temp);
+                        free_pages.push_back(temp);
+                    }
                 }
             }
+            for (PageListHandle* temp : free_pages) {
+                {
+                    std::lock_guard<std::mutex> lru_lg(lru_mutex_);
+                    if (temp->in_lru_)
+                        lru_remove(temp);
+                }
+                temp->unref(); // pairwise with the early `ref()`
+                size_--;
+            }
         }
     }
 
 
-    // The read of `bucket_num_` does not contend with modifying it in `rehash()`.
-    // Becase the modification must acquire the write-lock,
-    // thus any find/insert/erase call will block.
     inline uint32_t Hash_LRU::hash(page_id_t page_id) const noexcept {
         return (Hash_LRU::magic * page_id) & (bucket_num_ - 1);
     }
 
 
-    // Do not lock LRU !!!
-    void Hash_LRU::rehash()
-    {
-        // must immediately acquire the write-lock
-        std::lock_guard<std::shared_mutex> lg(shared_mutex_);
-
-        if (bucket_num_ >= Hash_LRU::max_bucket)
-            return;
-
-        // `bucket number` and `lru_max_size` multiply by 2.
-        const uint32_t old_bucket_num_ = bucket_num_;
-        bucket_num_ <<= 1;
-        lru_max_size_.fetch_add(
-            lru_max_size_.load(std::memory_order_seq_cst),
-            std::memory_order_seq_cst);
-
-        // move the element into new buckets
-        buckets_.resize(bucket_num_);
-        for (uint32_t i = 0; i < old_bucket_num_; i++)
-        {
-            // we hold write-lock already.
-            PageList& page_list = buckets_[i];
-            PageList& new_page_list = buckets_[i + old_bucket_num_];
-            PageListHandle* it = page_list.head_.next_hash_;
-            while (it != &(page_list.head_))
-            {
-                PageListHandle* temp = it;
-                it = it->next_hash_;
-                if (i != hash(temp->page_id_))
-                {
-                    // `temp` will not be destructed in that we don't leave this block,
-                    // `lru_evict()` does not `unref()` until erase the handle in hash-table,
-                    // thus we do not need to `ref()` here.
-                    page_list.remove(temp);
-                    new_page_list.append(temp);
-                }
-            }
-        }
-    } // end function `void Hash_LRU::rehash()`
+    uint32_t Hash_LRU::bucket_num_of(uint32_t frame_budget) noexcept {
+        uint32_t bucket_num = Hash_LRU::min_bucket;
+        while (bucket_num < frame_budget / 2)
+            bucket_num <<= 1;
+        return bucket_num;
+    }
 
 
-    void Hash_LRU::lru_append(PageListHandle* handle)
+    void Hash_LRU::lru_append(PageListHandle* handle, bool use_once)
     {
         handle->ref();
         handle->in_lru_ = true;
-        PageListHandle* second = lru_head_.next_lru_;
-        lru_head_.next_lru_ = handle; handle->prev_lru_ = &lru_head_;
-        handle->next_lru_ = second; second->prev_lru_ = handle;
+        policy_->insert(handle, use_once);
     }
 
 
-    void Hash_LRU::lru_update(PageListHandle* handle)
+    void Hash_LRU::lru_remove(PageListHandle* handle, bool evicted)
     {
-        PageListHandle* prev = handle->prev_lru_;
-        PageListHandle* next = handle->next_lru_;
-
-        if (prev == &lru_head_) return;
-
-        prev->next_lru_ = next; next->prev_lru_ = prev;
+        policy_->remove(handle, evicted);
+        handle->in_lru_ = false;
+        handle->unref();
+    }
 
-        PageListHandle* second = lru_head_.next_lru_;
 
-        lru_head_.next_lru_ = handle; handle->prev_lru_ = &lru_head_;
-        handle->next_lru_ = second; second->prev_lru_ = handle;
+    bool Hash_LRU::is_pinned(const PageListHandle* handle) {
+        return handle->page_->get_ref_count() > handle->ref_.load();
     }
 
 
-    void Hash_LRU::lru_remove(PageListHandle* handle)
-    {
-        PageListHandle* prev = handle->prev_lru_;
-        PageListHandle* next = handle->next_lru_;
-        prev->next_lru_ = next; next->prev_lru_ = prev;
-        handle->in_lru_ = false;
-        handle->unref();
+    // skip the page which is not committed yet (no-steal).
+    bool Hash_LRU::is_evictable(const PageListHandle* handle) {
+        return !is_pinned(handle) && handle->page_->is_stealable();
     }
 
 
     void Hash_LRU::lru_evict()
     {
-        /*
-        page_id_t page_id;
-        PageListHandle* victim;
-
-        // if conflicts with `erase()`, no size decrement in `erase()`.
-        size_--;
-
+        while (size() > max_size())
         {
-            std::lock_guard<std::mutex> lru_lg(lru_mutex_);
+            PageListHandle* victim = nullptr;
 
-            victim = lru_head_.prev_lru_;
-            PageListHandle* last = victim->prev_lru_;
+            // let the policy pick the victim.
+            {
+                std::lock_guard<std::mutex> lru_lg(lru_mutex_);
 
-            lru_head_.prev_lru_ = last; last->next_lru_ = &lru_head_;
+                victim = policy_->victim(&Hash_LRU::is_evictable, evict_scan_depth);
 
-            page_id = victim->page_id_;
+                if (victim == nullptr)
+                    return; // all pinned, the budget is exceeded temporarily.
 
-            victim->in_lru_ = false;
-            // victim->unref(); // must not do `unref` here, but later.
-        }
+                // extend its life until we leave, pairwise with the last `unref()`.
+                victim->ref();
+            }
 
-        {
-            std::shared_lock<std::shared_mutex> lock(shared_mutex_);
-            PageList& page_list = buckets_[hash(page_id)];
+            const page_id_t page_id = victim->page_id_;
+            bool evicted = false;
 
-            std::lock_guard<std::mutex> page_lg(page_list.mutex_);
+            // write back and remove from page_list.
+            // `find()` on the victim spins while `in_page_list_` is cleared,
+            // so `FetchPage()` never reads the stale page from disk.
+            {
+                PageList& page_list = buckets_[hash(page_id)];
+                std::lock_guard<std::mutex> page_lg(page_list.mutex_);
+
+                if (victim->in_page_list_)
+                {
+                    // clear then check the ref, pairwise with `find()`.
+                    victim->in_page_list_ = false;
+                    if (is_pinned(victim)) {
+                        victim->in_page_list_ = true;
+                    }
+                    else {
+                        if (victim->page_->is_dirty())
+                            victim->page_->flush();
+                        page_list.remove(victim);
+                        evicted = true;
+                    }
+                }
+            }
 
-            if (victim->in_page_list_)
-                page_list.remove(victim);
+            if (evicted)
+            {
+                {
+                    std::lock_guard<std::mutex> lru_lg(lru_mutex_);
+                    if (victim->in_lru_)
+                        lru_remove(victim, true);
+                }
+                size_--;
+                debug::DEBUG_LOG(debug::LRU_EVICT,
+                    "[LRU_EVICT] Hash_LRU::lru_evict() [evict_id=%d]\n", page_id);
+            }
 
-            victim->page_->set_dirty(); // in case that the victim has resided in memory.
-                                        // block `FetchPage` until the victim has been flushed.
+            victim->unref(); // page is deleted here if evicted.
 
-            victim->unref(); // `unref` for LRU
+            if (!evicted)
+                return; // someone holds it now, try next time.
         }
 
-        debug::DEBUG_LOG(debug::LRU_EVICT,
-            "Hash_LRU::lru_evict() evict: [evict_id = %d]n", page_id);
-        //*/
-
     } // end function `void Hash_LRU::lru_evict()`
 
 
@@ -2,15 +2,19 @@
 #define _BPLUSTREE_H
 #include "page.h"
 #include <atomic>
-#include <shared_mutex>
+#include <memory>
+#include <mutex>
+#include <vector>
 
-namespace DB::disk { class DiskManager; }
+namespace DB::disk { class DiskManager; struct ReadAheadMark; }
 namespace DB::vm { class StorageEngine; }
 namespace DB::buffer { class BufferPoolManager; }
 namespace DB::tree
 {
     using namespace ::DB::page;
 
+    class BTree;
+
     struct KVEntry {
         KeyEntry kEntry;
         ValueEntry vEntry; // tuple's max size is 67B 
@@ -20,6 +24,7 @@ namespace DB::tree
     struct OpenTableInfo {
         bool isInit;
         page_id_t root_id; // only needed when (!init)
+        leaf_format_t leaf_format = leaf_format_t::VALUE_PAGE;
     };
 
 
@@ -29,14 +34,29 @@ namespace DB::tree
     // > 0, if KeyEntry > keys[index]
     int32_t key_compare(const KeyEntry&, const BTreePage*, uint32_t key_index);
 
+    // binary search, narrowed by SIMD on INTEGER key, no allocation on (VAR)CHAR key.
+    // return the first index such that KeyEntry <= keys[index], `nEntry` if none.
+    uint32_t key_lower_bound(const KeyEntry&, const BTreePage*);
+    // return the first index such that KeyEntry < keys[index], `nEntry` if none.
+    uint32_t key_upper_bound(const KeyEntry&, const BTreePage*);
+    // return the index such that KeyEntry == keys[index], `nEntry` if none.
+    uint32_t key_find(const KeyEntry&, const BTreePage*);
+
+
+    // the comments are for 1KB page, see `BTNodeKeyCapacity`.
+    constexpr uint32_t MIN_KEY_SIZE = BTdegree - 1;         // 6
+    constexpr uint32_t MAX_KEY_SIZE = BTNodeKeySize;        // 13
+    constexpr uint32_t MIN_BRANCH_SIZE = BTdegree;          // 7
+    constexpr uint32_t MAX_BRANCH_SIZE = BTNodeBranchSize;  // 14
+    constexpr uint32_t MIN_LEAF_SIZE = MIN_KEY_SIZE;        // 6
+    constexpr uint32_t MAX_LEAF_SIZE = MAX_KEY_SIZE;        // 13
+    constexpr uint32_t KEY_MIDEIUM = MAX_KEY_SIZE >> 1;     // 6 in [0...5] [6] [7...12]
+
+    // bulk load fills each node up to 90%, leaving room for the later inserts.
+    constexpr double BULK_LOAD_FILL_FACTOR = 0.9;
 
-    constexpr uint32_t MIN_KEY_SIZE = BTdegree - 1;         // 7
-    constexpr uint32_t MAX_KEY_SIZE = BTNodeKeySize;        // 15
-    constexpr uint32_t MIN_BRANCH_SIZE = BTdegree;          // 8
-    constexpr uint32_t MAX_BRANCH_SIZE = BTNodeBranchSize;  // 16
-    constexpr uint32_t MIN_LEAF_SIZE = MIN_KEY_SIZE;        // 7
-    constexpr uint32_t MAX_LEAF_SIZE = MAX_KEY_SIZE;        // 15
-    constexpr uint32_t KEY_MIDEIUM = MAX_KEY_SIZE >> 1;     // 7 in [0...6] [7] [8...14]
+    // the leaves read ahead of a range scan, refilled when half of them are consumed.
+    constexpr uint32_t READ_AHEAD_LEAF_NUM = 32;
 
     static constexpr uint32_t
         INSERT_NOTHING = 0,
@@ -49,7 +69,6 @@ namespace DB::tree
     // e.g. 
     //      WHERE 3 <= pk < 11
     //
-    //  bt.range_query_begin_lock();
     //  BTit it = bt.range_query_from_left_begin(3, true);
     //  BTit end = bt.range_query_from_right_end(11, false);
     //  while(it != end) {
@@ -57,11 +76,15 @@ namespace DB::tree
     //      // ...
     //      ++it;
     //  }
-    //  bt.range_query_end_unlock();
     //
+    // the iterator never latches the leaf, but reads a snapshot of it under optimistic lock coupling,
+    // so that the scan runs concurrently with `find()`, `insert()` and `erase()`.
+    // if the leaf has changed when moving to the next leaf, seek the last key from root again.
     class BTit {
     public:
-        BTit(buffer::BufferPoolManager*, BTreePage* leaf, uint32_t cur_index);
+        explicit BTit(buffer::BufferPoolManager*);  // the end
+        // the first leaf.key >= kEntry (> kEntry if `upper`), or the begin if `kEntry` is nullptr.
+        BTit(buffer::BufferPoolManager*, const BTree*, const KeyEntry* kEntry, bool upper);
         BTit(const BTit&);
         void operator=(const BTit&);
         ~BTit();
@@ -70,11 +93,40 @@ namespace DB::tree
         // [depricated] void destroy();     // destroy the iterator when not use
         KeyEntry getK() const;
         ValueEntry getV() const;
-        void updateV(const ValueEntry&);
+        // latch the leaf, locate the key again from root if the leaf has changed since the snapshot.
+        // return false without any change if the key has gone.
+        bool updateV(const ValueEntry&);
+        // hint the buffer-pool that the following leaves are read only once, e.g. full scan,
+        // so that they are evicted prior to the hot pages.
+        void set_use_once() noexcept;
+        // read the next `leaf_num` leaves ahead asynchronously, for the scans that go through the tree.
+        void set_read_ahead(uint32_t leaf_num = READ_AHEAD_LEAF_NUM);
     private:
+        void seek(const KeyEntry* kEntry, bool upper);
+        // move to the next non-empty leaf, or the end.
+        void next_leaf();
+        // keep `read_ahead_` leaves read ahead of the scan, never the ones read already.
+        void read_ahead();
+        // copy the entries of `leaf_` if it is still a leaf of `version`.
+        bool load_leaf(uint64_t version);
+        void release();
+
         BTreePage * leaf_;
         uint32_t cur_index_;
         buffer::BufferPoolManager* buffer_pool_;
+        bool use_once_ = false;
+        uint32_t read_ahead_ = 0;
+        uint32_t read_ahead_left_ = 0;      // the leaves read ahead but not reached yet
+        std::shared_ptr<disk::ReadAheadMark> read_ahead_mark_;  // of this scan only, never copied
+
+        // snapshot of `leaf_`
+        const BTree* tree_ = nullptr;
+        uint64_t version_ = 0;
+        uint32_t nEntry_ = 0;
+        page_id_t next_page_id_ = NOT_A_PAGE;
+        std::vector<int32_t> keys_;         // INTEGER key
+        std::vector<char> key_blocks_;      // (VAR)CHAR key, `KEY_STR_BLOCK` per key
+        std::vector<char> value_blocks_;    // `TUPLE_BLOCK_SIZE` per value
     };
 
 
@@ -89,6 +141,7 @@ namespace DB::tree
     //          \____ InternalPage_____RootPage
     class BTree
     {
+        friend class BTit;
         friend TableMetaPage* page::parse_TableMetaPage(buffer::BufferPoolManager* buffer_pool, const char(&buffer)[page::PAGE_SIZE]);
     public:
         using Key = uint32_t; // direct value for `INTEGER`, offset for `VARCHAR`
@@ -117,14 +170,14 @@ namespace DB::tree
 
         key_t_t key_t() const;
         uint32_t str_len() const;
+        // INLINE only if asked on INTEGER key.
+        leaf_format_t leaf_format() const;
 
         // used when drop table
         void destruct();
 
 
 
-        void range_query_begin_lock();
-
         BTit range_query_from_begin();
         BTit range_query_from_end();            // the `leaf == nullptr` means it's end.
 
@@ -136,8 +189,6 @@ namespace DB::tree
         // handle [it <= kEntry] and [it < kEntry]
         BTit range_query_from_right_end(const KeyEntry& kEntry, bool equal);
 
-        void range_query_end_unlock();
-
 
 
         // return state: `OBSOLETE` denotes no such key exists.
@@ -150,6 +201,15 @@ namespace DB::tree
         uint32_t insert(const KVEntry&);
 
 
+        // build the tree bottom-up from the strictly ascending k-v, the tree should be empty.
+        // the leaves are packed left to right, then each internal level on top of them,
+        // every node is filled up to `fill_factor` but never below the min size.
+        // return false without any change if the k-v are not strictly ascending, or the tree is not empty,
+        // then insert them one by one.
+        bool bulk_load(const KVEntry* first, const KVEntry* last,
+            double fill_factor = BULK_LOAD_FILL_FACTOR);
+
+
         // return: `ERASE_NOTHING`, no such key exists.
         //         `ERASE_KV`,      the key-value has been erased.
         // operation:
@@ -190,14 +250,6 @@ namespace DB::tree
         void set_size(uint32_t);
 
 
-        // do nothing if BTree is empty.
-        // return the min leaf.key that *** KeyEntry <= leaf.key ***
-        struct SearchInfo {
-            page_id_t leaf_id = NOT_A_PAGE;
-            uint32_t key_index = 0;
-        };
-        void search(const KeyEntry&, SearchInfo&) const;
-        void doSearch(base_ptr node, const KeyEntry&, SearchInfo&) const;
 
 
         // Page* has been `ref()` before return.
@@ -206,6 +258,17 @@ namespace DB::tree
         BTreePage* fetch_node(base_ptr node, uint32_t index) const;
 
 
+        // optimistic descent, never latches, restart if any node on the path has changed.
+        // return the leaf (maybe root, has been `ref()`) that covers kEntry, the left-most if nullptr,
+        // and its version read while the parent was still valid.
+        BTreePage* seek_leaf(const KeyEntry* kEntry, uint64_t& version) const;
+
+
+        // latch the leaf that covers kEntry, and update its value.
+        // return false if no such key exists.
+        bool update_value(const KeyEntry&, const ValueEntry&) const;
+
+
         // Page* has been `ref()` before return.
         // `unref()` the Page after use ! ! !
         BTreePage* allocate_node(PageInitInfo) const;
@@ -267,9 +330,9 @@ namespace DB::tree
         //              1. find index such that kEntry <= node.k[index]
         //              2. hold write-lock of node.br[index]
         //                 if need to split node.br[index], then split.
-        //              3. release write-lock of node, then hold the read-lock of node.
-        //              4. maybe update index and child=node.br[index] after split.
-        //              5. recursively go down then release read-lock.
+        //              3. maybe update index and child=node.br[index] after split.
+        //              4. release write-lock of node, the child is non-full, node is never touched below.
+        //              5. recursively go down.
         uint32_t INSERT_NONFULL(base_ptr node, const KVEntry&);
 
 
@@ -277,6 +340,10 @@ namespace DB::tree
         KeyEntry max_KeyEntry(page_id_t);
 
 
+        // used for bulk load, set `size` children and the right-most key of each but the last.
+        void fill_internal(link_ptr node, const page_id_t* children, const KeyEntry* keys, uint32_t size) const;
+
+
         // all write-lock held, L.nEntry = R.nEtnry = KEY_MIN_SIZE
         // move R into L.
         //     move R.key[0..6] -> L.key[8..14], R.br[0..7] -> L.br[..15]
@@ -304,7 +371,8 @@ namespace DB::tree
         //              1. when call this function, the root must be ROOT_INTERNAL.
         //              2. if node is INTERNAL, node.nEntry >= MIN_KEY+1
         //              3. if node is root, root.nEntry >= 2
-        //              4. caller hold write-lock of node, callee should unlock. (UNDONE: read-lock??)
+        //              4. caller hold write-lock of node, callee should unlock.
+        //                 node is released as soon as child is non-min, before going down.
         // return: `ERASE_NOTHING`,     the key does not exist, do nothing.
         //         `ERASE_KV`,          the key exist and k-v has been deleted.
         // operation:
@@ -361,10 +429,14 @@ namespace DB::tree
         buffer::BufferPoolManager* buffer_pool_;
         const key_t_t key_t_;
         const uint32_t str_len_;
+        const leaf_format_t leaf_format_;
         base_ptr root_;
         std::atomic<uint32_t> size_;        // rebuild from parsing TableMetaPage
-        mutable std::shared_mutex range_query_lock_; // hold write-lock when do range query,
-                                                     // otherwise hole read-lock.
+#ifdef SIMPLE_TEST
+        // the page latches are no-op in `SIMPLE_TEST`, the writers are exclusive by this instead.
+        // the readers never take it, see `BTit`.
+        mutable std::mutex write_mtx_;
+#endif // SIMPLE_TEST
     }; // end class BTree
 
 
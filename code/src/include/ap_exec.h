@@ -2,30 +2,43 @@
 #include <deque>
 #include <vector>
 #include <string_view>
+#include <unordered_map>
 #include <cstring>
 #include <future>
 #include "ap_prefetch.h"
 #include "ap_simd.h"
 #include "page.h"
 #include "debug_log.h"
+#include "thread_pool.h"
 
 #define likely(x) __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
 
 namespace DB::vm { class VM; }
 namespace DB::ap {
+inline namespace AP_SIMD_NAMESPACE {
 
     /*
      * ************************* data flow representation *************************
      * 
      * ap_table_t:
-     *      array of tuples, iterated by block.
+     *      column vectors of a table, iterated by block.
+     *      INTEGER column is an aligned int32 array, CHAR/VARCHAR column is offset + heap.
+     *      kept across mode switch, the TP writes are merged in as appends and erases.
      * 
      * block_tuple_t:
-     *      array of tuples with fixed size, is the input for each APNode.
+     *      up to BLOCK_SIZE tuples, is the input for each APNode.
+     *      refers to the rows of ap_table_t or join_result_buf_t, no copy,
+     *      and keeps the positions of the selected tuples.
+     * 
+     * block_vector_t:
+     *      VECTOR_SIZE selected tuples of a block, the unit of SIMD execution.
      * 
      * join_result_buf_t:
-     *      array of tuples, iterated by block, is the output of join probe.
+     *      array of tuples, iterated by block, is the output of join probe and aggregation.
+     * 
+     * hash_agg_t:
+     *      GROUP BY, one agg_hash_table_t per pipeline task, merged into rows at the end.
      * 
      * ************************* *************************
      * 
@@ -33,7 +46,7 @@ namespace DB::ap {
      *      get block from table or join-result
      * 
      * block_tuple_iter_t:
-     *      for NON-SIMD use.
+     *      for NON-SIMD use, iterate the selected tuples.
      * 
      * VECTOR_INT:
      *      for SIMD use.
@@ -46,17 +59,16 @@ namespace DB::ap {
     struct ap_row_t {
         int32_t getINT(page::range_t range) const { return page::get_range_INT(row, range); }
         std::string_view getVARCHAR(page::range_t range) const {
-            if(row.content_[range.begin + range.len] == '\0') {
-                return std::string_view(row.content_ + range.begin);
-            }
-            else {
-                return std::string_view(row.content_ + range.begin, range.len);
-            }
+            const char* str = row.content_ + range.begin;
+            return std::string_view(str, strnlen(str, range.len));
         }
         page::ValueEntry row;
         std::string to_string() const { return std::string(std::begin(row.content_), std::end(row.content_)); }
     };
 
+    // tuples per block, a multiple of VECTOR_SIZE
+    constexpr uint32_t BLOCK_SIZE = 1024;
+
     /*
      * iterate block row-wisely, mainly for complex condition
      */
@@ -65,8 +77,8 @@ namespace DB::ap {
     public:
         block_tuple_iter_t(const block_tuple_t* block_tuple);
         bool is_end() const;
-        bool valid() const;
-        const ap_row_t& getTuple() const;
+        ap_row_t getTuple() const;
+        std::string_view getVARCHAR(page::range_t range) const;
         void next();
     private:
         const block_tuple_t* block_tuple_;
@@ -74,9 +86,9 @@ namespace DB::ap {
     };
 
 
-    class block_tuple_t;
+    class block_vector_t;
     struct VECTOR_STR_HANDLER {
-        const block_tuple_t* block_;
+        const block_vector_t* vector_;
         const page::range_t str_range_;
     };
     VECTOR_INT operator==(VECTOR_STR_HANDLER, std::string_view);
@@ -92,27 +104,75 @@ namespace DB::ap {
     VECTOR_INT operator>=(VECTOR_STR_HANDLER, std::string_view);
     VECTOR_INT operator>=(std::string_view, VECTOR_STR_HANDLER);
 
+    /*
+     * the input of a filter condition
+     */
+    class block_vector_t {
+        friend class block_tuple_t;
+        friend class hash_table_t;
+        friend class agg_hash_table_t;
+    public:
+        // for vector-wise SIMD execution
+        VECTOR_INT getINT(page::range_t range) const;
+        VECTOR_STR_HANDLER getVARCHAR(page::range_t range) const { return VECTOR_STR_HANDLER{ this, range }; }
+        // lane-wise
+        uint32_t size() const { return size_; }
+        std::string_view getVARCHAR(uint32_t lane, page::range_t range) const;
+    private:
+        VECTOR_INT select() const { return get_vec(size_) > IOTA_VEC; }
+    private:
+        const block_tuple_t* block_;
+        // position in block, lanes from `size_` on repeat the first one
+        VECTOR_INT pos_;
+        uint32_t size_;
+    };
+
     /*
      * APNode input
      */
+    class ap_table_t;
     class block_tuple_t {
         friend class block_tuple_iter_t;
+        friend class block_vector_t;
         friend class ap_block_iter_t;
-        friend class VECTOR_INT;
         friend class VMEmitOp;
         friend class hash_table_t;
+        friend class agg_hash_table_t;
     public:
         // for row-wise iteration
         block_tuple_iter_t first() const { return block_tuple_iter_t{this}; }
-        // for vector-wise SIMD execution
-        VECTOR_INT getINT(page::range_t range) const;
-        VECTOR_STR_HANDLER getVARCHAR(page::range_t range) const { return VECTOR_STR_HANDLER{ this, range }; }
-        void selectivity_and(VECTOR_INT mask) { select_ = select_ & mask; }
+        uint32_t size() const { return sel_size_; }
+        // keep the selected tuples whose 0-1 `cond(const block_vector_t&)` is 1
+        template<typename Cond> void filter(Cond cond);
+    private:
+        block_vector_t get_vector(uint32_t sel_begin) const;
+        int32_t getINT(uint32_t pos, page::range_t range) const;
+        ap_row_t getTuple(uint32_t pos) const;
+        std::string_view getVARCHAR(uint32_t pos, page::range_t range) const;
     private:
-        ap_row_t rows_[VECTOR_SIZE];
-        VECTOR_INT select_ = ZERO_VEC;
+        // from table: rows [row_begin_, row_begin_ + BLOCK_SIZE) of `table_`,
+        // otherwise the rows of a join result from `rows_`.
+        const ap_table_t* table_ = nullptr;
+        uint32_t row_begin_ = 0;
+        std::deque<ap_row_t>::const_iterator rows_;
+        // positions of the selected tuples, ascending
+        uint16_t sel_[BLOCK_SIZE];
+        uint32_t sel_size_ = 0;
     };
 
+    template<typename Cond>
+    void block_tuple_t::filter(Cond cond) {
+        // compact in place, the vector is read before its positions are overwritten,
+        // and the compress writes no further than its own positions.
+        uint32_t selected = 0;
+        for(uint32_t i = 0; i < sel_size_; i += VECTOR_SIZE) {
+            const block_vector_t vector = get_vector(i);
+            const VECTOR_INT mask = cond(vector) & vector.select();
+            selected += simd_compress_u16(sel_ + selected, vector.pos_, mask);
+        }
+        sel_size_ = selected;
+    }
+
     /*
      * ap_row_iter_t :
      *      holds all tuple content in an iterator-like object
@@ -122,23 +182,61 @@ namespace DB::ap {
     class ap_block_iter_t {
         using ap_row_iter_t = std::deque<ap_row_t>::const_iterator;
     public:
-        ap_block_iter_t(const ap_table_t* table);
+        // the blocks of a table are split into `parts` consecutive ranges
+        ap_block_iter_t(const ap_table_t* table, uint32_t part, uint32_t parts);
         ap_block_iter_t(const join_result_buf_t* table);
         bool is_end() const;
         block_tuple_t consume_block();
     private:
+        const ap_table_t* table_ = nullptr;
+        uint32_t row_ = 0;
+        uint32_t row_end_ = 0;
         ap_row_iter_t it_;
         ap_row_iter_t end_;
     };
 
+    class ap_column_t {
+        friend class ap_table_t;
+    public:
+        ap_column_t(page::col_range_t col) :col_(col) {}
+    private:
+        page::col_range_t col_;
+        // INTEGER, padded with 0 to a multiple of VECTOR_SIZE
+        std::vector<int32_t, simd_allocator<int32_t>> ints_;
+        // CHAR/VARCHAR, the i-th string is heap[offsets[i], offsets[i+1])
+        std::vector<uint32_t> str_offsets_{ 0 };
+        std::string str_heap_;
+    };
+
     class ap_table_t {
         friend class vm::VM;
         friend class ap_block_iter_t;
     public:
-        uint32_t size() const { return rows_.size(); }
-        ap_block_iter_t get_block_iter() const { return ap_block_iter_t{this}; }
+        ap_table_t(const std::vector<page::col_range_t>& cols, page::col_range_t key);
+        uint32_t size() const { return size_; } // erased rows included
+        ap_block_iter_t get_block_iter(uint32_t part = 0, uint32_t parts = 1) const { return ap_block_iter_t{this, part, parts}; }
+        // `range` must be an INTEGER column, nullptr if not
+        const int32_t* getINT(page::range_t range) const;
+        std::string_view getVARCHAR(uint32_t row, page::range_t range) const;
+        ap_row_t getTuple(uint32_t row) const;
     private:
-        std::deque<ap_row_t> rows_;
+        const ap_column_t* get_column(page::range_t range) const;
+        std::string get_key(const page::ValueEntry& vEntry) const;
+        void append(const page::ValueEntry& vEntry);
+        void erase(const page::ValueEntry& vEntry); // by key
+        void compact();
+    private:
+        std::vector<ap_column_t> columns_;
+        int8_t col_at_[page::MAX_TUPLE_SIZE]; // column index by range.begin, -1 if none
+        // 1 if the row is not erased, padded with 0 as the INTEGER columns,
+        // and is loaded as the block selectivity.
+        std::vector<int32_t, simd_allocator<int32_t>> alive_;
+        uint32_t size_ = 0;
+        uint32_t erased_ = 0;
+        // key -> row, built at the first erase
+        page::col_range_t key_;
+        std::unordered_map<std::string, uint32_t> key2row_;
+        bool indexed_ = false;
     };
 
     class ap_table_array_t {
@@ -165,6 +263,7 @@ namespace DB::ap {
     class join_result_buf_t {
         friend class ap_block_iter_t;
         friend class hash_table_t;
+        friend class hash_agg_t;
     public:
         ap_block_iter_t get_block_iter() const { return ap_block_iter_t{this}; }
     private:
@@ -181,6 +280,7 @@ namespace DB::ap {
              left_len_(left_len), right_len_(right_len), left_unique_(left_unique),
              keypos2rowid_(), row_buf_()
             {
+                build_completed_ = build_completion_.get_future().share();
                 bucket_size_ = new int32_t[BUCKET_AMOUNT];
                 std::memset(bucket_size_, 0, BUCKET_AMOUNT * sizeof(int32_t));
             }
@@ -197,11 +297,12 @@ namespace DB::ap {
     private:
 
         VECTOR_INT get_end_inclusive(VECTOR_INT bucket_no) const;
+        void probe(const block_vector_t&, join_result_buf_t&) const;
 
     private:
-        // for concurrent execution
-        mutable bool build_completed_ = false;
-        mutable std::promise<void> build_completion_;
+        // for concurrent execution, the probe side may run in several tasks
+        std::promise<void> build_completion_;
+        std::shared_future<void> build_completed_;
 
         const page::range_t left_, right_;
         const uint32_t left_len_, right_len_;
@@ -233,4 +334,81 @@ namespace DB::ap {
     };
 
 
-} // end namespace DB::ap
\ No newline at end of file
+    // pre-aggregation partitions of GROUP BY, one per thread of the VM task pool
+    constexpr uint32_t AGG_PARTS = util::ThreadsPool::max_threads;
+
+    // KEY is a GROUP BY column in select list
+    enum class agg_t_t { KEY, COUNT, SUM, MIN, MAX, AVG };
+    constexpr const char* agg_t_str[] = { "KEY", "COUNT", "SUM", "MIN", "MAX", "AVG" };
+
+    /*
+     * an output column of aggregation, in select order.
+     * KEY copies the group column `in_`, the others are INTEGER,
+     * aggregated over INTEGER `in_` (unused by COUNT).
+     * AVG is truncated, sums are kept in 64 bits,
+     * a result out of INT is a query error, never wraps.
+     */
+    struct agg_spec_t {
+        agg_t_t agg_t_;
+        page::range_t in_;
+        page::range_t out_;
+    };
+
+    /*
+     * open addressing (linear probing) table of groups, filled by one task.
+     * the slots are probed VECTOR_SIZE tuples at a time,
+     * then the aggregates are updated lane by lane.
+     */
+    class agg_hash_table_t {
+        friend class hash_agg_t;
+    public:
+        agg_hash_table_t(const std::vector<page::col_range_t>& group, const std::vector<agg_spec_t>& specs);
+        void insert(const block_tuple_t&);
+    private:
+        void insert(const block_vector_t&);
+        // group id of each selected lane, the new groups are created
+        VECTOR_INT find_or_insert(const block_vector_t&);
+        uint32_t find_or_insert(const char* key, uint32_t hash, int32_t tag);
+        uint32_t new_group(uint32_t slot, const char* key, uint32_t hash, int32_t tag);
+        void grow();
+        void merge(const agg_hash_table_t&);
+        const char* get_key(uint32_t group) const { return keys_.data() + group * key_len_; }
+    private:
+        std::vector<page::col_range_t> group_;
+        std::vector<agg_spec_t> specs_;
+        uint32_t key_len_ = 0; // group columns side by side, VARCHAR padded with 0
+        // a single INTEGER group column is the tag itself, no key compare.
+        // otherwise the tag is the hash.
+        bool int_key_;
+
+        // slot -> group, -1 if empty
+        uint32_t slot_mask_;
+        std::vector<int32_t, simd_allocator<int32_t>> slot_group_;
+        std::vector<int32_t, simd_allocator<int32_t>> slot_tag_;
+
+        // by group
+        uint32_t groups_ = 0;
+        std::string keys_;
+        std::vector<uint32_t> hashes_;
+        std::vector<int32_t> tags_;
+        std::vector<int64_t> acc_; // [row count, one per spec] per group
+    };
+
+    class hash_agg_t {
+    public:
+        hash_agg_t(std::vector<page::col_range_t> group, std::vector<agg_spec_t> specs, uint32_t parts);
+        hash_agg_t(const hash_agg_t&) = delete;
+        hash_agg_t& operator=(const hash_agg_t&) = delete;
+        agg_hash_table_t& partial(uint32_t part) { return partials_[part]; }
+        // merge the partials, one tuple per group.
+        // throw std::string if an aggregate exceeds INT.
+        join_result_buf_t result();
+    private:
+        const std::vector<agg_spec_t> specs_;
+        std::vector<uint32_t> key_at_; // KEY spec -> offset in the group key
+        std::vector<agg_hash_table_t> partials_;
+    };
+
+
+} // end namespace AP_SIMD_NAMESPACE
+} // end namespace DB::ap
@@ -1,26 +1,61 @@
 #pragma once
 #include <immintrin.h>
 #include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <new>
 
 #define likely(x) __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
 
+/*
+ * 8-lane int32 kernels, compiled for the ISA of the translation unit:
+ *      AVX512:     -mavx512f -mavx512vl, mask compare, masked gather/scatter and compress.
+ *      AVX2:       -mavx2.
+ *      SCALAR:     GCC vector extensions, gather/scatter lane by lane.
+ * libap_exec and the generated query are built per level, and the one
+ * `cpu::simd_level()` reports is linked at runtime.
+ */
+#if defined(__AVX512F__) && defined(__AVX512VL__)
+#define AP_SIMD_AVX512
+#define AP_SIMD_NAMESPACE avx512
+#elif defined(__AVX2__)
+#define AP_SIMD_AVX2
+#define AP_SIMD_NAMESPACE avx2
+#else
+#define AP_SIMD_NAMESPACE scalar
+#endif
+
+/*
+ * XJBDB exports its symbols (-rdynamic), and the dynamic linker binds the
+ * query and libap_exec_* to the first definition found, the baseline one in XJBDB.
+ * each level lives in its own inline namespace, so the symbols never interpose
+ * (and a `VECTOR_INT` passed in ymm is never received from memory).
+ */
 namespace DB::ap {
+inline namespace AP_SIMD_NAMESPACE {
 
     constexpr uint32_t VECTOR_SIZE = 8;
 
+    typedef int32_t v8si_t __attribute__ ((vector_size (32)));
+    typedef uint32_t v8su_t __attribute__ ((vector_size (32)));
+    typedef uint16_t v8hu_t __attribute__ ((vector_size (16)));
+
     struct VECTOR_INT {
-        __attribute__ ((aligned (32))) __m256i vec_;
-        int& operator[](uint32_t index) { return (reinterpret_cast<int32_t*>(&vec_))[index]; }
-        int operator[](uint32_t index) const { return (const_cast<int32_t*>(reinterpret_cast<const int32_t*>(&vec_)))[index]; }
+        // lanes are accessed through the union, an `int*` into `__m256i` breaks
+        // strict aliasing and -O2 may keep a stale lane across the SIMD writes.
+        union {
+            v8si_t v_;
+            __m256i vec_;
+            int32_t lane_[VECTOR_SIZE];
+        };
+        int& operator[](uint32_t index) { return lane_[index]; }
+        int operator[](uint32_t index) const { return lane_[index]; }
     };
-    inline VECTOR_INT get_vec(int32_t value) {
-        return { _mm256_set_epi32(value, value, value, value, value, value, value, value) };
-    }
+    inline VECTOR_INT get_vec(int32_t value) { return { v8si_t{} + value }; }
     static VECTOR_INT ZERO_VEC = { get_vec(0x0) };
     static VECTOR_INT ONE_VEC = { get_vec(0x1) };
-    static VECTOR_INT MAX_VEC = { get_vec(0x7FFFFFFF) };
-    static VECTOR_INT MIN_VEC = { get_vec(0xFFFFFFFF) };
+    static VECTOR_INT IOTA_VEC = { v8si_t{ 0, 1, 2, 3, 4, 5, 6, 7 } };
 
 
     struct VECTOR_BOOL {
@@ -30,138 +65,212 @@ namespace DB::ap {
         VECTOR_BOOL& operator&=(VECTOR_BOOL mask) { mask_ &= mask.mask_; return *this; }
         VECTOR_BOOL& operator|=(VECTOR_BOOL mask) { mask_ |= mask.mask_; return *this; }
     };
-    static VECTOR_BOOL TRUE_VEC = { 0xFF };
-    static VECTOR_BOOL FALSE_VEC = { 0x0 };
+
+
+    // 32B-aligned storage, so that a column can be read by `simd_load()`.
+    template<typename T>
+    struct simd_allocator {
+        using value_type = T;
+        static constexpr std::align_val_t alignment{ sizeof(__m256i) };
+        simd_allocator() = default;
+        template<typename U> simd_allocator(const simd_allocator<U>&) {}
+        T* allocate(std::size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), alignment)); }
+        void deallocate(T* p, std::size_t) { ::operator delete(p, alignment); }
+        template<typename U> bool operator==(const simd_allocator<U>&) const { return true; }
+        template<typename U> bool operator!=(const simd_allocator<U>&) const { return false; }
+    };
+
+
+    // SIMD load
+    inline VECTOR_INT simd_load(const int32_t* base) { return { *reinterpret_cast<const v8si_t*>(base) }; } // 32B-aligned
+    inline VECTOR_INT simd_loadu(const int32_t* base) {
+        VECTOR_INT vec;
+        std::memcpy(&vec.v_, base, sizeof(vec.v_));
+        return vec;
+    }
+    inline VECTOR_INT simd_loadu16(const uint16_t* base) {
+        v8hu_t vec;
+        std::memcpy(&vec, base, sizeof(vec));
+        return { __builtin_convertvector(vec, v8si_t) };
+    }
 
 
     // SIMD arithmetic
-    inline VECTOR_INT srl(VECTOR_INT vec) { return { _mm256_srli_epi32(vec.vec_, 1) }; }
-    inline VECTOR_INT simd_mod256(VECTOR_INT vec) { return { _mm256_srli_epi32(_mm256_slli_epi32(vec.vec_, 24), 24) }; }
+    inline VECTOR_INT srl(VECTOR_INT vec) { return { (v8si_t)((v8su_t)vec.v_ >> 1) }; }
+    inline VECTOR_INT simd_mod256(VECTOR_INT vec) { return { vec.v_ & 0xFF }; }
 
-    inline VECTOR_INT operator+(VECTOR_INT vec1, VECTOR_INT vec2) { return { _mm256_add_epi32(vec1.vec_, vec2.vec_) }; }
+    inline VECTOR_INT operator+(VECTOR_INT vec1, VECTOR_INT vec2) { return { vec1.v_ + vec2.v_ }; }
     inline VECTOR_INT operator+(VECTOR_INT vec, int32_t value) { return vec + get_vec(value); }
     inline VECTOR_INT operator+(int32_t value, VECTOR_INT vec) { return get_vec(value) + vec; }
 
-    inline VECTOR_INT operator-(VECTOR_INT vec1, VECTOR_INT vec2) { return { _mm256_sub_epi32(vec1.vec_, vec2.vec_) }; }
+    inline VECTOR_INT operator-(VECTOR_INT vec1, VECTOR_INT vec2) { return { vec1.v_ - vec2.v_ }; }
     inline VECTOR_INT operator-(VECTOR_INT vec, int32_t value) { return vec - get_vec(value); }
     inline VECTOR_INT operator-(int32_t value, VECTOR_INT vec) { return get_vec(value) - vec; }
 
-    inline VECTOR_INT operator*(VECTOR_INT vec1, VECTOR_INT vec2) { return { _mm256_mul_epi32(vec1.vec_, vec2.vec_) }; }
+    inline VECTOR_INT operator*(VECTOR_INT vec1, VECTOR_INT vec2) { return { vec1.v_ * vec2.v_ }; }
     inline VECTOR_INT operator*(VECTOR_INT vec, int32_t value) { return vec * get_vec(value); }
     inline VECTOR_INT operator*(int32_t value, VECTOR_INT vec) { return get_vec(value) * vec; }
 
 
     // SIMD logical operation
-    inline VECTOR_INT operator&(VECTOR_INT vec1, VECTOR_INT vec2) { return { _mm256_and_si256(vec1.vec_, vec2.vec_) }; }
+    inline VECTOR_INT operator&(VECTOR_INT vec1, VECTOR_INT vec2) { return { vec1.v_ & vec2.v_ }; }
     inline VECTOR_INT operator&(VECTOR_INT vec, int32_t value) { return vec & get_vec(value); }
     inline VECTOR_INT operator&(int32_t value, VECTOR_INT vec) { return get_vec(value) & vec; }
 
-    inline VECTOR_INT operator|(VECTOR_INT vec1, VECTOR_INT vec2) { return { _mm256_or_si256(vec1.vec_, vec2.vec_) }; }
+    inline VECTOR_INT operator|(VECTOR_INT vec1, VECTOR_INT vec2) { return { vec1.v_ | vec2.v_ }; }
     inline VECTOR_INT operator|(VECTOR_INT vec, int32_t value) { return vec | get_vec(value); }
     inline VECTOR_INT operator|(int32_t value, VECTOR_INT vec) { return get_vec(value) | vec; }
 
-    inline VECTOR_INT operator!(VECTOR_INT vec) { return ONE_VEC - vec; }
-    inline VECTOR_INT operator~(VECTOR_INT vec) { return { _mm256_andnot_si256(vec.vec_, MIN_VEC.vec_) }; }
-    inline VECTOR_INT simd_not1and2(VECTOR_INT vec1, VECTOR_INT vec2) { return { _mm256_andnot_si256(vec1.vec_, vec2.vec_) }; }
+    inline VECTOR_INT operator^(VECTOR_INT vec1, VECTOR_INT vec2) { return { vec1.v_ ^ vec2.v_ }; }
 
-    // return 0-1 mask
-    inline VECTOR_INT simd_compare_eq(VECTOR_INT vec1, VECTOR_INT vec2) { return { _mm256_srli_epi32(_mm256_cmpeq_epi32(vec1.vec_, vec2.vec_), 31) }; }
-    inline VECTOR_INT simd_compare_eq(VECTOR_INT vec, int32_t value) { return simd_compare_eq(vec, get_vec(value)); }
-    inline VECTOR_INT simd_compare_eq(int32_t value, VECTOR_INT vec) { return simd_compare_eq(get_vec(value), vec); }
-    // simd == with 0-1 mask, return 0-1 mask
-    inline VECTOR_INT simd_compare_eq_mask(VECTOR_INT vec1, VECTOR_INT vec2, VECTOR_INT mask) { return mask & VECTOR_INT{ _mm256_srli_epi32(_mm256_cmpeq_epi32(vec1.vec_, vec2.vec_), 31) }; }
-
-    inline VECTOR_INT simd_int2bool(VECTOR_INT vec) {
-        VECTOR_INT VEC_OVERFLOW = simd_compare_eq(vec, MIN_VEC);
-        for(int32_t i = 0; i < 32; i++) { // in fact, 31 round is enough
-            vec = srl(vec + 1);
-        }
-        return vec + VEC_OVERFLOW;
+    inline VECTOR_INT operator!(VECTOR_INT vec) { return ONE_VEC - vec; }
+    inline VECTOR_INT operator~(VECTOR_INT vec) { return { ~vec.v_ }; }
+    inline VECTOR_INT simd_not1and2(VECTOR_INT vec1, VECTOR_INT vec2) { return { ~vec1.v_ & vec2.v_ }; }
+    // lanes of `vec1` where 0-1 `mask` is 1, of `vec2` otherwise
+    inline VECTOR_INT simd_blend(VECTOR_INT mask, VECTOR_INT vec1, VECTOR_INT vec2) {
+        const v8si_t all = -mask.v_;
+        return { (all & vec1.v_) | (~all & vec2.v_) };
     }
 
 
-    // SIMD compare
-
-// Unfortunately, we donot have AVX512.
-// In addition, the `_mmask8` support is bizard, which leads to us using `_mm256i` as mask.
-/*
-    inline VECTOR_BOOL operator==(VECTOR_INT vec1, VECTOR_INT vec2) { return { _mm256_cmpeq_epi32_mask(vec1.vec_, vec2.vec_) }; }
-    inline VECTOR_BOOL operator==(VECTOR_INT vec, int32_t value) { return vec == get_vec(value); }
-    inline VECTOR_BOOL operator==(int32_t value, VECTOR_INT vec) { return get_vec(value) == vec; }
-
-    inline VECTOR_BOOL operator!=(VECTOR_INT vec1, VECTOR_INT vec2) { return { _mm256_cmpneq_epi32_mask(vec1.vec_, vec2.vec_) }; }
-    inline VECTOR_BOOL operator!=(VECTOR_INT vec, int32_t value) { return vec != get_vec(value); }
-    inline VECTOR_BOOL operator!=(int32_t value, VECTOR_INT vec) { return get_vec(value) != vec; }
-
-    inline VECTOR_BOOL operator<(VECTOR_INT vec1, VECTOR_INT vec2) { return { _mm256_cmplt_epi32_mask(vec1.vec_, vec2.vec_) }; }
-    inline VECTOR_BOOL operator<(VECTOR_INT vec, int32_t value) { return vec < get_vec(value); }
-    inline VECTOR_BOOL operator<(int32_t value, VECTOR_INT vec) { return get_vec(value) < vec; }
-
-    inline VECTOR_BOOL operator<=(VECTOR_INT vec1, VECTOR_INT vec2) { return { _mm256_cmple_epi32_mask(vec1.vec_, vec2.vec_) }; }
-    inline VECTOR_BOOL operator<=(VECTOR_INT vec, int32_t value) { return vec <= get_vec(value); }
-    inline VECTOR_BOOL operator<=(int32_t value, VECTOR_INT vec) { return get_vec(value) <= vec; }
+    // murmur3 finalizer, the lanes of `simd_hash32()` equal `hash32()`
+    inline uint32_t hash32(uint32_t h) {
+        h ^= h >> 16; h *= 0x85EBCA6B;
+        h ^= h >> 13; h *= 0xC2B2AE35;
+        return h ^ (h >> 16);
+    }
+    inline VECTOR_INT simd_hash32(VECTOR_INT vec) {
+        v8su_t h = (v8su_t)vec.v_;
+        h ^= h >> 16; h *= 0x85EBCA6B;
+        h ^= h >> 13; h *= 0xC2B2AE35;
+        return { (v8si_t)(h ^ (h >> 16)) };
+    }
 
-    inline VECTOR_BOOL operator>(VECTOR_INT vec1, VECTOR_INT vec2) { return { _mm256_cmpgt_epi32_mask(vec1.vec_, vec2.vec_) }; }
-    inline VECTOR_BOOL operator>(VECTOR_INT vec, int32_t value) { return vec > get_vec(value); }
-    inline VECTOR_BOOL operator>(int32_t value, VECTOR_INT vec) { return get_vec(value) > vec; }
 
-    inline VECTOR_BOOL operator>=(VECTOR_INT vec1, VECTOR_INT vec2) { return { _mm256_cmpge_epi32_mask(vec1.vec_, vec2.vec_) }; }
-    inline VECTOR_BOOL operator>=(VECTOR_INT vec, int32_t value) { return vec >= get_vec(value); }
-    inline VECTOR_BOOL operator>=(int32_t value, VECTOR_INT vec) { return get_vec(value) >= vec; }
-*/
+    // SIMD compare, return 0-1 mask
+#ifdef AP_SIMD_AVX512
+    inline VECTOR_INT mask2vec(__mmask8 mask) { return { (v8si_t)_mm256_maskz_set1_epi32(mask, 1) }; }
+    inline VECTOR_INT operator==(VECTOR_INT vec1, VECTOR_INT vec2) { return mask2vec(_mm256_cmpeq_epi32_mask(vec1.vec_, vec2.vec_)); }
+    inline VECTOR_INT operator!=(VECTOR_INT vec1, VECTOR_INT vec2) { return mask2vec(_mm256_cmpneq_epi32_mask(vec1.vec_, vec2.vec_)); }
+    inline VECTOR_INT operator<(VECTOR_INT vec1, VECTOR_INT vec2) { return mask2vec(_mm256_cmplt_epi32_mask(vec1.vec_, vec2.vec_)); }
+    inline VECTOR_INT operator<=(VECTOR_INT vec1, VECTOR_INT vec2) { return mask2vec(_mm256_cmple_epi32_mask(vec1.vec_, vec2.vec_)); }
+    inline VECTOR_INT operator>(VECTOR_INT vec1, VECTOR_INT vec2) { return mask2vec(_mm256_cmpgt_epi32_mask(vec1.vec_, vec2.vec_)); }
+    inline VECTOR_INT operator>=(VECTOR_INT vec1, VECTOR_INT vec2) { return mask2vec(_mm256_cmpge_epi32_mask(vec1.vec_, vec2.vec_)); }
+#else
+    // the comparison of vector extension gives -1 on true
+    inline VECTOR_INT operator==(VECTOR_INT vec1, VECTOR_INT vec2) { return { (vec1.v_ == vec2.v_) & 1 }; }
+    inline VECTOR_INT operator!=(VECTOR_INT vec1, VECTOR_INT vec2) { return { (vec1.v_ != vec2.v_) & 1 }; }
+    inline VECTOR_INT operator<(VECTOR_INT vec1, VECTOR_INT vec2) { return { (vec1.v_ < vec2.v_) & 1 }; }
+    inline VECTOR_INT operator<=(VECTOR_INT vec1, VECTOR_INT vec2) { return { (vec1.v_ <= vec2.v_) & 1 }; }
+    inline VECTOR_INT operator>(VECTOR_INT vec1, VECTOR_INT vec2) { return { (vec1.v_ > vec2.v_) & 1 }; }
+    inline VECTOR_INT operator>=(VECTOR_INT vec1, VECTOR_INT vec2) { return { (vec1.v_ >= vec2.v_) & 1 }; }
+#endif
 
-    inline VECTOR_INT operator==(VECTOR_INT vec1, VECTOR_INT vec2) { return { _mm256_srli_epi32(_mm256_cmpeq_epi32(vec1.vec_, vec2.vec_), 31) }; }
     inline VECTOR_INT operator==(VECTOR_INT vec, int32_t value) { return vec == get_vec(value); }
     inline VECTOR_INT operator==(int32_t value, VECTOR_INT vec) { return get_vec(value) == vec; }
-
-    inline VECTOR_INT operator!=(VECTOR_INT vec1, VECTOR_INT vec2) { return 1 - (vec1 == vec2); }
     inline VECTOR_INT operator!=(VECTOR_INT vec, int32_t value) { return vec != get_vec(value); }
     inline VECTOR_INT operator!=(int32_t value, VECTOR_INT vec) { return get_vec(value) != vec; }
-
-    inline VECTOR_INT operator<(VECTOR_INT vec1, VECTOR_INT vec2) { return { _mm256_srli_epi32((vec1 - vec2).vec_, 31) }; }
     inline VECTOR_INT operator<(VECTOR_INT vec, int32_t value) { return vec < get_vec(value); }
     inline VECTOR_INT operator<(int32_t value, VECTOR_INT vec) { return get_vec(value) < vec; }
-
-    inline VECTOR_INT operator<=(VECTOR_INT vec1, VECTOR_INT vec2) { return 1 - VECTOR_INT{ _mm256_srli_epi32((vec2 - vec1).vec_, 31) }; }
     inline VECTOR_INT operator<=(VECTOR_INT vec, int32_t value) { return vec <= get_vec(value); }
     inline VECTOR_INT operator<=(int32_t value, VECTOR_INT vec) { return get_vec(value) <= vec; }
-
-    inline VECTOR_INT operator>(VECTOR_INT vec1, VECTOR_INT vec2) { return { _mm256_srli_epi32((vec2 - vec1).vec_, 31) }; }
     inline VECTOR_INT operator>(VECTOR_INT vec, int32_t value) { return vec > get_vec(value); }
     inline VECTOR_INT operator>(int32_t value, VECTOR_INT vec) { return get_vec(value) > vec; }
-
-    inline VECTOR_INT operator>=(VECTOR_INT vec1, VECTOR_INT vec2) { return 1 - VECTOR_INT{ _mm256_srli_epi32((vec1 - vec2).vec_, 31) }; }
     inline VECTOR_INT operator>=(VECTOR_INT vec, int32_t value) { return vec >= get_vec(value); }
     inline VECTOR_INT operator>=(int32_t value, VECTOR_INT vec) { return get_vec(value) >= vec; }
 
+    inline VECTOR_INT simd_compare_eq(VECTOR_INT vec1, VECTOR_INT vec2) { return vec1 == vec2; }
+    inline VECTOR_INT simd_compare_eq(VECTOR_INT vec, int32_t value) { return simd_compare_eq(vec, get_vec(value)); }
+    inline VECTOR_INT simd_compare_eq(int32_t value, VECTOR_INT vec) { return simd_compare_eq(get_vec(value), vec); }
+    // simd == with 0-1 mask, return 0-1 mask
+    inline VECTOR_INT simd_compare_eq_mask(VECTOR_INT vec1, VECTOR_INT vec2, VECTOR_INT mask) { return mask & (vec1 == vec2); }
+
+    inline VECTOR_INT simd_int2bool(VECTOR_INT vec) { return vec != ZERO_VEC; }
 
 
-    inline bool simd_all_eq(VECTOR_BOOL mask1, VECTOR_BOOL mask2) { return mask1.mask_ == mask2.mask_; }
-    inline bool simd_all_eq(VECTOR_INT vec1, VECTOR_INT vec2) {
-        // return simd_all_eq({ _mm256_cmpeq_epi32_mask(vec1.vec_, vec2.vec_) }, TRUE_VEC);
-        // no SIMD support on AVX2
+    // 0-1 mask to bitmask, lane i is bit i
+    inline uint32_t simd_movemask(VECTOR_INT mask) {
+#if defined(AP_SIMD_AVX512)
+        return _mm256_test_epi32_mask(mask.vec_, mask.vec_);
+#elif defined(AP_SIMD_AVX2)
+        return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_slli_epi32(mask.vec_, 31)));
+#else
+        uint32_t bits = 0;
         for(uint32_t i = 0; i < VECTOR_SIZE; i++)
-            if(likely(vec1[i] != vec2[i]))
-                return false;
-        return true;
+            bits |= static_cast<uint32_t>(mask[i] & 1) << i;
+        return bits;
+#endif
     }
+
+    inline bool simd_all_eq(VECTOR_BOOL mask1, VECTOR_BOOL mask2) { return mask1.mask_ == mask2.mask_; }
+    inline bool simd_all_eq(VECTOR_INT vec1, VECTOR_INT vec2) { return simd_movemask(vec1 == vec2) == 0xFF; }
     inline bool simd_all_eq(VECTOR_INT vec, int value) { return simd_all_eq(vec, get_vec(value)); }
 
-    // SIMD gather/scatter
-    inline VECTOR_INT zero_one_mask_2_vector_mask(VECTOR_INT mask) { return { _mm256_slli_epi32(mask.vec_, 31) }; }
+    // write the lanes of `vec` selected by 0-1 `mask` to `out` in order, return the amount.
+    // NB: up to VECTOR_SIZE elements may be written.
+    inline uint32_t simd_compress_u16(uint16_t* out, VECTOR_INT vec, VECTOR_INT mask) {
+#ifdef AP_SIMD_AVX512
+        const __mmask8 bits = _mm256_test_epi32_mask(mask.vec_, mask.vec_);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                         _mm256_cvtepi32_epi16(_mm256_maskz_compress_epi32(bits, vec.vec_)));
+        return __builtin_popcount(bits);
+#else
+        uint32_t size = 0;
+        for(uint32_t bits = simd_movemask(mask); bits != 0; bits &= bits - 1) {
+            out[size++] = vec[__builtin_ctz(bits)];
+        }
+        return size;
+#endif
+    }
+
+
+    // SIMD gather/scatter, `mask` is 0-1
     inline VECTOR_INT simd_gatheri32(const int32_t* base, VECTOR_INT index) {
-        return { _mm256_i32gather_epi32(base, index.vec_, sizeof(int32_t)) };
+#if defined(AP_SIMD_AVX512) || defined(AP_SIMD_AVX2)
+        return { (v8si_t)_mm256_i32gather_epi32(base, index.vec_, sizeof(int32_t)) };
+#else
+        VECTOR_INT vec;
+        for(uint32_t i = 0; i < VECTOR_SIZE; i++)
+            vec[i] = base[index[i]];
+        return vec;
+#endif
     }
     inline VECTOR_INT simd_mask_gatheri32(VECTOR_INT src, const int32_t* base, VECTOR_INT index, VECTOR_INT mask) {
-        return { _mm256_mask_i32gather_epi32(src.vec_, base, index.vec_, mask.vec_, sizeof(int32_t)) };
+#if defined(AP_SIMD_AVX512)
+        return { (v8si_t)_mm256_mmask_i32gather_epi32(src.vec_, _mm256_test_epi32_mask(mask.vec_, mask.vec_),
+                                                      index.vec_, base, sizeof(int32_t)) };
+#elif defined(AP_SIMD_AVX2)
+        return { (v8si_t)_mm256_mask_i32gather_epi32(src.vec_, base, index.vec_,
+                                                     _mm256_slli_epi32(mask.vec_, 31), sizeof(int32_t)) };
+#else
+        for(uint32_t i = 0; i < VECTOR_SIZE; i++)
+            if(mask[i])
+                src[i] = base[index[i]];
+        return src;
+#endif
     }
 
-#ifdef AVX512
-    inline void scatter(int32_t* base, VECTOR_INT index, VECTOR_INT vec, int32_t scale) {
-        _mm256_i32scatter_epi32(base, index.vec_, vec.vec_, scale);
+    // lanes with the same index are written in order
+    inline void simd_scatteri32(int32_t* base, VECTOR_INT index, VECTOR_INT vec) {
+#ifdef AP_SIMD_AVX512
+        _mm256_i32scatter_epi32(base, index.vec_, vec.vec_, sizeof(int32_t));
+#else
+        for(uint32_t i = 0; i < VECTOR_SIZE; i++)
+            base[index[i]] = vec[i];
+#endif
     }
+    inline void simd_mask_scatteri32(int32_t* base, VECTOR_INT index, VECTOR_INT vec, VECTOR_INT mask) {
+#ifdef AP_SIMD_AVX512
+        _mm256_mask_i32scatter_epi32(base, _mm256_test_epi32_mask(mask.vec_, mask.vec_),
+                                     index.vec_, vec.vec_, sizeof(int32_t));
+#else
+        for(uint32_t i = 0; i < VECTOR_SIZE; i++)
+            if(mask[i])
+                base[index[i]] = vec[i];
 #endif
+    }
 
 
 
-} // end namespace DB::ap
\ No newline at end of file
+} // end namespace AP_SIMD_NAMESPACE
+} // end namespace DB::ap
@@ -7,6 +7,7 @@
 #include "sql_expr.h"
 #include "page.h"
 #include "table.h"
+#include "ap_exec.h"
 #include <utility>
 #include <memory>
 #include <vector>
@@ -52,16 +53,25 @@ namespace std {
 namespace DB::ast {
 
     //op nodes of ap
-    enum class ap_op_t_t { EMIT, PROJECT, FILTER, JOIN, TABLE };
+    enum class ap_op_t_t { EMIT, PROJECT, FILTER, JOIN, TABLE, AGGREGATE };
 
     using col_name_t = pair<string, string>;
 
+    // an item of select list, `column_` is {"", ""} for COUNT($)
+    struct APAggregate {
+        ap::agg_t_t agg_t_;
+        col_name_t column_;
+        string get_name() const;
+    };
+
     class APMap {
         friend class query::APSelectInfo;
     public:
         APMap() {}
         // init from source table
         APMap(const table::TableInfo& table);
+        // init from output columns, laid out in order
+        APMap(const vector<pair<col_name_t, page::col_range_t>>& cols);
         void join(const APMap& right, page::range_t left_range, page::range_t right_range);
         page::range_t get(const col_name_t&);
         uint32_t len() const;
@@ -94,7 +104,7 @@ namespace DB::ast {
 
     struct APEmitOp : public  APBaseOp {
         APEmitOp(APBaseOp *table, int hashTableCount, int tableCount)
-            : APBaseOp(ap_op_t_t::EMIT, table->get_table_name()), _table(table), _hashTableCount(hashTableCount), _tableCount(tableCount) {}
+            : APBaseOp(ap_op_t_t::EMIT, table->get_table_name()), _hashTableCount(hashTableCount), _tableCount(tableCount), _table(table) {}
         virtual ~APEmitOp() {}
 
         virtual void produce();
@@ -133,8 +143,8 @@ namespace DB::ast {
                  col_name_t rightAttr, int hashTableIndex)
             : APBaseOp(ap_op_t_t::JOIN,
                        tableLeft->get_table_name() + " join " + tableRight->get_table_name()),
-              _tableLeft(tableLeft), _tableRight(tableRight),
-              _leftAttr(leftAttr), _rightAttr(rightAttr), _hashTableIndex(hashTableIndex)
+              _hashTableIndex(hashTableIndex), _tableLeft(tableLeft), _tableRight(tableRight),
+              _leftAttr(leftAttr), _rightAttr(rightAttr)
             {}
         virtual ~APJoinOp() {}
 
@@ -153,6 +163,20 @@ namespace DB::ast {
         bool isUnique;
     };
 
+    struct APAggregateOp : public APBaseOp {
+        APAggregateOp(APBaseOp *table, vector<col_name_t> groupBy, vector<APAggregate> aggregates)
+            : APBaseOp(ap_op_t_t::AGGREGATE, table->get_table_name()), _table(table),
+              _groupBy(std::move(groupBy)), _aggregates(std::move(aggregates)) {}
+        virtual ~APAggregateOp() {}
+
+        virtual void produce();
+        virtual void consume(APBaseOp *source, APMap &map);
+
+        APBaseOp *_table;
+        vector<col_name_t> _groupBy;
+        vector<APAggregate> _aggregates;
+    };
+
     struct APTableOp : public APBaseOp {
         APTableOp(const table::TableInfo& table, string tableName, int tableIndex);
         virtual ~APTableOp() {}
@@ -177,6 +201,17 @@ namespace DB::ast {
 
     void apCheckVisit(vector<shared_ptr<BaseExpr>> &conditions);
 
+    /*
+     * check select list and GROUP BY
+     *  GROUP BY goes with a select list, a select list without GROUP BY has an aggregate
+     *  columns exist in the selected tables
+     *  SUM/MIN/MAX/AVG are on INTEGER
+     *  column in select list is in GROUP BY
+     * throw exception if check fails
+     */
+    void apCheckAggregate(const vector<string> &tables, const vector<col_name_t> &groupBy,
+                          const vector<APAggregate> &aggregates);
+
 
     using Column = std::pair<string, string>;
 
@@ -184,9 +219,10 @@ namespace DB::ast {
      * functions
      *  generate ast for compile
      *  default select all
-     *  currently don't handle select
+     *  currently don't handle select, except aggregation
      */
-    shared_ptr<APEmitOp> generateAst(const vector<string> &tables, const vector<shared_ptr<BaseExpr>> &conditions, vector<Column> columns = {});
+    shared_ptr<APEmitOp> generateAst(const vector<string> &tables, const vector<shared_ptr<BaseExpr>> &conditions, vector<Column> columns = {},
+                                     const vector<col_name_t> &groupBy = {}, const vector<APAggregate> &aggregates = {});
 
     /*
      * functions
@@ -27,13 +27,26 @@ namespace DB::buffer
         BufferPoolManager& operator=(const BufferPoolManager&) = delete;
         BufferPoolManager& operator=(BufferPoolManager&&) = delete;
 
-        BufferPoolManager(disk::DiskManager* disk_manager);
+        // `frame_budget` is the number of pages cached in bufferpool,
+        // pinned pages are never evicted, so the budget might be exceeded temporarily.
+        BufferPoolManager(disk::DiskManager* disk_manager,
+            uint32_t frame_budget = Hash_LRU::default_frame_budget,
+            replace_policy_t policy = replace_policy_t::TWO_Q);
+        ~BufferPoolManager();
 
         // return the corresponding Page*.
         // the Page* is `ref()` before return.
         // note that the Page* might be evicted from lru.
         // user should *`unref()`* the page after use ! ! !
-        Page* FetchPage(page_id_t page_id);
+        // `use_once` is the hint for sequential scan, the page neither promotes on hit,
+        // nor stays long after use.
+        // the process exits on a corrupted page, see `DiskManager::ReadPage()`.
+        Page* FetchPage(page_id_t page_id, bool use_once = false);
+
+        // read the leaf `page_id` and the `leaf_num - 1` leaves after it ahead, with their value pages.
+        // return at once, the later `FetchPage()` of them then hit the OS page cache.
+        // the leaves in the bufferpool are skipped, see `DiskManager::Prefetch()` for `mark`.
+        void Prefetch(page_id_t page_id, uint32_t leaf_num, std::shared_ptr<disk::ReadAheadMark> mark = nullptr);
 
         // flush the page in the bufferpool, return true.
         // if the page is not in the bufferpool, return false,
@@ -59,6 +72,8 @@ namespace DB::buffer
     private:
         friend class vm::VM;
         friend void debug::debug_page(bool config, const page::page_id_t, buffer::BufferPoolManager*);
+        // true if `page_id` is a leaf in the bufferpool, along with its right leaf.
+        bool cached_leaf(page_id_t page_id, page_id_t& next_page_id);
         Hash_LRU hash_lru_;
 
     }; // end class BufferPoolManager
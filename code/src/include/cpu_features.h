@@ -0,0 +1,14 @@
+#pragma once
+#include <cstdint>
+
+namespace DB::cpu {
+
+    // widest SIMD the host runs, by cpuid once at startup.
+    // AVX512 means AVX-512F + AVX-512VL, the 8-lane kernels use the VL forms.
+    enum class simd_level_t :uint32_t { SCALAR, AVX2, AVX512 };
+    constexpr const char* simd_level_str[] = { "SCALAR", "AVX2", "AVX512" };
+
+    simd_level_t simd_level();
+    bool has_sse42();
+
+} // end namespace DB::cpu
@@ -0,0 +1,12 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+namespace DB {
+
+    // CRC32C (Castagnoli), by the SSE4.2 `crc32` instruction,
+    // slicing-by-8 on the hosts without it.
+    // `crc` is the value of the previous part, chain the parts as `crc32c(crc32c(0, a, n), b, m)`.
+    uint32_t crc32c(uint32_t crc, const char* buffer, std::size_t len);
+
+} // end namespace DB
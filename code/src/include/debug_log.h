@@ -16,6 +16,7 @@ namespace DB::debug
         PAGE_READ = false,
         PAGE_WRITE = false,
         PAGE_GC = false,
+        IO_ENGINE = false,
         PAGE_FLUSH = false,         // (page) PAGE_FLUSH -> (buffer) BUFFER_FLUSH
 
         BUFFER_FETCH = false,
@@ -2,12 +2,18 @@
 #define _DISK_MANAGER_H
 #include "page.h"
 #include "env.h"
-#include <fstream>
+#include "io_engine.h"
 #include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <atomic>
 #include <shared_mutex>
 #include <unordered_set>
 #include <condition_variable>
+#include <thread>
+#include <functional>
 
 namespace DB::vm { class VM; }
 
@@ -19,10 +25,42 @@ namespace DB::disk
     static const char* db_name = "db.xjbDB";
     static const char* log_name = "db.xjbDB.log";
 
-    enum log_state_t { CORRUPTION, OK, UNDO, REDO };
+    // where the read ahead of a scan stops, namely the first leaf not read ahead yet,
+    // NOT_A_PAGE while the reads are in flight, or past the last leaf.
+    struct ReadAheadMark {
+        std::atomic<page_id_t> next_{ page::NOT_A_PAGE };
+    };
 
     /*
      * record any DB file, and record LOG
+     *
+     * redo log: append-only, every record is stamped with an LSN, namely its offset in the log.
+     *      the first write of a page since the last checkpoint began logs the full image (full-page write),
+     *      the later ones log the changed bytes against the previous image.
+     *      so the replay never reads a base from the db file, where a crash in the write-back may tear the page.
+     *      `commit()` appends a COMMIT record and fdatasyncs the log, that is the commit point.
+     *      the page images are kept in `pending_writes_`, and written back at checkpoint.
+     *      no-steal, an uncommitted page never reaches the db file, so there is no undo.
+     *      NB: the pages dirtied by the running statement stay in `pending_writes_` until it commits,
+     *          so a single large statement (LOAD into a non-empty table, a big UPDATE) is bounded by memory only.
+     *          the committed pages are written back once they pass `checkpoint_pending_num`, see `begin_write_back()`.
+     *
+     * fuzzy checkpoint: at a commit, `pending_writes_` is handed over to `checkpoint_writes_`,
+     *      then the checkpointer writes them back in batch while the statements go on,
+     *      and records the LSN of that commit in DB meta (`offset::CHECKPOINT_LSN`).
+     *      the recovery replays from that LSN, the log before it is punched out.
+     *
+     * free space: a bitmap, a bit per page, set if the page is in use.
+     *      each bitmap page covers `bitmap_page_num` pages, and sits at the 2nd page of them.
+     *      a page is allocated close to the hinted page first, so that siblings stay adjacent on disk,
+     *      then the lowest free page, then the file grows.
+     *      the dirty bitmap pages are logged at commit, along with the pages they describe.
+     *      the db file itself is preallocated by `file_extent_size` ahead of the write-back.
+     *      the scans read the written-back pages through a read-only mapping of the db file,
+     *      and read ahead the leaf chain by the prefetcher.
+     *
+     * page checksum: every page written back is stamped with a CRC32C in its trailer
+     *      (`offset::PAGE_CHECKSUM`), and verified when read from the db file.
      */
     class DiskManager
     {
@@ -41,49 +79,69 @@ namespace DB::disk
         DiskManager();
         ~DiskManager();
 
-        // reset next_free_page_id
         void set_vm(vm::VM* vm);
 
         page_id_t get_cut_page_id() const;
 
-        void set_cur_page_id(page_id_t);
+        // the db file is reserved up to here, it grows by `file_extent_size`.
+        page_id_t get_allocated_page_no() const;
 
-        // used for vm init
-        void init_set_next_free_page_id(page_id_t);
-
-        // return previous free head page
-        // used for page set free itself
-        page_id_t set_next_free_page_id(page_id_t);
+        // used for page set free itself, the page is reused after it has been flushed.
+        void FreePage(page_id_t);
 
         // no validation on `page_id`
         // the length of `page_data` should not surpass `PAGE_SIZE`
+        // the page is logged as redo and copied, then written back at the next checkpoint,
+        // the later `ReadPage()` is served from the pending copy.
+        // NB: not durable until `commit()`.
         void WritePage(page_id_t page_id, const char(&page_data)[page::PAGE_SIZE]);
 
+        // append COMMIT, then fdatasync the log.
+        // called after flush, wake the checkpointer if the log or the pending pages grow too large.
+        // false if the log cannot be written or synced, the records since the last commit are cut off then.
+        bool commit();
+
         // Concurrency: maybe wait until the page has been flushed.
         // no validation on `page_id`
         // the length of `page_data` should be enough to hold `PAGE_SIZE`
         // return true on read success,
-        //        false when the page maybe has been read by other threads.
+        //        false when the page fails its checksum, namely corrupted, never parse it.
         bool ReadPage(page_id_t page_id, char(&page_data)[page::PAGE_SIZE]);
 
-        page_id_t AllocatePage();
+        // read `n` pages in one submission, return when all have completed.
+        // false if any page fails its checksum, as `ReadPage()`.
+        bool ReadPages(const page_id_t* page_ids, char* const* page_datas, uint32_t n);
 
-        uint32_t hash(page_id_t page_id) const noexcept;
+        // the page in the read-only mapping of the db file, parse it without copying into a buffer.
+        // nullptr if the newest image has not been written back, the page is beyond the mapping,
+        // or fails its checksum, then read it by `ReadPage()`.
+        // NB: valid while no one flushes, namely within a statement.
+        const char* MapPage(page_id_t page_id);
 
-        bool is_dirty(page_id_t page_id) const;
+        // read ahead the leaf `page_id` and its value page, then the `leaf_num - 1` leaves after it
+        // along `NEXT_PAGE_ID`, into the OS page cache. return at once,
+        // the prefetcher follows the chain as the reads complete, the later reads then never wait on the disk.
+        // `mark` is where the scan goes on next time, see `ReadAheadMark`.
+        void Prefetch(page_id_t page_id, uint32_t leaf_num, std::shared_ptr<ReadAheadMark> mark = nullptr);
 
-        void set_dirty(page_id_t page_id);
+        // the leaves cached in the buffer pool are not read ahead, but followed by their link.
+        // true if `page_id` is such a leaf, along with its next leaf. empty to unset.
+        using cached_leaf_t = std::function<bool(page_id_t page_id, page_id_t& next_page_id)>;
+        void set_cached_leaf(cached_leaf_t);
 
-        // if need redo, send replay sql to vm
-        log_state_t check_log_state();
-        // only replay undo
-        void replay_log(disk::log_state_t);
+        // allocate a page right after `near` if possible, see `near_extent_num`.
+        page_id_t AllocatePage(page_id_t near = page::NOT_A_PAGE);
 
-        // write log for undo and redo
-        void doWAL(const page_id_t prev_last_page_id, const std::string& sql);
+        // the page size and the format recorded in DB meta when the DB was created.
+        // the current ones if DB meta has not been written back yet.
+        uint32_t read_db_page_size();
+        uint32_t read_db_format();
 
-        // after flush
-        void detroy_log();
+        uint32_t hash(page_id_t page_id) const noexcept;
+
+        bool is_dirty(page_id_t page_id) const;
+
+        void set_dirty(page_id_t page_id);
 
 
 
@@ -93,11 +151,58 @@ namespace DB::disk
         DiskManager& operator=(DiskManager&&) = delete;
 
         bool dn_init_;
+        bool compatible_;   // a db file of other format or page size is never recovered nor written.
 
     private:
 
-        bool check_undo();
-        bool check_redo();
+        // replay the committed records since the checkpoint LSN onto the db file, called on open.
+        // the log is read once, then replayed by the workers partitioned on page_id.
+        // false if a page cannot be replayed, the log is kept for the next open.
+        bool recover();
+
+        // read the bitmap pages up to `cur_page_no_`, or set up the first one for an empty DB.
+        // false if a bitmap page is corrupted.
+        bool load_bitmap();
+        // write the dirty bitmap pages, before the COMMIT record.
+        void log_bitmap();
+        // the first free page in [from, to), under `alloc_mtx_`.
+        page_id_t find_free(page_id_t from, page_id_t to) const;
+        void set_used(page_id_t page_id, bool used);
+        static page_id_t bitmap_page_id(uint32_t group) { return group * bitmap_page_num + 1; }
+
+        // preallocate the db file by extents, to hold the page `last_page_id`.
+        // called before the write-back, the writes then never change the file size.
+        void reserve_file(page_id_t last_page_id);
+
+        // hand over `pending_writes_` at the current commit, under `write_mtx_`.
+        void begin_checkpoint();
+        // hand over the committed part of `pending_writes_` within a statement, under `write_mtx_`.
+        void begin_write_back();
+        // write back `checkpoint_writes_`, then record the checkpoint LSN.
+        void do_checkpoint();
+        void checkpointer();
+        bool write_checkpoint_lsn(off_t lsn);
+
+        // append a redo record into `log_buffer_`, under `write_mtx_`.
+        void append_log(uint32_t type, page_id_t page_id, const char* body, uint32_t len);
+        void append_delta(page_id_t page_id, const char* before, const char* after);
+
+        struct PendingWrite;
+        // submit a batch of the staged writes, `write_mtx_` is released during the submission.
+        void submit_writes(std::unique_lock<std::mutex>&);
+        static void on_write_complete(IORequest*);
+
+        struct PrefetchTask {
+            page_id_t page_id_;
+            uint32_t leaf_num_;     // the leaves left to follow after this page
+            std::shared_ptr<ReadAheadMark> mark_;   // nullptr on the value page
+        };
+        struct PrefetchRead;
+        void prefetcher();
+        static void follow_leaf(const char* page_data, const PrefetchTask& task, std::vector<PrefetchTask>& tasks);
+        static void on_prefetch_complete(IORequest*);
+        // the newest image not on disk yet, under `write_mtx_`.
+        PendingWrite* find_pending(page_id_t page_id) const;
 
     private:
 
@@ -105,21 +210,64 @@ namespace DB::disk
 
         std::atomic<page_id_t> cur_page_no_; // the last used page_id
 
-        page_id_t next_free_page_id_;
-        std::atomic_flag next_free_page_id_lock_ = ATOMIC_FLAG_INIT;
+        // free-space bitmap, the words of all bitmap pages in order, under `alloc_mtx_`.
+        static constexpr uint32_t bitmap_word_num = (page::offset::PAGE_CHECKSUM - page::offset::BITMAP_START) / 8;
+        static constexpr uint32_t bitmap_page_num = bitmap_word_num * 64;
+        static constexpr uint32_t near_extent_num = 4;  // the 64-page extents searched after the hint
+        std::mutex alloc_mtx_;
+        std::vector<uint64_t> bitmap_;
+        std::vector<bool> bitmap_dirty_;    // per bitmap page
+        page_id_t first_free_ = 0;          // no free page below it
 
         std::unordered_set<page_id_t> dirty_page_sets_[dirty_hash_bucket];
         mutable std::shared_mutex dirty_page_sets_mtx_[dirty_hash_bucket];
         //std::unordered_map<page_id_t, WaitInfo*> wait_sets_[dirty_hash_bucket];
         //mutable std::mutex wait_sets_mtx_[dirty_hash_bucket];
 
-        // stream to write db file
+        // db file, accessed by pread/pwrite only, no shared file offset
         const std::string file_name_;
-        std::fstream db_io_;
+        int db_fd_;
+        const char* db_map_ = nullptr;      // read-only, never remapped, see `map_size`
+        static constexpr std::size_t map_size = std::size_t(1) << 36;
+        std::atomic<page_id_t> allocated_page_no_{ 0 };
+        static constexpr off_t file_extent_size = 64 << 20;
 
-        // stream to write log file
+        // log file
         const std::string log_name_;
-        std::fstream log_io_;
+        int log_fd_;
+
+        off_t log_size_ = 0;        // the committed log end, namely the next LSN
+        std::string log_buffer_;    // the records since the last commit
+
+        static constexpr off_t checkpoint_log_size = 16 << 20;
+        static constexpr uint32_t recovery_worker_num = 8;
+        static constexpr uint32_t checkpoint_pending_num = (16 << 20) / PAGE_SIZE;
+
+        static constexpr uint32_t write_batch_size = 32;
+        std::unique_ptr<IOEngine> io_engine_;
+        std::mutex write_mtx_;
+        std::condition_variable write_cv_;
+        std::unordered_map<page_id_t, PendingWrite*> pending_writes_;     // logged since the checkpoint began
+        std::unordered_map<page_id_t, PendingWrite*> checkpoint_writes_;  // being written back
+        std::vector<PendingWrite*> staged_writes_;                        // not submitted yet
+        std::unordered_set<page_id_t> uncommitted_;                       // written since the last commit, in `pending_writes_`
+
+        off_t checkpoint_lsn_ = 0;          // durable in DB meta
+        off_t checkpoint_begin_lsn_ = 0;
+        bool checkpoint_running_ = false;
+        bool checkpoint_stop_ = false;
+        std::condition_variable checkpoint_cv_;
+        std::thread checkpointer_;
+
+        static constexpr uint32_t prefetch_inflight_num = 64;
+        std::mutex prefetch_mtx_;
+        std::condition_variable prefetch_cv_;
+        std::vector<PrefetchTask> prefetch_tasks_;
+        std::unordered_set<page_id_t> prefetching_;     // in flight
+        std::mutex cached_leaf_mtx_;
+        cached_leaf_t cached_leaf_;
+        bool prefetch_stop_ = false;
+        std::thread prefetcher_;
 
     }; // end class DiskManager
 
@@ -0,0 +1,173 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <thread>
+
+namespace DB::util
+{
+
+    // epoch-based reclamation, refer to "Practical lock-freedom" (Keir Fraser).
+    //
+    // the lock-free reader enters a `Guard` before touching the shared object,
+    // the writer unlinks the object, then `retire()` instead of `delete`.
+    // the object is freed 2 epochs later, by then no reader can still hold it.
+    //
+    //  {
+    //      EpochManager::Guard guard;
+    //      // traverse the lock-free list
+    //  }
+    //
+    class EpochManager
+    {
+        static constexpr uint64_t inactive = 0;
+        static constexpr uint32_t max_slots = 256;
+        static constexpr uint32_t reclaim_period = 64;     // try reclaim per 64 retires
+
+        struct alignas(64) slot_t {
+            std::atomic<uint64_t> epoch_{ inactive };
+            std::atomic<bool> owned_{ false };
+        };
+
+        struct retired_t {
+            void* ptr_;
+            void(*deleter_)(void*);
+            uint64_t epoch_;
+        };
+
+        // slot is released on thread exit.
+        struct local_t {
+            EpochManager* manager_ = nullptr;
+            uint32_t slot_ = max_slots;
+            uint32_t depth_ = 0;
+            ~local_t() {
+                if (manager_ != nullptr && slot_ != max_slots)
+                    manager_->slots_[slot_].owned_.store(false, std::memory_order_release);
+            }
+        };
+
+    public:
+
+        class Guard {
+        public:
+            Guard() { instance().enter(); }
+            ~Guard() { instance().leave(); }
+            Guard(const Guard&) = delete;
+            Guard& operator=(const Guard&) = delete;
+        };
+
+        static EpochManager& instance() {
+            static EpochManager manager;
+            return manager;
+        }
+
+        template<typename T>
+        void retire(T* ptr) {
+            bool reclaim;
+            {
+                std::lock_guard<std::mutex> lg{ retired_mtx_ };
+                retired_.push_back(retired_t{ ptr, [](void* p) { delete static_cast<T*>(p); },
+                    global_epoch_.load(std::memory_order_seq_cst) });
+                reclaim = ++retire_count_ % reclaim_period == 0;
+            }
+            if (reclaim)
+                try_reclaim();
+        }
+
+        // free all the retired objects, the caller promises no reader is active.
+        // the deleter might retire more, e.g. LeafPage retires its ValuePage.
+        void drain() {
+            while (true) {
+                std::vector<retired_t> garbage;
+                {
+                    std::lock_guard<std::mutex> lg{ retired_mtx_ };
+                    garbage.swap(retired_);
+                }
+                if (garbage.empty())
+                    return;
+                for (retired_t& r : garbage)
+                    r.deleter_(r.ptr_);
+            }
+        }
+
+        EpochManager(const EpochManager&) = delete;
+        EpochManager& operator=(const EpochManager&) = delete;
+
+    private:
+
+        EpochManager() = default;
+
+        void enter() {
+            local_t& local = get_local();
+            if (local.depth_++ > 0)
+                return;
+            slots_[local.slot_].epoch_.store(global_epoch_.load(std::memory_order_seq_cst),
+                std::memory_order_seq_cst);
+        }
+
+        void leave() {
+            local_t& local = get_local();
+            if (--local.depth_ > 0)
+                return;
+            slots_[local.slot_].epoch_.store(inactive, std::memory_order_release);
+        }
+
+        // advance the epoch if all the active readers have observed the current one,
+        // then free the objects retired 2 epochs ago.
+        void try_reclaim() {
+            uint64_t epoch = global_epoch_.load(std::memory_order_seq_cst);
+            bool advance = true;
+            for (const slot_t& slot : slots_) {
+                const uint64_t e = slot.epoch_.load(std::memory_order_seq_cst);
+                if (e != inactive && e != epoch) {
+                    advance = false;
+                    break;
+                }
+            }
+            if (advance && global_epoch_.compare_exchange_strong(epoch, epoch + 1))
+                epoch++;
+
+            std::vector<retired_t> garbage;
+            {
+                std::lock_guard<std::mutex> lg{ retired_mtx_ };
+                auto it = retired_.begin();
+                for (const retired_t& r : retired_) {
+                    if (r.epoch_ + 2 <= epoch)
+                        garbage.push_back(r);
+                    else
+                        *it++ = r;
+                }
+                retired_.erase(it, retired_.end());
+            }
+            for (retired_t& r : garbage)
+                r.deleter_(r.ptr_);
+        }
+
+        local_t& get_local() {
+            thread_local local_t local;
+            if (local.slot_ == max_slots) {
+                local.manager_ = this;
+                while (true) {
+                    for (uint32_t i = 0; i < max_slots; i++) {
+                        bool expected = false;
+                        if (slots_[i].owned_.compare_exchange_strong(expected, true)) {
+                            local.slot_ = i;
+                            return local;
+                        }
+                    }
+                    std::this_thread::yield(); // too many threads, wait for someone exiting.
+                }
+            }
+            return local;
+        }
+
+        std::atomic<uint64_t> global_epoch_{ 1 };
+        slot_t slots_[max_slots];
+        std::mutex retired_mtx_;
+        std::vector<retired_t> retired_;
+        uint64_t retire_count_ = 0;
+
+    }; // end class EpochManager
+
+} // end namespace DB::util
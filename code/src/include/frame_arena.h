@@ -0,0 +1,59 @@
+#ifndef _FRAME_ARENA_H
+#define _FRAME_ARENA_H
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include "env.h"
+
+namespace DB::buffer
+{
+
+    // fixed-size slots mapped once, recycled by a lock-free free list.
+    // with `HUGE_PAGE` defined, the region is backed by 2MB huge pages if possible,
+    // otherwise transparent huge page is advised.
+    //
+    // `allocate()` returns nullptr when exhausted, the caller falls back to the heap,
+    // so the slots cap the memory of the pages in steady state only, the cap is soft:
+    // the pinned pages and the retired ones not reclaimed yet might exceed it for a while.
+    //
+    // the free list links live in a side array, never in the slots,
+    // a slot popped by another thread is written at once while the loser of the CAS still reads the link.
+    class FrameArena
+    {
+        static constexpr uint32_t NIL = 0xffffffff;
+
+    public:
+
+        FrameArena(std::size_t slot_size, uint32_t slot_num);
+        ~FrameArena();
+
+        FrameArena(const FrameArena&) = delete;
+        FrameArena& operator=(const FrameArena&) = delete;
+
+        // return nullptr if no free slot.
+        void* allocate() noexcept;
+
+        // return false if `ptr` is not from this arena.
+        bool deallocate(void* ptr) noexcept;
+
+        std::size_t slot_size() const noexcept;
+
+        // arenas for Page and PageListHandle, mapped on the first call,
+        // and live until the process exits, since pages might be retired late.
+        static void init(uint32_t frame_budget);
+        static FrameArena* page_arena() noexcept;
+        static FrameArena* handle_arena() noexcept;
+
+    private:
+        const std::size_t slot_size_;
+        const uint32_t slot_num_;
+        std::size_t region_size_;
+        char* region_;
+        std::atomic<uint64_t> free_head_;   // [tag(32) | slot index(32)], tag against ABA
+        std::unique_ptr<std::atomic<uint32_t>[]> next_;    // free list link per slot
+
+    }; // end class FrameArena
+
+} // end namespace DB::buffer
+
+#endif // !_FRAME_ARENA_H
@@ -6,29 +6,49 @@
 #include <memory>
 #include <utility>
 #include <mutex>
-#include <shared_mutex>
 #include <atomic>
 #include "page.h"
+#include "epoch.h"
 
 namespace DB::buffer
 {
     using namespace page;
 
+    // `page_id_` and `page_` are immutable once the handle is published in PageList,
+    // since `Hash_LRU::find()` reads them without lock.
     struct PageListHandle {
         std::atomic<uint32_t> ref_ = 0;
-        page_id_t page_id_;
-        page::Page* page_;              // `ref_count` of page might not equal the handle.
+        const page_id_t page_id_;
+        page::Page* const page_;        // `ref_count` of page might not equal the handle.
         bool in_lru_ = false;
-        bool in_page_list_ = false;
+        std::atomic<bool> in_page_list_ = false;    // cleared before unlinking from PageList
+        std::atomic<bool> accessed_ = false;        // hit since last seen by ReplacePolicy
         PageListHandle* prev_hash_ = nullptr;
-        PageListHandle* next_hash_ = nullptr;
+        std::atomic<PageListHandle*> next_hash_ = nullptr;
         PageListHandle* prev_lru_ = nullptr;
         PageListHandle* next_lru_ = nullptr;
+        uint8_t lru_queue_ = 0;         // owned by ReplacePolicy
+        bool use_once_ = false;         // owned by ReplacePolicy
         PageListHandle(page_id_t page_id, page::Page* page) :page_id_(page_id), page_(page) {}
+        // allocated in `FrameArena::handle_arena()`, fall back to heap if exhausted.
+        static void* operator new(std::size_t size);
+        static void operator delete(void* ptr) noexcept;
+        // page `ref_count` >= handle `ref_` always holds, see `Hash_LRU::is_pinned()`.
         void ref() { page_->ref(); ref_++; }
-        void unref() { page_->unref(); if (--ref_ == 0) delete this; }
+        void unref() {
+            page::Page* page = page_;
+            const bool last = --ref_ == 0;
+            page->unref();
+            if (last) util::EpochManager::instance().retire(this); // lock-free reader might stand on it
+        }
     };
 
+    enum class replace_policy_t { LRU, TWO_Q };
+
+    class ReplacePolicy;
+
+    // writers lock `mutex_`, readers traverse `next_hash_` in epoch without lock.
+    // the removed handle keeps its `next_hash_`, so that the reader on it can go on.
     struct PageList {
         mutable std::mutex mutex_;
         PageListHandle head_;             // dummy node
@@ -46,32 +66,40 @@ namespace DB::buffer
      * value :  Page*
      *
      * The implementation is thread safe.
+     * `find()` takes no lock: it walks the bucket in epoch and `try_ref()` the page,
+     * the hit is recorded in `accessed_` and applied by ReplacePolicy on eviction.
+     * The bucket number is fixed from the frame budget, so no rehash.
      */
     class Hash_LRU
     {
         // hash function = (magic * key) & (bucket_num_ - 1)
-        static constexpr uint32_t init_bucket = 1 << 6;
+        static constexpr uint32_t min_bucket = 1 << 6;
         static constexpr uint32_t magic = 769;
 
-        static constexpr uint32_t max_bucket = 1 << 10;
-        static constexpr uint32_t rehash_ratio = 3;
-        static constexpr uint32_t  lru_init_size = init_bucket << 2; // 4 times of buckets
+        // handles inspected by the policy per eviction round,
+        // the skipped (pinned or not yet logged) handles get a second chance.
+        static constexpr uint32_t evict_scan_depth = 64;
 
     public:
 
-        Hash_LRU();
+        // frame budget in pages, 16K pages = 16MB.
+        static constexpr uint32_t default_frame_budget = 1 << 14;
+
+        explicit Hash_LRU(uint32_t frame_budget = default_frame_budget,
+            replace_policy_t policy = replace_policy_t::TWO_Q);
 
         ~Hash_LRU();
 
         // return true on success, false if the key does exist.
-        bool insert(page_id_t, page::Page*);
+        // `use_once` hints the replacement policy that the page comes from a sequential scan.
+        bool insert(page_id_t, page::Page*, bool use_once = false);
 
         // return false if the key does exist, 
         // after this call, the corresponding value of that page_id must be the Page* given.
         bool insert_or_assign(page_id_t, page::Page*);
 
         // return the corresponding Page if the key does exist, nullprt otherwise.
-        // the Page* is `ref()` before return and updated to the lru head.
+        // the Page* is `ref()` before return and marked accessed if `update`.
         // note that the Page* might be evicted from lru.
         page::Page* find(page_id_t, const bool update = true);
 
@@ -82,38 +110,42 @@ namespace DB::buffer
         // return approximate size.
         uint32_t size() const;
 
+        // the frame budget, might be exceeded when all the pages are pinned.
         uint32_t max_size() const;
 
         void flush();
 
 
     private:
-        uint32_t bucket_num_;                       // the modification only in `rehash()`
+        const uint32_t bucket_num_;
         std::deque<PageList> buckets_;
         std::atomic<uint32_t> size_;
-        mutable std::shared_mutex shared_mutex_;    // mutex for rehashing
-        PageListHandle lru_head_;                   // dummy node, LRU is a cyclic list
-        std::atomic<uint32_t> lru_max_size_;
+        std::unique_ptr<ReplacePolicy> policy_;     // order of handles in LRU, under `lru_mutex_`
+        const uint32_t lru_max_size_;
         mutable std::mutex lru_mutex_;
 
         uint32_t hash(page_id_t) const noexcept;
 
-        // `bucket_num_` and `lru_max_size_` will be multiplied by 2.
-        // the hash-table will be locked during rehashing, while lru-list won't.
-        void rehash();
+        // about 2 pages per bucket when the budget is full.
+        static uint32_t bucket_num_of(uint32_t frame_budget) noexcept;
 
         // append a new handle into lru list.
-        void lru_append(PageListHandle*);
+        void lru_append(PageListHandle*, bool use_once);
 
-        // move handle after the dummy.
-        void lru_update(PageListHandle*);
+        // remove the handle, `evicted` is false if erased by the user.
+        void lru_remove(PageListHandle*, bool evicted = false);
 
-        // remove the handle.
-        void lru_remove(PageListHandle*);
-
-        // remove the handle, call on `lru_size_` exceeding.
+        // evict unpinned pages picked by the policy until `size()` fits the budget,
+        // dirty victim is written back before leaving the hash-table.
+        // NB: lock LRU and page_list in turn, never nested.
         void lru_evict();
 
+        // return true if the page is held by someone besides the handle,
+        // since every `ref()` on handle also `ref()` the page.
+        static bool is_pinned(const PageListHandle*);
+
+        static bool is_evictable(const PageListHandle*);
+
     }; // end class Hash_LRU
 
 } // end namespace DB::buffer
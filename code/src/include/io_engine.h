@@ -0,0 +1,63 @@
+#ifndef _IO_ENGINE_H
+#define _IO_ENGINE_H
+#include "env.h"
+#include <cstddef>
+#include <memory>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace DB::disk
+{
+
+    // positional I/O never touches the file offset, so it is safe to call concurrently.
+    // return the bytes read, less than `len` only on EOF or error.
+    std::size_t read_at(int fd, char* buffer, std::size_t len, off_t offset);
+    bool write_at(int fd, const char* buffer, std::size_t len, off_t offset);
+
+
+    struct IORequest
+    {
+        enum op_t :uint8_t { READ, WRITE };
+        using callback_t = void(*)(IORequest*);
+
+        op_t op_;
+        int fd_;
+        char* buffer_;
+        uint32_t len_;
+        off_t offset_;
+        int32_t result_;            // bytes transferred, or -errno
+        callback_t on_complete_;    // called on the engine thread, might delete the request
+        iovec iov_;                 // used by io_uring
+    };
+
+
+    /*
+     * Asynchronous I/O, the requests are submitted in batch,
+     * and complete out of order on the engine threads.
+     *
+     * `IOEngine::make()` prefers io_uring, and falls back to the worker threads
+     * if the kernel does not support it (or it is forbidden by seccomp).
+     *
+     * NB: the requests in flight on the same offset are not ordered,
+     *     the caller serializes them, see `DiskManager::WritePage()`.
+     */
+    class IOEngine
+    {
+    public:
+
+        static constexpr uint32_t default_queue_depth = 128;
+
+        static std::unique_ptr<IOEngine> make(uint32_t queue_depth = default_queue_depth);
+
+        virtual ~IOEngine() = default;
+
+        // might block if the queue is full, never call it in `on_complete_`.
+        virtual void submit(IORequest* const* requests, uint32_t n) = 0;
+
+        virtual const char* name() const noexcept = 0;
+
+    }; // end class IOEngine
+
+} // end namespace DB::disk
+
+#endif // !_IO_ENGINE_H
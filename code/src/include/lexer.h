@@ -112,6 +112,11 @@ namespace DB::lexer
 		LEFT_CURLY_BRACKETS, RIGHT_CURLY_BRACKETS,   // curly brackets   : "{", "}"
 
 		EXIT,
+		LOAD,
+
+		GROUP, BY,
+		COUNT, SUM, MIN, MAX, AVG,
+		INLINE, VALUE_PAGE,
 
 		__EOF__,
 	};
@@ -154,6 +159,11 @@ namespace DB::lexer
 		{ "{", type::LEFT_CURLY_BRACKETS },   { "}", type::RIGHT_CURLY_BRACKETS },
 
 		{"EXIT", type::EXIT},
+		{"LOAD", type::LOAD},
+
+		{ "GROUP", type::GROUP }, { "BY", type::BY },
+		{ "COUNT", type::COUNT }, { "SUM", type::SUM }, { "MIN", type::MIN }, { "MAX", type::MAX }, { "AVG", type::AVG },
+		{ "INLINE", type::INLINE }, { "VALUE_PAGE", type::VALUE_PAGE },
 	};
 
 	// for display
@@ -195,6 +205,11 @@ namespace DB::lexer
 		{ type::LEFT_CURLY_BRACKETS, "{" },   { type::RIGHT_CURLY_BRACKETS, "}" },
 
 		{type::EXIT, "EXIT"},
+		{type::LOAD, "LOAD"},
+
+		{ type::GROUP, "GROUP" }, { type::BY, "BY" },
+		{ type::COUNT, "COUNT" }, { type::SUM, "SUM" }, { type::MIN, "MIN" }, { type::MAX, "MAX" }, { type::AVG, "AVG" },
+		{ type::INLINE, "INLINE" }, { type::VALUE_PAGE, "VALUE_PAGE" },
 
 		{ type::__EOF__, "$eof$" },
 	};
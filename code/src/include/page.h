@@ -5,8 +5,10 @@
 #include <shared_mutex>
 #include <atomic>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
+#include <algorithm>
 #include "env.h"
 
 namespace DB::disk { class DiskManager; }
@@ -15,7 +17,18 @@ namespace DB::buffer { class BufferPoolManager; }
 namespace DB::page
 {
 
-    constexpr uint32_t PAGE_SIZE = 1 << 10; // 1KB
+    // page size is fixed when the DB is created, and recorded in DBMetaPage.
+    // choose it by `-DPAGE_SIZE_SHIFT=n` in CMakeLists.txt, [1KB, 64KB].
+    // all the layouts and the B+ tree fanout derive from it.
+#ifndef PAGE_SIZE_SHIFT
+#define PAGE_SIZE_SHIFT 10
+#endif
+    static_assert(PAGE_SIZE_SHIFT >= 10 && PAGE_SIZE_SHIFT <= 16, "page size should be in [1KB, 64KB]");
+    constexpr uint32_t PAGE_SIZE = 1 << PAGE_SIZE_SHIFT; // 1KB by default
+
+    // the layout of db file and log, recorded in DBMetaPage, bump it on any incompatible change.
+    // 0 on the DB created before the version is recorded.
+    constexpr uint32_t DB_FORMAT_VERSION = 1;
 
     enum class page_t_t :uint32_t {
         DB_META,
@@ -28,6 +41,7 @@ namespace DB::page
         VALUE,
 
         FREE,
+        BITMAP,
     };
 
     static const char* page_t_str[] = {
@@ -41,6 +55,7 @@ namespace DB::page
         "VALUE",
 
         "FREE",
+        "BITMAP",
     };
 
     class Page;
@@ -72,16 +87,20 @@ namespace DB::page
             // Page
             PAGE_T = 0,
             PAGE_ID = 4,
+            PAGE_CHECKSUM = PAGE_SIZE - 4,  // trailer, CRC32C stamped by DiskManager only
 
-            // Free Page
-            FREE_PAGE_ID = 8,
+            // Bitmap Page
+            BITMAP_START = 8,
 
             // DB meta
             CUR_PAGE_NO = 8,
             TABLE_NUM = 12,
-            NEXT_FREE_PAGE_ID = 16,
+            ALLOCATED_PAGE_NO = 16,
             TABLE_PAGEID_NAMEOFFSET_START = 20,
             TABLE_NAME_STR_START = 260,
+            CHECKPOINT_LSN = 1000,          // 8 bytes, maintained by DiskManager only
+            DB_PAGE_SIZE = 1012,            // within the first 1KB, readable with any page size
+            DB_FORMAT = 1016,               // the same as above, see `DB_FORMAT_VERSION`
 
             // Table meta
             BT_ROOT_ID = 8,
@@ -91,6 +110,7 @@ namespace DB::page
             AUTO_ID = 24,
             COLINFO_START = 28,
             COLUMN_NAME_STR_START = 238,
+            LEAF_FORMAT = 1004,
 
             // BTree Page / Value Page
             PARENT_PAGE_ID = 8,
@@ -126,12 +146,18 @@ namespace DB::page
         friend class ::DB::buffer::BufferPoolManager;
     public:
 
-        Page(page_t_t, page_id_t, buffer::BufferPoolManager*, bool isInit);
+        // when (!isInit), `src` is the image the caller has read, copied into the page once.
+        Page(page_t_t, page_id_t, buffer::BufferPoolManager*, bool isInit, const char* src = nullptr);
 
         virtual ~Page();
 
         void ref();
 
+        // `ref()` unless the page is dying, namely `ref_count_` has been 0.
+        // used by the lock-free reader, which might see the page after its last `unref()`.
+        bool try_ref();
+
+        // the page is retired in epoch rather than deleted at once.
         void unref();
 
         page_t_t get_page_t() const noexcept;
@@ -144,9 +170,15 @@ namespace DB::page
 
         bool is_dirty() noexcept;
 
+        uint32_t get_ref_count() const noexcept;
+
+        // return true if the page (and its attached value page) could be written back
+        // before txn commits, namely no uncommitted image reaches the redo log.
+        bool is_stealable() const;
+
         // called when update_data and FREE-PAGE
-        // return to next_free_page_id
-        page_id_t add_free_page();
+        // mark the page free in the bitmap
+        void add_free_page();
         // called when
         //          1. table page is drop, TableMetaPage, and all BTree Pages // TODO:
         //          2. merge, Internal or Leaf-Value, do not forget merge in ROOT-erase
@@ -165,6 +197,12 @@ namespace DB::page
         void page_read_unlock();
         void page_write_unlock();
 
+        // optimistic lock coupling, the version is odd while a writer holds `page_write_lock()`.
+        // the reader never latches: it reads between `read_begin()` and `read_validate()`,
+        // and restarts if any writer has been in between. (the writer latches as before)
+        uint64_t read_begin() const;
+        bool read_validate(uint64_t version) const;
+
         // update the all metadata into memory, for the later `flush()`.
         virtual void update_data() = 0;
 
@@ -173,17 +211,22 @@ namespace DB::page
         Page(Page&&) = delete;
         Page& operator=(Page&&) = delete;
 
+        // allocated in `buffer::FrameArena::page_arena()`, fall back to heap if exhausted.
+        static void* operator new(std::size_t size);
+        static void operator delete(void* ptr) noexcept;
+
 
     protected:
         buffer::BufferPoolManager* buffer_pool_;
         page_t_t page_t_; // fundamentally const, but ROOT may violate the rule.
-        page_id_t page_id_; // might be used for next_free_page_id when FREE
+        page_id_t page_id_;
         char data_[PAGE_SIZE];
         bool dirty_;
         bool free_update_ = false;
 
     private:
         mutable std::shared_mutex rw_page_mutex_;
+        std::atomic<uint64_t> version_;
         std::atomic<uint32_t> ref_count_;
     };
 
@@ -200,10 +243,11 @@ namespace DB::page
 
         static constexpr uint32_t TABLE_NAME_STR_BLOCK = 25;
         static constexpr uint32_t MAX_TABLE_NAME_STR = 24;
-        static constexpr uint32_t MAX_TABLE_NUM = 30;
+        static constexpr uint32_t MAX_TABLE_NUM = 29;
+        static_assert(offset::TABLE_NAME_STR_START + MAX_TABLE_NUM * TABLE_NAME_STR_BLOCK <= offset::CHECKPOINT_LSN);
 
         DBMetaPage(page_id_t, buffer::BufferPoolManager*, bool isInit,
-            uint32_t cur_page_no, uint32_t table_num, page_id_t next_free_page_id);
+            uint32_t cur_page_no, uint32_t table_num, const char* src = nullptr);
         ~DBMetaPage();
 
         page_id_t find_table(const std::string&);
@@ -216,8 +260,9 @@ namespace DB::page
 
     public:
         uint32_t cur_page_no_; // out of date, update from disk_manager in update_data().
+        uint32_t allocated_page_no_; // the pages reserved in db file, same as above.
         uint32_t table_num_;
-        page_id_t next_free_page_id_;
+        uint32_t page_size_;
         uint32_t* table_page_ids_;
         uint32_t* table_name_offset_;
         std::unordered_map<std::string, page_id_t> table_name2id_;
@@ -260,14 +305,20 @@ namespace DB::page
     };
 
     using key_t_t = col_t_t;
+
+    // where the leaves of a table keep the tuples, chosen when the table is created.
+    //      VALUE_PAGE: in a ValuePage attached to each leaf, `VALUE_PAGE_ID`.
+    //      INLINE:     in the leaf itself, after the key slots, see `INLINE_VALUE_START`.
+    //                  INTEGER key only, since the (VAR)CHAR key-str blocks take that room.
+    // a lookup or a scan step touches one page per row on INLINE, instead of two.
+    enum class leaf_format_t :uint32_t { VALUE_PAGE, INLINE };
     constexpr uint32_t INVALID_OFFSET = PAGE_SIZE;
     // if key is (VAR)CHAR, the key is stored the offset to the real content.
     // all contents are organized as blocks, each block is 58B.
     // block structure: mark(1B), content(<=57B)
-    // the 1st block starts at 152u.
+    // the 1st block starts right after the key slots, see `KEY_STR_START`.
     constexpr uint32_t MAX_STR_LEN = 57u;
     constexpr uint32_t KEY_STR_BLOCK = 58u;
-    constexpr uint32_t KEY_STR_START = 152u;
 
     struct KeyEntry {
         key_t_t key_t;
@@ -305,6 +356,7 @@ namespace DB::page
         static constexpr uint32_t COLUMN_NAME_STR_BLOCK = 51;
         static constexpr uint32_t MAX_COLUMN_NAME_STR = 50;
         static constexpr uint32_t MAX_COLUMN_NUM = 15;
+        static_assert(offset::COLUMN_NAME_STR_START + MAX_COLUMN_NUM * COLUMN_NAME_STR_BLOCK <= offset::LEAF_FORMAT);
         static constexpr uint32_t NOT_A_COLUMN = MAX_COLUMN_NUM + 1;
 
         // if no PK, the column `autoPK` will be added at the first column
@@ -315,7 +367,8 @@ namespace DB::page
         TableMetaPage(buffer::BufferPoolManager* buffer_pool, page_id_t,
             bool isInit, key_t_t key_t, uint32_t str_len,
             // below 3 are needed only when (!init)
-            page_id_t BT_root_id, uint32_t col_num, page_id_t default_value_page_id);
+            page_id_t BT_root_id, uint32_t col_num, page_id_t default_value_page_id,
+            leaf_format_t leaf_format = leaf_format_t::VALUE_PAGE, const char* src = nullptr);
 
         ~TableMetaPage();
 
@@ -345,6 +398,7 @@ namespace DB::page
         uint32_t col_num_;
         page_id_t default_value_page_id_ = NOT_A_PAGE;
         std::atomic<page_id_t> auto_id_ = NOT_A_PAGE;
+        leaf_format_t leaf_format_;
         ValuePage* value_page_;
         std::unordered_map<std::string, ColumnInfo*> col_name2col_;
         uint32_t pk_col_ = NOT_A_COLUMN;                // `NOT_A_COLUMN` denotes no PK
@@ -372,9 +426,25 @@ namespace DB::page
     //////////////////////       B+ Tree Page       //////////////////////
     //////////////////////////////////////////////////////////////////////
 
-    constexpr uint32_t BTdegree = 8u; // nEntry is [BTdegree - 1, 2*BTdegree -1], [7, 15]
+    // the max keys a node holds, limited by
+    //      LeafPage:  KV_START + nEntry * (8B kv slot + KEY_STR_BLOCK) <= PAGE_CHECKSUM
+    //      ValuePage: VALUE_START + nEntry * TUPLE_BLOCK_SIZE <= PAGE_CHECKSUM
+    //      INLINE LeafPage: KV_START + nEntry * (8B kv slot + TUPLE_BLOCK_SIZE) <= PAGE_CHECKSUM
+    // InternalPage holds one more branch, still less than LeafPage.
+    constexpr uint32_t BTNodeKeyCapacity =
+        std::min({ (offset::PAGE_CHECKSUM - offset::KV_START) / (8u + KEY_STR_BLOCK),
+            (offset::PAGE_CHECKSUM - offset::VALUE_START) / TUPLE_BLOCK_SIZE,
+            (offset::PAGE_CHECKSUM - offset::KV_START) / (8u + TUPLE_BLOCK_SIZE) });
+    constexpr uint32_t BTdegree = (BTNodeKeyCapacity + 1) >> 1; // nEntry is [BTdegree - 1, 2*BTdegree -1], [6, 13] on 1KB
     constexpr uint32_t BTNodeKeySize = (BTdegree << 1) - 1;
     constexpr uint32_t BTNodeBranchSize = BTdegree << 1;
+    constexpr uint32_t KEY_STR_START = offset::KV_START + 8u * BTNodeKeySize; // 136u on 1KB
+    static_assert(KEY_STR_START + BTNodeKeySize * KEY_STR_BLOCK <= offset::PAGE_CHECKSUM);
+    static_assert(offset::CHILD_START + 8u * BTNodeKeySize + 4u <= KEY_STR_START);
+    static_assert(offset::VALUE_START + BTNodeKeySize * TUPLE_BLOCK_SIZE <= offset::PAGE_CHECKSUM);
+    // the tuple blocks of INLINE leaf, in place of the key-str blocks.
+    constexpr uint32_t INLINE_VALUE_START = KEY_STR_START;
+    static_assert(INLINE_VALUE_START + BTNodeKeySize * TUPLE_BLOCK_SIZE <= offset::PAGE_CHECKSUM);
 
 
     // for ROOT, INTERNAL, LEAF
@@ -383,7 +453,7 @@ namespace DB::page
     public:
 
         BTreePage(page_t_t, page_id_t, page_id_t parent_id, uint32_t nEntry, buffer::BufferPoolManager*,
-            key_t_t, uint32_t str_len, bool isInit);
+            key_t_t, uint32_t str_len, bool isInit, const char* src = nullptr);
         virtual ~BTreePage();
 
         virtual void update_data() = 0;
@@ -404,6 +474,12 @@ namespace DB::page
         // called when key_t is (VAR)CHAR
         KeyEntry read_key(uint32_t index) const;
 
+        // view the key-str in page, no copy. called when key_t is (VAR)CHAR.
+        std::string_view read_key_view(uint32_t index) const;
+
+        // view the key-str in a `KEY_STR_BLOCK`, might be copied out of the page.
+        static std::string_view key_view(const char* block);
+
 
     public:
 
@@ -429,6 +505,8 @@ namespace DB::page
         page_id_t value_page_id;    // used for LeafPage, ignore if `isInit == true`
         page_id_t previous_page_id; // used for LeafPage, ignore if `isInit == true`
         page_id_t next_page_id;     // used for LeafPage, ignore if `isInit == true`
+        page_id_t near_page_id = NOT_A_PAGE; // allocation hint, place the new page right after it
+        leaf_format_t leaf_format = leaf_format_t::VALUE_PAGE; // used for LeafPage
     };
 
 
@@ -437,7 +515,7 @@ namespace DB::page
         friend class ::DB::tree::BTree;
     public:
         InternalPage(page_t_t, page_id_t, page_id_t parent_id, uint32_t nEntry,
-            buffer::BufferPoolManager*, key_t_t, uint32_t str_len, bool isInit);
+            buffer::BufferPoolManager*, key_t_t, uint32_t str_len, bool isInit, const char* src = nullptr);
         virtual ~InternalPage();
 
         // update the all metadata into memory, for the later `flush()`.
@@ -454,16 +532,20 @@ namespace DB::page
     // ValuePage stores whole `char*` and does not care about the specific content.
     // record structure: mark(1B), content(<=67B)
     // each record is 68B :), so it's trivial to handle.
-    // 15 * 68 < PAGE_SIZE
+    // `BTNodeKeySize` records always fit in the page, see `BTNodeKeyCapacity`.
     // the state mark is used when deleted, and when do inserttion, find the `OBSOLETE` entry.
     class ValuePage :public Page {
     public:
-        ValuePage(page_id_t, page_id_t, uint32_t nEntry, buffer::BufferPoolManager*, bool isInit);
+        ValuePage(page_id_t, page_id_t, uint32_t nEntry, buffer::BufferPoolManager*, bool isInit,
+            const char* src = nullptr);
         ~ValuePage();
 
         // read ValueEntry at `offset`.
         void read_content(uint32_t offset, ValueEntry&) const;
 
+        // read ValueEntry in a `TUPLE_BLOCK_SIZE` block, might be copied out of the page.
+        static void read_block(const char* block, ValueEntry&);
+
         // update content at `offset`
         void update_content(uint32_t offset, const ValueEntry&);
 
@@ -484,13 +566,15 @@ namespace DB::page
 
 
 
-    // all value is stored in the corresponding ValuePage
+    // all value is stored in the corresponding ValuePage, or in the leaf itself if INLINE.
+    // the INLINE leaf has no ValuePage, namely `VALUE_PAGE_ID` is `NOT_A_PAGE`.
     class LeafPage :public BTreePage {
         friend class ::DB::tree::BTree;
         friend class BTreePage;
     public:
         LeafPage(buffer::BufferPoolManager*, page_id_t, page_id_t parent_id, uint32_t nEntry,
-            key_t_t, uint32_t str_len, page_id_t value_page_id, bool isInit);
+            key_t_t, uint32_t str_len, page_id_t value_page_id, leaf_format_t, bool isInit,
+            const char* src = nullptr);
         virtual ~LeafPage();
 
         // read the value record into ValueEntry
@@ -514,10 +598,11 @@ namespace DB::page
         virtual void update_data();
 
     public:
-        ValuePage * value_page_;
+        const leaf_format_t leaf_format_;
+        ValuePage * value_page_;    // nullptr if INLINE
         page_id_t value_page_id_;
         page_id_t previous_page_id_, next_page_id_;
-        uint32_t* values_; // points to offset of the value-blocks.
+        uint32_t* values_; // points to offset of the value-blocks, in the value page or in this page.
 
     }; // end class LeafPage
 
@@ -530,10 +615,11 @@ namespace DB::page
         friend RootPage* parse_RootPage(buffer::BufferPoolManager* buffer_pool, const char(&buffer)[page::PAGE_SIZE]);
     public:
         RootPage(buffer::BufferPoolManager*, page_t_t, page_id_t parent_id, page_id_t,
-            uint32_t nEntry, key_t_t, uint32_t str_len, page_id_t value_page_id, bool isInit);
+            uint32_t nEntry, key_t_t, uint32_t str_len, page_id_t value_page_id, leaf_format_t, bool isInit,
+            const char* src = nullptr);
         virtual ~RootPage();
 
-        void change_to_leaf(buffer::BufferPoolManager* buffer_pool);
+        void change_to_leaf(buffer::BufferPoolManager* buffer_pool, leaf_format_t);
         void change_to_internal(buffer::BufferPoolManager* buffer_pool);
 
         // read the value record into ValueEntry
@@ -558,7 +644,8 @@ namespace DB::page
 
     public:
         // for ROOT_LEAF
-        ValuePage * value_page_;
+        leaf_format_t leaf_format_;
+        ValuePage * value_page_;    // nullptr if INLINE
         page_id_t value_page_id_;
         uint32_t* values_; // points to offset of the value-blocks.
         page_id_t previous_page_id_, next_page_id_;
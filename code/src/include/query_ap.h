@@ -40,6 +40,16 @@ namespace DB::query {
             {
                 ast::exprOutputVisit(condition, std::cout);
             }
+            if(!aggregates.empty())
+            {
+                std::cout << "select : ";
+                for(const auto& aggregate : aggregates)
+                    std::cout << aggregate.get_name() << " ";
+                std::cout << std::endl << "group by : ";
+                for(const auto& column : groupBy)
+                    std::cout << column.first << "." << column.second << " ";
+                std::cout << std::endl;
+            }
         }
 
         void compile();
@@ -56,6 +66,8 @@ namespace DB::query {
         vector<string> tables;
         vector<shared_ptr<ast::BaseExpr>> conditions;
         vector<std::pair<string, string>> columns; // selected pairs of<table, column>
+        vector<ast::col_name_t> groupBy;
+        vector<ast::APAggregate> aggregates; // select list of aggregation, empty if `SELECT $`
 
     private:
 
@@ -100,6 +100,17 @@ namespace DB::query {
         }
     };
 
+    // LOAD <table> FROM "<path>"
+    // one row per line, the values are separated by ',' in column order (without autoPK).
+    struct LoadInfo {
+        std::string sourceTable;
+        std::string path;
+        void print() const
+        {
+            std::cout << "Load table : " << sourceTable << " from " << path << std::endl;
+        }
+    };
+
     using OrderbyElement = std::pair<ast::BaseExpr*, bool>;	//	orderExpr, isASC
 
     struct TPSelectInfo {
@@ -115,7 +126,7 @@ namespace DB::query {
 
 
     //tp query return type to vm
-    using TPValue = std::variant<CreateTableInfo, DropTableInfo, TPSelectInfo, UpdateInfo, InsertInfo, DeleteInfo, Show, Exit, ErrorMsg, Switch, Schema>;
+    using TPValue = std::variant<CreateTableInfo, DropTableInfo, TPSelectInfo, UpdateInfo, InsertInfo, DeleteInfo, Show, Exit, ErrorMsg, Switch, Schema, LoadInfo>;
 
     void print(const TPValue &value);
 
@@ -0,0 +1,115 @@
+#ifndef _REPLACE_POLICY_H
+#define _REPLACE_POLICY_H
+#include <deque>
+#include <memory>
+#include <unordered_set>
+#include "hash_lru.h"
+
+namespace DB::buffer
+{
+
+    // intrusive list on `prev_lru_` and `next_lru_` of PageListHandle.
+    struct LRUList {
+        PageListHandle head_;               // dummy node, cyclic list
+        uint32_t size_;
+        LRUList();
+        void push_front(PageListHandle*);
+        void push_back(PageListHandle*);
+        void move_front(PageListHandle*);
+        void remove(PageListHandle*);
+        PageListHandle* back() const;       // nullptr if empty
+    };
+
+
+    /*
+     * The replacement policy only orders the handles,
+     * `ref()` and `in_lru_` are maintained by Hash_LRU.
+     *
+     * NB: all the calls are under `Hash_LRU::lru_mutex_`.
+     *     the hit does not call in, but is applied lazily in `victim()`.
+     */
+    class ReplacePolicy
+    {
+    public:
+
+        using evictable_t = bool(*)(const PageListHandle*);
+
+        virtual ~ReplacePolicy() = default;
+
+        // `use_once` hints that the page is read by a sequential scan,
+        // thus it should be the first to be evicted.
+        virtual void insert(PageListHandle*, bool use_once) = 0;
+
+        // apply the hit, which is recorded in `accessed_` by the lock-free `find()`,
+        // and consumed when the victim scan meets the handle.
+        // return true if the handle is moved away from the tail.
+        virtual bool access(PageListHandle*) = 0;
+
+        // `evicted` is false if the page is erased by the user.
+        virtual void remove(PageListHandle*, bool evicted) = 0;
+
+        // return the victim satisfying `evictable`, or nullptr if none found within `scan_depth`.
+        // the victim is still in the policy, skipped handles might be reordered.
+        virtual PageListHandle* victim(evictable_t evictable, uint32_t scan_depth) = 0;
+
+        // remove and return any handle, nullptr if empty. used on destruction.
+        virtual PageListHandle* drain() = 0;
+
+    }; // end class ReplacePolicy
+
+
+    // plain LRU, use-once page is appended to the tail.
+    class LRUPolicy :public ReplacePolicy
+    {
+    public:
+        void insert(PageListHandle*, bool use_once) override;
+        bool access(PageListHandle*) override;
+        void remove(PageListHandle*, bool evicted) override;
+        PageListHandle* victim(evictable_t evictable, uint32_t scan_depth) override;
+        PageListHandle* drain() override;
+
+    private:
+        LRUList lru_;
+    };
+
+
+    /*
+     * Simplified 2Q, refer to "2Q: A Low Overhead High Performance Buffer Management Replacement Algorithm".
+     *
+     *  A1in  : FIFO for pages referenced once, hit in A1in does not promote.
+     *  Am    : LRU for pages re-referenced after leaving A1in.
+     *  A1out : ghost page_id evicted from A1in, a miss on ghost goes into Am.
+     *
+     * A full scan only churns A1in, while hot internal pages stay in Am.
+     * use-once page is appended to the tail of A1in and never remembered in A1out.
+     */
+    class TwoQPolicy :public ReplacePolicy
+    {
+        enum queue_t :uint8_t { NONE, A1IN, AM };
+
+    public:
+        explicit TwoQPolicy(uint32_t frame_budget);
+
+        void insert(PageListHandle*, bool use_once) override;
+        bool access(PageListHandle*) override;
+        void remove(PageListHandle*, bool evicted) override;
+        PageListHandle* victim(evictable_t evictable, uint32_t scan_depth) override;
+        PageListHandle* drain() override;
+
+    private:
+        const uint32_t kin_;                // max size of A1in, 1/4 of budget
+        const uint32_t kout_;               // max size of A1out, 1/2 of budget
+        LRUList a1in_;
+        LRUList am_;
+        std::deque<page_id_t> a1out_fifo_;
+        std::unordered_set<page_id_t> a1out_;
+
+        void remember(page_id_t);
+    };
+
+
+    std::unique_ptr<ReplacePolicy> make_replace_policy(replace_policy_t, uint32_t frame_budget);
+
+} // end namespace DB::buffer
+
+#endif // !_REPLACE_POLICY_H
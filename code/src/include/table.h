@@ -48,6 +48,9 @@ namespace DB::table
         std::string tableName_;
         std::vector<std::string> colNames_;
         std::vector<page::ColumnInfo> columnInfos_; // col offset is in asending order !!!
+        // the tuples in value pages by default, `CREATE TABLE ... INLINE` to keep them in the leaves.
+        // VALUE_PAGE anyway if the PK is (VAR)CHAR.
+        page::leaf_format_t leafFormat_ = page::leaf_format_t::VALUE_PAGE;
         const std::unordered_map<page::page_id_t,
             std::unordered_map<int32_t, uint32_t>>*table_pk_ref_INT;
         const std::unordered_map<page::page_id_t,
@@ -22,6 +22,7 @@ namespace DB::util
     {
     public:
         enum class schedule_policy { FIFO, LIFO };
+        static constexpr int max_threads = 3;
     public:
         ThreadsPool(schedule_policy policy = schedule_policy::FIFO) :_schedule_policy(policy) {}
         ThreadsPool(const ThreadsPool&) = delete;
@@ -65,7 +66,6 @@ namespace DB::util
 
     private:
         using task_t = std::function<void()>;
-        static constexpr int max_threads = 3;
 
         int num_threads = max_threads;
         const schedule_policy _schedule_policy;
@@ -123,6 +123,9 @@ namespace DB::util
             {
                 // execute task
                 task();
+                // release the task before reporting idle, its code may live in a
+                // library that is unloaded once the pool is joined.
+                task = nullptr;
                 std::lock_guard<std::mutex> lg{ _mtx };
                 num_threads++;
                 _cv.notify_one();
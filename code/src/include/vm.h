@@ -21,6 +21,7 @@
 #include <optional>
 #include <iostream>
 #include <string_view>
+#include <chrono>
 
 namespace DB::tree { class BTree; }
 namespace DB::ast {
@@ -55,6 +56,7 @@ namespace DB::vm
         void start(std::future<void> exit_signal);
         void stop();
         std::string get_sql(); // might stuck
+        std::optional<std::string> try_get_sql(std::chrono::microseconds timeout);
         void add_sql(std::string); // only used when redo
     private:
         std::queue<std::string> sql_pool_;
@@ -93,7 +95,12 @@ namespace DB::vm
             return task_pool_.register_for_execution(std::forward<F>(f), std::forward<Args>(args)...);
         }
 
-        void set_next_free_page_id(page::page_id_t);
+        // group commit: the OLTP statements arriving within `window` of each other
+        // are committed as one batch, namely one WAL and one flush.
+        // `max_size` = 1 commits every statement on its own.
+        static constexpr uint32_t default_group_commit_size = 32;
+        static constexpr std::chrono::microseconds default_group_commit_window{ 1000 };
+        void set_group_commit(uint32_t max_size, std::chrono::microseconds window);
 
         std::optional<table::TableInfo> getTableInfo(const std::string& tableName);
 
@@ -113,18 +120,12 @@ namespace DB::vm
         process_result_t txn_process(const query::TPValue&);
         process_result_t query_process(query::APValue&);
 
-        void doWAL(page::page_id_t prev_last_page_id, const std::string& sql);
-
-        // flush dirty page into disk.
+        // log dirty page as redo.
         void flush();
 
-        void detroy_log();
-
-        // return   OK   : no need to reply log.
-        //          UNDO : undo the last txn.
-        //          REDO : undo the last txn, then redo.
-        disk::log_state_t check_log();
-        void replay_log(disk::log_state_t);
+        // the commit point, the logged pages are written back lazily.
+        // false if the log cannot be synced, then the DB turns read-only, see `commit_failed_`.
+        bool commit();
 
 
         // txn process functions
@@ -134,6 +135,7 @@ namespace DB::vm
         void doUpdate(process_result_t&, const query::UpdateInfo&);
         void doInsert(process_result_t&, const query::InsertInfo&);
         void doDelete(process_result_t&, const query::DeleteInfo&);
+        void doLoad(process_result_t&, const query::LoadInfo&);
 
         // query process function
         void doQuery(process_result_t&, query::APSelectInfo&);
@@ -173,9 +175,21 @@ namespace DB::vm
         // for mode switch
         void switch_mode();
         void AP_INIT();
-        void AP_RESET();
         uint32_t get_ap_table_index(const std::string&) const;
 
+        // AP snapshot maintenance
+        enum class ap_delta_t_t { INSERT, UPDATE, DELETE };
+        struct ap_delta_t {
+            ap_delta_t_t delta_t;
+            std::string table_name;
+            page::ValueEntry vEntry;
+        };
+        static constexpr uint32_t AP_MERGE_DELTA_SIZE = 4096;
+        ap::ap_table_t new_ap_table(const page::TableMetaPage*) const;
+        void ap_add_delta(ap_delta_t_t, const std::string& table_name, const page::ValueEntry&);
+        void ap_merge_delta();
+        void ap_merger();
+
     private:
 
         StorageEngine storage_engine_;
@@ -202,11 +216,27 @@ namespace DB::vm
             std::unordered_map<std::string, uint32_t>> table_pk_ref_VARCHAR;
 
 
+        uint32_t group_commit_size_ = default_group_commit_size;
+        std::chrono::microseconds group_commit_window_ = default_group_commit_window;
+        // a commit failed, the changes in memory are not durable and there is no undo,
+        // so no more writes nor commits build on them.
+        bool commit_failed_ = false;
+
         // for AP
         bool tp_ = true;
         std::shared_ptr<ap::ap_table_array_t> ap_table_array_;
         std::vector<std::string> table_names_;
 
+        // the snapshot is built at the first SWITCH, and then kept current:
+        // TP writes go to `ap_delta_`, which `ap_merger_` merges into the snapshot
+        // once `AP_MERGE_DELTA_SIZE` rows are pending, and SWITCH merges the rest.
+        std::vector<ap_delta_t> ap_delta_;
+        std::mutex ap_delta_mtx_;
+        std::condition_variable ap_delta_cv_;
+        std::mutex ap_merge_mtx_; // held while the snapshot is changed
+        bool ap_merger_stop_ = false;
+        std::thread ap_merger_;
+
 
     public: // for test
         void test_create_table();
@@ -0,0 +1,368 @@
+#include "include/io_engine.h"
+#include "include/debug_log.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define _xjbDB_IO_URING_
+#endif
+
+namespace DB::disk
+{
+
+    std::size_t read_at(int fd, char* buffer, std::size_t len, off_t offset)
+    {
+        std::size_t done = 0;
+        while (done < len) {
+            const ssize_t n = ::pread(fd, buffer + done, len - done, offset + done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            done += n;
+        }
+        return done;
+    }
+
+    bool write_at(int fd, const char* buffer, std::size_t len, off_t offset)
+    {
+        std::size_t done = 0;
+        while (done < len) {
+            const ssize_t n = ::pwrite(fd, buffer + done, len - done, offset + done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            done += n;
+        }
+        return true;
+    }
+
+
+    // finish the request synchronously from `done` bytes.
+    static void finish_sync(IORequest* request, std::size_t done)
+    {
+        if (request->op_ == IORequest::READ)
+            request->result_ = done + read_at(request->fd_, request->buffer_ + done,
+                request->len_ - done, request->offset_ + done);
+        else
+            request->result_ = write_at(request->fd_, request->buffer_ + done,
+                request->len_ - done, request->offset_ + done) ? request->len_ : -EIO;
+    }
+
+
+    /****************  implementation for class ThreadIOEngine  ****************/
+
+    // fallback, the workers do the blocking pread/pwrite.
+    class ThreadIOEngine :public IOEngine
+    {
+        static constexpr uint32_t worker_num = 4;
+
+    public:
+
+        ThreadIOEngine() :stop_(false)
+        {
+            for (uint32_t i = 0; i < worker_num; i++)
+                workers_.emplace_back(&ThreadIOEngine::work, this);
+        }
+
+        ~ThreadIOEngine()
+        {
+            {
+                std::lock_guard<std::mutex> lg{ mtx_ };
+                stop_ = true;
+            }
+            cv_.notify_all();
+            for (std::thread& worker : workers_)
+                worker.join();
+        }
+
+        void submit(IORequest* const* requests, uint32_t n) override
+        {
+            {
+                std::lock_guard<std::mutex> lg{ mtx_ };
+                queue_.insert(queue_.end(), requests, requests + n);
+            }
+            cv_.notify_all();
+        }
+
+        const char* name() const noexcept override { return "threads"; }
+
+    private:
+
+        // drain the queue before exit.
+        void work()
+        {
+            while (true) {
+                IORequest* request;
+                {
+                    std::unique_lock<std::mutex> ulk{ mtx_ };
+                    cv_.wait(ulk, [this]() { return stop_ || !queue_.empty(); });
+                    if (queue_.empty())
+                        return;
+                    request = queue_.front();
+                    queue_.pop_front();
+                }
+                finish_sync(request, 0);
+                request->on_complete_(request);
+            }
+        }
+
+        std::mutex mtx_;
+        std::condition_variable cv_;
+        std::deque<IORequest*> queue_;
+        bool stop_;
+        std::vector<std::thread> workers_;
+
+    }; // end class ThreadIOEngine
+
+
+#ifdef _xjbDB_IO_URING_
+
+    /****************  implementation for class UringIOEngine  ****************/
+
+    //
+    // io_uring on raw syscalls, no liburing.
+    //
+    // the submitters fill the SQ under `submit_mtx_`,
+    // the reaper thread waits on the CQ and calls `on_complete_`.
+    // at most `sq_entries_` requests in flight, thus the CQ never overflows.
+    // a NOP with `user_data == 0` stops the reaper, pushed once the requests in flight have drained,
+    // since the CQEs are not ordered, the NOP might complete ahead of the reads and writes before it.
+    //
+    class UringIOEngine :public IOEngine
+    {
+    public:
+
+        // return nullptr if io_uring is unavailable.
+        static std::unique_ptr<IOEngine> try_make(uint32_t queue_depth)
+        {
+            std::unique_ptr<UringIOEngine> engine{ new UringIOEngine() };
+            if (!engine->setup(queue_depth))
+                return nullptr;
+            engine->reaper_ = std::thread(&UringIOEngine::reap, engine.get());
+            return engine;
+        }
+
+        ~UringIOEngine()
+        {
+            if (reaper_.joinable()) {
+                {
+                    std::unique_lock<std::mutex> ulk{ inflight_mtx_ };
+                    inflight_cv_.wait(ulk, [this]() { return inflight_ == 0; });
+                }
+                push(nullptr, 1);
+                reaper_.join();
+            }
+            if (sqes_ != MAP_FAILED) ::munmap(sqes_, sqes_size_);
+            if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) ::munmap(cq_ptr_, cq_size_);
+            if (sq_ptr_ != MAP_FAILED) ::munmap(sq_ptr_, sq_size_);
+            if (ring_fd_ >= 0) ::close(ring_fd_);
+        }
+
+        void submit(IORequest* const* requests, uint32_t n) override
+        {
+            while (n > 0) {
+                const uint32_t batch = push(requests, n);
+                requests += batch;
+                n -= batch;
+            }
+        }
+
+        const char* name() const noexcept override { return "io_uring"; }
+
+    private:
+
+        UringIOEngine()
+            :ring_fd_(-1), sq_ptr_(MAP_FAILED), cq_ptr_(MAP_FAILED), sqes_(MAP_FAILED),
+            sq_entries_(0), inflight_(0) {}
+
+        bool setup(uint32_t queue_depth)
+        {
+            io_uring_params params;
+            std::memset(&params, 0, sizeof(params));
+            ring_fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, queue_depth, &params));
+            if (ring_fd_ < 0)
+                return false;
+
+            sq_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+            cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+            if (single_mmap)
+                sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+
+            sq_ptr_ = ::mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+            if (sq_ptr_ == MAP_FAILED)
+                return false;
+            cq_ptr_ = single_mmap ? sq_ptr_ : ::mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+            if (cq_ptr_ == MAP_FAILED)
+                return false;
+            sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+            sqes_ = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+            if (sqes_ == MAP_FAILED)
+                return false;
+
+            char* sq = static_cast<char*>(sq_ptr_);
+            sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+            char* cq = static_cast<char*>(cq_ptr_);
+            cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+            sq_entries_ = params.sq_entries;
+            return true;
+        }
+
+        // push at most `n` requests as the queue allows, return the number pushed.
+        // nullptr `requests` means a NOP to stop the reaper.
+        uint32_t push(IORequest* const* requests, uint32_t n)
+        {
+            uint32_t batch;
+            {
+                std::unique_lock<std::mutex> ulk{ inflight_mtx_ };
+                inflight_cv_.wait(ulk, [this]() { return inflight_ < sq_entries_; });
+                batch = std::min(n, sq_entries_ - inflight_);
+                inflight_ += batch;
+            }
+
+            std::lock_guard<std::mutex> lg{ submit_mtx_ };
+            unsigned tail = *sq_tail_;
+            io_uring_sqe* sqes = static_cast<io_uring_sqe*>(sqes_);
+            for (uint32_t i = 0; i < batch; i++, tail++) {
+                const unsigned index = tail & sq_mask_;
+                io_uring_sqe& sqe = sqes[index];
+                std::memset(&sqe, 0, sizeof(sqe));
+                if (requests == nullptr) {
+                    sqe.opcode = IORING_OP_NOP;
+                    sqe.user_data = 0;
+                }
+                else {
+                    IORequest* request = requests[i];
+                    request->iov_.iov_base = request->buffer_;
+                    request->iov_.iov_len = request->len_;
+                    sqe.opcode = request->op_ == IORequest::READ ? IORING_OP_READV : IORING_OP_WRITEV;
+                    sqe.fd = request->fd_;
+                    sqe.addr = reinterpret_cast<uint64_t>(&request->iov_);
+                    sqe.len = 1;
+                    sqe.off = request->offset_;
+                    sqe.user_data = reinterpret_cast<uint64_t>(request);
+                }
+                sq_array_[index] = index;
+            }
+            __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+            uint32_t to_submit = batch;
+            while (to_submit > 0) {
+                const int ret = static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd_, to_submit, 0, 0, nullptr, 0));
+                if (ret < 0) {
+                    if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    debug::ERROR_LOG("[IO_ENGINE] io_uring_enter submit error: %s\n", std::strerror(errno));
+                    break;
+                }
+                to_submit -= ret;
+            }
+            return batch;
+        }
+
+        void reap()
+        {
+            bool stop = false;
+            while (true) {
+                unsigned head = *cq_head_;
+                const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+                if (head == tail) {
+                    const int ret = static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd_, 0, 1,
+                        IORING_ENTER_GETEVENTS, nullptr, 0));
+                    if (ret < 0 && errno != EINTR)
+                        debug::ERROR_LOG("[IO_ENGINE] io_uring_enter wait error: %s\n", std::strerror(errno));
+                    continue;
+                }
+
+                uint32_t completed = 0;
+                for (; head != tail; head++, completed++) {
+                    const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+                    IORequest* request = reinterpret_cast<IORequest*>(cqe.user_data);
+                    if (request == nullptr) {
+                        stop = true;
+                        continue;
+                    }
+                    // short transfer or retryable error, finish it here.
+                    if (cqe.res == -EINTR || cqe.res == -EAGAIN)
+                        finish_sync(request, 0);
+                    else if (cqe.res >= 0 && static_cast<uint32_t>(cqe.res) < request->len_)
+                        finish_sync(request, cqe.res);
+                    else
+                        request->result_ = cqe.res;
+                    request->on_complete_(request);
+                }
+                __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+                bool drained;
+                {
+                    std::lock_guard<std::mutex> lg{ inflight_mtx_ };
+                    inflight_ -= completed;
+                    drained = inflight_ == 0;
+                }
+                inflight_cv_.notify_all();
+                if (stop && drained)
+                    return;
+            }
+        }
+
+        int ring_fd_;
+        void* sq_ptr_;
+        void* cq_ptr_;
+        void* sqes_;
+        std::size_t sq_size_, cq_size_, sqes_size_;
+
+        unsigned* sq_tail_;
+        unsigned sq_mask_;
+        unsigned* sq_array_;
+        unsigned* cq_head_;
+        unsigned* cq_tail_;
+        unsigned cq_mask_;
+        io_uring_cqe* cqes_;
+        uint32_t sq_entries_;
+
+        std::mutex submit_mtx_;
+        std::mutex inflight_mtx_;
+        std::condition_variable inflight_cv_;
+        uint32_t inflight_;
+
+        std::thread reaper_;
+
+    }; // end class UringIOEngine
+
+#endif // _xjbDB_IO_URING_
+
+
+    std::unique_ptr<IOEngine> IOEngine::make(uint32_t queue_depth)
+    {
+        std::unique_ptr<IOEngine> engine;
+#ifdef _xjbDB_IO_URING_
+        engine = UringIOEngine::try_make(queue_depth);
+#endif // _xjbDB_IO_URING_
+        if (!engine)
+            engine = std::make_unique<ThreadIOEngine>();
+        debug::DEBUG_LOG(debug::IO_ENGINE, "[IO_ENGINE] using %s\n", engine->name());
+        return engine;
+    }
+
+} // end namespace DB::disk
@@ -3,7 +3,10 @@
 #include "include/buffer_pool.h"
 #include "include/debug_log.h"
 #include "include/BplusTree.h"
+#include "include/epoch.h"
+#include "include/frame_arena.h"
 #include <cstring>
+#include <thread>
 #include <vector>
 
 namespace DB::page
@@ -114,10 +117,10 @@ namespace DB::page
         page_id_t page_id = read_int(buffer + offset::PAGE_ID);
         uint32_t cur_page_no = read_int(buffer + offset::CUR_PAGE_NO);
         uint32_t table_num = read_int(buffer + offset::TABLE_NUM);
-        page_id_t next_free_page_id = read_int(buffer + offset::NEXT_FREE_PAGE_ID);
         DBMetaPage* page = new DBMetaPage(page_id, buffer_pool,
-            false, cur_page_no, table_num, next_free_page_id);
-        std::memcpy(page->get_data(), buffer, page::PAGE_SIZE);
+            false, cur_page_no, table_num, buffer);
+        page->page_size_ = read_int(buffer + offset::DB_PAGE_SIZE);
+        page->allocated_page_no_ = read_int(buffer + offset::ALLOCATED_PAGE_NO);
         for (uint32_t i = 0; i < table_num; i++) {
             page->table_page_ids_[i] =
                 read_int(buffer + offset::TABLE_PAGEID_NAMEOFFSET_START + 8 * i);
@@ -142,7 +145,8 @@ namespace DB::page
         uint32_t col_num = read_int(buffer + offset::COL_NUM);
         uint32_t row_num = read_int(buffer + offset::ROW_NUM);
         page_id_t default_page_id = read_int(buffer + offset::DEFAULT_VALUE_PAGE_ID);
-        page_id_t auto_id = read_int(buffer + offset::DEFAULT_VALUE_PAGE_ID);
+        page_id_t auto_id = read_int(buffer + offset::AUTO_ID);
+        leaf_format_t leaf_format = static_cast<leaf_format_t>(read_int(buffer + offset::LEAF_FORMAT));
 
         std::vector<std::string> cols(col_num);
         std::unordered_map<std::string, ColumnInfo*> col_name2col;
@@ -191,8 +195,7 @@ namespace DB::page
 
         TableMetaPage* page = new TableMetaPage(buffer_pool, page_id,
             // `BT_root_id` is needed only when (!init)
-            false, key_t, str_len, BT_root_id, col_num, default_page_id);
-        std::memcpy(page->get_data(), buffer, page::PAGE_SIZE);
+            false, key_t, str_len, BT_root_id, col_num, default_page_id, leaf_format, buffer);
 
         page->pk_col_ = pk_col; // maybe `TableMetaPage::NOT_A_COLUMN`, NO PK
         if (pk_col == TableMetaPage::NOT_A_COLUMN)
@@ -216,8 +219,7 @@ namespace DB::page
         key_t_t key_t = static_cast<key_t_t>(read_short(buffer + offset::KEY_T));
         uint32_t str_len = read_short(buffer + offset::STR_LEN);
         InternalPage* page = new InternalPage(page_t, page_id, parent_id, nEntry,
-            buffer_pool, key_t, str_len, false);
-        std::memcpy(page->get_data(), buffer, page::PAGE_SIZE);
+            buffer_pool, key_t, str_len, false, buffer);
         for (uint32_t i = 0; i < nEntry; i++) {
             page->branch_[i] =
                 read_int(buffer + offset::CHILD_START + 8 * i);
@@ -236,8 +238,7 @@ namespace DB::page
         page_id_t parent_id = read_int(buffer + offset::PARENT_PAGE_ID);
         uint32_t nEntry = read_int(buffer + offset::NENTRY);
         ValuePage* page = new ValuePage(page_id, parent_id, nEntry,
-            buffer_pool, false);
-        std::memcpy(page->get_data(), buffer, page::PAGE_SIZE);
+            buffer_pool, false, buffer);
         return page;
     }
 
@@ -251,9 +252,9 @@ namespace DB::page
         key_t_t key_t = static_cast<key_t_t>(read_short(buffer + offset::KEY_T));
         uint32_t str_len = read_short(buffer + offset::STR_LEN);
         page_id_t value_page_id = read_int(buffer + offset::VALUE_PAGE_ID);
+        const leaf_format_t leaf_format = value_page_id == NOT_A_PAGE ? leaf_format_t::INLINE : leaf_format_t::VALUE_PAGE;
         LeafPage* page = new LeafPage(buffer_pool, page_id, parent_id, nEntry,
-            key_t, str_len, value_page_id, false);
-        std::memcpy(page->get_data(), buffer, page::PAGE_SIZE);
+            key_t, str_len, value_page_id, leaf_format, false, buffer);
         page->previous_page_id_ = read_int(buffer + offset::PREVIOUS_PAGE_ID);
         page->next_page_id_ = read_int(buffer + offset::NEXT_PAGE_ID);
         for (uint32_t i = 0; i < nEntry; i++) {
@@ -275,11 +276,15 @@ namespace DB::page
         key_t_t key_t = static_cast<key_t_t>(read_short(buffer + offset::KEY_T));
         uint32_t str_len = read_short(buffer + offset::STR_LEN);
         uint32_t value_page_id = NOT_A_PAGE;
-        if (page_t == page_t_t::ROOT_LEAF)
+        leaf_format_t leaf_format = leaf_format_t::VALUE_PAGE; // set by `change_to_leaf()` if ROOT_INTERNAL
+        if (page_t == page_t_t::ROOT_LEAF) {
             value_page_id = read_int(buffer + offset::VALUE_PAGE_ID);
+            if (value_page_id == NOT_A_PAGE)
+                leaf_format = leaf_format_t::INLINE;
+        }
 
         RootPage* page = new RootPage(buffer_pool, page_t, page_id, parent_id, nEntry,
-            key_t, str_len, value_page_id, false);
+            key_t, str_len, value_page_id, leaf_format, false, buffer);
 
         if (page_t == page_t_t::ROOT_LEAF) {
             for (uint32_t i = 0; i < nEntry; i++) {
@@ -296,25 +301,28 @@ namespace DB::page
                 page->keys_[i] =
                     read_int(buffer + offset::CHILD_START + 8 * i + 4);
             }
+            page->branch_[nEntry] = read_int(buffer + offset::CHILD_START + 8 * nEntry);
         }
-
-        std::memcpy(page->get_data(), buffer, page::PAGE_SIZE);
         return page;
     }
 
 
 
     Page::Page(page_t_t page_t, page_id_t page_id,
-        buffer::BufferPoolManager* buffer_pool, bool isInit)
+        buffer::BufferPoolManager* buffer_pool, bool isInit, const char* src)
         :
         buffer_pool_(buffer_pool),
         page_t_(page_t),
         page_id_(page_id),
+        version_(0),
         ref_count_(0),
         dirty_(false)
     {
         if (!isInit) {
-            buffer_pool_->disk_manager_->ReadPage(page_id_, data_);
+            if (src != nullptr)
+                std::memcpy(data_, src, PAGE_SIZE);
+            else
+                buffer_pool_->disk_manager_->ReadPage(page_id_, data_);
         }
         else {
             std::memset(data_, 0, PAGE_SIZE * sizeof(char));
@@ -333,6 +341,22 @@ namespace DB::page
 #endif
     }
 
+    void* Page::operator new(std::size_t size) {
+        buffer::FrameArena* arena = buffer::FrameArena::page_arena();
+        if (arena != nullptr && size <= arena->slot_size()) {
+            if (void* ptr = arena->allocate())
+                return ptr;
+        }
+        return ::operator new(size);
+    }
+
+    void Page::operator delete(void* ptr) noexcept {
+        buffer::FrameArena* arena = buffer::FrameArena::page_arena();
+        if (arena != nullptr && arena->deallocate(ptr))
+            return;
+        ::operator delete(ptr);
+    }
+
     void Page::ref() {
         debug::DEBUG_LOG(debug::PAGE_REF, "page_id %d ref %d -> %d\n",
             this->get_page_id(), ref_count_.load(), ref_count_.load() + 1);
@@ -350,8 +374,17 @@ namespace DB::page
                 force_flush();
 #endif
             }
-            delete this;
+            util::EpochManager::instance().retire(this);
+        }
+    }
+
+    bool Page::try_ref() {
+        uint32_t ref_count = ref_count_.load();
+        while (ref_count != 0) {
+            if (ref_count_.compare_exchange_weak(ref_count, ref_count + 1))
+                return true;
         }
+        return false;
     }
 
     page_t_t Page::get_page_t() const noexcept {
@@ -375,17 +408,42 @@ namespace DB::page
         return dirty_;
     }
 
-    page_id_t Page::add_free_page() {
-        return buffer_pool_->disk_manager_->set_next_free_page_id(page_id_);
+    uint32_t Page::get_ref_count() const noexcept {
+        return ref_count_.load();
+    }
+
+    // page in `dirty_page_sets_` has not been committed,
+    // flushing it before `commit()` will log an uncommitted image, and there is no undo.
+    bool Page::is_stealable() const {
+        const disk::DiskManager* disk_manager = buffer_pool_->disk_manager_;
+        if (disk_manager->is_dirty(page_id_))
+            return false;
+        switch (page_t_)
+        {
+        case page_t_t::LEAF:
+            return static_cast<const LeafPage*>(this)->value_page_ == nullptr
+                || !disk_manager->is_dirty(static_cast<const LeafPage*>(this)->value_page_id_);
+        case page_t_t::ROOT_LEAF:
+            return static_cast<const RootPage*>(this)->value_page_ == nullptr
+                || !disk_manager->is_dirty(static_cast<const RootPage*>(this)->value_page_id_);
+        case page_t_t::TABLE_META:
+            return !disk_manager->is_dirty(static_cast<const TableMetaPage*>(this)->default_value_page_id_);
+        default:
+            return true;
+        }
+    }
+
+    void Page::add_free_page() {
+        buffer_pool_->disk_manager_->FreePage(page_id_);
     }
 
     void Page::set_free() {
         dirty_ = true;
 
-        if (page_t_ == page_t_t::LEAF)
+        if (page_t_ == page_t_t::LEAF && static_cast<LeafPage*>(this)->value_page_ != nullptr)
             static_cast<LeafPage*>(this)->value_page_->set_free();
 
-        if (page_t_ == page_t_t::ROOT_LEAF)
+        if (page_t_ == page_t_t::ROOT_LEAF && static_cast<RootPage*>(this)->value_page_ != nullptr)
             static_cast<RootPage*>(this)->value_page_->set_free();
 
         if (page_t_ == page_t_t::TABLE_META)
@@ -407,11 +465,11 @@ namespace DB::page
             buffer_pool_->FlushPage(this);
 
             // update attached value page
-            if (page_t_ == page_t_t::LEAF) {
+            if (page_t_ == page_t_t::LEAF && static_cast<LeafPage*>(this)->value_page_ != nullptr) {
                 static_cast<LeafPage*>(this)->value_page_->flush();
             }
 
-            if (page_t_ == page_t_t::ROOT_LEAF) {
+            if (page_t_ == page_t_t::ROOT_LEAF && static_cast<RootPage*>(this)->value_page_ != nullptr) {
                 static_cast<RootPage*>(this)->value_page_->flush();
             }
 
@@ -453,11 +511,13 @@ namespace DB::page
 #endif // SIMPLE_TEST
         while (!(try_page_read_lock()));
     }
+    // the version is bumped even in SIMPLE_TEST, the optimistic reader relies on it.
+    // NB: the latch is no-op in SIMPLE_TEST, the writers are serialized by `BTree::write_mtx_` then.
     void Page::page_write_lock() {
-#ifdef SIMPLE_TEST
-        return;
-#endif // SIMPLE_TEST
+#ifndef SIMPLE_TEST
         while (!(try_page_write_lock()));
+#endif // SIMPLE_TEST
+        version_.fetch_add(1, std::memory_order_acq_rel);
     }
     void Page::page_read_unlock() {
 #ifdef SIMPLE_TEST
@@ -466,10 +526,24 @@ namespace DB::page
         rw_page_mutex_.unlock_shared();
     }
     void Page::page_write_unlock() {
-#ifdef SIMPLE_TEST
-        return;
-#endif // SIMPLE_TEST
+        version_.fetch_add(1, std::memory_order_release);
+#ifndef SIMPLE_TEST
         rw_page_mutex_.unlock();
+#endif // SIMPLE_TEST
+    }
+
+    uint64_t Page::read_begin() const {
+        uint64_t version = version_.load(std::memory_order_acquire);
+        while (version & 1) {
+            std::this_thread::yield();
+            version = version_.load(std::memory_order_acquire);
+        }
+        return version;
+    }
+
+    bool Page::read_validate(uint64_t version) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return version_.load(std::memory_order_relaxed) == version;
     }
 
 
@@ -479,17 +553,16 @@ namespace DB::page
 
     DBMetaPage::DBMetaPage(page_id_t page_id,
         buffer::BufferPoolManager* buffer_pool, bool isInit,
-        uint32_t cur_page_no, uint32_t table_num, page_id_t next_free_page_id)
+        uint32_t cur_page_no, uint32_t table_num, const char* src)
         :
-        Page(page_t_t::DB_META, page_id, buffer_pool, isInit),
+        Page(page_t_t::DB_META, page_id, buffer_pool, isInit, src),
         cur_page_no_(cur_page_no),
+        allocated_page_no_(0),
         table_num_(table_num),
-        next_free_page_id_(next_free_page_id)
+        page_size_(PAGE_SIZE)
     {
-        if (isInit) {
+        if (isInit)
             table_num_ = 0;
-            next_free_page_id_ = NOT_A_PAGE;
-        }
         table_page_ids_ = new uint32_t[MAX_TABLE_NUM];
         table_name_offset_ = new uint32_t[MAX_TABLE_NUM];
     }
@@ -577,11 +650,14 @@ namespace DB::page
     void DBMetaPage::update_data()
     {
         cur_page_no_ = buffer_pool_->disk_manager_->get_cut_page_id();
+        allocated_page_no_ = buffer_pool_->disk_manager_->get_allocated_page_no();
         write_int(data_ + offset::PAGE_T, static_cast<uint32_t>(page_t_));
         write_int(data_ + offset::PAGE_ID, page_id_);
         write_int(data_ + offset::CUR_PAGE_NO, cur_page_no_);
         write_int(data_ + offset::TABLE_NUM, table_num_);
-        write_int(data_ + offset::NEXT_FREE_PAGE_ID, next_free_page_id_);
+        write_int(data_ + offset::ALLOCATED_PAGE_NO, allocated_page_no_);
+        write_int(data_ + offset::DB_PAGE_SIZE, PAGE_SIZE);
+        write_int(data_ + offset::DB_FORMAT, DB_FORMAT_VERSION);
         for (uint32_t i = 0; i < table_num_; i++)
         {
             write_int(data_ + offset::TABLE_PAGEID_NAMEOFFSET_START + 8 * i,
@@ -599,12 +675,14 @@ namespace DB::page
     TableMetaPage::TableMetaPage(buffer::BufferPoolManager* buffer_pool, page_id_t page_id,
                                  bool isInit, key_t_t key_t, uint32_t str_len,
         // below 3 are needed only when (!init)
-        page_id_t BT_root_id, uint32_t col_num, page_id_t default_value_page_id)
+        page_id_t BT_root_id, uint32_t col_num, page_id_t default_value_page_id,
+        leaf_format_t leaf_format, const char* src)
         :
-        Page(page_t_t::TABLE_META, page_id, buffer_pool, isInit),
+        Page(page_t_t::TABLE_META, page_id, buffer_pool, isInit, src),
         BT_root_id_(BT_root_id),
         col_num_(col_num),
-        default_value_page_id_(default_value_page_id)
+        default_value_page_id_(default_value_page_id),
+        leaf_format_(leaf_format)
     {
         if (!isInit) {
             if (default_value_page_id_ != NOT_A_PAGE) {
@@ -614,6 +692,7 @@ namespace DB::page
             tree::OpenTableInfo info;
             info.isInit = false;
             info.root_id = BT_root_id_;
+            info.leaf_format = leaf_format_;
             bt_ = new tree::BTree(info, buffer_pool, key_t, str_len);
         }
         else {
@@ -622,6 +701,7 @@ namespace DB::page
             PageInitInfo info;
             info.page_t = page_t_t::VALUE;
             info.parent_id = this->get_page_id();
+            info.near_page_id = this->get_page_id();
             value_page_ = static_cast<ValuePage*>(buffer_pool->NewPage(info));
             default_value_page_id_ = value_page_->get_page_id();
             buffer_pool->DeletePage(default_value_page_id_);
@@ -633,8 +713,10 @@ namespace DB::page
             // create B+Tree
             tree::OpenTableInfo btinfo;
             btinfo.isInit = true;
+            btinfo.leaf_format = leaf_format_;
             bt_ = new tree::BTree(btinfo, buffer_pool, key_t, str_len);
             BT_root_id_ = bt_->get_root_id();
+            leaf_format_ = bt_->leaf_format(); // fall back to VALUE_PAGE on (VAR)CHAR key
         }
     }
 
@@ -762,7 +844,7 @@ namespace DB::page
             if (free_update_)
                 return;
             free_update_ = true;
-            write_int(data_ + offset::FREE_PAGE_ID, add_free_page()); // write next_free_page_id
+            add_free_page();
             return;
         }
         write_int(data_ + offset::PAGE_ID, page_id_);
@@ -771,6 +853,7 @@ namespace DB::page
         write_int(data_ + offset::ROW_NUM, bt_->size());
         write_int(data_ + offset::DEFAULT_VALUE_PAGE_ID, default_value_page_id_);
         write_int(data_ + offset::AUTO_ID, auto_id_.load(std::memory_order_seq_cst));
+        write_int(data_ + offset::LEAF_FORMAT, static_cast<uint32_t>(leaf_format_));
         for (uint32_t i = 0; i < col_num_; i++) {
             ColumnInfo* col = col_name2col_[cols_[i]];
             write_int(data_ + offset::COLINFO_START + 14 * i,
@@ -847,15 +930,15 @@ namespace DB::page
     // BTree Page
     //
     BTreePage::BTreePage(page_t_t page_t, page_id_t page_id, page_id_t parent_id, uint32_t nEntry,
-        buffer::BufferPoolManager* buffer_pool, key_t_t key_t, uint32_t str_len, bool isInit)
-        :Page(page_t, page_id, buffer_pool, isInit),
+        buffer::BufferPoolManager* buffer_pool, key_t_t key_t, uint32_t str_len, bool isInit, const char* src)
+        :Page(page_t, page_id, buffer_pool, isInit, src),
         parent_id_(parent_id),
         nEntry_(nEntry),
         key_t_(key_t),
         str_len_(str_len)
         //, last_offset_(PAGE_SIZE)
     {
-        keys_ = new int32_t[BTNodeKeySize];
+        keys_ = new int32_t[BTNodeKeySize]();
         if (!isInit) {
 
         }
@@ -903,6 +986,8 @@ namespace DB::page
             const uint32_t min_size =
                 MAX_STR_LEN > kEntry.key_str.size() ? kEntry.key_str.size() : MAX_STR_LEN;
             std::memcpy(data_ + offset + 1, kEntry.key_str.c_str(), min_size);
+            // the block might be reused, clear the tail of the previous key-str.
+            std::memset(data_ + offset + 1 + min_size, 0, MAX_STR_LEN - min_size);
         }
         set_dirty();
     }
@@ -930,24 +1015,35 @@ namespace DB::page
         }
         else
         {
-            const uint32_t offset = keys_[index];
-            if (data_[offset + KEY_STR_BLOCK - 1] != '\0')
-                kEntry.key_str = std::string(data_ + offset + 1, KEY_STR_BLOCK - 1);
-            else
-                kEntry.key_str = std::string(data_ + offset + 1);
+            kEntry.key_str = std::string(read_key_view(index));
         }
         return kEntry;
     }
 
 
+    std::string_view BTreePage::read_key_view(uint32_t index) const
+    {
+        return key_view(data_ + keys_[index]);
+    }
+
+
+    std::string_view BTreePage::key_view(const char* block)
+    {
+        if (block[KEY_STR_BLOCK - 1] != '\0')
+            return std::string_view(block + 1, KEY_STR_BLOCK - 1);
+        else
+            return std::string_view(block + 1);
+    }
+
+
     //
     // InternalPage
     //
     InternalPage::InternalPage(page_t_t page_t, page_id_t page_id, page_id_t parent_id, uint32_t nEntry,
-        buffer::BufferPoolManager* buffer_pool, key_t_t key_t, uint32_t str_len, bool isInit)
-        :BTreePage(page_t, page_id, parent_id, nEntry, buffer_pool, key_t, str_len, isInit)
+        buffer::BufferPoolManager* buffer_pool, key_t_t key_t, uint32_t str_len, bool isInit, const char* src)
+        :BTreePage(page_t, page_id, parent_id, nEntry, buffer_pool, key_t, str_len, isInit, src)
     {
-        branch_ = new page_id_t[BTNodeBranchSize];
+        branch_ = new page_id_t[BTNodeBranchSize]();
     }
 
     InternalPage::~InternalPage()
@@ -965,7 +1061,7 @@ namespace DB::page
             if (free_update_)
                 return;
             free_update_ = true;
-            write_int(data_ + offset::FREE_PAGE_ID, add_free_page()); // write next_free_page_id
+            add_free_page();
             return;
         }
         write_int(data_ + offset::PAGE_ID, page_id_);
@@ -988,9 +1084,9 @@ namespace DB::page
     // ValuePage
     //
     ValuePage::ValuePage(page_id_t page_id, page_id_t parent_id, uint32_t nEntry,
-        buffer::BufferPoolManager* buffer_pool, bool isInit)
+        buffer::BufferPoolManager* buffer_pool, bool isInit, const char* src)
         :
-        Page(page_t_t::VALUE, page_id, buffer_pool, isInit),
+        Page(page_t_t::VALUE, page_id, buffer_pool, isInit, src),
         parent_id_(parent_id),
         nEntry_(nEntry)
     {
@@ -1011,8 +1107,13 @@ namespace DB::page
 
     void ValuePage::read_content(uint32_t offset, ValueEntry& vEntry) const
     {
-        vEntry.value_state_ = static_cast<value_state>(data_[offset]);
-        std::memcpy(vEntry.content_, data_ + offset + 1, TUPLE_BLOCK_SIZE - 1);
+        read_block(data_ + offset, vEntry);
+    }
+
+    void ValuePage::read_block(const char* block, ValueEntry& vEntry)
+    {
+        vEntry.value_state_ = static_cast<value_state>(block[0]);
+        std::memcpy(vEntry.content_, block + 1, TUPLE_BLOCK_SIZE - 1);
     }
 
     void ValuePage::update_content(uint32_t offset, const ValueEntry& vEntry)
@@ -1052,7 +1153,7 @@ namespace DB::page
             if (free_update_)
                 return;
             free_update_ = true;
-            write_int(data_ + offset::FREE_PAGE_ID, add_free_page()); // write next_free_page_id
+            add_free_page();
             return;
         }
         write_int(data_ + offset::PAGE_ID, page_id_);
@@ -1062,21 +1163,55 @@ namespace DB::page
 
 
 
+    // the tuple blocks of INLINE leaf, in the same structure as ValuePage.
+    // return offset of the block.
+    static uint32_t write_inline_block(char* data, const ValueEntry& vEntry)
+    {
+        uint32_t index = 0;
+        for (; index < BTNodeKeySize; index++)
+            if (data[INLINE_VALUE_START + index * TUPLE_BLOCK_SIZE] == static_cast<char>(value_state::OBSOLETE))
+                break;
+        if (index == BTNodeKeySize)
+            debug::ERROR_LOG("`write_inline_block()`, might forget erase value somewhere");
+        const uint32_t offset = INLINE_VALUE_START + index * TUPLE_BLOCK_SIZE;
+        data[offset] = static_cast<char>(value_state::INUSED);
+        std::memcpy(data + offset + 1, vEntry.content_, MAX_TUPLE_SIZE);
+        return offset;
+    }
+
+    static void update_inline_block(char* block, const ValueEntry& vEntry)
+    {
+        if (vEntry.value_state_ != value_state::INUSED)
+            debug::ERROR_LOG("`update_inline_block()` input data invalid.");
+        block[0] = static_cast<char>(vEntry.value_state_);
+        std::memcpy(block + 1, vEntry.content_, MAX_TUPLE_SIZE);
+    }
+
+
     //
     // LeafPage
     //
     LeafPage::LeafPage(buffer::BufferPoolManager* buffer_pool, page_id_t page_id, page_id_t parent_id, uint32_t nEntry,
-        key_t_t key_t, uint32_t str_len, page_id_t value_page_id, bool isInit)
+        key_t_t key_t, uint32_t str_len, page_id_t value_page_id, leaf_format_t leaf_format, bool isInit,
+        const char* src)
         :BTreePage(page_t_t::LEAF, page_id, parent_id, nEntry,
-            buffer_pool, key_t, str_len, isInit), value_page_id_(value_page_id)
+            buffer_pool, key_t, str_len, isInit, src), leaf_format_(leaf_format), value_page_id_(value_page_id)
     {
-        values_ = new uint32_t[BTNodeKeySize];
+        values_ = new uint32_t[BTNodeKeySize]();
         std::memset(values_, 0, BTNodeKeySize * sizeof(uint32_t));
-        if (isInit) // new
+        if (leaf_format_ == leaf_format_t::INLINE)
+        {
+            value_page_ = nullptr;
+            value_page_id_ = NOT_A_PAGE;
+            if (isInit)
+                set_dirty();
+        }
+        else if (isInit) // new
         {
             PageInitInfo info;
             info.page_t = page_t_t::VALUE;
             info.parent_id = this->get_page_id();
+            info.near_page_id = this->get_page_id();
             value_page_ = static_cast<ValuePage*>(buffer_pool->NewPage(info));
             value_page_id_ = value_page_->get_page_id();
             buffer_pool->DeletePage(value_page_id_);
@@ -1097,29 +1232,46 @@ namespace DB::page
 #ifndef _xjbDB_test_BPLUSTREE_
         update_data();
 #endif
-        value_page_->unref(); // ref 1->0
+        if (value_page_ != nullptr)
+            value_page_->unref(); // ref 1->0
         delete[] values_;
     }
 
     void LeafPage::read_value(uint32_t index, ValueEntry& vEntry) const
     {
-        value_page_->read_content(values_[index], vEntry);
+        if (value_page_ == nullptr)
+            ValuePage::read_block(data_ + values_[index], vEntry);
+        else
+            value_page_->read_content(values_[index], vEntry);
         if (vEntry.value_state_ != value_state::INUSED)
             debug::ERROR_LOG("`LeafPage::read_value()` read corrupted value.\n");
     }
 
     void LeafPage::insert_value(uint32_t index, const ValueEntry& vEntry)
     {
-        values_[index] = value_page_->write_content(vEntry);
+        if (value_page_ == nullptr)
+            values_[index] = write_inline_block(data_, vEntry);
+        else
+            values_[index] = value_page_->write_content(vEntry);
         set_dirty();
     }
 
     void LeafPage::erase_value(uint32_t index) {
-        value_page_->erase_block(values_[index]);
+        if (value_page_ == nullptr) {
+            data_[values_[index]] = static_cast<char>(value_state::OBSOLETE);
+            set_dirty();
+        }
+        else
+            value_page_->erase_block(values_[index]);
     }
 
     void LeafPage::update_value(uint32_t index, const ValueEntry& vEntry) {
-        value_page_->update_content(values_[index], vEntry);
+        if (value_page_ == nullptr) {
+            update_inline_block(data_ + values_[index], vEntry);
+            set_dirty();
+        }
+        else
+            value_page_->update_content(values_[index], vEntry);
     }
 
     void LeafPage::set_left_leaf(page_id_t previous_page_id) { previous_page_id_ = previous_page_id; }
@@ -1134,7 +1286,7 @@ namespace DB::page
             if (free_update_)
                 return;
             free_update_ = true;
-            write_int(data_ + offset::FREE_PAGE_ID, add_free_page()); // write next_free_page_id
+            add_free_page();
             return;
         }
         write_int(data_ + offset::PAGE_ID, page_id_);
@@ -1161,17 +1313,26 @@ namespace DB::page
     //(buffer::BufferPoolManager*, page_t_t, page_id_t parent_id, page_id_t,
     //uint32_t nEntry, disk::DiskManager*, key_t_t, uint32_t str_len, page_id_t value_page_id, bool isInit);
     RootPage::RootPage(buffer::BufferPoolManager* buffer_pool, page_t_t page_t, page_id_t page_id, page_id_t parent_id, uint32_t nEntry,
-        key_t_t key_t, uint32_t str_len, page_id_t value_page_id, bool isInit)
+        key_t_t key_t, uint32_t str_len, page_id_t value_page_id, leaf_format_t leaf_format, bool isInit,
+        const char* src)
         :InternalPage(page_t, page_id, parent_id, nEntry,
-            buffer_pool, key_t, str_len, isInit), value_page_id_(value_page_id)
+            buffer_pool, key_t, str_len, isInit, src), leaf_format_(leaf_format), value_page_id_(value_page_id)
     {
-        values_ = new uint32_t[BTNodeKeySize];
+        values_ = new uint32_t[BTNodeKeySize]();
         std::memset(values_, 0, BTNodeKeySize * sizeof(uint32_t));
-        if (isInit) // new
+        if (leaf_format_ == leaf_format_t::INLINE)
+        {
+            value_page_ = nullptr;
+            value_page_id_ = NOT_A_PAGE;
+            if (isInit)
+                set_dirty();
+        }
+        else if (isInit) // new
         {
             PageInitInfo info;
             info.page_t = page_t_t::VALUE;
             info.parent_id = this->get_page_id();
+            info.near_page_id = this->get_page_id();
             value_page_ = static_cast<ValuePage*>(buffer_pool->NewPage(info));
             value_page_id_ = value_page_->get_page_id();
             buffer_pool->DeletePage(value_page_id_);
@@ -1200,17 +1361,32 @@ namespace DB::page
         delete[] values_;
     }
 
-    void RootPage::change_to_leaf(buffer::BufferPoolManager* buffer_pool) {
+    void RootPage::change_to_leaf(buffer::BufferPoolManager* buffer_pool, leaf_format_t leaf_format) {
         page_t_ = page_t_t::ROOT_LEAF;
-        value_page_id_ = buffer_pool_->disk_manager_->AllocatePage();
-        value_page_ = static_cast<ValuePage*>(buffer_pool->FetchPage(value_page_id_));
+        leaf_format_ = leaf_format;
+        if (leaf_format_ == leaf_format_t::INLINE) {
+            // clear the blocks left since this page was ROOT_LEAF last time.
+            std::memset(data_ + INLINE_VALUE_START, 0, BTNodeKeySize * TUPLE_BLOCK_SIZE);
+            return;
+        }
+        // a new value page, it has never been on disk.
+        PageInitInfo info;
+        info.page_t = page_t_t::VALUE;
+        info.parent_id = page_id_;
+        info.near_page_id = page_id_;
+        value_page_ = static_cast<ValuePage*>(buffer_pool->NewPage(info));
+        value_page_id_ = value_page_->get_page_id();
         buffer_pool->DeletePage(value_page_id_);
         // now value_page has excatly *** 1 ref count ***.
+        value_page_->set_dirty();
+        set_dirty();
     }
 
     void RootPage::change_to_internal(buffer::BufferPoolManager* buffer_pool) {
         page_t_ = page_t_t::ROOT_INTERNAL;
         value_page_id_ = NOT_A_PAGE;
+        if (value_page_ == nullptr) // INLINE
+            return;
         value_page_->set_free();
         value_page_->unref(); // ref 1->0
         value_page_ = nullptr;
@@ -1218,23 +1394,39 @@ namespace DB::page
 
     void RootPage::read_value(uint32_t index, ValueEntry& vEntry) const
     {
-        value_page_->read_content(values_[index], vEntry);
+        if (value_page_ == nullptr)
+            ValuePage::read_block(data_ + values_[index], vEntry);
+        else
+            value_page_->read_content(values_[index], vEntry);
         if (vEntry.value_state_ != value_state::INUSED)
             debug::ERROR_LOG("`RootPage::read_value()` read corrupted value.\n");
     }
 
     void RootPage::insert_value(uint32_t index, const ValueEntry& vEntry)
     {
-        values_[index] = value_page_->write_content(vEntry);
+        if (value_page_ == nullptr)
+            values_[index] = write_inline_block(data_, vEntry);
+        else
+            values_[index] = value_page_->write_content(vEntry);
         set_dirty();
     }
 
     void RootPage::erase_value(uint32_t index) {
-        value_page_->erase_block(values_[index]);
+        if (value_page_ == nullptr) {
+            data_[values_[index]] = static_cast<char>(value_state::OBSOLETE);
+            set_dirty();
+        }
+        else
+            value_page_->erase_block(values_[index]);
     }
 
     void RootPage::update_value(uint32_t index, const ValueEntry& vEntry) {
-        value_page_->update_content(values_[index], vEntry);
+        if (value_page_ == nullptr) {
+            update_inline_block(data_ + values_[index], vEntry);
+            set_dirty();
+        }
+        else
+            value_page_->update_content(values_[index], vEntry);
     }
 
     void RootPage::set_left_leaf(page_id_t previous_page_id) { previous_page_id_ = previous_page_id; }
@@ -1253,7 +1445,7 @@ namespace DB::page
                 if (free_update_)
                     return;
                 free_update_ = true;
-                write_int(data_ + offset::FREE_PAGE_ID, add_free_page()); // write next_free_page_id
+                add_free_page();
                 return;
             }
             write_int(data_ + offset::PAGE_ID, page_id_);
@@ -3,6 +3,7 @@
 //
 
 #include "debug_log.h"
+#include "cpu_features.h"
 #include "query_ap.h"
 #include "timing.h"
 #include "lexer.h"
@@ -17,7 +18,7 @@ namespace DB::query {
     void APSelectInfo::generateCode()
     {
         auto begin = std::chrono::system_clock::now();
-        auto emit = generateAst(tables, conditions);
+        auto emit = generateAst(tables, conditions, columns, groupBy, aggregates);
         auto end = std::chrono::system_clock::now();
         print_timing(begin, end, "generate ast");
 
@@ -45,12 +46,26 @@ namespace DB::query {
                          ">>> [compile] compile ../src/codegen/query.cpp\n");
         //chdir("../src/codegen");
         //system("cmake . && make");
+        // the query and libap_exec are built for the SIMD level of this host
+        static const std::string simd_option[] = {
+            "",
+            "-mavx2 ",
+            "-mavx2 -mavx512f -mavx512vl ",
+        };
+        static const std::string simd_library[] = {
+            "-lap_exec ",
+            "-lap_exec_avx2 ",
+            "-lap_exec_avx512 ",
+        };
+        const uint32_t simd_level = static_cast<uint32_t>(cpu::simd_level());
+        debug::DEBUG_LOG(debug::AP_COMPILE,
+                         ">>> [compile] SIMD level %s\n", cpu::simd_level_str[simd_level]);
         const std::string compile_header =
             "g++ ../src/codegen/query.cpp ";
         const std::string compile_option =
-            "-std=c++17 -O2 -mavx2 -march=broadwell ";
+            "-std=c++17 -O2 " + simd_option[simd_level];
         const std::string compile_link_option =
-            "-fPIC -shared -L. -lap_exec -lpthread -Wl,-rpath=. ";
+            "-fPIC -shared -L. " + simd_library[simd_level] + "-lpthread -Wl,-rpath=. ";
         const std::string compile_output =
             "-o query.so ";
         const std::string compile =
@@ -112,7 +127,8 @@ namespace DB::query {
         for(auto const& [col_name_pair, col_range] : map.attr_map) {
             schema.attrs_.push_back({
                 col_range,
-                col_name_pair.first + "." + col_name_pair.second,
+                col_name_pair.first.empty() ? col_name_pair.second // aggregate
+                                            : col_name_pair.first + "." + col_name_pair.second,
                 });
         }
         std::sort(schema.attrs_.begin(), schema.attrs_.end(),
@@ -159,7 +175,20 @@ namespace DB::query {
                 std::cout << "\n--Start Parse---------------------------------------\n" << std::endl;
             }
 
-            auto res = parse_ap::analyze(lexer.getTokens());
+            // drive the parser by token, so that a syntax error is reported where it is
+            parse_ap::pass_info res;
+            parse_ap::SyntacticAnalyzer analyzer(res);
+            for (const auto &token : lexer.getTokens())
+            {
+                try { analyzer(&token); }
+                catch (const parse_ap::AnalyzeException&) {
+                    throw DB::DB_Universal_Exception("unexpected token", token._pos);
+                }
+            }
+            try { analyzer(nullptr); }
+            catch (const parse_ap::AnalyzeException&) {
+                throw DB::DB_Universal_Exception("unexpected end of SQL", sql.size());
+            }
             value = res.apValue;
 
             if (debug::PARSE_LOG)
@@ -169,6 +198,7 @@ namespace DB::query {
             if (auto ptr = get_if<APSelectInfo>(&value))
             {
                 apCheckVisit(ptr->conditions);
+                apCheckAggregate(ptr->tables, ptr->groupBy, ptr->aggregates);
                 ptr->generateCode();
             }
         }
@@ -17,6 +17,7 @@ namespace DB::query {
 			[](const UpdateInfo& t) { t.print(); },
 			[](const InsertInfo& t) { t.print(); },
 			[](const DeleteInfo& t) { t.print(); },
+			[](const LoadInfo& t) { t.print(); },
 			[](const Show& t) { t.print(); },
 			[](const Exit& t) { t.print(); },
 			[](const ErrorMsg& t) { t.print(); },
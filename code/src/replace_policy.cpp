@@ -0,0 +1,202 @@
+#include "include/replace_policy.h"
+#include "include/debug_log.h"
+
+namespace DB::buffer
+{
+
+    /****************  implementation for struct LRUList  ****************/
+
+    LRUList::LRUList() :head_(page::NOT_A_PAGE, nullptr), size_(0)
+    {
+        head_.prev_lru_ = &head_;
+        head_.next_lru_ = &head_;
+    }
+
+    void LRUList::push_front(PageListHandle* handle) {
+        size_++;
+        PageListHandle* second = head_.next_lru_;
+        head_.next_lru_ = handle; handle->prev_lru_ = &head_;
+        handle->next_lru_ = second; second->prev_lru_ = handle;
+    }
+
+    void LRUList::push_back(PageListHandle* handle) {
+        size_++;
+        PageListHandle* last = head_.prev_lru_;
+        last->next_lru_ = handle; handle->prev_lru_ = last;
+        handle->next_lru_ = &head_; head_.prev_lru_ = handle;
+    }
+
+    void LRUList::move_front(PageListHandle* handle) {
+        if (handle->prev_lru_ == &head_) return;
+        remove(handle);
+        push_front(handle);
+    }
+
+    void LRUList::remove(PageListHandle* handle) {
+        size_--;
+        PageListHandle* prev = handle->prev_lru_;
+        PageListHandle* next = handle->next_lru_;
+        prev->next_lru_ = next; next->prev_lru_ = prev;
+    }
+
+    PageListHandle* LRUList::back() const {
+        return head_.prev_lru_ == &head_ ? nullptr : head_.prev_lru_;
+    }
+
+
+    // scan from the tail of `list`, the accessed handle is applied to the policy,
+    // other skipped handles are moved to the head, namely second chance,
+    // to keep the tail evictable.
+    static PageListHandle* scan_tail(ReplacePolicy& policy, LRUList& list,
+        ReplacePolicy::evictable_t evictable, uint32_t scan_depth)
+    {
+        PageListHandle* it = list.head_.prev_lru_;
+        for (uint32_t i = 0; i < scan_depth && it != &list.head_; i++)
+        {
+            PageListHandle* prev = it->prev_lru_;
+            if (it->accessed_.exchange(false, std::memory_order_relaxed) && policy.access(it)) {
+                it = prev;
+                continue;
+            }
+            if (evictable(it))
+                return it;
+            list.move_front(it);
+            it = prev;
+        }
+        return nullptr;
+    }
+
+
+    /****************  implementation for class LRUPolicy  ****************/
+
+    void LRUPolicy::insert(PageListHandle* handle, bool use_once) {
+        handle->use_once_ = use_once;
+        if (use_once)
+            lru_.push_back(handle);
+        else
+            lru_.push_front(handle);
+    }
+
+    bool LRUPolicy::access(PageListHandle* handle) {
+        handle->use_once_ = false;
+        lru_.move_front(handle);
+        return true;
+    }
+
+    void LRUPolicy::remove(PageListHandle* handle, bool) {
+        lru_.remove(handle);
+    }
+
+    PageListHandle* LRUPolicy::victim(evictable_t evictable, uint32_t scan_depth) {
+        return scan_tail(*this, lru_, evictable, scan_depth);
+    }
+
+    PageListHandle* LRUPolicy::drain() {
+        PageListHandle* handle = lru_.back();
+        if (handle != nullptr)
+            lru_.remove(handle);
+        return handle;
+    }
+
+
+    /****************  implementation for class TwoQPolicy  ****************/
+
+    TwoQPolicy::TwoQPolicy(uint32_t frame_budget)
+        :kin_(frame_budget / 4 + 1), kout_(frame_budget / 2 + 1) {}
+
+    void TwoQPolicy::insert(PageListHandle* handle, bool use_once)
+    {
+        handle->use_once_ = use_once;
+        if (use_once) {
+            handle->lru_queue_ = A1IN;
+            a1in_.push_back(handle);
+            return;
+        }
+        // seen recently, the page is hot.
+        if (a1out_.erase(handle->page_id_)) {
+            handle->lru_queue_ = AM;
+            am_.push_front(handle);
+        }
+        else {
+            handle->lru_queue_ = A1IN;
+            a1in_.push_front(handle);
+        }
+    }
+
+    bool TwoQPolicy::access(PageListHandle* handle)
+    {
+        if (handle->lru_queue_ == AM) {
+            am_.move_front(handle);
+            return true;
+        }
+        // hit in A1in is regarded as correlated reference, except the use-once page,
+        // which is now accessed by someone else other than the scan.
+        if (handle->use_once_) {
+            handle->use_once_ = false;
+            a1in_.move_front(handle);
+            return true;
+        }
+        return false;
+    }
+
+    void TwoQPolicy::remove(PageListHandle* handle, bool evicted)
+    {
+        if (handle->lru_queue_ == AM)
+            am_.remove(handle);
+        else {
+            a1in_.remove(handle);
+            if (evicted && !handle->use_once_)
+                remember(handle->page_id_);
+        }
+        handle->lru_queue_ = NONE;
+    }
+
+    PageListHandle* TwoQPolicy::victim(evictable_t evictable, uint32_t scan_depth)
+    {
+        // reclaim from A1in only if it exceeds its share.
+        LRUList& first = (a1in_.size_ > kin_ || am_.size_ == 0) ? a1in_ : am_;
+        LRUList& second = (&first == &a1in_) ? am_ : a1in_;
+        PageListHandle* handle = scan_tail(*this, first, evictable, scan_depth);
+        if (handle == nullptr)
+            handle = scan_tail(*this, second, evictable, scan_depth);
+        return handle;
+    }
+
+    PageListHandle* TwoQPolicy::drain()
+    {
+        PageListHandle* handle = a1in_.back();
+        if (handle == nullptr)
+            handle = am_.back();
+        if (handle != nullptr)
+            remove(handle, false);
+        return handle;
+    }
+
+    void TwoQPolicy::remember(page_id_t page_id)
+    {
+        if (a1out_.insert(page_id).second)
+            a1out_fifo_.push_back(page_id);
+        while (a1out_fifo_.size() > kout_) {
+            // the entry might have been erased on hit, or even re-remembered later,
+            // in which case the page_id is forgotten a little earlier.
+            a1out_.erase(a1out_fifo_.front());
+            a1out_fifo_.pop_front();
+        }
+    }
+
+
+    std::unique_ptr<ReplacePolicy> make_replace_policy(replace_policy_t policy, uint32_t frame_budget)
+    {
+        switch (policy)
+        {
+        case replace_policy_t::LRU:
+            return std::make_unique<LRUPolicy>();
+        case replace_policy_t::TWO_Q:
+            return std::make_unique<TwoQPolicy>(frame_budget);
+        default:
+            debug::ERROR_LOG("`make_replace_policy()` unknown policy\n");
+            return std::make_unique<LRUPolicy>();
+        }
+    }
+
+} // end namespace DB::buffer
@@ -6,7 +6,12 @@
 #include "query_ap.h"
 #include "ap_exec.h"
 #include "timing.h"
+#include <cerrno>
 #include <cstring>
+#include <cstdlib>
+#include <limits>
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <variant>
 #include <functional>
@@ -18,7 +23,6 @@ namespace DB::vm
 {
 
     using namespace page;
-    using disk::log_state_t;
 
     void ConsoleReader::start(std::future<void> exit_signal)
     {
@@ -98,9 +102,19 @@ namespace DB::vm
         return sql;
     }
 
+    std::optional<std::string> ConsoleReader::try_get_sql(std::chrono::microseconds timeout) {
+        std::unique_lock<std::mutex> ulk{ sql_pool_mutex_ };
+        if (!sql_pool_cv_.wait_for(ulk, timeout, [this]() { return !sql_pool_.empty(); }))
+            return std::nullopt;
+        std::string sql = std::move(sql_pool_.front());
+        sql_pool_.pop();
+        return sql;
+    }
+
     void ConsoleReader::add_sql(std::string sql) {
         std::lock_guard<std::mutex> lg{ sql_pool_mutex_ };
         sql_pool_.push(std::move(sql));
+        sql_pool_cv_.notify_one();
     }
 
 
@@ -125,7 +139,7 @@ namespace DB::vm
         if (storage_engine_.disk_manager_->dn_init_)
         {
             db_meta_ = new DBMetaPage(NOT_A_PAGE, // DB meta
-                storage_engine_.buffer_pool_manager_, true, 0, 0, NOT_A_PAGE);
+                storage_engine_.buffer_pool_manager_, true, 0, 0);
             storage_engine_.disk_manager_->set_vm(this);
         }
 
@@ -135,36 +149,38 @@ namespace DB::vm
             // set vm
             storage_engine_.disk_manager_->set_vm(this);
 
-            // check log for undo and redo
-            const log_state_t log_state = check_log();
-            switch (log_state)
-            {
-            case log_state_t::CORRUPTION: // exit directly
-                debug::ERROR_LOG("log corruption, bomb, you die\n");
+            // refuse the db file of other format, never parse it.
+            const uint32_t db_format = storage_engine_.disk_manager_->read_db_format();
+            if (db_format != page::DB_FORMAT_VERSION) {
+                debug::ERROR_LOG("DB format is %u, but built with %u, the db file cannot be opened\n",
+                    db_format, page::DB_FORMAT_VERSION);
+                exit(1);
+            }
+
+            // page size is fixed when the DB is created, all the layouts depend on it.
+            const uint32_t db_page_size = storage_engine_.disk_manager_->read_db_page_size();
+            if (db_page_size != page::PAGE_SIZE) {
+                debug::ERROR_LOG("DB page size is %u, but built with %u, rebuild with PAGE_SIZE_SHIFT\n",
+                    db_page_size, page::PAGE_SIZE);
                 exit(1);
-            case log_state_t::REDO:
-            case log_state_t::UNDO:
-                replay_log(log_state);
-            case log_state_t::OK:
-            default:
-                break;
             }
 
             // read DB meta
             char buffer[page::PAGE_SIZE];
-            storage_engine_.disk_manager_->ReadPage(page::NOT_A_PAGE, buffer);
+            if (!storage_engine_.disk_manager_->ReadPage(page::NOT_A_PAGE, buffer)) {
+                debug::ERROR_LOG("DB meta is corrupted, the db file cannot be opened\n");
+                exit(1);
+            }
             db_meta_ = page::parse_DBMetaPage(storage_engine_.buffer_pool_manager_, buffer);
 
-            // set cur_page_no
-            storage_engine_.disk_manager_->set_cur_page_id(db_meta_->cur_page_no_);
-
-            // set next_free_page_id
-            storage_engine_.disk_manager_->init_set_next_free_page_id(db_meta_->next_free_page_id_);
-
             // read table meta
             for (auto const&[tableName, page_id] : db_meta_->table_name2id_)
             {
-                storage_engine_.disk_manager_->ReadPage(page_id, buffer);
+                if (!storage_engine_.disk_manager_->ReadPage(page_id, buffer)) {
+                    debug::ERROR_LOG("table meta of \"%s\" is corrupted, the db file cannot be opened\n",
+                        tableName.c_str());
+                    exit(1);
+                }
                 TableMetaPage* table_meta = parse_TableMetaPage(storage_engine_.buffer_pool_manager_, buffer);
                 table_meta_[tableName] = table_meta;
             }
@@ -182,6 +198,9 @@ namespace DB::vm
         // start task pool
         task_pool_.start();
 
+        // merge TP writes into the AP snapshot in background
+        ap_merger_ = std::thread(std::mem_fn(&VM::ap_merger), this);
+
 #ifndef _xjbDB_test_STORAGE_ENGINE_
         // start scan from console.
         console_reader_.start(get_exit_signal_for_console());
@@ -193,9 +212,11 @@ namespace DB::vm
     // run db task until user input "EXIT"
     void VM::start()
     {
+        std::optional<std::string> next_sql; // read ahead by the last group
         while (true)
         {
-            const std::string sql_statemt = console_reader_.get_sql();
+            std::string sql_statemt = next_sql ? std::move(*next_sql) : console_reader_.get_sql();
+            next_sql.reset();
             debug::DEBUG_LOG(debug::SQL_INPUT,
                              ">>> input sql: %s\n",
                              sql_statemt.c_str());
@@ -211,30 +232,73 @@ namespace DB::vm
                     continue;
                 }
 
-                const page::page_id_t prev_last_page_id =
-                    storage_engine_.disk_manager_->get_cut_page_id();
+                // group commit:
+                //      the pages of the whole group are logged and synced once.
+                //      the replies are delayed until the group is durable.
+                //      if the commit fails, the replies of the group say so, see `commit_failed_`.
+                std::vector<std::string> replies;
+                std::string exit_msg;
+                uint32_t group_size = 0;
+                bool exit = false;
 
-                // handle ErrorMsg or EXIT
-                VM::process_result_t result = txn_process(plan);
+                while (true)
+                {
+                    // handle ErrorMsg or EXIT
+                    VM::process_result_t result = txn_process(plan);
 
-                if (!result.msg.empty()) {
-                    printXJBDB("\n%s\n", result.msg.c_str());
-                }
-                if (result.exit) {
-                    set_exit_signal_for_console();
-                    return;
-                }
-                if (result.error) {
-                    continue;
+                    if (result.exit) {
+                        exit = true;
+                        exit_msg = std::move(result.msg);
+                        break;
+                    }
+                    if (result.error) {
+                        // nothing changed, reply right now
+                        if (!result.msg.empty())
+                            printXJBDB("\n%s\n", result.msg.c_str());
+                    }
+                    else {
+                        task_pool_.join();
+                        group_size++;
+                        if (!result.msg.empty())
+                            replies.push_back(std::move(result.msg));
+                    }
+
+                    if (group_size >= group_commit_size_)
+                        break;
+                    next_sql = console_reader_.try_get_sql(group_commit_window_);
+                    if (!next_sql)
+                        break;
+                    plan = query::tp_parse(*next_sql);
+                    if (std::get_if<query::Switch>(&plan) != nullptr)
+                        break; // parse again in the next round
+                    sql_statemt = std::move(*next_sql);
+                    next_sql.reset();
+                    debug::DEBUG_LOG(debug::SQL_INPUT,
+                                     ">>> input sql: %s\n",
+                                     sql_statemt.c_str());
                 }
 
-                task_pool_.join();
+                bool durable = true;
+                if (group_size > 0 && !commit_failed_) {
+                    flush();
 
-                doWAL(prev_last_page_id, sql_statemt);
+                    durable = commit();
+                }
 
-                flush();
+                for (const std::string& msg : replies) {
+                    if (msg.empty())
+                        continue;
+                    if (durable)
+                        printXJBDB("\n%s\n", msg.c_str());
+                    else
+                        printXJBDB("\nCOMMIT FAILED, not durable: %s\n", msg.c_str());
+                }
 
-                detroy_log();
+                if (exit) {
+                    printXJBDB("\n%s\n", exit_msg.c_str());
+                    set_exit_signal_for_console();
+                    return;
+                }
             } // end OLTP
             else
             {
@@ -266,9 +330,9 @@ namespace DB::vm
 
 
 
-    void VM::set_next_free_page_id(page::page_id_t next_free_page) {
-        db_meta_->next_free_page_id_ = next_free_page;
-        db_meta_->set_dirty();
+    void VM::set_group_commit(uint32_t max_size, std::chrono::microseconds window) {
+        group_commit_size_ = max_size == 0 ? 1 : max_size;
+        group_commit_window_ = window;
     }
 
 
@@ -309,14 +373,23 @@ namespace DB::vm
     VM::process_result_t VM::txn_process(const query::TPValue& plan)
     {
         VM::process_result_t result;
+        // read-only after a commit failure
+        auto writable = [&result, this]() {
+            if (!commit_failed_)
+                return true;
+            result.error = true;
+            result.msg = "DB is read-only, the last commit failed";
+            return false;
+        };
         std::visit(
             overloaded{
-                [&result, this](const query::CreateTableInfo& info) { doCreate(result,info); },
-                [&result, this](const query::DropTableInfo& info) { doDrop(result,info); },
+                [&result, &writable, this](const query::CreateTableInfo& info) { if (writable()) doCreate(result,info); },
+                [&result, &writable, this](const query::DropTableInfo& info) { if (writable()) doDrop(result,info); },
                 [&result, this](const query::TPSelectInfo& info) { doSelect(result, info);  },
-                [&result, this](const query::UpdateInfo& info) { doUpdate(result,info); },
-                [&result, this](const query::InsertInfo& info) { doInsert(result,info); },
-                [&result, this](const query::DeleteInfo& info) { doDelete(result,info); },
+                [&result, &writable, this](const query::UpdateInfo& info) { if (writable()) doUpdate(result,info); },
+                [&result, &writable, this](const query::InsertInfo& info) { if (writable()) doInsert(result,info); },
+                [&result, &writable, this](const query::DeleteInfo& info) { if (writable()) doDelete(result,info); },
+                [&result, &writable, this](const query::LoadInfo& info) { if (writable()) doLoad(result,info); },
                 [&result](query::Exit) { result.exit = true; result.msg = "DB exit"; },
                 [&result, this](query::Show) { this->showDB(); },
                 [this](query::Schema) { this->showSCHEMA(); },
@@ -342,10 +415,6 @@ namespace DB::vm
     }
 
 
-    void VM::doWAL(page::page_id_t prev_last_page_id, const std::string& sql) {
-        storage_engine_.disk_manager_->doWAL(prev_last_page_id, sql);
-    }
-
     void VM::flush()
     {
         db_meta_->flush();
@@ -360,21 +429,15 @@ namespace DB::vm
         storage_engine_.buffer_pool_manager_->flush();
     }
 
-
-    void VM::detroy_log() {
-        storage_engine_.disk_manager_->detroy_log();
+    bool VM::commit() {
+        if (storage_engine_.disk_manager_->commit())
+            return true;
+        commit_failed_ = true;
+        debug::ERROR_LOG("commit failed, DB is read-only from now on\n");
+        return false;
     }
 
 
-    log_state_t VM::check_log() {
-        return storage_engine_.disk_manager_->check_log_state();
-    }
-
-
-    void VM::replay_log(log_state_t log_state) {
-        storage_engine_.disk_manager_->replay_log(log_state);
-    }
-
 
 
     //
@@ -399,7 +462,7 @@ namespace DB::vm
         page::TableMetaPage* table_page = new TableMetaPage(
             storage_engine_.buffer_pool_manager_, table_id,
             true, tableInfo.PK_t(), tableInfo.str_len(),
-            NOT_A_PAGE, 0, NOT_A_PAGE);
+            NOT_A_PAGE, 0, NOT_A_PAGE, tableInfo.leafFormat_);
 
         auto default_it = info.defaults.begin();
         auto fk_it = info.fkTables.begin();
@@ -461,6 +524,12 @@ namespace DB::vm
         table_meta_[tableInfo.tableName_] = table_page;
         table_info_[tableInfo.tableName_] = tableInfo;
 
+        if (ap_table_array_ != nullptr) {
+            std::lock_guard<std::mutex> lg{ ap_merge_mtx_ };
+            table_names_.push_back(tableInfo.tableName_);
+            ap_table_array_->tables_.push_back(new_ap_table(table_page));
+        }
+
         result.msg = "create table \"" + tableInfo.tableName_ + "\"";
     }
 
@@ -520,7 +589,6 @@ namespace DB::vm
                 }
             }
 
-            table->bt_->range_query_begin_lock();
             tree::BTit it = table->bt_->range_query_from_begin();
             tree::BTit end = table->bt_->range_query_from_end();
             while (it != end) {
@@ -537,7 +605,6 @@ namespace DB::vm
                 }
                 ++it;
             }
-            table->bt_->range_query_end_unlock();
         } // end unref PK view for fk cols
 
         db_meta_->drop_table(info.tableName);
@@ -547,6 +614,15 @@ namespace DB::vm
         table_meta_.erase(info.tableName);
         table_info_.erase(info.tableName);
 
+        // the pending delta of this table must not reach a new table with the same name
+        if (ap_table_array_ != nullptr) {
+            ap_merge_delta();
+            std::lock_guard<std::mutex> lg{ ap_merge_mtx_ };
+            const uint32_t index = get_ap_table_index(info.tableName);
+            table_names_.erase(table_names_.begin() + index);
+            ap_table_array_->tables_.erase(ap_table_array_->tables_.begin() + index);
+        }
+
         if (table->PK_t() == key_t_t::INTEGER) {
             table_pk_ref_INT.erase(table->get_page_id());
         }
@@ -626,6 +702,7 @@ namespace DB::vm
         tree::BTree* bt = table->bt_;
         tree::BTit it = bt->range_query_from_begin();
         tree::BTit end = bt->range_query_from_end();
+        it.set_read_ahead();
         uint32_t updated_row_num = 0;
 
         struct target_t {
@@ -708,8 +785,9 @@ namespace DB::vm
 
                 // finally commit
                 if (ok_to_update) {
-                    if (diff_num > 0) {
-                        it.updateV(vEntry);
+                    // the row might have been erased since the scan reached it, nothing to update then.
+                    if (diff_num > 0 && it.updateV(vEntry)) {
+                        ap_add_delta(ap_delta_t_t::UPDATE, info.sourceTable, vEntry);
                         updated_row_num++;
                         for (uint32_t* pi : add_ref)
                             *pi = *pi + 1;
@@ -777,7 +855,7 @@ namespace DB::vm
                 ValueEntry dv = table->get_default_value(name);
                 table::value_t v;
                 if (col->col_t_ == col_t_t::INTEGER) {
-                    v = page::read_int(dv.content_);
+                    v = static_cast<int32_t>(page::read_int(dv.content_));
                 }
                 else {
                     v = std::string(dv.content_, col->str_len_);
@@ -823,7 +901,7 @@ namespace DB::vm
             // HACK: promise to be the last element for auto pk
             elements.push_back(insert_element{
                 table->get_col_range(page::autoPK),
-                table->get_auto_id(), col_t_t::INTEGER, false, NOT_A_PAGE
+                static_cast<int32_t>(table->get_auto_id()), col_t_t::INTEGER, false, NOT_A_PAGE
                 });
         }
         else {
@@ -879,6 +957,9 @@ namespace DB::vm
         if (table->bt_->insert(kv) == tree::INSERT_NOTHING) {
             debug::ERROR_LOG("INSERT ERROR\n");
         }
+        else {
+            ap_add_delta(ap_delta_t_t::INSERT, info.sourceTable, kv.vEntry);
+        }
 
         // update table size on TableMetaPage
         table->set_dirty_on_insert_or_delete();
@@ -987,6 +1068,9 @@ namespace DB::vm
             if(bt->erase(kv.kEntry) == tree::ERASE_NOTHING) {
                 debug::ERROR_LOG("ERASE ERROR\n");
             }
+            else {
+                ap_add_delta(ap_delta_t_t::DELETE, info.sourceTable, kv.vEntry);
+            }
 
             // update table size on TableMetaPage
             table->set_dirty_on_insert_or_delete();
@@ -1001,6 +1085,180 @@ namespace DB::vm
         result.msg = "delete " + std::to_string(to_be_deleted.size()) + " rows";
     }
 
+    // the rows are all parsed and checked before any change, so that LOAD is all or nothing.
+    // bulk load if the table is empty, otherwise insert one by one.
+    void VM::doLoad(process_result_t& result, const query::LoadInfo& info)
+    {
+        auto table_it = table_meta_.find(info.sourceTable);
+        if (table_it == table_meta_.end()) {
+            result.error = true;
+            result.msg = "LOAD no such table: \"" + info.sourceTable + "\"";
+            return;
+        }
+        page::TableMetaPage* table = table_it->second;
+        tree::BTree* bt = table->bt_;
+
+        std::ifstream file(info.path);
+        if (!file) {
+            result.error = true;
+            result.msg = "LOAD cannot open \"" + info.path + "\"";
+            return;
+        }
+
+        // the columns in file, all but autoPK
+        std::vector<const ColumnInfo*> cols;
+        uint32_t pk_col = TableMetaPage::NOT_A_COLUMN;
+        for (const std::string& name : table->cols_) {
+            if (name == page::autoPK)
+                continue;
+            const ColumnInfo* col = table->col_name2col_[name];
+            if (col->isPK())
+                pk_col = cols.size();
+            cols.push_back(col);
+        }
+
+        // FK of the column `c`
+        auto fk_exists = [this, &cols](uint32_t c, const table::value_t& value) {
+            const page::page_id_t fk_table = cols[c]->other_value_;
+            if (cols[c]->col_t_ == col_t_t::INTEGER)
+                return table_pk_ref_INT[fk_table].count(std::get<int32_t>(value)) != 0;
+            return table_pk_ref_VARCHAR[fk_table].count(std::get<std::string>(value)) != 0;
+        };
+
+        // parse rows, one row per line, values separated by ','
+        // each row is checked and turned into its k-v as soon as read, there is no copy of the file.
+        // NB: the k-v are kept until all rows pass, and sorted for the bulk load.
+        std::vector<tree::KVEntry> kvs;
+        std::vector<std::string> fields;
+        std::string line;
+        uint32_t line_no = 0;
+        while (std::getline(file, line))
+        {
+            line_no++;
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+            fields.clear();
+            for (std::size_t begin = 0, end = 0; end != std::string::npos; begin = end + 1) {
+                end = line.find(',', begin);
+                std::string field = line.substr(begin, end == std::string::npos ? end : end - begin);
+                field.erase(0, field.find_first_not_of(" \t\r"));
+                field.erase(field.find_last_not_of(" \t\r") + 1);
+                fields.push_back(std::move(field));
+            }
+
+            tree::KVEntry kv;
+            kv.kEntry.key_t = table->PK_t();
+            kv.kEntry.key_int = NOT_A_PAGE; // autoPK, assigned after checks
+            uint32_t c = 0;
+            for (; c < cols.size() && fields.size() == cols.size(); c++) {
+                std::string& field = fields[c];
+                table::value_t value;
+                if (cols[c]->col_t_ == col_t_t::INTEGER) {
+                    char* parsed_end;
+                    errno = 0;
+                    const long i = std::strtol(field.c_str(), &parsed_end, 10);
+                    // out of INT, never truncate.
+                    if (field.empty() || *parsed_end != '\0' || errno == ERANGE ||
+                        i < std::numeric_limits<int32_t>::min() || i > std::numeric_limits<int32_t>::max())
+                        break;
+                    value = static_cast<int32_t>(i);
+                }
+                else {
+                    if (field.size() >= 2 && field.front() == '"' && field.back() == '"')
+                        field = field.substr(1, field.size() - 2);
+                    value = std::move(field);
+                }
+                if (cols[c]->isFK() && !fk_exists(c, value)) {
+                    result.error = true;
+                    result.msg = "FK constraint violate: \"" + (cols[c]->col_t_ == col_t_t::INTEGER
+                        ? std::to_string(std::get<int32_t>(value)) : std::get<std::string>(value)) + "\"";
+                    return;
+                }
+                const page::range_t range{ cols[c]->vEntry_offset_, cols[c]->str_len_ };
+                if (cols[c]->col_t_ == col_t_t::INTEGER) {
+                    update_vEntry(kv.vEntry, range, std::get<int32_t>(value));
+                    if (c == pk_col)
+                        kv.kEntry.key_int = std::get<int32_t>(value);
+                }
+                else {
+                    update_vEntry(kv.vEntry, range, std::get<std::string>(value));
+                    if (c == pk_col)
+                        kv.kEntry.key_str = std::move(std::get<std::string>(value));
+                }
+            }
+            if (c != cols.size() || fields.size() != cols.size()) {
+                result.error = true;
+                result.msg = "LOAD invalid row at line " + std::to_string(line_no);
+                return;
+            }
+            kvs.push_back(std::move(kv));
+        }
+
+        // check PK
+        if (pk_col != TableMetaPage::NOT_A_COLUMN)
+        {
+            std::sort(kvs.begin(), kvs.end(), [](const tree::KVEntry& left, const tree::KVEntry& right) {
+                if (left.kEntry.key_t == key_t_t::INTEGER)
+                    return left.kEntry.key_int < right.kEntry.key_int;
+                return left.kEntry.key_str < right.kEntry.key_str;
+            });
+            for (uint32_t r = 0; r < kvs.size(); r++) {
+                const page::KeyEntry& kEntry = kvs[r].kEntry;
+                const bool duplicate = r > 0 && (kEntry.key_t == key_t_t::INTEGER
+                    ? kEntry.key_int == kvs[r - 1].kEntry.key_int
+                    : kEntry.key_str == kvs[r - 1].kEntry.key_str);
+                const bool exists = kEntry.key_t == key_t_t::INTEGER
+                    ? table_pk_ref_INT[table->get_page_id()].count(kEntry.key_int) != 0
+                    : table_pk_ref_VARCHAR[table->get_page_id()].count(kEntry.key_str) != 0;
+                if (duplicate || exists) {
+                    result.error = true;
+                    result.msg = "PK exists: \"" + (kEntry.key_t == key_t_t::INTEGER
+                        ? std::to_string(kEntry.key_int) : kEntry.key_str) + "\"";
+                    return;
+                }
+            }
+        }
+        else {
+            // auto id is increasing, so that already sorted
+            const page::range_t range = table->get_col_range(page::autoPK);
+            for (tree::KVEntry& kv : kvs) {
+                kv.kEntry.key_int = static_cast<int32_t>(table->get_auto_id());
+                update_vEntry(kv.vEntry, range, kv.kEntry.key_int);
+            }
+        }
+
+        // insert, bulk load if the table is empty.
+        if (bt->size() != 0 || !bt->bulk_load(kvs.data(), kvs.data() + kvs.size())) {
+            for (const tree::KVEntry& kv : kvs)
+                if (bt->insert(kv) == tree::INSERT_NOTHING)
+                    debug::ERROR_LOG("LOAD ERROR\n");
+        }
+
+        // update table size on TableMetaPage
+        table->set_dirty_on_insert_or_delete();
+
+        // update PK view and FK view
+        for (const tree::KVEntry& kv : kvs)
+        {
+            ap_add_delta(ap_delta_t_t::INSERT, info.sourceTable, kv.vEntry);
+            if (kv.kEntry.key_t == key_t_t::INTEGER)
+                table_pk_ref_INT[table->get_page_id()][kv.kEntry.key_int] = NON_FK_REF;
+            else
+                table_pk_ref_VARCHAR[table->get_page_id()][kv.kEntry.key_str] = NON_FK_REF;
+            for (const ColumnInfo* col : cols) {
+                if (!col->isFK())
+                    continue;
+                const page::range_t range{ col->vEntry_offset_, col->str_len_ };
+                if (col->col_t_ == col_t_t::INTEGER)
+                    table_pk_ref_INT[col->other_value_][page::get_range_INT(kv.vEntry, range)]++;
+                else
+                    table_pk_ref_VARCHAR[col->other_value_][page::get_range_VARCHAR(kv.vEntry, range)]++;
+            }
+        }
+
+        result.msg = "LOAD " + std::to_string(kvs.size()) + " rows";
+    }
+
 
 
     //
@@ -1033,14 +1291,14 @@ namespace DB::vm
             return;
         }
         BTree* bt = table->second->bt_;
-        bt->range_query_begin_lock();
         tree::BTit it = bt->range_query_from_begin();
         tree::BTit end = bt->range_query_from_end();
+        it.set_use_once(); // full scan should not flush the hot pages
+        it.set_read_ahead();
         while (it != end) {
             ret.addRow({ ret.table_view_, it.getV() });
             ++it;
         }
-        bt->range_query_end_unlock();
         ret.addEOF();
         auto time_end = std::chrono::system_clock::now();
         print_timing(time_begin, time_end, "scan %s", tableName.c_str());
@@ -1291,32 +1549,41 @@ namespace DB::vm
 
         plan.load();
 
-        ap::VMEmitOp emit = plan.query(*ap_table_array_, this);
-        const table::schema_t& schema = plan.get_schema();
+        // an aggregate out of INT throws, see `hash_agg_t::result()`
+        try {
+            ap::VMEmitOp emit = plan.query(*ap_table_array_, this);
+            const table::schema_t& schema = plan.get_schema();
 
-        for(const table::attr_t& attr : schema.attrs_) {
-            query_print("%s\t", attr.attr_name_.c_str());
-        }
-        query_print_n();
-        println();
-        const uint32_t output_size = emit.rows_.size();
-        if(debug::AP_QUERY_OUTPUT) {
-            for(const ap::ap_row_t row : emit.rows_) {
-                for(const table::attr_t& attr : schema.attrs_) {
-                    if(attr.attr_range_.col_t_ == col_t_t::INTEGER) {
-                        query_print("%d\t", row.getINT(attr.attr_range_.range_));
-                    }
-                    else {
-                        query_print(row.getVARCHAR(attr.attr_range_.range_));
-                        query_print("\t");
+            for(const table::attr_t& attr : schema.attrs_) {
+                query_print("%s\t", attr.attr_name_.c_str());
+            }
+            query_print_n();
+            println();
+            const uint32_t output_size = emit.rows_.size();
+            if(debug::AP_QUERY_OUTPUT) {
+                for(const ap::ap_row_t& row : emit.rows_) {
+                    for(const table::attr_t& attr : schema.attrs_) {
+                        if(attr.attr_range_.col_t_ == col_t_t::INTEGER) {
+                            query_print("%d\t", row.getINT(attr.attr_range_.range_));
+                        }
+                        else {
+                            query_print(row.getVARCHAR(attr.attr_range_.range_));
+                            query_print("\t");
+                        }
                     }
+                    query_print_n();
                 }
-                query_print_n();
-            }
-        } // end if debug::AP_QUERY_OUTPUT
-        query_print("output size = %d\n", output_size);
-        println();
+            } // end if debug::AP_QUERY_OUTPUT
+            query_print("output size = %d\n", output_size);
+            println();
+        }
+        catch (const std::string& e) {
+            result.error = true;
+            result.msg = "AP query error: " + e;
+        }
 
+        // the pipelines are lambdas in query.so, wait for the workers to drop them.
+        task_pool_.join();
         plan.close();
     }
 
@@ -1356,6 +1623,8 @@ namespace DB::vm
 
                 tree::BTit it = bt->range_query_from_begin();
                 tree::BTit end = bt->range_query_from_end();
+                it.set_use_once();
+                it.set_read_ahead();
                 while (it != end) {
                     KeyEntry kEntry = it.getK();
                     pk_view[kEntry.key_int]++;
@@ -1397,6 +1666,8 @@ namespace DB::vm
 
                 tree::BTit it = bt->range_query_from_begin();
                 tree::BTit end = bt->range_query_from_end();
+                it.set_use_once();
+                it.set_read_ahead();
                 while (it != end) {
                     KeyEntry kEntry = it.getK();
                     pk_view[kEntry.key_str]++;
@@ -1432,44 +1703,132 @@ namespace DB::vm
         }
         else {
             tp_ = true;
-            AP_RESET();
         }
     }
 
     void VM::AP_INIT() {
+        // the snapshot is kept current, only the unmerged delta is left
+        if(ap_table_array_ != nullptr) {
+            ap_merge_delta();
+            return;
+        }
+        std::lock_guard<std::mutex> lg{ ap_merge_mtx_ };
         ap_table_array_ = std::make_shared<ap::ap_table_array_t>();
         // prepare "table name" and "table data"
         for(auto& [name, table_meta] : table_meta_) {
             table_names_.push_back(name);
 
-            ap::ap_table_t table_in_memory;
+            ap::ap_table_t table_in_memory = new_ap_table(table_meta);
             tree::BTit it = table_meta->bt_->range_query_from_begin();
             tree::BTit end = table_meta->bt_->range_query_from_end();
+            it.set_use_once();
+            it.set_read_ahead();
             while(it != end) {
-                table_in_memory.rows_.push_back(ap::ap_row_t{ it.getV() });
+                table_in_memory.append(it.getV());
                 ++it;
             }
             ap_table_array_->tables_.push_back(std::move(table_in_memory));
         }
     }
 
-    void VM::AP_RESET() {
-        ap_table_array_.reset();
-        table_names_.clear();
+    ap::ap_table_t VM::new_ap_table(const page::TableMetaPage* table_meta) const {
+        std::vector<page::col_range_t> cols;
+        page::col_range_t key{};
+        for(const std::string& col_name : table_meta->cols_) {
+            const page::ColumnInfo* col = table_meta->col_name2col_.at(col_name);
+            cols.push_back({ col->get_range(), col->col_t_ });
+            if(col->isPK()) {
+                key = cols.back();
+            }
+        }
+        return ap::ap_table_t(cols, key);
+    }
+
+    void VM::ap_add_delta(ap_delta_t_t delta_t, const std::string& table_name, const page::ValueEntry& vEntry) {
+        if(ap_table_array_ == nullptr) {
+            return; // no snapshot yet
+        }
+        std::lock_guard<std::mutex> lg{ ap_delta_mtx_ };
+        ap_delta_.push_back(ap_delta_t{ delta_t, table_name, vEntry });
+        if(ap_delta_.size() >= AP_MERGE_DELTA_SIZE) {
+            ap_delta_cv_.notify_one();
+        }
+    }
+
+    void VM::ap_merge_delta() {
+        // hold the snapshot before taking the delta, so that
+        // a SWITCH never sees the delta taken but not yet merged.
+        std::lock_guard<std::mutex> merge_lg{ ap_merge_mtx_ };
+        std::vector<ap_delta_t> delta;
+        {
+            std::lock_guard<std::mutex> lg{ ap_delta_mtx_ };
+            delta.swap(ap_delta_);
+        }
+
+        std::unordered_set<ap::ap_table_t*> merged_tables;
+        const std::string* table_name = nullptr;
+        ap::ap_table_t* table = nullptr;
+        for(const ap_delta_t& d : delta) {
+            if(table_name == nullptr || *table_name != d.table_name) {
+                table_name = &d.table_name;
+                table = &ap_table_array_->tables_[get_ap_table_index(d.table_name)];
+                merged_tables.insert(table);
+            }
+            switch(d.delta_t) {
+            case ap_delta_t_t::INSERT:
+                table->append(d.vEntry);
+                break;
+            case ap_delta_t_t::UPDATE:
+                table->erase(d.vEntry);
+                table->append(d.vEntry);
+                break;
+            case ap_delta_t_t::DELETE:
+                table->erase(d.vEntry);
+                break;
+            }
+        }
+
+        // drop the erased rows once they are the majority
+        for(ap::ap_table_t* merged_table : merged_tables) {
+            if(merged_table->erased_ * 2 > merged_table->size()) {
+                merged_table->compact();
+            }
+        }
+    }
+
+    void VM::ap_merger() {
+        while(true) {
+            {
+                std::unique_lock<std::mutex> ulk{ ap_delta_mtx_ };
+                ap_delta_cv_.wait(ulk, [this]() {
+                    return ap_merger_stop_ || ap_delta_.size() >= AP_MERGE_DELTA_SIZE; });
+                if(ap_merger_stop_)
+                    return;
+            }
+            ap_merge_delta();
+        }
     }
 
     uint32_t VM::get_ap_table_index(const std::string& table_name) const {
-        for(int i = 0; i < table_names_.size(); i++) {
+        for(uint32_t i = 0; i < table_names_.size(); i++) {
             if(table_names_[i] == table_name) {
                 return i;
             }
         }
+        return table_names_.size(); // no such table, out of range
     }
 
 
     VM::~VM()
     {
         console_reader_.stop();
+        {
+            std::lock_guard<std::mutex> lg{ ap_delta_mtx_ };
+            ap_merger_stop_ = true;
+        }
+        ap_delta_cv_.notify_one();
+        if (ap_merger_.joinable())
+            ap_merger_.join();
         task_pool_.stop();
         delete db_meta_;
         for (auto&[name, table] : table_meta_)
@@ -1526,7 +1885,6 @@ namespace DB::vm
     void VM::test_output() {
         TableMetaPage* table = table_meta_["test"];
         int cnt = 0;
-        table->bt_->range_query_begin_lock();
         auto it = table->bt_->range_query_from_begin();
         auto end = table->bt_->range_query_from_end();
         while (it != end) {
@@ -1534,12 +1892,12 @@ namespace DB::vm
             ++it;
             cnt++;
         }
-        table->bt_->range_query_end_unlock();
         std::printf("output size = %d\n", cnt);
     }
 
     void VM::test_flush() {
         flush();
+        commit();
     }
 
 
@@ -1572,7 +1930,6 @@ namespace DB::vm
             println();
 
             uint32_t cnt = 0;
-            table->bt_->range_query_begin_lock();
             auto it = table->bt_->range_query_from_begin();
             auto end = table->bt_->range_query_from_end();
             while (it != end)
@@ -1597,7 +1954,6 @@ namespace DB::vm
                 ++it;
                 cnt++;
             }
-            table->bt_->range_query_end_unlock();
             query_print("output size = %d", cnt);
             query_print_n();
             println();
@@ -162,7 +162,7 @@ static void create_simple_big_table(vm::VM& vm) {
     auto insert = [&vm](char table, int id, int value) {
         static char insert_base[64] = "INSERT A(id, value) VALUES(";
         insert_base[7] = table;
-        sprintf(insert_base + 27, "%d,%d)\0", id, value);
+        sprintf(insert_base + 27, "%d,%d)", id, value);
         vm.add_sql(std::string(insert_base));
     };
 
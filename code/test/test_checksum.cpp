@@ -0,0 +1,139 @@
+#ifdef _xjbDB_test_CHECKSUM_
+#include "test.h"
+#include <cstdio>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace DB::tree;
+using namespace std;
+
+// corrupted page:
+//      a byte of a written back page is flipped behind the db,
+//      the reads should report it rather than hand it out, the other pages are read as usual.
+
+static constexpr int page_num = 256;
+static constexpr int corrupted = 100;
+
+static void fill(char(&page_data)[page::PAGE_SIZE], page::page_id_t page_id)
+{
+    std::memset(page_data, 0, page::PAGE_SIZE);
+    for (uint32_t j = 0; j < page::offset::PAGE_CHECKSUM; j++)
+        page_data[j] = static_cast<char>(page_id * 13 + j);
+}
+
+void test()
+{
+    printf("--------------------- test begin ---------------------\n");
+    std::remove(disk::db_name);
+    std::remove(disk::log_name);
+
+    // written back on the final checkpoint
+    std::vector<page::page_id_t> page_ids(page_num);
+    page::page_id_t never_written;
+    {
+        disk::DiskManager disk_manager;
+        char page_data[page::PAGE_SIZE];
+        for (int i = 0; i < page_num; i++) {
+            page_ids[i] = disk_manager.AllocatePage();
+            fill(page_data, page_ids[i]);
+            disk_manager.WritePage(page_ids[i], page_data);
+        }
+        never_written = disk_manager.AllocatePage();
+        disk_manager.commit();
+    }
+
+    // flip a byte
+    {
+        const int fd = open(disk::db_name, O_RDWR);
+        const off_t offset = static_cast<off_t>(page_ids[corrupted]) * page::PAGE_SIZE + 100;
+        char c;
+        if (fd < 0 || pread(fd, &c, 1, offset) != 1) {
+            printf("open error\n");
+            return;
+        }
+        c ^= 0x10;
+        if (pwrite(fd, &c, 1, offset) != 1 || fsync(fd) != 0) {
+            printf("write error\n");
+            return;
+        }
+        close(fd);
+    }
+
+    int read_error = 0, map_error = 0, batch_error = 0;
+    {
+        disk::DiskManager disk_manager;
+        char page_data[page::PAGE_SIZE];
+        char expected[page::PAGE_SIZE];
+
+        // ReadPage
+        for (int i = 0; i < page_num; i++)
+        {
+            const bool ok = disk_manager.ReadPage(page_ids[i], page_data);
+            if (i == corrupted) {
+                if (ok) {
+                    printf("read error at [page = %u]: corruption not detected\n", page_ids[i]);
+                    read_error++;
+                }
+                continue;
+            }
+            fill(expected, page_ids[i]);
+            if (!ok || std::memcmp(page_data, expected, page::offset::PAGE_CHECKSUM) != 0) {
+                printf("read error at [page = %u]\n", page_ids[i]);
+                read_error++;
+            }
+        }
+        // zero page, never written back, no checksum
+        if (!disk_manager.ReadPage(never_written, page_data)) {
+            printf("read error at [page = %u]: zero page\n", never_written);
+            read_error++;
+        }
+
+        // MapPage
+        for (int i = 0; i < page_num; i++)
+        {
+            const char* mapped = disk_manager.MapPage(page_ids[i]);
+            if (i == corrupted) {
+                if (mapped != nullptr) {
+                    printf("map error at [page = %u]: corruption not detected\n", page_ids[i]);
+                    map_error++;
+                }
+                continue;
+            }
+            fill(expected, page_ids[i]);
+            if (mapped != nullptr && std::memcmp(mapped, expected, page::offset::PAGE_CHECKSUM) != 0) {
+                printf("map error at [page = %u]\n", page_ids[i]);
+                map_error++;
+            }
+        }
+
+        // ReadPages, a batch with or without the corrupted one
+        constexpr uint32_t batch = 8;
+        std::vector<char> buf(batch * page::PAGE_SIZE);
+        char* datas[batch];
+        for (uint32_t b = 0; b < batch; b++)
+            datas[b] = buf.data() + b * page::PAGE_SIZE;
+        if (disk_manager.ReadPages(&page_ids[corrupted - batch / 2], datas, batch)) {
+            printf("batch error: corruption not detected\n");
+            batch_error++;
+        }
+        if (!disk_manager.ReadPages(&page_ids[0], datas, batch)) {
+            printf("batch error: good pages\n");
+            batch_error++;
+        }
+        for (uint32_t b = 0; b < batch; b++) {
+            fill(expected, page_ids[b]);
+            if (std::memcmp(datas[b], expected, page::offset::PAGE_CHECKSUM) != 0) {
+                printf("batch error at [page = %u]\n", page_ids[b]);
+                batch_error++;
+            }
+        }
+    }
+
+    printf("page num = %d\n", page_num);
+    printf("read error = %d\n", read_error);
+    printf("map error = %d\n", map_error);
+    printf("batch error = %d\n", batch_error);
+    printf("--------------------- test end ---------------------\n");
+}
+
+#endif // _xjbDB_test_CHECKSUM_
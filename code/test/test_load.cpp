@@ -0,0 +1,170 @@
+#ifdef _xjbDB_test_LOAD_
+#include "test.h"
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace DB::tree;
+using namespace std;
+
+// bulk load:
+//      I.  B+Tree: the k-v loaded bottom-up should be found, scanned in order,
+//          and the tree goes on with the usual insert and erase. once for each leaf format.
+//      II. VM:     LOAD from a file, then the rows are queried back, the bad files are rejected.
+//          the same rows are loaded into an INLINE table.
+
+static constexpr int kv_num = 20000;
+
+static void test_bulk_load(page::leaf_format_t leaf_format)
+{
+    printf("leaf format: %s\n", leaf_format == page::leaf_format_t::INLINE ? "INLINE" : "VALUE_PAGE");
+    OpenTableInfo info;
+    info.isInit = true;
+    info.leaf_format = leaf_format;
+    std::shared_ptr<disk::DiskManager> disk_manager = std::make_shared<disk::DiskManager>();
+    std::shared_ptr<buffer::BufferPoolManager> buffer_pool_manager = std::make_shared<buffer::BufferPoolManager>(disk_manager.get());
+    BTree bt(info, buffer_pool_manager.get(), page::key_t_t::INTEGER);
+
+    // the even keys
+    std::vector<KVEntry> kvs(kv_num);
+    for (int i = 0; i < kv_num; i++) {
+        kvs[i].kEntry.key_t = page::key_t_t::INTEGER;
+        kvs[i].kEntry.key_int = i * 2;
+        kvs[i].vEntry.value_state_ = value_state::INUSED;
+        set_vEntry(kvs[i].vEntry, s[i % (sizeof(s) / sizeof(const char*))]);
+    }
+
+    int load_error = 0, find_error = 0, scan_error = 0;
+
+    // unsorted, nothing loaded
+    std::swap(kvs[10], kvs[11]);
+    if (bt.bulk_load(kvs.data(), kvs.data() + kvs.size()) || bt.size() != 0) {
+        printf("load error: unsorted k-v loaded\n");
+        load_error++;
+    }
+    std::swap(kvs[10], kvs[11]);
+
+    if (!bt.bulk_load(kvs.data(), kvs.data() + kvs.size()) || bt.size() != kv_num) {
+        printf("load error: [size = %d]\n", bt.size());
+        load_error++;
+    }
+
+    // non-empty, nothing loaded
+    if (bt.bulk_load(kvs.data(), kvs.data() + 1) || bt.size() != kv_num) {
+        printf("load error: loaded into non-empty tree\n");
+        load_error++;
+    }
+
+    KeyEntry key;
+    key.key_t = page::key_t_t::INTEGER;
+    for (int i = 0; i < kv_num * 2; i++)
+    {
+        key.key_int = i;
+        ValueEntry value = bt.find(key);
+        const bool found = value.value_state_ == value_state::INUSED;
+        if (found != (i % 2 == 0)) {
+            printf("find error at [key = %d]: %s\n", i, found ? "key should not be found" : "key not found");
+            find_error++;
+        }
+        else if (found && std::strcmp(value.content_, s[i / 2 % (sizeof(s) / sizeof(const char*))]) != 0) {
+            printf("find error at [key = %d]: value dismatched!!!\n", i);
+            find_error++;
+        }
+    }
+
+    int cnt = 0;
+    for (BTit it = bt.range_query_from_begin(), end = bt.range_query_from_end(); it != end; ++it, cnt++) {
+        if (cnt >= kv_num || it.getK().key_int != cnt * 2) {
+            printf("scan error at [%d]: [key = %d]\n", cnt, it.getK().key_int);
+            scan_error++;
+            break;
+        }
+    }
+    if (cnt != kv_num) {
+        printf("scan error: [output size = %d]\n", cnt);
+        scan_error++;
+    }
+
+    // the odd keys in between, then erase the even ones
+    ValueEntry value;
+    value.value_state_ = value_state::INUSED;
+    for (int i = 1; i < kv_num * 2; i += 2) {
+        key.key_int = i;
+        set_vEntry(value, s[i % (sizeof(s) / sizeof(const char*))]);
+        if (bt.insert({ key, value }) != tree::INSERT_KV) {
+            printf("insert error at [key = %d]\n", i);
+            load_error++;
+        }
+    }
+    for (int i = 0; i < kv_num * 2; i += 2) {
+        key.key_int = i;
+        if (bt.erase(key) != tree::ERASE_KV) {
+            printf("erase error at [key = %d]\n", i);
+            load_error++;
+        }
+    }
+    cnt = 0;
+    for (BTit it = bt.range_query_from_begin(), end = bt.range_query_from_end(); it != end; ++it, cnt++) {
+        if (it.getK().key_int != cnt * 2 + 1) {
+            printf("scan error at [%d]: [key = %d]\n", cnt, it.getK().key_int);
+            scan_error++;
+            break;
+        }
+    }
+
+    printf("B+Tree size = %d\n", bt.size());
+    printf("load error = %d\n", load_error);
+    printf("find error = %d\n", find_error);
+    printf("scan error = %d\n", scan_error);
+}
+
+static void test_load_statement()
+{
+    {
+        std::ofstream file("load_ok.csv");
+        for (int i = 0; i < kv_num; i++)
+            file << i << ", \"name" << i << "\"\n";
+        std::ofstream invalid("load_invalid.csv");
+        invalid << "1, \"a\"\n" << "x, \"b\"\n";
+        std::ofstream dup("load_dup.csv");
+        dup << kv_num << ", \"c\"\n" << kv_num << ", \"d\"\n";
+    }
+
+    vm::VM vm_;
+    vm_.init();
+
+    vm_.add_sql("CREATE TABLE Loaded(id INT PK, name VARCHAR(16))");
+    vm_.add_sql("LOAD Loaded FROM \"load_ok.csv\"");               // LOAD 20000 rows
+    vm_.add_sql("SELECT $ FROM Loaded WHERE id < 3 OR id >= 19998"); // 0, 1, 2, 19998, 19999
+    vm_.add_sql("LOAD Loaded FROM \"load_invalid.csv\"");          // invalid row at line 2
+    vm_.add_sql("LOAD Loaded FROM \"load_dup.csv\"");              // PK exists: "20000"
+    vm_.add_sql("LOAD Loaded FROM \"load_ok.csv\"");               // PK exists: "0"
+    vm_.add_sql("LOAD Loaded FROM \"load_none.csv\"");             // cannot open
+    vm_.add_sql("SELECT $ FROM Loaded WHERE id >= 19998");         // 19998, 19999
+    vm_.add_sql("CREATE TABLE Inlined(id INT PK, name VARCHAR(16)) INLINE");
+    vm_.add_sql("LOAD Inlined FROM \"load_ok.csv\"");              // LOAD 20000 rows
+    vm_.add_sql("SELECT $ FROM Inlined WHERE id < 3 OR id >= 19998"); // 0, 1, 2, 19998, 19999
+    vm_.add_sql("EXIT");
+
+    vm_.start();
+}
+
+void test()
+{
+    printf("--------------------- test begin ---------------------\n");
+    std::remove(disk::db_name);
+    std::remove(disk::log_name);
+    test_bulk_load(page::leaf_format_t::VALUE_PAGE);
+
+    std::remove(disk::db_name);
+    std::remove(disk::log_name);
+    test_bulk_load(page::leaf_format_t::INLINE);
+
+    std::remove(disk::db_name);
+    std::remove(disk::log_name);
+    test_load_statement();
+    printf("--------------------- test end ---------------------\n");
+}
+
+#endif // _xjbDB_test_LOAD_
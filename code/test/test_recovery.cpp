@@ -0,0 +1,212 @@
+#ifdef _xjbDB_test_RECOVERY_
+#include "test.h"
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+using namespace DB::tree;
+using namespace std;
+
+// I.  crash between commit and checkpoint:
+//      the child commits, then dies without the final checkpoint of ~DiskManager(),
+//      the parent reopens the db, the committed pages should be recovered from the log,
+//      and nothing written after the last commit.
+// II. torn page after checkpoint:
+//      the child rewrites the pages while the checkpoint writes them back, and dies once the checkpoint is done,
+//      the parent tears them in the db file, as a crash in their next write-back,
+//      they should be recovered from the log all the same.
+
+static constexpr int page_num = 1024;
+static constexpr int modified_num = page_num / 2;
+static constexpr int uncommitted_num = 64;
+// enough to begin a checkpoint at commit
+static constexpr int checkpoint_page_num = (16 << 20) / page::PAGE_SIZE + 64;
+
+static void fill(char(&page_data)[page::PAGE_SIZE], page::page_id_t page_id, int round)
+{
+    std::memset(page_data, 0, page::PAGE_SIZE);
+    for (uint32_t j = 0; j < page::offset::PAGE_CHECKSUM; j++)
+        page_data[j] = static_cast<char>(page_id * 31 + j * 7 + round);
+}
+
+// only a few bytes changed, so that it is logged as delta
+static void modify(char(&page_data)[page::PAGE_SIZE], int round)
+{
+    for (uint32_t j = 0; j < 16; j++)
+        page_data[j * 37] = static_cast<char>(round);
+}
+
+static void commit_then_crash(disk::DiskManager& disk_manager, std::vector<page::page_id_t>& page_ids)
+{
+    char page_data[page::PAGE_SIZE];
+    page_ids.resize(page_num);
+
+    // round 1: full pages
+    for (int i = 0; i < page_num; i++) {
+        page_ids[i] = disk_manager.AllocatePage();
+        fill(page_data, page_ids[i], 1);
+        disk_manager.WritePage(page_ids[i], page_data);
+    }
+    disk_manager.commit();
+
+    // round 2: small changes on half of the pages
+    for (int i = 0; i < modified_num; i++) {
+        fill(page_data, page_ids[i], 1);
+        modify(page_data, 2);
+        disk_manager.WritePage(page_ids[i], page_data);
+    }
+    disk_manager.commit();
+
+    // round 3: never committed
+    for (int i = 0; i < uncommitted_num; i++) {
+        fill(page_data, page_ids[i], 3);
+        disk_manager.WritePage(page_ids[i], page_data);
+    }
+}
+
+static off_t read_checkpoint_lsn()
+{
+    char buffer[8] = { 0 };
+    const int fd = open(disk::db_name, O_RDONLY);
+    if (fd >= 0) {
+        if (pread(fd, buffer, 8, page::offset::CHECKPOINT_LSN) != 8)
+            std::memset(buffer, 0, 8);
+        close(fd);
+    }
+    return page::read_int(buffer) | static_cast<uint64_t>(page::read_int(buffer + 4)) << 32;
+}
+
+static void checkpoint_then_crash(disk::DiskManager& disk_manager, std::vector<page::page_id_t>& page_ids)
+{
+    char page_data[page::PAGE_SIZE];
+    page_ids.resize(checkpoint_page_num);
+
+    // round 1: begin a checkpoint at commit
+    for (int i = 0; i < checkpoint_page_num; i++) {
+        page_ids[i] = disk_manager.AllocatePage();
+        fill(page_data, page_ids[i], 1);
+        disk_manager.WritePage(page_ids[i], page_data);
+    }
+    disk_manager.commit();
+
+    // round 2: small changes while being written back, the pages written back last first
+    for (int i = 0; i < modified_num; i++) {
+        fill(page_data, page_ids[i], 1);
+        modify(page_data, 2);
+        disk_manager.WritePage(page_ids[i], page_data);
+    }
+    disk_manager.commit();
+
+    // die once the checkpoint is done
+    while (read_checkpoint_lsn() == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+// run `scenario` in a child, which dies without checkpoint, the page ids are sent to the parent.
+static bool crash(void (*scenario)(disk::DiskManager&, std::vector<page::page_id_t>&),
+    std::vector<page::page_id_t>& page_ids)
+{
+    std::remove(disk::db_name);
+    std::remove(disk::log_name);
+
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+    const pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        disk::DiskManager disk_manager;
+        scenario(disk_manager, page_ids);
+        const ssize_t len = sizeof(page::page_id_t) * page_ids.size();
+        _exit(write(fds[1], page_ids.data(), len) == len ? 0 : 1);
+    }
+    close(fds[1]);
+
+    page::page_id_t page_id;
+    while (read(fds[0], &page_id, sizeof(page_id)) == sizeof(page_id))
+        page_ids.push_back(page_id);
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("crash error [status = %d]\n", status);
+        return false;
+    }
+    return true;
+}
+
+// the pages before `modified_num` are in round 2, the others in round 1.
+static int verify(const std::vector<page::page_id_t>& page_ids, int& uncommitted_error)
+{
+    int recover_error = 0;
+    disk::DiskManager disk_manager;
+    char page_data[page::PAGE_SIZE];
+    char expected[page::PAGE_SIZE];
+    char uncommitted[page::PAGE_SIZE];
+    for (uint32_t i = 0; i < page_ids.size(); i++)
+    {
+        fill(expected, page_ids[i], 1);
+        if (i < modified_num)
+            modify(expected, 2);
+        fill(uncommitted, page_ids[i], 3);
+
+        if (!disk_manager.ReadPage(page_ids[i], page_data)) {
+            printf("recover error at [page = %u]: corrupted\n", page_ids[i]);
+            recover_error++;
+            continue;
+        }
+        if (std::memcmp(page_data, expected, page::offset::PAGE_CHECKSUM) != 0) {
+            if (std::memcmp(page_data, uncommitted, page::offset::PAGE_CHECKSUM) == 0) {
+                printf("uncommitted error at [page = %u]\n", page_ids[i]);
+                uncommitted_error++;
+            }
+            else {
+                printf("recover error at [page = %u]: content dismatched!!!\n", page_ids[i]);
+                recover_error++;
+            }
+        }
+    }
+    return recover_error;
+}
+
+void test()
+{
+    printf("--------------------- test begin ---------------------\n");
+    int recover_error = 0, uncommitted_error = 0, torn_error = 0;
+
+    // I.
+    std::vector<page::page_id_t> page_ids;
+    if (crash(commit_then_crash, page_ids)) {
+        // recovered in the constructor, then recovered twice, namely the checkpoint after recovery
+        recover_error += verify(page_ids, uncommitted_error);
+        recover_error += verify(page_ids, uncommitted_error);
+    }
+    else
+        recover_error++;
+
+    // II.
+    page_ids.clear();
+    if (crash(checkpoint_then_crash, page_ids)) {
+        // torn: the first half of the page is overwritten.
+        const int fd = open(disk::db_name, O_RDWR);
+        char garbage[page::PAGE_SIZE / 2];
+        std::memset(garbage, 0x5a, sizeof(garbage));
+        for (int i = 0; i < modified_num; i++)
+            if (pwrite(fd, garbage, sizeof(garbage), static_cast<off_t>(page_ids[i]) * page::PAGE_SIZE) != sizeof(garbage))
+                torn_error++;
+        close(fd);
+        torn_error += verify(page_ids, uncommitted_error);
+    }
+    else
+        torn_error++;
+
+    printf("page num = %d\n", page_num);
+    printf("recover error = %d\n", recover_error);
+    printf("uncommitted error = %d\n", uncommitted_error);
+    printf("torn error = %d\n", torn_error);
+    printf("--------------------- test end ---------------------\n");
+}
+
+#endif // _xjbDB_test_RECOVERY_
@@ -0,0 +1,144 @@
+#ifdef _xjbDB_test_SCAN_
+#include "test.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace DB::tree;
+using namespace std;
+
+// scan during inserts:
+//      the even keys are there before, the writers insert then erase the odd keys,
+//      each writer on its own key range, so that they go down different subtrees at the same time.
+//      the leaves split and merge under the readers.
+//      every scan should be strictly ascending, with all the even keys and the value of its own key.
+//      at last only the even keys are left.
+
+static constexpr int key_num = 20000;
+static constexpr int reader_num = 2;
+static constexpr int writer_num = 4;
+
+static void set_value(ValueEntry& value, int key)
+{
+    set_vEntry(value, ("v" + std::to_string(key)).c_str());
+}
+
+void test()
+{
+    printf("--------------------- test begin ---------------------\n");
+    std::remove(disk::db_name);
+    std::remove(disk::log_name);
+
+    OpenTableInfo info;
+    info.isInit = true;
+    std::shared_ptr<disk::DiskManager> disk_manager = std::make_shared<disk::DiskManager>();
+    std::shared_ptr<buffer::BufferPoolManager> buffer_pool_manager = std::make_shared<buffer::BufferPoolManager>(disk_manager.get());
+    BTree bt(info, buffer_pool_manager.get(), page::key_t_t::INTEGER);
+
+    KeyEntry key;
+    key.key_t = page::key_t_t::INTEGER;
+    ValueEntry value;
+    value.value_state_ = value_state::INUSED;
+    for (int i = 0; i < key_num; i += 2) {
+        key.key_int = i;
+        set_value(value, i);
+        bt.insert({ key, value });
+    }
+
+    std::atomic<int> writing{ writer_num };
+    std::atomic<int> write_error{ 0 };
+    std::vector<std::thread> writers;
+    for (int w = 0; w < writer_num; w++)
+    {
+        writers.emplace_back([&, w] {
+            std::vector<int> odd_keys;
+            for (int i = w * key_num / writer_num + 1; i < (w + 1) * key_num / writer_num; i += 2)
+                odd_keys.push_back(i);
+            std::mt19937 g(std::random_device{}());
+            std::shuffle(odd_keys.begin(), odd_keys.end(), g);
+
+            KeyEntry key;
+            key.key_t = page::key_t_t::INTEGER;
+            ValueEntry value;
+            value.value_state_ = value_state::INUSED;
+            for (int i : odd_keys) {
+                key.key_int = i;
+                set_value(value, i);
+                if (bt.insert({ key, value }) != tree::INSERT_KV)
+                    write_error++;
+            }
+            std::shuffle(odd_keys.begin(), odd_keys.end(), g);
+            for (int i : odd_keys) {
+                key.key_int = i;
+                if (bt.erase(key) != tree::ERASE_KV)
+                    write_error++;
+            }
+            writing--;
+        });
+    }
+
+    std::vector<int> scan_num(reader_num), order_error(reader_num), lost_error(reader_num), value_error(reader_num);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < reader_num; r++)
+    {
+        readers.emplace_back([&, r] {
+            // at least one scan after the writer is done
+            bool last;
+            do {
+                last = writing == 0;
+                int prev = -1, even = 0;
+                for (BTit it = bt.range_query_from_begin(), end = bt.range_query_from_end(); it != end; ++it)
+                {
+                    const int k = it.getK().key_int;
+                    if (k <= prev) {
+                        order_error[r]++;
+                        break;
+                    }
+                    if (k % 2 == 0) {
+                        if (k != even * 2)
+                            break;
+                        even++;
+                    }
+                    if (std::string(it.getV().content_) != "v" + std::to_string(k))
+                        value_error[r]++;
+                    prev = k;
+                }
+                if (even != key_num / 2)
+                    lost_error[r]++;
+                scan_num[r]++;
+            } while (!last);
+        });
+    }
+
+    for (std::thread& writer : writers)
+        writer.join();
+    for (std::thread& reader : readers)
+        reader.join();
+
+    int errors[3] = {};
+    for (int r = 0; r < reader_num; r++) {
+        printf("reader %d: [scan = %d]\n", r, scan_num[r]);
+        errors[0] += order_error[r];
+        errors[1] += lost_error[r];
+        errors[2] += value_error[r];
+    }
+    int size_error = 0;
+    for (int i = 0; i < key_num; i++) {
+        key.key_int = i;
+        if ((bt.find(key).value_state_ == value_state::INUSED) != (i % 2 == 0))
+            size_error++;
+    }
+    printf("B+Tree size = %d\n", bt.size());
+    printf("write error = %d\n", write_error.load());
+    printf("size error = %d\n", size_error);
+    printf("order error = %d\n", errors[0]);
+    printf("lost error = %d\n", errors[1]);
+    printf("value error = %d\n", errors[2]);
+    printf("--------------------- test end ---------------------\n");
+}
+
+#endif // _xjbDB_test_SCAN_